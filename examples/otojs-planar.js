@@ -0,0 +1,15 @@
+// Otojs oto_render_planar example.
+
+// oto_render_planar writes audio samples into outputs, an array of Float32Array(frames) per channel.
+// inputs is the same form for the input. Both are reused every call.
+function oto_render_planar(outputs, inputs, frames, channels) {
+	for (let c = 0; c < channels; c++) {
+		// each channel gets its own frequency: 220Hz, 330Hz, 440Hz, ...
+		let output = outputs[c];
+		let frequency = 110 * (c + 2);
+		for (let f = 0; f < frames; f++) {
+			output[f] = 0.3 * Math.sin( 3.1415 * 2 * (frame + f) * frequency / sample_rate );
+		}
+	}
+	frame += frames;
+}
@@ -0,0 +1,15 @@
+// Otojs oto_render_into example.
+
+// oto_render_into writes audio samples into output (Float32Array(frames * channels)).
+// output and input_array are reused every call, nothing is allocated while rendering.
+function oto_render_into(output, input_array, frames, channels) {
+	for (let f = 0; f < frames; f++) {
+		// sinewave oscillator (330Hz) with a slow tremolo
+		let v = 0.5 * Math.sin( 3.1415 * 2 * frame * 330 / sample_rate );
+		let m = 0.5 + 0.5 * Math.sin( 3.1415 * 2 * frame * 2.0 / sample_rate );
+		for (let c = 0; c < channels; c++) {
+			output[f * channels + c] = v * m;
+		}
+		frame++;
+	}
+}
@@ -0,0 +1,98 @@
+// otojsd::asyncrecorder - feeds a recorder from a writer thread, the audio thread never touches the file.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include "asyncrecorder.h"
+
+// seconds of sound the ring holds while the disk stalls
+#define RING_SECONDS 4
+// samples written at once, about 64 KiB
+#define BLOCK_BYTES 65536
+// interval the writer thread checks the ring
+#define WRITER_POLL_NS 20000000
+
+// ------------------------------------------------------ private functions
+void *AsyncRecorder__writer(void *arg);
+size_t AsyncRecorder__write_block(AsyncRecorder *self);
+
+// ---------------------------------------------- implimentation
+
+// Takes the ownership of the opened recorder, it is closed and destroyed by AsyncRecorder_destroy().
+AsyncRecorder *AsyncRecorder_create(SoundRecorder *recorder, int channels, int sampleRate) {
+	AsyncRecorder *self = new AsyncRecorder;
+	self->recorder = recorder;
+	self->channels = channels;
+	self->ring = new SpscRing<float>((size_t)RING_SECONDS * sampleRate * channels);
+	// whole frames only, so a block never splits a frame.
+	self->block_samples = (BLOCK_BYTES / sizeof(float)) / channels * channels;
+	if ( posix_memalign((void **)&self->block, 4096, self->block_samples * sizeof(float)) != 0 ) {
+		printf("malloc failed for recording.\n");
+		delete self->ring;
+		delete self;
+		return NULL;
+	}
+	self->running = true;
+	self->overflows = 0;
+	if ( pthread_create(&self->thread, NULL, AsyncRecorder__writer, self) != 0 ) {
+		printf("failed to start the recording thread.\n");
+		free(self->block);
+		delete self->ring;
+		delete self;
+		return NULL;
+	}
+	return self;
+}
+
+// Queue interleaved frames for recording. Real-time safe: never blocks, allocates nor touches the file.
+// Returns false and counts the frames as overflows if the ring is full.
+bool AsyncRecorder_write(AsyncRecorder *self, const float *data, int frames) {
+	size_t samples = (size_t)frames * self->channels;
+	if ( self->ring->writable() < samples ) {
+		self->overflows.fetch_add(frames, std::memory_order_relaxed);
+		return false;
+	}
+	self->ring->write(data, samples);
+	return true;
+}
+
+uint64_t AsyncRecorder_overflows(AsyncRecorder *self) {
+	return self->overflows.load(std::memory_order_relaxed);
+}
+
+// Write everything queued, then close and destroy the recorder.
+void AsyncRecorder_destroy(AsyncRecorder *self) {
+	self->running = false;
+	pthread_join(self->thread, NULL);
+	while ( AsyncRecorder__write_block(self) > 0 ) {
+	}
+	SoundRecorder_close(self->recorder);
+	SoundRecorder_destroy(self->recorder);
+	free(self->block);
+	delete self->ring;
+	delete self;
+}
+
+void *AsyncRecorder__writer(void *arg) {
+	AsyncRecorder *self = (AsyncRecorder *)arg;
+	struct timespec interval = {0, WRITER_POLL_NS};
+	while ( self->running ) {
+		// write full blocks only, the rest waits for the next round.
+		while ( self->ring->readable() >= self->block_samples ) {
+			AsyncRecorder__write_block(self);
+		}
+		nanosleep(&interval, NULL);
+	}
+	return NULL;
+}
+
+// Write up to a block of whole frames from the ring. Returns the number of samples written.
+size_t AsyncRecorder__write_block(AsyncRecorder *self) {
+	size_t samples = self->ring->readable();
+	if ( samples > self->block_samples ) samples = self->block_samples;
+	samples -= samples % self->channels;
+	if ( samples == 0 ) return 0;
+	self->ring->read(self->block, samples);
+	SoundRecorder_write(self->recorder, self->block, samples / self->channels);
+	return samples;
+}
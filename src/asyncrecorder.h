@@ -0,0 +1,32 @@
+#ifndef ASYNCRECORDER_H
+#define ASYNCRECORDER_H
+// otojsd::asyncrecorder - feeds a recorder from a writer thread, the audio thread never touches the file.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+
+#include "soundrecorder.h"
+#include "spsc_ring.h"
+
+typedef struct {
+	SoundRecorder *recorder;
+	int channels;
+	// interleaved samples from the audio thread to the writer thread
+	SpscRing<float> *ring;
+	// block the writer thread reads from the ring and writes at once
+	float *block;
+	size_t block_samples;
+	pthread_t thread;
+	std::atomic<bool> running;
+	// frames dropped because the ring was full
+	std::atomic<uint64_t> overflows;
+} AsyncRecorder;
+
+AsyncRecorder *AsyncRecorder_create(SoundRecorder *recorder, int channels, int sampleRate);
+bool AsyncRecorder_write(AsyncRecorder *self, const float *data, int frames);
+uint64_t AsyncRecorder_overflows(AsyncRecorder *self);
+void AsyncRecorder_destroy(AsyncRecorder *self);
+
+#endif
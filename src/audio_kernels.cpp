@@ -0,0 +1,624 @@
+// Otojsd::audio_kernels - vectorized sample shuffling and conversion loops.
+
+#include <math.h>
+#include <string.h>
+
+#include "audio_kernels.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define AUDIO_KERNELS_X86_64 1
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#define AUDIO_KERNELS_NEON 1
+#endif
+
+// The implementations of the kernels selected for the running CPU.
+// Stereo is interleaved by pairs. Other channel counts go by groups of 4 channels (a 4x4 transpose per 4 frames)
+// written at the stride of the frame, and the 1 to 3 channels left over by the strided scalar loop.
+struct Kernels {
+    const char *name;
+    void (*interleave2)(float *dst, const float *left, const float *right, size_t frames);
+    void (*deinterleave2)(float *left, float *right, const float *src, size_t frames);
+    void (*interleave4)(float *dst, const float *const *src, size_t frames, size_t stride);
+    void (*deinterleave4)(float *const *dst, const float *src, size_t frames, size_t stride);
+    float (*peak)(const float *src, size_t count);
+    float (*sum_squares)(const float *src, size_t count);
+    void (*float_to_be32)(uint32_t *dst, const float *src, size_t count);
+    void (*float_to_int16)(int16_t *dst, const float *src, size_t count);
+    void (*float_to_int24)(int32_t *dst, const float *src, size_t count);
+};
+
+static const float INT16_SCALE = 32767.0f;
+static const float INT24_SCALE = 8388607.0f;
+
+// -------------------- scalar
+
+static void interleave2_scalar(float *dst, const float *left, const float *right, size_t frames) {
+    for (size_t i = 0; i < frames; i++) {
+        dst[i * 2] = left[i];
+        dst[i * 2 + 1] = right[i];
+    }
+}
+
+static void deinterleave2_scalar(float *left, float *right, const float *src, size_t frames) {
+    for (size_t i = 0; i < frames; i++) {
+        left[i] = src[i * 2];
+        right[i] = src[i * 2 + 1];
+    }
+}
+
+static void interleave4_scalar(float *dst, const float *const *src, size_t frames, size_t stride) {
+    for (size_t i = 0; i < frames; i++) {
+        for (size_t channel = 0; channel < 4; channel++) {
+            dst[i * stride + channel] = src[channel][i];
+        }
+    }
+}
+
+static void deinterleave4_scalar(float *const *dst, const float *src, size_t frames, size_t stride) {
+    for (size_t i = 0; i < frames; i++) {
+        for (size_t channel = 0; channel < 4; channel++) {
+            dst[channel][i] = src[i * stride + channel];
+        }
+    }
+}
+
+static float peak_scalar(const float *src, size_t count) {
+    float level = 0;
+    for (size_t i = 0; i < count; i++) {
+        float value = fabsf(src[i]);
+        level = value > level ? value : level;
+    }
+    return level;
+}
+
+static float sum_squares_scalar(const float *src, size_t count) {
+    float sum = 0;
+    for (size_t i = 0; i < count; i++) {
+        sum += src[i] * src[i];
+    }
+    return sum;
+}
+
+static void float_to_be32_scalar(uint32_t *dst, const float *src, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        uint32_t bits;
+        memcpy(&bits, src + i, sizeof(bits));
+        dst[i] = __builtin_bswap32(bits);
+    }
+}
+
+static inline float clip(float value) {
+    return value < -1.0f ? -1.0f : (value > 1.0f ? 1.0f : value);
+}
+
+static void float_to_int16_scalar(int16_t *dst, const float *src, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = (int16_t)lrintf(clip(src[i]) * INT16_SCALE);
+    }
+}
+
+static void float_to_int24_scalar(int32_t *dst, const float *src, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+        dst[i] = (int32_t)lrintf(clip(src[i]) * INT24_SCALE);
+    }
+}
+
+// also the reference the others are tested against, see select().
+static const Kernels SCALAR_KERNELS = {
+    "scalar",
+    interleave2_scalar,
+    deinterleave2_scalar,
+    interleave4_scalar,
+    deinterleave4_scalar,
+    peak_scalar,
+    sum_squares_scalar,
+    float_to_be32_scalar,
+    float_to_int16_scalar,
+    float_to_int24_scalar,
+};
+
+#if AUDIO_KERNELS_X86_64
+// -------------------- SSE2 (always available on x86-64)
+
+static void interleave2_sse2(float *dst, const float *left, const float *right, size_t frames) {
+    size_t i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        __m128 l = _mm_loadu_ps(left + i);
+        __m128 r = _mm_loadu_ps(right + i);
+        _mm_storeu_ps(dst + i * 2, _mm_unpacklo_ps(l, r));
+        _mm_storeu_ps(dst + i * 2 + 4, _mm_unpackhi_ps(l, r));
+    }
+    interleave2_scalar(dst + i * 2, left + i, right + i, frames - i);
+}
+
+static void deinterleave2_sse2(float *left, float *right, const float *src, size_t frames) {
+    size_t i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        __m128 a = _mm_loadu_ps(src + i * 2);
+        __m128 b = _mm_loadu_ps(src + i * 2 + 4);
+        _mm_storeu_ps(left + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+        _mm_storeu_ps(right + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+    }
+    deinterleave2_scalar(left + i, right + i, src + i * 2, frames - i);
+}
+
+// the transpose is its own inverse: channels in, frames out, or frames in, channels out.
+static void interleave4_sse2(float *dst, const float *const *src, size_t frames, size_t stride) {
+    size_t i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        __m128 a = _mm_loadu_ps(src[0] + i);
+        __m128 b = _mm_loadu_ps(src[1] + i);
+        __m128 c = _mm_loadu_ps(src[2] + i);
+        __m128 d = _mm_loadu_ps(src[3] + i);
+        _MM_TRANSPOSE4_PS(a, b, c, d);
+        _mm_storeu_ps(dst + i * stride, a);
+        _mm_storeu_ps(dst + (i + 1) * stride, b);
+        _mm_storeu_ps(dst + (i + 2) * stride, c);
+        _mm_storeu_ps(dst + (i + 3) * stride, d);
+    }
+    const float *rest[4] = {src[0] + i, src[1] + i, src[2] + i, src[3] + i};
+    interleave4_scalar(dst + i * stride, rest, frames - i, stride);
+}
+
+static void deinterleave4_sse2(float *const *dst, const float *src, size_t frames, size_t stride) {
+    size_t i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        __m128 a = _mm_loadu_ps(src + i * stride);
+        __m128 b = _mm_loadu_ps(src + (i + 1) * stride);
+        __m128 c = _mm_loadu_ps(src + (i + 2) * stride);
+        __m128 d = _mm_loadu_ps(src + (i + 3) * stride);
+        _MM_TRANSPOSE4_PS(a, b, c, d);
+        _mm_storeu_ps(dst[0] + i, a);
+        _mm_storeu_ps(dst[1] + i, b);
+        _mm_storeu_ps(dst[2] + i, c);
+        _mm_storeu_ps(dst[3] + i, d);
+    }
+    float *rest[4] = {dst[0] + i, dst[1] + i, dst[2] + i, dst[3] + i};
+    deinterleave4_scalar(rest, src + i * stride, frames - i, stride);
+}
+
+static float horizontal_max_sse2(__m128 v) {
+    v = _mm_max_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_max_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(v);
+}
+
+static float horizontal_sum_sse2(__m128 v) {
+    v = _mm_add_ps(v, _mm_movehl_ps(v, v));
+    v = _mm_add_ss(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(1, 1, 1, 1)));
+    return _mm_cvtss_f32(v);
+}
+
+static float peak_sse2(const float *src, size_t count) {
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    __m128 level = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        level = _mm_max_ps(level, _mm_andnot_ps(sign, _mm_loadu_ps(src + i)));
+    }
+    float rest = peak_scalar(src + i, count - i);
+    float result = horizontal_max_sse2(level);
+    return rest > result ? rest : result;
+}
+
+static float sum_squares_sse2(const float *src, size_t count) {
+    __m128 sum = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128 v = _mm_loadu_ps(src + i);
+        sum = _mm_add_ps(sum, _mm_mul_ps(v, v));
+    }
+    return horizontal_sum_sse2(sum) + sum_squares_scalar(src + i, count - i);
+}
+
+static void float_to_be32_sse2(uint32_t *dst, const float *src, size_t count) {
+    const __m128i byte_mask = _mm_set1_epi32(0x00ff00ff);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        __m128i v = _mm_loadu_si128((const __m128i *)(src + i));
+        // swap the bytes in each 16-bit half, then swap the halves.
+        v = _mm_or_si128(_mm_and_si128(_mm_srli_epi16(v, 8), byte_mask), _mm_slli_epi16(v, 8));
+        v = _mm_shufflehi_epi16(_mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)), _MM_SHUFFLE(2, 3, 0, 1));
+        _mm_storeu_si128((__m128i *)(dst + i), v);
+    }
+    float_to_be32_scalar(dst + i, src + i, count - i);
+}
+
+static inline __m128i scale_to_int_sse2(__m128 v, __m128 scale) {
+    v = _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(-1.0f)), _mm_set1_ps(1.0f));
+    return _mm_cvtps_epi32(_mm_mul_ps(v, scale));
+}
+
+static void float_to_int16_sse2(int16_t *dst, const float *src, size_t count) {
+    const __m128 scale = _mm_set1_ps(INT16_SCALE);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m128i a = scale_to_int_sse2(_mm_loadu_ps(src + i), scale);
+        __m128i b = scale_to_int_sse2(_mm_loadu_ps(src + i + 4), scale);
+        _mm_storeu_si128((__m128i *)(dst + i), _mm_packs_epi32(a, b));
+    }
+    float_to_int16_scalar(dst + i, src + i, count - i);
+}
+
+static void float_to_int24_sse2(int32_t *dst, const float *src, size_t count) {
+    const __m128 scale = _mm_set1_ps(INT24_SCALE);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        _mm_storeu_si128((__m128i *)(dst + i), scale_to_int_sse2(_mm_loadu_ps(src + i), scale));
+    }
+    float_to_int24_scalar(dst + i, src + i, count - i);
+}
+
+static const Kernels SSE2_KERNELS = {
+    "sse2",
+    interleave2_sse2,
+    deinterleave2_sse2,
+    interleave4_sse2,
+    deinterleave4_sse2,
+    peak_sse2,
+    sum_squares_sse2,
+    float_to_be32_sse2,
+    float_to_int16_sse2,
+    float_to_int24_sse2,
+};
+
+// -------------------- AVX2 (selected at runtime)
+
+#define AVX2_TARGET __attribute__((target("avx2")))
+
+AVX2_TARGET static void interleave2_avx2(float *dst, const float *left, const float *right, size_t frames) {
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m256 l = _mm256_loadu_ps(left + i);
+        __m256 r = _mm256_loadu_ps(right + i);
+        // unpack works within each 128-bit lane: lo = [L0 R0 L1 R1 | L4 R4 L5 R5], hi = [L2 R2 L3 R3 | L6 R6 L7 R7]
+        __m256 lo = _mm256_unpacklo_ps(l, r);
+        __m256 hi = _mm256_unpackhi_ps(l, r);
+        _mm256_storeu_ps(dst + i * 2, _mm256_permute2f128_ps(lo, hi, 0x20));
+        _mm256_storeu_ps(dst + i * 2 + 8, _mm256_permute2f128_ps(lo, hi, 0x31));
+    }
+    interleave2_sse2(dst + i * 2, left + i, right + i, frames - i);
+}
+
+AVX2_TARGET static void deinterleave2_avx2(float *left, float *right, const float *src, size_t frames) {
+    size_t i = 0;
+    for (; i + 8 <= frames; i += 8) {
+        __m256 a = _mm256_loadu_ps(src + i * 2);
+        __m256 b = _mm256_loadu_ps(src + i * 2 + 8);
+        // shuffle works within each 128-bit lane: [L0 L1 L4 L5 | L2 L3 L6 L7], then reorder the 64-bit pairs.
+        __m256 l = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+        __m256 r = _mm256_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+        _mm256_storeu_ps(left + i, _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(l), _MM_SHUFFLE(3, 1, 2, 0))));
+        _mm256_storeu_ps(right + i, _mm256_castpd_ps(_mm256_permute4x64_pd(_mm256_castps_pd(r), _MM_SHUFFLE(3, 1, 2, 0))));
+    }
+    deinterleave2_sse2(left + i, right + i, src + i * 2, frames - i);
+}
+
+AVX2_TARGET static float peak_avx2(const float *src, size_t count) {
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    __m256 level = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        level = _mm256_max_ps(level, _mm256_andnot_ps(sign, _mm256_loadu_ps(src + i)));
+    }
+    float rest = peak_sse2(src + i, count - i);
+    float result = horizontal_max_sse2(_mm_max_ps(_mm256_castps256_ps128(level), _mm256_extractf128_ps(level, 1)));
+    return rest > result ? rest : result;
+}
+
+AVX2_TARGET static float sum_squares_avx2(const float *src, size_t count) {
+    __m256 sum = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256 v = _mm256_loadu_ps(src + i);
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(v, v));
+    }
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    return horizontal_sum_sse2(half) + sum_squares_sse2(src + i, count - i);
+}
+
+AVX2_TARGET static void float_to_be32_avx2(uint32_t *dst, const float *src, size_t count) {
+    const __m256i reverse = _mm256_setr_epi8(
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+        3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        __m256i v = _mm256_loadu_si256((const __m256i *)(src + i));
+        _mm256_storeu_si256((__m256i *)(dst + i), _mm256_shuffle_epi8(v, reverse));
+    }
+    float_to_be32_sse2(dst + i, src + i, count - i);
+}
+
+AVX2_TARGET static inline __m256i scale_to_int_avx2(__m256 v, __m256 scale) {
+    v = _mm256_min_ps(_mm256_max_ps(v, _mm256_set1_ps(-1.0f)), _mm256_set1_ps(1.0f));
+    return _mm256_cvtps_epi32(_mm256_mul_ps(v, scale));
+}
+
+AVX2_TARGET static void float_to_int16_avx2(int16_t *dst, const float *src, size_t count) {
+    const __m256 scale = _mm256_set1_ps(INT16_SCALE);
+    size_t i = 0;
+    for (; i + 16 <= count; i += 16) {
+        __m256i a = scale_to_int_avx2(_mm256_loadu_ps(src + i), scale);
+        __m256i b = scale_to_int_avx2(_mm256_loadu_ps(src + i + 8), scale);
+        // packs works within each 128-bit lane, reorder the 64-bit quarters afterwards.
+        __m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(a, b), _MM_SHUFFLE(3, 1, 2, 0));
+        _mm256_storeu_si256((__m256i *)(dst + i), packed);
+    }
+    float_to_int16_sse2(dst + i, src + i, count - i);
+}
+
+AVX2_TARGET static void float_to_int24_avx2(int32_t *dst, const float *src, size_t count) {
+    const __m256 scale = _mm256_set1_ps(INT24_SCALE);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        _mm256_storeu_si256((__m256i *)(dst + i), scale_to_int_avx2(_mm256_loadu_ps(src + i), scale));
+    }
+    float_to_int24_sse2(dst + i, src + i, count - i);
+}
+
+static const Kernels AVX2_KERNELS = {
+    "avx2",
+    interleave2_avx2,
+    deinterleave2_avx2,
+    // a frame of 4 channels is 128 bits, the SSE2 transpose is as wide as it gets.
+    interleave4_sse2,
+    deinterleave4_sse2,
+    peak_avx2,
+    sum_squares_avx2,
+    float_to_be32_avx2,
+    float_to_int16_avx2,
+    float_to_int24_avx2,
+};
+#endif // AUDIO_KERNELS_X86_64
+
+#if AUDIO_KERNELS_NEON
+// -------------------- NEON (always available on arm64)
+
+static void interleave2_neon(float *dst, const float *left, const float *right, size_t frames) {
+    size_t i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        float32x4x2_t pair = {{vld1q_f32(left + i), vld1q_f32(right + i)}};
+        vst2q_f32(dst + i * 2, pair);
+    }
+    interleave2_scalar(dst + i * 2, left + i, right + i, frames - i);
+}
+
+static void deinterleave2_neon(float *left, float *right, const float *src, size_t frames) {
+    size_t i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        float32x4x2_t pair = vld2q_f32(src + i * 2);
+        vst1q_f32(left + i, pair.val[0]);
+        vst1q_f32(right + i, pair.val[1]);
+    }
+    deinterleave2_scalar(left + i, right + i, src + i * 2, frames - i);
+}
+
+// the transpose is its own inverse: channels in, frames out, or frames in, channels out.
+static inline void transpose4_neon(float32x4_t *rows) {
+    float32x4x2_t ab = vtrnq_f32(rows[0], rows[1]);
+    float32x4x2_t cd = vtrnq_f32(rows[2], rows[3]);
+    rows[0] = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+    rows[1] = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+    rows[2] = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+    rows[3] = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+}
+
+static void interleave4_neon(float *dst, const float *const *src, size_t frames, size_t stride) {
+    size_t i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        float32x4_t rows[4] = {vld1q_f32(src[0] + i), vld1q_f32(src[1] + i), vld1q_f32(src[2] + i), vld1q_f32(src[3] + i)};
+        transpose4_neon(rows);
+        for (size_t frame = 0; frame < 4; frame++) {
+            vst1q_f32(dst + (i + frame) * stride, rows[frame]);
+        }
+    }
+    const float *rest[4] = {src[0] + i, src[1] + i, src[2] + i, src[3] + i};
+    interleave4_scalar(dst + i * stride, rest, frames - i, stride);
+}
+
+static void deinterleave4_neon(float *const *dst, const float *src, size_t frames, size_t stride) {
+    size_t i = 0;
+    for (; i + 4 <= frames; i += 4) {
+        float32x4_t rows[4];
+        for (size_t frame = 0; frame < 4; frame++) {
+            rows[frame] = vld1q_f32(src + (i + frame) * stride);
+        }
+        transpose4_neon(rows);
+        for (size_t channel = 0; channel < 4; channel++) {
+            vst1q_f32(dst[channel] + i, rows[channel]);
+        }
+    }
+    float *rest[4] = {dst[0] + i, dst[1] + i, dst[2] + i, dst[3] + i};
+    deinterleave4_scalar(rest, src + i * stride, frames - i, stride);
+}
+
+static float peak_neon(const float *src, size_t count) {
+    float32x4_t level = vdupq_n_f32(0);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        level = vmaxq_f32(level, vabsq_f32(vld1q_f32(src + i)));
+    }
+    float rest = peak_scalar(src + i, count - i);
+    float result = vmaxvq_f32(level);
+    return rest > result ? rest : result;
+}
+
+static float sum_squares_neon(const float *src, size_t count) {
+    float32x4_t sum = vdupq_n_f32(0);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        float32x4_t v = vld1q_f32(src + i);
+        sum = vmlaq_f32(sum, v, v);
+    }
+    return vaddvq_f32(sum) + sum_squares_scalar(src + i, count - i);
+}
+
+static void float_to_be32_neon(uint32_t *dst, const float *src, size_t count) {
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        uint8x16_t v = vld1q_u8((const uint8_t *)(src + i));
+        vst1q_u8((uint8_t *)(dst + i), vrev32q_u8(v));
+    }
+    float_to_be32_scalar(dst + i, src + i, count - i);
+}
+
+static inline int32x4_t scale_to_int_neon(float32x4_t v, float32x4_t scale) {
+    v = vminq_f32(vmaxq_f32(v, vdupq_n_f32(-1.0f)), vdupq_n_f32(1.0f));
+    return vcvtnq_s32_f32(vmulq_f32(v, scale));
+}
+
+static void float_to_int16_neon(int16_t *dst, const float *src, size_t count) {
+    const float32x4_t scale = vdupq_n_f32(INT16_SCALE);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8) {
+        int16x4_t a = vqmovn_s32(scale_to_int_neon(vld1q_f32(src + i), scale));
+        int16x4_t b = vqmovn_s32(scale_to_int_neon(vld1q_f32(src + i + 4), scale));
+        vst1q_s16(dst + i, vcombine_s16(a, b));
+    }
+    float_to_int16_scalar(dst + i, src + i, count - i);
+}
+
+static void float_to_int24_neon(int32_t *dst, const float *src, size_t count) {
+    const float32x4_t scale = vdupq_n_f32(INT24_SCALE);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4) {
+        vst1q_s32(dst + i, scale_to_int_neon(vld1q_f32(src + i), scale));
+    }
+    float_to_int24_scalar(dst + i, src + i, count - i);
+}
+
+static const Kernels NEON_KERNELS = {
+    "neon",
+    interleave2_neon,
+    deinterleave2_neon,
+    interleave4_neon,
+    deinterleave4_neon,
+    peak_neon,
+    sum_squares_neon,
+    float_to_be32_neon,
+    float_to_int16_neon,
+    float_to_int24_neon,
+};
+#endif // AUDIO_KERNELS_NEON
+
+// -------------------- dispatch
+
+static const Kernels *select_kernels() {
+#if AUDIO_KERNELS_X86_64
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return &AVX2_KERNELS;
+    }
+    return &SSE2_KERNELS;
+#elif AUDIO_KERNELS_NEON
+    return &NEON_KERNELS;
+#else
+    return &SCALAR_KERNELS;
+#endif
+}
+
+static const Kernels *&selected_kernels() {
+    static const Kernels *selected = select_kernels();
+    return selected;
+}
+
+static const Kernels &kernels() {
+    return *selected_kernels();
+}
+
+namespace audio_kernels {
+
+const char *initialize() {
+    return kernels().name;
+}
+
+bool select(const char *name) {
+#if AUDIO_KERNELS_X86_64
+    const Kernels *candidates[] = {&SCALAR_KERNELS, &SSE2_KERNELS, &AVX2_KERNELS};
+#elif AUDIO_KERNELS_NEON
+    const Kernels *candidates[] = {&SCALAR_KERNELS, &NEON_KERNELS};
+#else
+    const Kernels *candidates[] = {&SCALAR_KERNELS};
+#endif
+    for (const Kernels *candidate : candidates) {
+        if (strcmp(candidate->name, name) != 0) {
+            continue;
+        }
+#if AUDIO_KERNELS_X86_64
+        if (candidate == &AVX2_KERNELS && !__builtin_cpu_supports("avx2")) {
+            return false;
+        }
+#endif
+        selected_kernels() = candidate;
+        return true;
+    }
+    return false;
+}
+
+void interleave(float *dst, const float *const *src, unsigned int frames, unsigned int channels) {
+    if (channels == 1) {
+        memcpy(dst, src[0], frames * sizeof(float));
+        return;
+    }
+    if (channels == 2) {
+        kernels().interleave2(dst, src[0], src[1], frames);
+        return;
+    }
+    unsigned int channel = 0;
+    for (; channel + 4 <= channels; channel += 4) {
+        kernels().interleave4(dst + channel, src + channel, frames, channels);
+    }
+    for (; channel < channels; channel++) {
+        const float *from = src[channel];
+        float *to = dst + channel;
+        for (unsigned int frame = 0; frame < frames; frame++) {
+            to[frame * channels] = from[frame];
+        }
+    }
+}
+
+void deinterleave(float *const *dst, const float *src, unsigned int frames, unsigned int channels) {
+    if (channels == 1) {
+        memcpy(dst[0], src, frames * sizeof(float));
+        return;
+    }
+    if (channels == 2) {
+        kernels().deinterleave2(dst[0], dst[1], src, frames);
+        return;
+    }
+    unsigned int channel = 0;
+    for (; channel + 4 <= channels; channel += 4) {
+        kernels().deinterleave4(dst + channel, src + channel, frames, channels);
+    }
+    for (; channel < channels; channel++) {
+        const float *from = src + channel;
+        float *to = dst[channel];
+        for (unsigned int frame = 0; frame < frames; frame++) {
+            to[frame] = from[frame * channels];
+        }
+    }
+}
+
+float peak(const float *src, size_t count) {
+    return kernels().peak(src, count);
+}
+
+float rms(const float *src, size_t count) {
+    return count > 0 ? sqrtf(kernels().sum_squares(src, count) / count) : 0;
+}
+
+void float_to_be32(uint32_t *dst, const float *src, size_t count) {
+    kernels().float_to_be32(dst, src, count);
+}
+
+void float_to_int16(int16_t *dst, const float *src, size_t count) {
+    kernels().float_to_int16(dst, src, count);
+}
+
+void float_to_int24(int32_t *dst, const float *src, size_t count) {
+    kernels().float_to_int24(dst, src, count);
+}
+
+} // namespace audio_kernels
@@ -0,0 +1,42 @@
+#ifndef AUDIO_KERNELS_H
+#define AUDIO_KERNELS_H
+// Otojsd::audio_kernels - vectorized sample shuffling and conversion loops.
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace audio_kernels {
+
+// Select the implementation for the running CPU and return its name.
+// It is also selected on the first use, call this at startup to keep that off the audio thread.
+const char *initialize();
+
+// Use the implementation of the name instead ("scalar", "sse2", "avx2" or "neon"), for the tests.
+// Returns false if it is not built in or the CPU lacks it.
+bool select(const char *name);
+
+// Interleave channels planar buffers of frames samples into dst ([L0, R0, L1, R1, ...]).
+// Stereo and every group of 4 channels are vectorized, up to 3 channels beyond the groups (e.g. 2 of 6) are not.
+void interleave(float *dst, const float *const *src, unsigned int frames, unsigned int channels);
+
+// Split the interleaved src into channels planar buffers of frames samples.
+void deinterleave(float *const *dst, const float *src, unsigned int frames, unsigned int channels);
+
+// Return the largest absolute value of the samples.
+float peak(const float *src, size_t count);
+
+// Return the root mean square of the samples.
+float rms(const float *src, size_t count);
+
+// Convert the samples to big-endian 32-bit floats.
+void float_to_be32(uint32_t *dst, const float *src, size_t count);
+
+// Convert the samples to native-endian 16-bit integers, clipping at -1.0 and 1.0.
+void float_to_int16(int16_t *dst, const float *src, size_t count);
+
+// Convert the samples to native-endian 24-bit integers in 32-bit words, clipping at -1.0 and 1.0.
+void float_to_int24(int32_t *dst, const float *src, size_t count);
+
+} // namespace audio_kernels
+
+#endif // AUDIO_KERNELS_H
@@ -0,0 +1,45 @@
+#ifndef OTOJSD_AUDIOBACKEND_H
+#define OTOJSD_AUDIOBACKEND_H
+// otojsd::audiobackend - interface of the audio device backends.
+
+#include <stdbool.h>
+
+#ifdef __APPLE__
+#include <CoreAudio/CoreAudioTypes.h>
+#else
+#include <stdint.h>
+// the CoreAudio types the callback contract is written in, for the other platforms.
+typedef uint32_t UInt32;
+typedef float Float32;
+typedef struct AudioBuffer {
+	UInt32 mNumberChannels;
+	UInt32 mDataByteSize;
+	void *mData;
+} AudioBuffer;
+#endif
+
+// Called on the audio thread with an array of channels buffers, each holding frames non-interleaved Float32 samples.
+// The buffers hold the input if it is enabled, the callback overwrites them with the output.
+typedef void (*audiobackend_callback)(AudioBuffer *outbuf, UInt32 frames, UInt32 channels);
+
+typedef struct {
+	const char *name;
+	// device is the part after "name:" of the -B option, or NULL. Returns false if the device did not start.
+	// bits is the sample format of -b, for the backends writing a file.
+	bool (*start)(const char *device, bool enable_input, int channel, int sample_rate, int bits, audiobackend_callback callback);
+	void (*stop)();
+} audiobackend;
+
+#ifdef __APPLE__
+extern const audiobackend audiobackend_coreaudio;
+#endif
+#ifdef OTOJSD_WITH_JACK
+extern const audiobackend audiobackend_jack;
+#endif
+#ifdef OTOJSD_WITH_ALSA
+extern const audiobackend audiobackend_alsa;
+#endif
+extern const audiobackend audiobackend_null;
+extern const audiobackend audiobackend_file;
+
+#endif
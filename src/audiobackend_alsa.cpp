@@ -0,0 +1,155 @@
+// otojsd::audiobackend_alsa - run an ALSA device (Linux), "alsa" or "alsa:hw:1,0".
+// A thread reads a period from the capture device if the input is enabled, calls back and writes it to the playback device.
+
+#ifdef OTOJSD_WITH_ALSA
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <atomic>
+#include <alsa/asoundlib.h>
+
+#include "audiobackend.h"
+#include "const.h"
+
+// latency requested to ALSA, it chooses the period from this
+#define ALSA_LATENCY_US 10000
+
+static snd_pcm_t *alsa_playback;
+static snd_pcm_t *alsa_capture;
+static pthread_t alsa_thread;
+static std::atomic<bool> alsa_running(false);
+static audiobackend_callback alsa_callback;
+static int alsa_channels;
+static snd_pcm_uframes_t alsa_period;
+static Float32 *alsa_samples;
+static AudioBuffer alsa_buffers[MAX_CHANNELS];
+static void *alsa_channel_pointers[MAX_CHANNELS];
+
+// ------------------------------------------------------ private functions
+bool alsabackend_start(const char *device, bool enable_input, int channel, int sample_rate, int bits, audiobackend_callback callback);
+void alsabackend_stop();
+snd_pcm_t *alsabackend_open(const char *device, snd_pcm_stream_t stream, int channel, int sample_rate);
+void *alsabackend_main(void *arg);
+void alsabackend_close();
+
+// ---------------------------------------------- implimentation
+
+bool alsabackend_start(const char *device, bool enable_input, int channel, int sample_rate, int, audiobackend_callback callback) {
+	if (!device || !*device) device = "default";
+	alsa_callback = callback;
+	alsa_channels = channel;
+	alsa_capture = NULL;
+
+	alsa_playback = alsabackend_open(device, SND_PCM_STREAM_PLAYBACK, channel, sample_rate);
+	if (!alsa_playback) return false;
+	snd_pcm_uframes_t buffer_size;
+	if (snd_pcm_get_params(alsa_playback, &buffer_size, &alsa_period) < 0) {
+		printf("snd_pcm_get_params failed.\n");
+		alsabackend_close();
+		return false;
+	}
+	if (enable_input) {
+		alsa_capture = alsabackend_open(device, SND_PCM_STREAM_CAPTURE, channel, sample_rate);
+		if (!alsa_capture) {
+			alsabackend_close();
+			return false;
+		}
+	}
+
+	alsa_samples = (Float32 *)calloc((size_t)alsa_period * channel, sizeof(Float32));
+	if (!alsa_samples) {
+		printf("malloc failed for the audio backend.\n");
+		alsabackend_close();
+		return false;
+	}
+	for (int c = 0; c < channel; c++) {
+		alsa_buffers[c].mNumberChannels = 1;
+		alsa_buffers[c].mDataByteSize = alsa_period * sizeof(Float32);
+		alsa_buffers[c].mData = alsa_samples + c * alsa_period;
+	}
+
+	alsa_running = true;
+	if (pthread_create(&alsa_thread, NULL, alsabackend_main, NULL) != 0) {
+		printf("failed to start the audio backend thread.\n");
+		alsa_running = false;
+		alsabackend_close();
+		return false;
+	}
+	printf("alsa: %s, %lu frames per period.\n", device, (unsigned long)alsa_period);
+	return true;
+}
+
+void alsabackend_stop() {
+	alsa_running = false;
+	pthread_join(alsa_thread, NULL);
+	snd_pcm_drop(alsa_playback);
+	alsabackend_close();
+}
+
+// Open the device for non-interleaved float samples, resampled by ALSA if the device does not support the rate.
+snd_pcm_t *alsabackend_open(const char *device, snd_pcm_stream_t stream, int channel, int sample_rate) {
+	snd_pcm_t *pcm;
+	int err = snd_pcm_open(&pcm, device, stream, 0);
+	if (err < 0) {
+		printf("snd_pcm_open %s failed: %s\n", device, snd_strerror(err));
+		return NULL;
+	}
+	err = snd_pcm_set_params(pcm, SND_PCM_FORMAT_FLOAT, SND_PCM_ACCESS_RW_NONINTERLEAVED,
+		channel, sample_rate, 1, ALSA_LATENCY_US);
+	if (err < 0) {
+		printf("snd_pcm_set_params failed: %s\n", snd_strerror(err));
+		snd_pcm_close(pcm);
+		return NULL;
+	}
+	return pcm;
+}
+
+void *alsabackend_main(void *) {
+	while (alsa_running) {
+		for (int c = 0; c < alsa_channels; c++) {
+			alsa_channel_pointers[c] = alsa_buffers[c].mData;
+		}
+		if (alsa_capture) {
+			snd_pcm_sframes_t read = snd_pcm_readn(alsa_capture, alsa_channel_pointers, alsa_period);
+			if (read < 0) {
+				snd_pcm_recover(alsa_capture, (int)read, 1);
+				memset(alsa_samples, 0, alsa_period * alsa_channels * sizeof(Float32));
+			}
+		}
+
+		alsa_callback(alsa_buffers, alsa_period, alsa_channels);
+
+		snd_pcm_uframes_t written = 0;
+		while (written < alsa_period && alsa_running) {
+			snd_pcm_sframes_t r = snd_pcm_writen(alsa_playback, alsa_channel_pointers, alsa_period - written);
+			if (r < 0) {
+				// underrun or suspend: restart the stream and write the period again.
+				if (snd_pcm_recover(alsa_playback, (int)r, 1) < 0) {
+					printf("snd_pcm_writen failed: %s\n", snd_strerror((int)r));
+					alsa_running = false;
+				}
+				continue;
+			}
+			written += r;
+			for (int c = 0; c < alsa_channels; c++) {
+				alsa_channel_pointers[c] = (Float32 *)alsa_buffers[c].mData + written;
+			}
+		}
+	}
+	return NULL;
+}
+
+void alsabackend_close() {
+	if (alsa_capture) snd_pcm_close(alsa_capture);
+	if (alsa_playback) snd_pcm_close(alsa_playback);
+	alsa_capture = NULL;
+	alsa_playback = NULL;
+	free(alsa_samples);
+	alsa_samples = NULL;
+}
+
+const audiobackend audiobackend_alsa = { "alsa", alsabackend_start, alsabackend_stop };
+
+#endif
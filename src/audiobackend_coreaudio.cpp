@@ -0,0 +1,274 @@
+// Otoperl::otoperld::audiobackend_coreaudio - run AudioUnit for otoperld.
+
+#ifdef __APPLE__
+
+#include <AudioUnit/AudioUnit.h>
+#include <CoreAudio/CoreAudio.h>
+#include "audiobackend.h"
+#include "coreaudioutilities.h"
+
+#define UNUSED(x) (void)(x)
+
+// ----------------------------------------------------- private functions
+OSStatus	audiocallback_input(void 		*inRefCon, 
+				AudioUnitRenderActionFlags 	*ioActionFlags, 
+				const AudioTimeStamp 		*inTimeStamp, 
+				UInt32 						inBusNumber, 
+				UInt32 						inNumberFrames, 
+				AudioBufferList 			*ioData);
+OSStatus	audiocallback_output(void 		*inRefCon, 
+				AudioUnitRenderActionFlags 	*ioActionFlags, 
+				const AudioTimeStamp 		*inTimeStamp, 
+				UInt32 						inBusNumber, 
+				UInt32 						inNumberFrames, 
+				AudioBufferList 			*ioData);
+OSStatus	audiocallback_outputonly(void 	*inRefCon, 
+				AudioUnitRenderActionFlags 	*ioActionFlags, 
+				const AudioTimeStamp 		*inTimeStamp, 
+				UInt32 						inBusNumber, 
+				UInt32 						inNumberFrames, 
+				AudioBufferList 			*ioData);
+
+bool CreateDefaultAU( bool enable_input, int channel, int sample_rate );
+void CloseDefaultAU();
+// -------------------------------------------- audiounit implimentation
+
+const UInt32 theFormatID = kAudioFormatLinearPCM;
+// these are set based on which format is chosen
+const UInt32 theFormatFlags = (AudioFormatFlags)kAudioFormatFlagsNativeFloatPacked | (AudioFormatFlags)kAudioFormatFlagIsNonInterleaved;
+const UInt32 theBytesInAPacket = 4;
+const UInt32 theBitsPerChannel = 32;
+const UInt32 theBytesPerFrame = 4;
+// these are the same regardless of format
+const UInt32 theFramesPerPacket = 1; // this shouldn't change'
+
+AudioUnit	gOutputUnit;
+AudioBufferList *inputBuffer;
+
+audiobackend_callback audiounit_callback;
+
+OSStatus	audiocallback_input(void 				*inRefCon, 
+				AudioUnitRenderActionFlags 	*ioActionFlags, 
+				const AudioTimeStamp 		*inTimeStamp, 
+				UInt32 						inBusNumber, 
+				UInt32 						inNumberFrames, 
+				AudioBufferList 			*ioData) {
+	UNUSED(inRefCon);
+	UNUSED(ioData);
+	
+	OSStatus err = AudioUnitRender(gOutputUnit,
+		ioActionFlags,
+		inTimeStamp,
+		inBusNumber,
+		inNumberFrames,
+		inputBuffer);
+	if (err) {
+		printf ("AudioUnitRender failed. (%4.4s, %ld)\n", (char*)&err, (long int)err);
+		return err;
+	}
+	
+	audiounit_callback(inputBuffer->mBuffers, inNumberFrames, inputBuffer->mNumberBuffers);
+	
+	return err;
+}
+
+OSStatus	audiocallback_output(void 				*inRefCon, 
+				AudioUnitRenderActionFlags 	*ioActionFlags, 
+				const AudioTimeStamp 		*inTimeStamp, 
+				UInt32 						inBusNumber, 
+				UInt32 						inNumberFrames, 
+				AudioBufferList 			*ioData) {
+	UNUSED(inRefCon);
+	UNUSED(ioActionFlags);
+	UNUSED(inTimeStamp);
+	UNUSED(inBusNumber);
+	
+	for (UInt32 b = 0; b < inputBuffer->mNumberBuffers; b++) {
+		memcpy(
+			ioData->mBuffers[b].mData,
+			inputBuffer->mBuffers[b].mData,
+			inNumberFrames * sizeof(Float32)
+		);
+	}
+	
+	return noErr;
+}
+
+OSStatus	audiocallback_outputonly(void 				*inRefCon, 
+				AudioUnitRenderActionFlags 	*ioActionFlags, 
+				const AudioTimeStamp 		*inTimeStamp, 
+				UInt32 						inBusNumber, 
+				UInt32 						inNumberFrames, 
+				AudioBufferList 			*ioData) {
+	UNUSED(inRefCon);
+	UNUSED(ioActionFlags);
+	UNUSED(inTimeStamp);
+	UNUSED(inBusNumber);
+	
+	audiounit_callback(ioData->mBuffers, inNumberFrames, ioData->mNumberBuffers);
+	
+	return noErr;
+}
+
+bool	CreateDefaultAU( bool enable_input, int channel, int sample_rate ) {
+	OSStatus err = noErr;
+
+	// Open the default output unit
+	AudioComponentDescription desc;
+	desc.componentType = kAudioUnitType_Output;
+	desc.componentSubType = kAudioUnitSubType_HALOutput;
+	desc.componentManufacturer = kAudioUnitManufacturer_Apple;
+	desc.componentFlags = 0;
+	desc.componentFlagsMask = 0;
+	
+	AudioComponent comp = AudioComponentFindNext(NULL, &desc);
+	if (comp == NULL) { printf ("AudioComponentFindNext\n"); return false; }
+	
+	err = AudioComponentInstanceNew(comp, &gOutputUnit);
+	if (comp == NULL) { printf ("AudioComponentInstanceNew=%ld\n", (long int)err); return false; }
+
+	// enable input
+	if (enable_input) {
+		UInt32 enableIO = 1;
+		err = AudioUnitSetProperty (gOutputUnit,
+									kAudioOutputUnitProperty_EnableIO,
+									kAudioUnitScope_Input,
+									1,
+									&enableIO,
+									sizeof(enableIO));
+		if (err) { printf ("AudioUnitSetProperty-EnableInput=%4.4s, %ld\n", (char*)&err, (long int)err); return false; }
+	}
+
+	// set current input/output device
+	AudioObjectID inputDevice, outputDevice;
+	outputDevice = getDefaultDeviceID(false);
+	if (enable_input) {
+		inputDevice = getDefaultDeviceID(true);
+		inputDevice = outputDevice = getInputOutputDevice(inputDevice, outputDevice, channel);
+		err = AudioUnitSetProperty (gOutputUnit,
+									kAudioOutputUnitProperty_CurrentDevice,
+									kAudioUnitScope_Global,
+									1,
+									&inputDevice,
+									sizeof(inputDevice));
+		if (err) { printf ("AudioUnitSetProperty-CurrentDevice-1=%ld\n", (long int)err); return false; }
+	}
+	err = AudioUnitSetProperty (gOutputUnit,
+								kAudioOutputUnitProperty_CurrentDevice,
+								kAudioUnitScope_Global,
+								0,
+								&outputDevice,
+								sizeof(outputDevice));
+	if (err) { printf ("AudioUnitSetProperty-CurrentDevice-0=%ld\n", (long int)err); return false; }
+
+	// Set up a callback function to obtain inputs
+	if (enable_input) {
+		AURenderCallbackStruct input;
+		input.inputProc = audiocallback_input;
+		input.inputProcRefCon = NULL;
+		err = AudioUnitSetProperty (gOutputUnit, 
+									kAudioOutputUnitProperty_SetInputCallback, 
+									kAudioUnitScope_Global,
+									1, 
+									&input, 
+									sizeof(input));
+		if (err) { printf ("AudioUnitSetProperty-CallbackIn=%ld\n", (long int)err); return false; }
+	}
+
+	// Set up a callback function to generate output to the output unit
+	AURenderCallbackStruct output;
+	output.inputProc = enable_input ? audiocallback_output : audiocallback_outputonly;
+	output.inputProcRefCon = NULL;
+	err = AudioUnitSetProperty (gOutputUnit, 
+								kAudioUnitProperty_SetRenderCallback, 
+								kAudioUnitScope_Input,
+								0, 
+								&output, 
+								sizeof(output));
+	if (err) { printf ("AudioUnitSetProperty-CallbackOut=%ld\n", (long int)err); return false; }
+
+	// Set stream format
+	AudioStreamBasicDescription streamFormat;
+	streamFormat.mSampleRate = sample_rate;      //	the sample rate of the audio stream
+	streamFormat.mFormatID = theFormatID;        //	the specific encoding type of audio stream
+	streamFormat.mFormatFlags = theFormatFlags;  //	flags specific to each format
+	streamFormat.mBytesPerPacket = theBytesInAPacket;
+	streamFormat.mFramesPerPacket = theFramesPerPacket;
+	streamFormat.mBytesPerFrame = theBytesPerFrame;
+	streamFormat.mChannelsPerFrame = channel;
+	streamFormat.mBitsPerChannel = theBitsPerChannel;
+	
+	if (enable_input) {
+		setSamplingRateToDevice(inputDevice, sample_rate);
+		err = AudioUnitSetProperty (gOutputUnit,
+									kAudioUnitProperty_StreamFormat,
+									kAudioUnitScope_Output,
+									1,
+									&streamFormat,
+									sizeof(AudioStreamBasicDescription));
+		if (err) { printf ("AudioUnitSetProperty-FromInputFormat=%4.4s, %ld\n", (char*)&err, (long int)err); return false; }
+	}
+
+	err = AudioUnitSetProperty (gOutputUnit,
+								kAudioUnitProperty_StreamFormat,
+								kAudioUnitScope_Input,
+								0,
+								&streamFormat,
+								sizeof(AudioStreamBasicDescription));
+	if (err) { printf ("AudioUnitSetProperty-IntoOutputFormat=%4.4s, %ld\n", (char*)&err, (long int)err); return false; }
+
+	// alloc bufferList
+	inputBuffer = NULL;
+	if (enable_input) {
+		UInt32 bufferSizeFrames;
+		UInt32 size = sizeof(bufferSizeFrames);
+		err = AudioUnitGetProperty (gOutputUnit, 
+									kAudioDevicePropertyBufferFrameSize, kAudioUnitScope_Global,
+									1,
+									&bufferSizeFrames,
+									&size);
+		if (err) { printf ("AudioUnitGetProperty-BufferFrameSize=%4.4s, %ld\n", (char*)&err, (long int)err); return false; }
+		inputBuffer = allocAudioBufferList(channel, bufferSizeFrames);
+	}
+
+	// Initialize unit
+	err = AudioUnitInitialize(gOutputUnit);
+	if (err) { printf ("AudioUnitInitialize=%ld\n", (long int)err); return false; }
+
+	// Start the rendering
+	// The DefaultOutputUnit will do any format conversions to the format of the default device
+	err = AudioOutputUnitStart (gOutputUnit);
+	if (err) { printf ("AudioOutputUnitStart=%ld\n", (long int)err); return false; }
+	return true;
+}
+
+void CloseDefaultAU () {
+	OSStatus err = noErr;
+
+	err = AudioOutputUnitStop (gOutputUnit);
+	if (err) { printf ("AudioOutputUnitStop=%ld\n", (long int)err); }
+
+	err = AudioUnitUninitialize (gOutputUnit);
+	if (err) { printf ("AudioUnitUninitialize=%ld\n", (long int)err); }
+
+	AudioComponentInstanceDispose (gOutputUnit);
+
+	if (inputBuffer) deallocAudioBufferList(inputBuffer);
+}
+
+// ---------------------------
+bool coreaudio_start( const char *device, bool enable_input, int channel, int sample_rate, int, audiobackend_callback callback ) {
+	if (device) {
+		printf("coreaudio backend uses the default devices, ignored: %s\n", device);
+	}
+	audiounit_callback = callback;
+	return CreateDefaultAU( enable_input, channel, sample_rate );
+}
+
+void coreaudio_stop() {
+	CloseDefaultAU();
+}
+
+const audiobackend audiobackend_coreaudio = { "coreaudio", coreaudio_start, coreaudio_stop };
+
+#endif
@@ -0,0 +1,109 @@
+// otojsd::audiobackend_jack - run as a JACK client (also PipeWire through its JACK API), "jack" or "jack:client_name".
+// The output ports are connected to the physical playback ports, and the physical capture ports to the input ports.
+
+#ifdef OTOJSD_WITH_JACK
+
+#include <stdio.h>
+#include <string.h>
+#include <jack/jack.h>
+
+#include "audiobackend.h"
+#include "const.h"
+
+static jack_client_t *jack_client;
+static jack_port_t *jack_outputs[MAX_CHANNELS];
+static jack_port_t *jack_inputs[MAX_CHANNELS];
+static audiobackend_callback jack_callback;
+static int jack_channels;
+static bool jack_input_enabled;
+static AudioBuffer jack_buffers[MAX_CHANNELS];
+
+// ------------------------------------------------------ private functions
+bool jackbackend_start(const char *device, bool enable_input, int channel, int sample_rate, int bits, audiobackend_callback callback);
+void jackbackend_stop();
+int jackbackend_process(jack_nframes_t frames, void *arg);
+void jackbackend_connect(unsigned long flags);
+
+// ---------------------------------------------- implimentation
+
+bool jackbackend_start(const char *device, bool enable_input, int channel, int sample_rate, int, audiobackend_callback callback) {
+	const char *name = device && *device ? device : "otojsd";
+	jack_status_t status;
+	jack_client = jack_client_open(name, JackNoStartServer, &status);
+	if (!jack_client) {
+		printf("jack_client_open failed (status 0x%x), is the JACK server running?\n", (unsigned int)status);
+		return false;
+	}
+	jack_callback = callback;
+	jack_channels = channel;
+	jack_input_enabled = enable_input;
+	if (jack_get_sample_rate(jack_client) != (jack_nframes_t)sample_rate) {
+		printf("jack runs at %u Hz, not %d Hz: the sound plays at the wrong speed.\n", jack_get_sample_rate(jack_client), sample_rate);
+	}
+
+	char port_name[32];
+	for (int c = 0; c < channel; c++) {
+		snprintf(port_name, sizeof(port_name), "out_%d", c + 1);
+		jack_outputs[c] = jack_port_register(jack_client, port_name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+		jack_inputs[c] = NULL;
+		if (enable_input) {
+			snprintf(port_name, sizeof(port_name), "in_%d", c + 1);
+			jack_inputs[c] = jack_port_register(jack_client, port_name, JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+		}
+		if (!jack_outputs[c] || (enable_input && !jack_inputs[c])) {
+			printf("jack_port_register failed.\n");
+			jack_client_close(jack_client);
+			return false;
+		}
+		jack_buffers[c].mNumberChannels = 1;
+	}
+
+	jack_set_process_callback(jack_client, jackbackend_process, NULL);
+	if (jack_activate(jack_client) != 0) {
+		printf("jack_activate failed.\n");
+		jack_client_close(jack_client);
+		return false;
+	}
+	jackbackend_connect(JackPortIsInput);
+	if (enable_input) {
+		jackbackend_connect(JackPortIsOutput);
+	}
+	return true;
+}
+
+void jackbackend_stop() {
+	jack_deactivate(jack_client);
+	jack_client_close(jack_client);
+	jack_client = NULL;
+}
+
+int jackbackend_process(jack_nframes_t frames, void *) {
+	for (int c = 0; c < jack_channels; c++) {
+		Float32 *output = (Float32 *)jack_port_get_buffer(jack_outputs[c], frames);
+		if (jack_input_enabled) {
+			memcpy(output, jack_port_get_buffer(jack_inputs[c], frames), frames * sizeof(Float32));
+		}
+		jack_buffers[c].mDataByteSize = frames * sizeof(Float32);
+		jack_buffers[c].mData = output;
+	}
+	jack_callback(jack_buffers, frames, jack_channels);
+	return 0;
+}
+
+// Connect our ports in order to the physical ports with the flags (JackPortIsInput for playback).
+void jackbackend_connect(unsigned long flags) {
+	const char **ports = jack_get_ports(jack_client, NULL, JACK_DEFAULT_AUDIO_TYPE, JackPortIsPhysical | flags);
+	if (!ports) return;
+	for (int c = 0; c < jack_channels && ports[c]; c++) {
+		if (flags & JackPortIsInput) {
+			jack_connect(jack_client, jack_port_name(jack_outputs[c]), ports[c]);
+		} else {
+			jack_connect(jack_client, ports[c], jack_port_name(jack_inputs[c]));
+		}
+	}
+	jack_free(ports);
+}
+
+const audiobackend audiobackend_jack = { "jack", jackbackend_start, jackbackend_stop };
+
+#endif
@@ -0,0 +1,134 @@
+// otojsd::audiobackend_null - timer driven backends without an audio device, for headless servers and testing.
+// "null" discards the output, "file:path" writes it to a sound file (the format is chosen as -o).
+// Both call back in real time from their own thread, the input is silence.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "audiobackend.h"
+#include "audio_kernels.h"
+#include "soundrecorder.h"
+#include "const.h"
+
+// frames per callback
+#define TIMER_BACKEND_FRAMES 512
+
+static pthread_t timer_thread;
+static std::atomic<bool> timer_running(false);
+static audiobackend_callback timer_callback;
+static bool timer_input_enabled;
+static int timer_channels;
+static int timer_sample_rate;
+static Float32 *timer_samples;
+static AudioBuffer timer_buffers[MAX_CHANNELS];
+// file backend only
+static SoundRecorder *timer_recorder;
+static Float32 *timer_interleaved;
+
+// ------------------------------------------------------ private functions
+bool timerbackend_start(bool enable_input, int channel, int sample_rate, audiobackend_callback callback);
+void *timerbackend_main(void *arg);
+bool nullbackend_start(const char *device, bool enable_input, int channel, int sample_rate, int bits, audiobackend_callback callback);
+bool filebackend_start(const char *device, bool enable_input, int channel, int sample_rate, int bits, audiobackend_callback callback);
+void timerbackend_stop();
+
+// ---------------------------------------------- implimentation
+
+bool timerbackend_start(bool enable_input, int channel, int sample_rate, audiobackend_callback callback) {
+	timer_callback = callback;
+	timer_input_enabled = enable_input;
+	timer_channels = channel;
+	timer_sample_rate = sample_rate;
+	timer_samples = (Float32 *)calloc((size_t)TIMER_BACKEND_FRAMES * channel, sizeof(Float32));
+	if (!timer_samples) {
+		printf("malloc failed for the audio backend.\n");
+		return false;
+	}
+	for (int c = 0; c < channel; c++) {
+		timer_buffers[c].mNumberChannels = 1;
+		timer_buffers[c].mDataByteSize = TIMER_BACKEND_FRAMES * sizeof(Float32);
+		timer_buffers[c].mData = timer_samples + c * TIMER_BACKEND_FRAMES;
+	}
+	timer_running = true;
+	if (pthread_create(&timer_thread, NULL, timerbackend_main, NULL) != 0) {
+		printf("failed to start the audio backend thread.\n");
+		timer_running = false;
+		free(timer_samples);
+		return false;
+	}
+	return true;
+}
+
+void *timerbackend_main(void *) {
+	const Float32 *channels[MAX_CHANNELS];
+	auto period = std::chrono::nanoseconds((int64_t)TIMER_BACKEND_FRAMES * 1000000000 / timer_sample_rate);
+	auto next = std::chrono::steady_clock::now();
+	while (timer_running) {
+		if (timer_input_enabled) {
+			memset(timer_samples, 0, (size_t)TIMER_BACKEND_FRAMES * timer_channels * sizeof(Float32));
+		}
+		timer_callback(timer_buffers, TIMER_BACKEND_FRAMES, timer_channels);
+		if (timer_recorder) {
+			for (int c = 0; c < timer_channels; c++) {
+				channels[c] = (const Float32 *)timer_buffers[c].mData;
+			}
+			audio_kernels::interleave(timer_interleaved, channels, TIMER_BACKEND_FRAMES, timer_channels);
+			SoundRecorder_write(timer_recorder, timer_interleaved, TIMER_BACKEND_FRAMES);
+		}
+		next += period;
+		auto now = std::chrono::steady_clock::now();
+		if (next < now - period) {
+			// fell behind more than a period, like a device would drop out.
+			next = now;
+		}
+		std::this_thread::sleep_until(next);
+	}
+	return NULL;
+}
+
+void timerbackend_stop() {
+	timer_running = false;
+	pthread_join(timer_thread, NULL);
+	free(timer_samples);
+	if (timer_recorder) {
+		SoundRecorder_close(timer_recorder);
+		SoundRecorder_destroy(timer_recorder);
+		timer_recorder = NULL;
+		free(timer_interleaved);
+	}
+}
+
+bool nullbackend_start(const char *, bool enable_input, int channel, int sample_rate, int, audiobackend_callback callback) {
+	return timerbackend_start(enable_input, channel, sample_rate, callback);
+}
+
+bool filebackend_start(const char *device, bool enable_input, int channel, int sample_rate, int bits, audiobackend_callback callback) {
+	if (!device || !*device) {
+		printf("file backend needs a path: -B file:path\n");
+		return false;
+	}
+	timer_recorder = SoundRecorder_create(channel, bits, sample_rate);
+	timer_interleaved = (Float32 *)malloc((size_t)TIMER_BACKEND_FRAMES * channel * sizeof(Float32));
+	if (!timer_recorder || !timer_interleaved || !SoundRecorder_open(timer_recorder, device)) {
+		if (timer_recorder) SoundRecorder_destroy(timer_recorder);
+		timer_recorder = NULL;
+		free(timer_interleaved);
+		return false;
+	}
+	if (!timerbackend_start(enable_input, channel, sample_rate, callback)) {
+		SoundRecorder_close(timer_recorder);
+		SoundRecorder_destroy(timer_recorder);
+		timer_recorder = NULL;
+		free(timer_interleaved);
+		return false;
+	}
+	return true;
+}
+
+const audiobackend audiobackend_null = { "null", nullbackend_start, timerbackend_stop };
+const audiobackend audiobackend_file = { "file", filebackend_start, timerbackend_stop };
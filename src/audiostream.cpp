@@ -0,0 +1,370 @@
+// otojsd::audiostream - streams the output to HTTP listeners, encoded on its own thread.
+// The audio thread only copies the output into a ring, and only while someone listens. The encoder thread
+// decimates and encodes the ring for each listener with a SoundRecorder writing into memory, and sends it
+// in chunks through non-blocking sockets, so a slow listener never holds the others nor the audio.
+//
+// GET /otojsd/stream.wav, stream.flac or stream.raw (little-endian samples without header), with
+// ?rate=24000 to downsample by an integer factor and &bits=16, 24 or 32 (float, wav and raw only).
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <string>
+#include <format>
+#include "audiostream.h"
+#include "logger.h"
+
+// seconds of output the ring holds while the encoder thread is late
+#define RING_SECONDS 1
+// frames the encoder thread reads from the ring at once
+#define BLOCK_FRAMES 4096
+// interval the encoder thread checks the ring
+#define ENCODER_POLL_NS 20000000
+// seconds of stream a listener may be late before it is dropped
+#define PENDING_SECONDS 4
+// taps of the lowpass per decimation factor
+#define TAPS_PER_FACTOR 16
+#define DECIMATION_MAX 8
+
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+// ------------------------------------------------------ private functions
+void *AudioStream__encoder(void *arg);
+AudioStreamListener *AudioStream__listener(AudioStream *self, int fd, const char *path, char **error);
+void AudioStream__encode(AudioStream *self, AudioStreamListener *listener, const float *data, size_t frames);
+int AudioStream__decimate(AudioStream *self, AudioStreamListener *listener, const float *data, size_t frames);
+void AudioStream__push(AudioStreamListener *listener, const void *data, size_t bytes);
+void AudioStream__push_chunk(AudioStreamListener *listener, const void *data, size_t bytes);
+void AudioStream__send(AudioStreamListener *listener);
+void AudioStream__close_listener(AudioStreamListener *listener);
+long AudioStream__query(const char *query, const char *name, long fallback);
+
+// ---------------------------------------------- implimentation
+
+AudioStream *AudioStream_create(int channels, int sampleRate) {
+	AudioStream *self = new AudioStream;
+	self->channels = channels;
+	self->sampleRate = sampleRate;
+	self->ring = new SpscRing<float>((size_t)RING_SECONDS * sampleRate * channels);
+	self->blockFrames = BLOCK_FRAMES;
+	self->block = (float *)malloc(BLOCK_FRAMES * channels * sizeof(float));
+	self->listenerCount = 0;
+	self->active = 0;
+	self->overflows = 0;
+	self->running = true;
+	pthread_mutex_init(&self->mutex, NULL);
+	if ( ! self->block || pthread_create(&self->thread, NULL, AudioStream__encoder, self) != 0 ) {
+		printf("failed to start the stream thread.\n");
+		free(self->block);
+		pthread_mutex_destroy(&self->mutex);
+		delete self->ring;
+		delete self;
+		return NULL;
+	}
+	return self;
+}
+
+// True if someone listens. Real-time safe.
+bool AudioStream_listening(AudioStream *self) {
+	return self->active.load(std::memory_order_relaxed) > 0;
+}
+
+// Queue interleaved frames for the listeners. Real-time safe: never blocks, allocates nor touches a socket.
+void AudioStream_write(AudioStream *self, const float *data, int frames) {
+	if ( ! AudioStream_listening(self) ) return;
+	size_t samples = (size_t)frames * self->channels;
+	if ( self->ring->writable() < samples ) {
+		self->overflows.fetch_add(frames, std::memory_order_relaxed);
+		return;
+	}
+	self->ring->write(data, samples);
+}
+
+// Take over the connection of a GET request to the stream path, with the query. Returns false with the
+// error (malloc'ed) if the request is not acceptable, then the connection is left to the caller.
+bool AudioStream_add(AudioStream *self, int fd, const char *path, char **error) {
+	pthread_mutex_lock(&self->mutex);
+	int count = self->listenerCount;
+	pthread_mutex_unlock(&self->mutex);
+	if ( count >= AUDIOSTREAM_LISTENERS_MAX ) {
+		*error = strdup(std::format("too many stream listeners, up to {}.", AUDIOSTREAM_LISTENERS_MAX).c_str());
+		return false;
+	}
+	AudioStreamListener *listener = AudioStream__listener(self, fd, path, error);
+	if ( ! listener ) return false;
+
+	pthread_mutex_lock(&self->mutex);
+	self->listeners[self->listenerCount++] = listener;
+	self->active = self->listenerCount;
+	pthread_mutex_unlock(&self->mutex);
+	return true;
+}
+
+// Stop the encoder thread, end the streams and close the connections.
+void AudioStream_destroy(AudioStream *self) {
+	self->running = false;
+	pthread_join(self->thread, NULL);
+	for ( int i = 0; i < self->listenerCount; i++ ) {
+		AudioStreamListener *listener = self->listeners[i];
+		// the last chunk, if the socket takes it now.
+		AudioStream__push(listener, "0\r\n\r\n", 5);
+		AudioStream__send(listener);
+		AudioStream__close_listener(listener);
+	}
+	uint64_t overflows = self->overflows.load();
+	if ( overflows > 0 ) {
+		logger::warn(std::format("stream encoder fell behind: {} frames lost.", overflows));
+	}
+	free(self->block);
+	pthread_mutex_destroy(&self->mutex);
+	delete self->ring;
+	delete self;
+}
+
+void *AudioStream__encoder(void *arg) {
+	AudioStream *self = (AudioStream *)arg;
+	struct timespec interval = {0, ENCODER_POLL_NS};
+	while ( self->running ) {
+		pthread_mutex_lock(&self->mutex);
+		size_t frames;
+		while ( (frames = self->ring->readable() / self->channels) > 0 ) {
+			if ( frames > self->blockFrames ) frames = self->blockFrames;
+			self->ring->read(self->block, frames * self->channels);
+			for ( int i = 0; i < self->listenerCount; i++ ) {
+				AudioStream__encode(self, self->listeners[i], self->block, frames);
+			}
+		}
+		for ( int i = 0; i < self->listenerCount; i++ ) {
+			AudioStreamListener *listener = self->listeners[i];
+			AudioStream__send(listener);
+			if ( listener->closed ) {
+				AudioStream__close_listener(listener);
+				self->listeners[i--] = self->listeners[--self->listenerCount];
+				logger::queue_format(logger::LEVEL_LOG, "stream listener left, {} listening.", self->listenerCount);
+			}
+		}
+		self->active = self->listenerCount;
+		pthread_mutex_unlock(&self->mutex);
+		nanosleep(&interval, NULL);
+	}
+	return NULL;
+}
+
+// Parse the request, prepare the encoder and queue the response headers.
+AudioStreamListener *AudioStream__listener(AudioStream *self, int fd, const char *path, char **error) {
+	const char *query = strchr(path, '?');
+	std::string name(path, query ? (size_t)(query - path) : strlen(path));
+	SoundFileFormat format;
+	const char *contentType;
+	if ( name == "stream" || name == "stream.wav" ) {
+		format = SOUNDFILE_WAV;
+		contentType = "audio/wav";
+	} else if ( name == "stream.flac" ) {
+		format = SOUNDFILE_FLAC;
+		contentType = "audio/flac";
+	} else if ( name == "stream.raw" ) {
+		format = SOUNDFILE_RAW;
+		contentType = "application/octet-stream";
+	} else {
+		*error = strdup("stream is stream.wav, stream.flac or stream.raw.");
+		return NULL;
+	}
+	long rate = AudioStream__query(query, "rate", self->sampleRate);
+	long bits = AudioStream__query(query, "bits", 16);
+	int decimation = rate > 0 ? self->sampleRate / rate : 0;
+	if ( decimation < 1 || decimation > DECIMATION_MAX || (long)self->sampleRate != rate * decimation ) {
+		*error = strdup(std::format("stream rate must be {} divided by 1 to {}.", self->sampleRate, DECIMATION_MAX).c_str());
+		return NULL;
+	}
+	if ( (bits != 16 && bits != 24 && bits != 32) || (format == SOUNDFILE_FLAC && bits == 32) ) {
+		*error = strdup("stream bits must be 16, 24 or 32 (not for flac).");
+		return NULL;
+	}
+	if ( format == SOUNDFILE_FLAC && self->channels > FLAC_CHANNELS_MAX ) {
+		*error = strdup(std::format("stream.flac is up to {} channels, use stream.wav for {}.", FLAC_CHANNELS_MAX, self->channels).c_str());
+		return NULL;
+	}
+
+	AudioStreamListener *listener = (AudioStreamListener *)calloc(1, sizeof(AudioStreamListener));
+	listener->fd = fd;
+	listener->decimation = decimation;
+	listener->pendingMax = (size_t)PENDING_SECONDS * rate * self->channels * (bits / 8) + 65536;
+	listener->decimated = (float *)malloc((BLOCK_FRAMES / decimation + 1) * self->channels * sizeof(float));
+	if ( decimation > 1 ) {
+		// windowed sinc lowpass at 90% of the new Nyquist frequency
+		listener->tapCount = TAPS_PER_FACTOR * decimation + 1;
+		listener->taps = (float *)malloc(listener->tapCount * sizeof(float));
+		listener->history = (float *)calloc((size_t)listener->tapCount * 2 * self->channels, sizeof(float));
+		double cutoff = 0.45 / decimation;
+		double sum = 0;
+		int middle = listener->tapCount / 2;
+		for ( int i = 0; i < listener->tapCount; i++ ) {
+			double x = i - middle;
+			double sinc = x == 0 ? 2 * cutoff : sin(2 * M_PI * cutoff * x) / (M_PI * x);
+			double window = 0.42 - 0.5 * cos(2 * M_PI * i / (listener->tapCount - 1)) + 0.08 * cos(4 * M_PI * i / (listener->tapCount - 1));
+			listener->taps[i] = sinc * window;
+			sum += listener->taps[i];
+		}
+		for ( int i = 0; i < listener->tapCount; i++ ) {
+			listener->taps[i] /= sum;
+		}
+	}
+
+	listener->stream = open_memstream(&listener->streamBuffer, &listener->streamBytes);
+	listener->recorder = SoundRecorder_create(self->channels, bits, rate);
+	if ( ! listener->stream || ! listener->recorder || ! SoundRecorder_open_stream(listener->recorder, listener->stream, format) ) {
+		*error = strdup("failed to start the stream encoder.");
+		listener->fd = -1;
+		AudioStream__close_listener(listener);
+		return NULL;
+	}
+
+	// the socket is written by the encoder thread without waiting.
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+	int on = 1;
+	setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+	std::string headers = std::format("HTTP/1.1 200 OK\r\nContent-Type: {}\r\nTransfer-Encoding: chunked\r\nCache-Control: no-cache\r\nConnection: close\r\n\r\n", contentType);
+	AudioStream__push(listener, headers.data(), headers.size());
+	// the file headers written by the recorder
+	fflush(listener->stream);
+	AudioStream__push_chunk(listener, listener->streamBuffer, listener->streamBytes);
+	rewind(listener->stream);
+	logger::queue_format(logger::LEVEL_LOG, "stream listener joined: {} Hz {} bits {}.", rate, bits, contentType);
+	return listener;
+}
+
+// Encode frames of the ring for the listener and queue them as a chunk.
+void AudioStream__encode(AudioStream *self, AudioStreamListener *listener, const float *data, size_t frames) {
+	if ( listener->closed ) return;
+	if ( listener->decimation > 1 ) {
+		int decimated = AudioStream__decimate(self, listener, data, frames);
+		SoundRecorder_write(listener->recorder, listener->decimated, decimated);
+	} else {
+		SoundRecorder_write(listener->recorder, data, frames);
+	}
+	fflush(listener->stream);
+	if ( listener->streamBytes > 0 ) {
+		AudioStream__push_chunk(listener, listener->streamBuffer, listener->streamBytes);
+		rewind(listener->stream);
+	}
+	if ( listener->pendingBytes > listener->pendingMax ) {
+		logger::queue_format(logger::LEVEL_WARN, "stream listener is {} seconds late, dropped.", PENDING_SECONDS);
+		listener->closed = true;
+	}
+}
+
+// Lowpass and keep every decimation-th frame into listener->decimated. Returns the frames kept.
+int AudioStream__decimate(AudioStream *self, AudioStreamListener *listener, const float *data, size_t frames) {
+	int channels = self->channels;
+	int taps = listener->tapCount;
+	int count = 0;
+	for ( size_t i = 0; i < frames; i++ ) {
+		const float *frame = data + i * channels;
+		int position = listener->historyPosition;
+		for ( int c = 0; c < channels; c++ ) {
+			listener->history[(size_t)position * channels + c] = frame[c];
+			listener->history[(size_t)(position + taps) * channels + c] = frame[c];
+		}
+		listener->historyPosition = position + 1 == taps ? 0 : position + 1;
+		if ( ++listener->phase < listener->decimation ) continue;
+		listener->phase = 0;
+		// the window of the last taps frames, oldest first
+		const float *window = listener->history + (size_t)listener->historyPosition * channels;
+		float *out = listener->decimated + (size_t)count * channels;
+		for ( int c = 0; c < channels; c++ ) {
+			float sum = 0;
+			for ( int t = 0; t < taps; t++ ) {
+				sum += listener->taps[t] * window[(size_t)t * channels + c];
+			}
+			out[c] = sum;
+		}
+		count++;
+	}
+	return count;
+}
+
+void AudioStream__push(AudioStreamListener *listener, const void *data, size_t bytes) {
+	if ( listener->pendingBytes + bytes > listener->pendingCapacity ) {
+		size_t capacity = listener->pendingCapacity ? listener->pendingCapacity : 65536;
+		while ( capacity < listener->pendingBytes + bytes ) capacity *= 2;
+		unsigned char *pending = (unsigned char *)realloc(listener->pending, capacity);
+		if ( ! pending ) {
+			listener->closed = true;
+			return;
+		}
+		listener->pending = pending;
+		listener->pendingCapacity = capacity;
+	}
+	memcpy(listener->pending + listener->pendingBytes, data, bytes);
+	listener->pendingBytes += bytes;
+}
+
+// Queue the bytes as a chunk of the chunked transfer encoding.
+void AudioStream__push_chunk(AudioStreamListener *listener, const void *data, size_t bytes) {
+	if ( bytes == 0 ) return;
+	char size[20];
+	int length = snprintf(size, sizeof(size), "%zx\r\n", bytes);
+	AudioStream__push(listener, size, length);
+	AudioStream__push(listener, data, bytes);
+	AudioStream__push(listener, "\r\n", 2);
+}
+
+// Send what the socket takes now.
+void AudioStream__send(AudioStreamListener *listener) {
+	size_t sent = 0;
+	while ( sent < listener->pendingBytes && ! listener->closed ) {
+		ssize_t length = send(listener->fd, listener->pending + sent, listener->pendingBytes - sent, SEND_FLAGS);
+		if ( length > 0 ) {
+			sent += length;
+		} else if ( length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK) ) {
+			break;
+		} else if ( length < 0 && errno == EINTR ) {
+			continue;
+		} else {
+			// the listener closed the connection.
+			listener->closed = true;
+		}
+	}
+	memmove(listener->pending, listener->pending + sent, listener->pendingBytes - sent);
+	listener->pendingBytes -= sent;
+}
+
+void AudioStream__close_listener(AudioStreamListener *listener) {
+	if ( listener->recorder ) {
+		SoundRecorder_close(listener->recorder);
+		SoundRecorder_destroy(listener->recorder);
+	}
+	if ( listener->stream ) fclose(listener->stream);
+	free(listener->streamBuffer);
+	if ( listener->fd >= 0 ) close(listener->fd);
+	free(listener->pending);
+	free(listener->decimated);
+	free(listener->taps);
+	free(listener->history);
+	free(listener);
+}
+
+// Integer value of name=value in the query string, fallback if missing, -1 if not a number.
+long AudioStream__query(const char *query, const char *name, long fallback) {
+	size_t length = strlen(name);
+	for ( const char *p = query; p && *p; p = strchr(p, '&') ) {
+		p++;
+		if ( strncmp(p, name, length) == 0 && p[length] == '=' ) {
+			char *end;
+			long value = strtol(p + length + 1, &end, 10);
+			return (*end == '\0' || *end == '&') && end != p + length + 1 ? value : -1;
+		}
+	}
+	return fallback;
+}
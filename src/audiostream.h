@@ -0,0 +1,66 @@
+#ifndef AUDIOSTREAM_H
+#define AUDIOSTREAM_H
+// otojsd::audiostream - streams the output to HTTP listeners, encoded on its own thread.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+
+#include "soundrecorder.h"
+#include "spsc_ring.h"
+
+#define AUDIOSTREAM_LISTENERS_MAX 16
+
+typedef struct {
+	int fd;
+	// output rate is the sample rate divided by decimation
+	int decimation;
+	// lowpass before decimation: taps, and the last taps frames twice in a row so that a window is contiguous
+	float *taps;
+	int tapCount;
+	float *history;
+	int historyPosition;
+	int phase;
+	// decimated frames of a block
+	float *decimated;
+	// encodes into memory through stream, the bytes are in streamBuffer
+	SoundRecorder *recorder;
+	FILE *stream;
+	char *streamBuffer;
+	size_t streamBytes;
+	// bytes waiting for the socket, chunked
+	unsigned char *pending;
+	size_t pendingBytes;
+	size_t pendingCapacity;
+	size_t pendingMax;
+	bool closed;
+} AudioStreamListener;
+
+typedef struct {
+	int channels;
+	int sampleRate;
+	// interleaved samples from the audio thread to the encoder thread
+	SpscRing<float> *ring;
+	float *block;
+	size_t blockFrames;
+	pthread_t thread;
+	std::atomic<bool> running;
+	// listeners are added by the code server and removed by the encoder thread
+	pthread_mutex_t mutex;
+	AudioStreamListener *listeners[AUDIOSTREAM_LISTENERS_MAX];
+	int listenerCount;
+	// the audio thread writes nothing while no one listens
+	std::atomic<int> active;
+	// frames dropped because the ring was full
+	std::atomic<uint64_t> overflows;
+} AudioStream;
+
+AudioStream *AudioStream_create(int channels, int sampleRate);
+bool AudioStream_listening(AudioStream *self);
+void AudioStream_write(AudioStream *self, const float *data, int frames);
+bool AudioStream_add(AudioStream *self, int fd, const char *path, char **error);
+void AudioStream_destroy(AudioStream *self);
+
+#endif
@@ -1,265 +1,70 @@
-// Otoperl::otoperld::audiounit - run AudioUnit for otoperld.
+// Otoperl::otoperld::audiounit - run the audio device for otoperld, through the selected backend.
 
-#include <CoreAudio/CoreAudio.h>
+#include <stdio.h>
+#include <string.h>
 #include "audiounit.h"
-#include "coreaudioutilities.h"
 
-#define UNUSED(x) (void)(x)
+// the first one is the default
+const audiobackend *audiounit_backend_list[] = {
+#ifdef __APPLE__
+	&audiobackend_coreaudio,
+#endif
+#ifdef OTOJSD_WITH_JACK
+	&audiobackend_jack,
+#endif
+#ifdef OTOJSD_WITH_ALSA
+	&audiobackend_alsa,
+#endif
+	&audiobackend_null,
+	&audiobackend_file,
+	NULL
+};
+
+// the running backend
+const audiobackend *audiounit_backend = NULL;
 
-// ----------------------------------------------------- private functions
-OSStatus	audiocallback_input(void 		*inRefCon, 
-				AudioUnitRenderActionFlags 	*ioActionFlags, 
-				const AudioTimeStamp 		*inTimeStamp, 
-				UInt32 						inBusNumber, 
-				UInt32 						inNumberFrames, 
-				AudioBufferList 			*ioData);
-OSStatus	audiocallback_output(void 		*inRefCon, 
-				AudioUnitRenderActionFlags 	*ioActionFlags, 
-				const AudioTimeStamp 		*inTimeStamp, 
-				UInt32 						inBusNumber, 
-				UInt32 						inNumberFrames, 
-				AudioBufferList 			*ioData);
-OSStatus	audiocallback_outputonly(void 	*inRefCon, 
-				AudioUnitRenderActionFlags 	*ioActionFlags, 
-				const AudioTimeStamp 		*inTimeStamp, 
-				UInt32 						inBusNumber, 
-				UInt32 						inNumberFrames, 
-				AudioBufferList 			*ioData);
-
-void CreateDefaultAU( bool enable_input, int channel, int sample_rate );
-void CloseDefaultAU();
 // -------------------------------------------- audiounit implimentation
 
-const UInt32 theFormatID = kAudioFormatLinearPCM;
-// these are set based on which format is chosen
-const UInt32 theFormatFlags = (AudioFormatFlags)kAudioFormatFlagsNativeFloatPacked | (AudioFormatFlags)kAudioFormatFlagIsNonInterleaved;
-const UInt32 theBytesInAPacket = 4;
-const UInt32 theBitsPerChannel = 32;
-const UInt32 theBytesPerFrame = 4;
-// these are the same regardless of format
-const UInt32 theFramesPerPacket = 1; // this shouldn't change'
-
-AudioUnit	gOutputUnit;
-AudioBufferList *inputBuffer;
-
-void (*audiounit_callback)(AudioBuffer *outbuf, UInt32 frames, UInt32 channels);
-
-OSStatus	audiocallback_input(void 				*inRefCon, 
-				AudioUnitRenderActionFlags 	*ioActionFlags, 
-				const AudioTimeStamp 		*inTimeStamp, 
-				UInt32 						inBusNumber, 
-				UInt32 						inNumberFrames, 
-				AudioBufferList 			*ioData) {
-	UNUSED(inRefCon);
-	UNUSED(ioData);
-	
-	OSStatus err = AudioUnitRender(gOutputUnit,
-		ioActionFlags,
-		inTimeStamp,
-		inBusNumber,
-		inNumberFrames,
-		inputBuffer);
-	if (err) {
-		printf ("AudioUnitRender failed. (%4.4s, %ld)\n", (char*)&err, (long int)err);
-		return err;
+bool audiounit_start( const char *backend, bool enable_input, int channel, int sample_rate, int bits, audiobackend_callback callback ) {
+	const audiobackend *selected = audiounit_backend_list[0];
+	const char *device = NULL;
+	if (backend) {
+		const char *colon = strchr(backend, ':');
+		size_t length = colon ? (size_t)(colon - backend) : strlen(backend);
+		device = colon ? colon + 1 : NULL;
+		selected = NULL;
+		for (int i = 0; audiounit_backend_list[i]; i++) {
+			const char *name = audiounit_backend_list[i]->name;
+			if (strlen(name) == length && strncmp(name, backend, length) == 0) {
+				selected = audiounit_backend_list[i];
+			}
+		}
+		if (!selected) {
+			printf("unknown audio backend: %.*s (built in: %s)\n", (int)length, backend, audiounit_backends().c_str());
+			return false;
+		}
 	}
-	
-	audiounit_callback(inputBuffer->mBuffers, inNumberFrames, inputBuffer->mNumberBuffers);
-	
-	return err;
-}
-
-OSStatus	audiocallback_output(void 				*inRefCon, 
-				AudioUnitRenderActionFlags 	*ioActionFlags, 
-				const AudioTimeStamp 		*inTimeStamp, 
-				UInt32 						inBusNumber, 
-				UInt32 						inNumberFrames, 
-				AudioBufferList 			*ioData) {
-	UNUSED(inRefCon);
-	UNUSED(ioActionFlags);
-	UNUSED(inTimeStamp);
-	UNUSED(inBusNumber);
-	
-	for (UInt32 b = 0; b < inputBuffer->mNumberBuffers; b++) {
-		memcpy(
-			ioData->mBuffers[b].mData,
-			inputBuffer->mBuffers[b].mData,
-			inNumberFrames * sizeof(Float32)
-		);
+	if (!selected->start(device, enable_input, channel, sample_rate, bits, callback)) {
+		printf("audio backend %s failed to start.\n", selected->name);
+		return false;
 	}
-	
-	return noErr;
+	audiounit_backend = selected;
+	printf("audiounit start (%s).\n", selected->name);
+	return true;
 }
 
-OSStatus	audiocallback_outputonly(void 				*inRefCon, 
-				AudioUnitRenderActionFlags 	*ioActionFlags, 
-				const AudioTimeStamp 		*inTimeStamp, 
-				UInt32 						inBusNumber, 
-				UInt32 						inNumberFrames, 
-				AudioBufferList 			*ioData) {
-	UNUSED(inRefCon);
-	UNUSED(ioActionFlags);
-	UNUSED(inTimeStamp);
-	UNUSED(inBusNumber);
-	
-	audiounit_callback(ioData->mBuffers, inNumberFrames, ioData->mNumberBuffers);
-	
-	return noErr;
+void audiounit_stop() {
+	if (!audiounit_backend) return;
+	audiounit_backend->stop();
+	audiounit_backend = NULL;
+	printf("audiounit stop.\n");
 }
 
-void	CreateDefaultAU( bool enable_input, int channel, int sample_rate ) {
-	OSStatus err = noErr;
-
-	// Open the default output unit
-	AudioComponentDescription desc;
-	desc.componentType = kAudioUnitType_Output;
-	desc.componentSubType = kAudioUnitSubType_HALOutput;
-	desc.componentManufacturer = kAudioUnitManufacturer_Apple;
-	desc.componentFlags = 0;
-	desc.componentFlagsMask = 0;
-	
-	AudioComponent comp = AudioComponentFindNext(NULL, &desc);
-	if (comp == NULL) { printf ("AudioComponentFindNext\n"); return; }
-	
-	err = AudioComponentInstanceNew(comp, &gOutputUnit);
-	if (comp == NULL) { printf ("AudioComponentInstanceNew=%ld\n", (long int)err); return; }
-
-	// enable input
-	if (enable_input) {
-		UInt32 enableIO = 1;
-		err = AudioUnitSetProperty (gOutputUnit,
-									kAudioOutputUnitProperty_EnableIO,
-									kAudioUnitScope_Input,
-									1,
-									&enableIO,
-									sizeof(enableIO));
-		if (err) { printf ("AudioUnitSetProperty-EnableInput=%4.4s, %ld\n", (char*)&err, (long int)err); return; }
-	}
-
-	// set current input/output device
-	AudioObjectID inputDevice, outputDevice;
-	outputDevice = getDefaultDeviceID(false);
-	if (enable_input) {
-		inputDevice = getDefaultDeviceID(true);
-		inputDevice = outputDevice = getInputOutputDevice(inputDevice, outputDevice, channel);
-		err = AudioUnitSetProperty (gOutputUnit,
-									kAudioOutputUnitProperty_CurrentDevice,
-									kAudioUnitScope_Global,
-									1,
-									&inputDevice,
-									sizeof(inputDevice));
-		if (err) { printf ("AudioUnitSetProperty-CurrentDevice-1=%ld\n", (long int)err); return; }
-	}
-	err = AudioUnitSetProperty (gOutputUnit,
-								kAudioOutputUnitProperty_CurrentDevice,
-								kAudioUnitScope_Global,
-								0,
-								&outputDevice,
-								sizeof(outputDevice));
-	if (err) { printf ("AudioUnitSetProperty-CurrentDevice-0=%ld\n", (long int)err); return; }
-
-	// Set up a callback function to obtain inputs
-	if (enable_input) {
-		AURenderCallbackStruct input;
-		input.inputProc = audiocallback_input;
-		input.inputProcRefCon = NULL;
-		err = AudioUnitSetProperty (gOutputUnit, 
-									kAudioOutputUnitProperty_SetInputCallback, 
-									kAudioUnitScope_Global,
-									1, 
-									&input, 
-									sizeof(input));
-		if (err) { printf ("AudioUnitSetProperty-CallbackIn=%ld\n", (long int)err); return; }
-	}
-
-	// Set up a callback function to generate output to the output unit
-	AURenderCallbackStruct output;
-	output.inputProc = enable_input ? audiocallback_output : audiocallback_outputonly;
-	output.inputProcRefCon = NULL;
-	err = AudioUnitSetProperty (gOutputUnit, 
-								kAudioUnitProperty_SetRenderCallback, 
-								kAudioUnitScope_Input,
-								0, 
-								&output, 
-								sizeof(output));
-	if (err) { printf ("AudioUnitSetProperty-CallbackOut=%ld\n", (long int)err); return; }
-
-	// Set stream format
-	AudioStreamBasicDescription streamFormat;
-	streamFormat.mSampleRate = sample_rate;      //	the sample rate of the audio stream
-	streamFormat.mFormatID = theFormatID;        //	the specific encoding type of audio stream
-	streamFormat.mFormatFlags = theFormatFlags;  //	flags specific to each format
-	streamFormat.mBytesPerPacket = theBytesInAPacket;
-	streamFormat.mFramesPerPacket = theFramesPerPacket;
-	streamFormat.mBytesPerFrame = theBytesPerFrame;
-	streamFormat.mChannelsPerFrame = channel;
-	streamFormat.mBitsPerChannel = theBitsPerChannel;
-	
-	if (enable_input) {
-		setSamplingRateToDevice(inputDevice, sample_rate);
-		err = AudioUnitSetProperty (gOutputUnit,
-									kAudioUnitProperty_StreamFormat,
-									kAudioUnitScope_Output,
-									1,
-									&streamFormat,
-									sizeof(AudioStreamBasicDescription));
-		if (err) { printf ("AudioUnitSetProperty-FromInputFormat=%4.4s, %ld\n", (char*)&err, (long int)err); return; }
+std::string audiounit_backends() {
+	std::string names;
+	for (int i = 0; audiounit_backend_list[i]; i++) {
+		if (i > 0) names += " ";
+		names += audiounit_backend_list[i]->name;
 	}
-
-	err = AudioUnitSetProperty (gOutputUnit,
-								kAudioUnitProperty_StreamFormat,
-								kAudioUnitScope_Input,
-								0,
-								&streamFormat,
-								sizeof(AudioStreamBasicDescription));
-	if (err) { printf ("AudioUnitSetProperty-IntoOutputFormat=%4.4s, %ld\n", (char*)&err, (long int)err); return; }
-
-	// alloc bufferList
-	inputBuffer = NULL;
-	if (enable_input) {
-		UInt32 bufferSizeFrames;
-		UInt32 size = sizeof(bufferSizeFrames);
-		err = AudioUnitGetProperty (gOutputUnit, 
-									kAudioDevicePropertyBufferFrameSize, kAudioUnitScope_Global,
-									1,
-									&bufferSizeFrames,
-									&size);
-		if (err) { printf ("AudioUnitGetProperty-BufferFrameSize=%4.4s, %ld\n", (char*)&err, (long int)err); return; }
-		inputBuffer = allocAudioBufferList(channel, bufferSizeFrames);
-	}
-
-	// Initialize unit
-	err = AudioUnitInitialize(gOutputUnit);
-	if (err) { printf ("AudioUnitInitialize=%ld\n", (long int)err); return; }
-
-	// Start the rendering
-	// The DefaultOutputUnit will do any format conversions to the format of the default device
-	err = AudioOutputUnitStart (gOutputUnit);
-	if (err) { printf ("AudioOutputUnitStart=%ld\n", (long int)err); return; }	
-}
-
-void CloseDefaultAU () {
-	OSStatus err = noErr;
-
-	err = AudioOutputUnitStop (gOutputUnit);
-	if (err) { printf ("AudioOutputUnitStop=%ld\n", (long int)err); }
-
-	err = AudioUnitUninitialize (gOutputUnit);
-	if (err) { printf ("AudioUnitUninitialize=%ld\n", (long int)err); }
-
-	AudioComponentInstanceDispose (gOutputUnit);
-
-	if (inputBuffer) deallocAudioBufferList(inputBuffer);
-}
-
-// ---------------------------
-void audiounit_start( bool enable_input, int channel, int sample_rate, void (*callback)(AudioBuffer *outbuf, UInt32 frames, UInt32 channels) ) {
-	audiounit_callback = callback;
-	CreateDefaultAU( enable_input, channel, sample_rate );
-	printf("audiounit start.\n");
-}
-
-void audiounit_stop() {
-	CloseDefaultAU();
-	printf("audiounit stop.\n");
+	return names;
 }
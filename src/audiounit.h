@@ -1,10 +1,15 @@
 #ifndef OTOPERL_AUDIOUNIT_H
 #define OTOPERL_AUDIOUNIT_H
-// Otoperl::otoperld::audiounit - run AudioUnit for otoperld.
+// Otoperl::otoperld::audiounit - run the audio device for otoperld, through the selected backend.
 
-#include <AudioUnit/AudioUnit.h>
+#include <string>
 
-void audiounit_start( bool enable_input, int channel, int sample_rate, void (*callback)(AudioBuffer *outbuf, UInt32 frames, UInt32 channels) );
+#include "audiobackend.h"
+
+// backend is "name" or "name:device", NULL for the first available one.
+bool audiounit_start( const char *backend, bool enable_input, int channel, int sample_rate, int bits, audiobackend_callback callback );
 void audiounit_stop();
+// names of the backends built in, separated by spaces
+std::string audiounit_backends();
 
-#endif
\ No newline at end of file
+#endif
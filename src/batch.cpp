@@ -0,0 +1,236 @@
+// otojsd::batch - process sound files through the scripts on parallel workers.
+// Each worker takes the next input file, runs the start codes in a ScriptEngine of its own
+// (so no state leaks between files) and streams the file through the render function into the output.
+
+#include "logger.h"
+
+#include <pthread.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <atomic>
+#include <chrono>
+#include <format>
+#include <map>
+#include <thread>
+
+#include "batch.h"
+#include "script_engine.h"
+#include "soundreader.h"
+#include "soundrecorder.h"
+#include "audio_kernels.h"
+#include "const.h"
+
+// V8 needs more stack than the default of secondary threads on macOS (512 KiB).
+#define BATCH_WORKER_STACK_SIZE (8 * 1024 * 1024)
+
+typedef struct {
+	otojsd_options *options;
+	const std::vector<std::string> *start_codes;
+	const std::vector<std::string> *inputs;
+	std::atomic<size_t> next;
+	std::atomic<int> failed;
+	std::atomic<int> running;
+} batch;
+
+// ------------------------------------------------------ private functions
+void *batch__worker(void *arg);
+bool batch__process(batch *self, const std::string &input);
+std::string batch__output_path(const char *directory, const std::string &input);
+
+// ---------------------------------------------- implimentation
+
+int batch_run(otojsd_options *options, std::vector<std::string> start_codes, std::vector<std::string> inputs, const char *exec_path) {
+	int jobs = options->jobs > 0 ? options->jobs : (int)std::thread::hardware_concurrency();
+	if (jobs < 1) jobs = 1;
+	if ((size_t)jobs > inputs.size()) jobs = inputs.size();
+	logger::log(std::format("batch: {} files into {} on {} workers.", inputs.size(), options->batch_output, jobs));
+	logger::info(std::format("audio kernels: {}.", audio_kernels::initialize()));
+
+	// inputs of the same name in different directories would be written to the same output at once.
+	std::map<std::string, const std::string *> outputs;
+	int duplicates = 0;
+	for (const std::string &input : inputs) {
+		auto added = outputs.emplace(batch__output_path(options->batch_output, input), &input);
+		if (!added.second) {
+			logger::error(std::format("batch: {} and {} would both be written to {}.", *added.first->second, input, added.first->first));
+			duplicates++;
+		}
+	}
+	if (duplicates > 0) {
+		logger::error("batch: rename the inputs or process them into different directories, nothing processed.");
+		return duplicates;
+	}
+
+	ScriptEngine::initializePlatform(exec_path);
+
+	batch self;
+	self.options = options;
+	self.start_codes = &start_codes;
+	self.inputs = &inputs;
+	self.next = 0;
+	self.failed = 0;
+	self.running = 0;
+
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	pthread_attr_setstacksize(&attr, BATCH_WORKER_STACK_SIZE);
+	std::vector<pthread_t> workers;
+	auto started = std::chrono::steady_clock::now();
+	for (int i = 0; i < jobs; i++) {
+		pthread_t thread;
+		self.running++;
+		if (pthread_create(&thread, &attr, batch__worker, &self) != 0) {
+			self.running--;
+			logger::error("failed to start a batch worker.");
+			continue;
+		}
+		workers.push_back(thread);
+	}
+	pthread_attr_destroy(&attr);
+
+	// print what the workers logged while they run.
+	struct timespec interval = {0, 100000000};
+	while (self.running > 0) {
+		nanosleep(&interval, NULL);
+		logger::drain();
+	}
+	for (pthread_t thread : workers) {
+		pthread_join(thread, NULL);
+	}
+	logger::drain();
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+	logger::log(std::format("batch: {} files done, {} failed, in {:.2f} seconds.", inputs.size() - self.failed, self.failed.load(), elapsed));
+
+	ScriptEngine::disposePlatform();
+	return self.failed;
+}
+
+void *batch__worker(void *arg) {
+	batch *self = (batch *)arg;
+	size_t index;
+	while ((index = self->next++) < self->inputs->size()) {
+		if (!batch__process(self, (*self->inputs)[index])) {
+			self->failed++;
+		}
+	}
+	self->running--;
+	return NULL;
+}
+
+bool batch__process(batch *self, const std::string &input) {
+	SoundReader *reader = SoundReader_open(input.c_str());
+	if (!reader) {
+		logger::queue_format(logger::LEVEL_ERROR, "batch: cannot read {}.", input);
+		return false;
+	}
+	int channels = reader->channels;
+	int rate = reader->sampleRate;
+	std::string output = batch__output_path(self->options->batch_output, input);
+	char input_real[PATH_MAX], output_real[PATH_MAX];
+	if (realpath(input.c_str(), input_real) && realpath(output.c_str(), output_real) && strcmp(input_real, output_real) == 0) {
+		logger::queue_format(logger::LEVEL_ERROR, "batch: {} would be overwritten, choose another output directory.", input);
+		SoundReader_close(reader);
+		return false;
+	}
+	auto started = std::chrono::steady_clock::now();
+
+	ScriptEngine *engine = new ScriptEngine();
+	engine->setGlobalVariable("sample_rate", rate);
+	bool ok = true;
+	for (const std::string &code : *self->start_codes) {
+		const char *error_message = engine->executeFromFile(code.c_str());
+		if (error_message) {
+			logger::queue_format(logger::LEVEL_ERROR, "batch: {}: {}", input, error_message);
+			free((void *)error_message);
+			ok = false;
+		}
+	}
+
+	SoundRecorder *recorder = NULL;
+	// true once the output file is created, it is removed if the processing fails.
+	bool created = false;
+	if (ok) {
+		recorder = SoundRecorder_create(channels, self->options->bits, rate);
+		if (!recorder || !SoundRecorder_open(recorder, output.c_str())) {
+			logger::queue_format(logger::LEVEL_ERROR, "batch: cannot write {}.", output);
+			if (recorder) SoundRecorder_destroy(recorder);
+			recorder = NULL;
+			ok = false;
+		} else {
+			created = true;
+		}
+	}
+
+	unsigned int quantum = self->options->render_quantum;
+	float *interleaved = (float *)malloc((size_t)quantum * channels * sizeof(float));
+	float *planar_input[MAX_CHANNELS];
+	const float *planar_output[MAX_CHANNELS];
+	uint64_t done = 0;
+	int frames;
+	while (ok && (frames = SoundReader_read(reader, interleaved, quantum)) > 0) {
+		RenderBuffers io = engine->buffers(frames, channels);
+		int length = frames * channels;
+		if (io.planar) {
+			for (int channel = 0; channel < channels; channel++) {
+				planar_input[channel] = io.input + channel * frames;
+			}
+			audio_kernels::deinterleave(planar_input, interleaved, frames, channels);
+		} else {
+			memcpy(io.input, interleaved, length * sizeof(float));
+		}
+		RenderResult result = engine->executeRender(frames, channels);
+		if (result.error) {
+			logger::queue_format(logger::LEVEL_ERROR, "batch: {} at {:.2f} seconds: {}", input, (double)done / rate, result.error);
+			ok = false;
+			break;
+		}
+		if (result.count < length) {
+			memset(io.output + result.count, 0, (length - result.count) * sizeof(float));
+		}
+		const float *samples = io.output;
+		if (io.planar) {
+			for (int channel = 0; channel < channels; channel++) {
+				planar_output[channel] = io.output + channel * frames;
+			}
+			audio_kernels::interleave(interleaved, planar_output, frames, channels);
+			samples = interleaved;
+		}
+		if (!SoundRecorder_write(recorder, samples, frames)) {
+			logger::queue_format(logger::LEVEL_ERROR, "batch: failed to write {}.", output);
+			ok = false;
+		}
+		done += frames;
+	}
+
+	free(interleaved);
+	if (recorder) {
+		if (!SoundRecorder_close(recorder) && ok) {
+			logger::queue_format(logger::LEVEL_ERROR, "batch: failed to complete {}.", output);
+			ok = false;
+		}
+		SoundRecorder_destroy(recorder);
+	}
+	delete engine;
+	SoundReader_close(reader);
+	if (!ok && created) {
+		// no partial output left to be taken for a processed file.
+		unlink(output.c_str());
+	}
+	if (ok) {
+		double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - started).count();
+		logger::queue_format(logger::LEVEL_LOG, "batch: {} -> {}, {:.1f} seconds in {:.2f} seconds.", input, output, (double)done / rate, elapsed);
+	}
+	return ok;
+}
+
+// The output has the file name of the input, in the output directory.
+std::string batch__output_path(const char *directory, const std::string &input) {
+	size_t slash = input.find_last_of('/');
+	std::string name = slash == std::string::npos ? input : input.substr(slash + 1);
+	std::string path = directory;
+	if (!path.empty() && path.back() != '/') path += "/";
+	return path + name;
+}
@@ -0,0 +1,14 @@
+#ifndef OTOJSD_BATCH_H
+#define OTOJSD_BATCH_H
+// otojsd::batch - process sound files through the scripts on parallel workers.
+
+#include <string>
+#include <vector>
+
+#include "otojsd.h"
+
+// Process each input file with the start codes into options->batch_output, on options->jobs threads.
+// Returns the number of files which failed.
+int batch_run(otojsd_options *options, std::vector<std::string> start_codes, std::vector<std::string> inputs, const char *exec_path);
+
+#endif
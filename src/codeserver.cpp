@@ -3,9 +3,20 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
+#include <errno.h>
+#include <time.h>
 #include <arpa/inet.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
+#ifdef __linux__
+#include <sys/epoll.h>
+#include <sys/sendfile.h>
+#else
+#include <sys/event.h>
+#include <sys/uio.h>
+#endif
 #include <fcntl.h>
 #include <libgen.h>
 #include <format>
@@ -13,13 +24,101 @@
 #include "const.h"
 #include "codeserver.h"
 #include "logger.h"
+#include "httprequest.h"
+#include "websocket.h"
 
 #define BUFFERSIZE 8192
+// the receive buffer holds the largest request, with room for its chunk sizes and trailers
+#define CODESERVER_RECEIVE_MAX (HTTPREQUEST_BODY_MAX + 2 * HTTPREQUEST_HEADER_MAX)
+// keep-alive connections idle for this many seconds are closed
+#define CODESERVER_IDLE_SECONDS 60
+// events handled per wait
+#define CODESERVER_EVENTS_MAX 64
+// bytes of document root files kept in memory
+#define CODESERVER_FILE_CACHE_BYTES (32 * 1024 * 1024)
+// the path a WebSocket connects to
+#define CODESERVER_WEBSOCKET_PATH CONTROL_PATH_PREFIX "ws"
+// published messages are skipped for a WebSocket with this many bytes unsent
+#define CODESERVER_WEBSOCKET_BACKLOG (1024 * 1024)
+// published messages waiting for the event loop at most
+#define CODESERVER_MESSAGES_MAX 256
 
-const int METHOD_UNKNOWN = 0;
-const int METHOD_UNSUPPORTED = -1;
-const int METHOD_GET     = 1;
-const int METHOD_POST    = 2;
+#ifdef MSG_NOSIGNAL
+#define SEND_FLAGS MSG_NOSIGNAL
+#else
+#define SEND_FLAGS 0
+#endif
+
+const int CONNECTION_KEEP     = 0;
+const int CONNECTION_CLOSE    = 1;
+const int CONNECTION_DETACHED = 2;
+
+typedef struct {
+	char *data;
+	size_t size;
+	size_t capacity;
+} codeserver_buffer;
+
+struct codeserver_connection_s {
+	int fd;
+	// received bytes not handled yet, the beginning of the next requests
+	codeserver_buffer in;
+	// bytes to send from out_offset
+	codeserver_buffer out;
+	size_t out_offset;
+	// the body following out: a cached file sent from memory, or a file sent by the kernel
+	FileCacheEntry *body_entry;
+	size_t body_offset;
+	int file_fd;
+	off_t file_offset;
+	off_t file_end;
+	time_t last_active;
+	// the peer closed its side, no more bytes come
+	bool closed;
+	// of the request being answered
+	bool keep_alive;
+	// the request being answered is queued for codeserver_run()
+	bool busy;
+	// the connection closes once the responses are sent
+	bool finishing;
+	// write events are watched
+	bool writing;
+	// read events are not watched, while the receive buffer is full behind a request being answered
+	bool paused;
+	// upgraded to WebSocket: the frames of a fragmented message so far, a ping is not answered yet,
+	// published messages were skipped
+	bool websocket;
+	codeserver_buffer message;
+	bool fragmented;
+	bool pinged;
+	bool lagging;
+};
+
+// a request for the script engine, run by codeserver_run()
+struct codeserver_job_s {
+	codeserver_connection *conn;
+	int method;
+	char *path;
+	char *body;
+	bool keep_alive;
+	// the response is a message of a WebSocket
+	bool websocket;
+	codeserver_buffer response;
+	codeserver_job *next;
+};
+
+// a frame for every WebSocket, from codeserver_publish()
+struct codeserver_message_s {
+	char *data;
+	size_t size;
+	codeserver_message *next;
+};
+
+#ifdef __linux__
+typedef struct epoll_event codeserver_event;
+#else
+typedef struct kevent codeserver_event;
+#endif
 
 // -------------------------------------------------------- private function
 
@@ -27,48 +126,84 @@ void codeserver__error(codeserver *self, const char *err);
 bool codeserver__decode_ipaddr(char *str, unsigned char *addr, unsigned char *mask);
 bool codeserver__check_client_ip( codeserver *self, struct sockaddr_in *client);
 void codeserver__write_port_file( codeserver *self, const char *path, int port );
-void codeserver__respond(int conn_fd, int status, const char *body, const char *server_message);
-int codeserver__get_http_method(const char *request);
+void *codeserver__loop(void *arg);
+void codeserver__wake(codeserver *self);
+void codeserver__accept(codeserver *self);
+void codeserver__receive(codeserver *self, codeserver_connection *conn);
+void codeserver__overflow(codeserver *self, codeserver_connection *conn);
+void codeserver__process(codeserver *self, codeserver_connection *conn);
+void codeserver__flush(codeserver *self, codeserver_connection *conn);
+void codeserver__close_connection(codeserver *self, codeserver_connection *conn);
+void codeserver__free_connection(codeserver_connection *conn);
+void codeserver__sweep(codeserver *self);
+bool codeserver__handle(codeserver *self, codeserver_connection *conn, httprequest *request);
+void codeserver__upgrade(codeserver *self, codeserver_connection *conn, httprequest *request);
+void codeserver__process_websocket(codeserver *self, codeserver_connection *conn);
+void codeserver__websocket_message(codeserver *self, codeserver_connection *conn, const char *data, size_t length);
+void codeserver__close_websocket(codeserver_connection *conn, int status);
+void codeserver__deliver_messages(codeserver *self);
+void codeserver__queue_job(codeserver *self, codeserver_connection *conn, httprequest *request);
+void codeserver__run_job(codeserver *self, codeserver_job *job);
+void codeserver__complete_jobs(codeserver *self);
+void codeserver__free_job(codeserver_job *job);
+bool codeserver__poll_add(codeserver *self, int fd, void *token);
+void codeserver__poll_remove(codeserver *self, int fd);
+void codeserver__poll_watch(codeserver *self, codeserver_connection *conn);
+int codeserver__poll_wait(codeserver *self, codeserver_event *events, int count, int timeout_ms);
+void *codeserver__event_token(codeserver_event *event);
+bool codeserver__event_readable(codeserver_event *event);
+bool codeserver__event_writable(codeserver_event *event);
+const char *codeserver__status_text(int status);
+bool codeserver__buffer_reserve(codeserver_buffer *buffer, size_t bytes);
+bool codeserver__buffer_push(codeserver_buffer *buffer, const void *data, size_t bytes);
+void codeserver__format_response(codeserver_buffer *buffer, int status, const char *body, bool keep_alive);
+void codeserver__format_message(codeserver_buffer *buffer, int status, const char *body);
+void codeserver__push_frame(codeserver_buffer *buffer, int opcode, const char *payload, size_t length);
+size_t codeserver__utf8_length(const unsigned char *text, size_t length);
+void codeserver__respond(codeserver_connection *conn, int status, const char *body, const char *server_message);
+void codeserver__respond_job(codeserver_job *job, int status, const char *body, const char *server_message);
 bool codeserver__is_safe_path(const char *path);
-bool codeserver__serve_file(codeserver *self, int conn_fd, const char *path);
-char *codeserver__get_request_path(const char *request);
+bool codeserver__sending(codeserver_connection *conn);
+bool codeserver__send_body(codeserver_connection *conn);
+bool codeserver__serve_file(codeserver *self, codeserver_connection *conn, const char *path, const char *if_none_match);
+void codeserver__respond_entry(codeserver *self, codeserver_connection *conn, FileCacheEntry *entry, const char *if_none_match);
+void codeserver__run_command(codeserver *self, codeserver_job *job, const char *method, const char *path, const char *body);
 const char *codeserver__get_mime_type(const char *filename);
 
-// ------------------------------------------------- codeserver_text decraration
-struct codeserver_textnode_s {
-	char *text;
-	int size;
-	struct codeserver_textnode_s *next;
-};
-typedef struct codeserver_textnode_s codeserver_textnode;
-
-typedef struct {
-	codeserver_textnode *root;
-	codeserver_textnode *cur;
-	int size;
-} codeserver_text;
-
-codeserver_text *codeserver_text_new();
-void  codeserver_text_push(codeserver_text *self, char *buf, int size);
-char *codeserver_text_join(codeserver_text *self);
-void  codeserver_text_destroy(codeserver_text *self);
-
 // --------------------------------------------------- codeserver implimentation
 
-codeserver *codeserver_init(int port, bool findfreeport, const char *c_allow, bool verbose, const char *document_root, const char *(*callback)(const char *code)) {
-	codeserver *self = (codeserver *)malloc(sizeof(codeserver));
+codeserver *codeserver_init(int port, bool findfreeport, const char *c_allow, bool verbose, const char *document_root, codeserver_result (*callback)(const char *code), codeserver_result (*command)(const char *method, const char *path, const char *body), bool (*stream)(int conn_fd, const char *path, char **error)) {
+	codeserver *self = new codeserver;
 	self->callback = callback;
+	self->command = command;
+	self->stream = stream;
+	self->connection_count = 0;
+	self->jobs = NULL;
+	self->done = NULL;
+	self->websockets = 0;
+	self->messages = NULL;
+	self->message_count = 0;
+	self->running = false;
+	self->failed = false;
+	self->started = false;
+	self->listen_fd = -1;
+	self->poll_fd = -1;
+	self->wake_fds[0] = self->wake_fds[1] = -1;
+	pthread_mutex_init(&self->mutex, NULL);
+	pthread_cond_init(&self->cond, NULL);
 	self->port = port;
 	self->findfreeport = findfreeport;
 	self->verbose = verbose;
 
 	if (document_root) {
 		self->document_root = strdup(document_root);
+		self->files = FileCache_create(CODESERVER_FILE_CACHE_BYTES);
 	} else {
 		self->document_root = NULL;
+		self->files = NULL;
 	}
 	
-	char *allow = (char *)malloc(strlen(c_allow));
+	char *allow = (char *)malloc(strlen(c_allow) + 1);
 	if (!allow) {
 		codeserver__error(self, "malloc failed(codeserver_init).");
 		return NULL;
@@ -107,6 +242,9 @@ bool codeserver_start(codeserver *self) {
 	if ((self->listen_fd = socket(AF_INET, SOCK_STREAM, 0)) < 0) {
 		codeserver__error(self, "socket failed."); return false;
 	}
+	// the connections closed by the server stay in TIME_WAIT, which should not keep a restarted server off the port.
+	int reuse = 1;
+	setsockopt(self->listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 	
 	bzero((char *)&saddr, sizeof(saddr));
 	saddr.sin_family        = PF_INET;
@@ -128,190 +266,966 @@ bool codeserver_start(codeserver *self) {
 	if (listen(self->listen_fd, SOMAXCONN) < 0) {
 		codeserver__error(self, "listen failed."); return false;
 	}
+	fcntl(self->listen_fd, F_SETFL, fcntl(self->listen_fd, F_GETFL) | O_NONBLOCK);
+
+#ifdef __linux__
+	self->poll_fd = epoll_create1(EPOLL_CLOEXEC);
+#else
+	self->poll_fd = kqueue();
+#endif
+	if (self->poll_fd < 0 || pipe(self->wake_fds) < 0) {
+		codeserver__error(self, "creating the event loop failed."); return false;
+	}
+	fcntl(self->wake_fds[0], F_SETFL, fcntl(self->wake_fds[0], F_GETFL) | O_NONBLOCK);
+	fcntl(self->wake_fds[1], F_SETFL, fcntl(self->wake_fds[1], F_GETFL) | O_NONBLOCK);
+	if (!codeserver__poll_add(self, self->listen_fd, &self->listen_fd) || !codeserver__poll_add(self, self->wake_fds[0], &self->wake_fds)) {
+		codeserver__error(self, "watching the sockets failed."); return false;
+	}
+	self->running = true;
+	if (pthread_create(&self->thread, NULL, codeserver__loop, self) != 0) {
+		codeserver__error(self, "starting the codeserver thread failed.");
+		self->running = false;
+		return false;
+	}
+	self->started = true;
 	logger::log(std::format("codeserver start listening port {}.", self->port));
 	return true;
 }
 
 void codeserver_stop(codeserver *self) {
-	close(self->listen_fd);
+	if (self->started) {
+		self->running = false;
+		codeserver__wake(self);
+		pthread_join(self->thread, NULL);
+	}
+	while (self->connection_count > 0) {
+		codeserver_connection *conn = self->connections[--self->connection_count];
+		codeserver__close_connection(self, conn);
+		codeserver__free_connection(conn);
+	}
+	for (codeserver_job *jobs : {self->jobs, self->done}) {
+		while (jobs) {
+			codeserver_job *next = jobs->next;
+			codeserver__free_job(jobs);
+			jobs = next;
+		}
+	}
+	while (self->messages) {
+		codeserver_message *next = self->messages->next;
+		free(self->messages->data);
+		free(self->messages);
+		self->messages = next;
+	}
+	for (int fd : {self->listen_fd, self->poll_fd, self->wake_fds[0], self->wake_fds[1]}) {
+		if (fd >= 0) close(fd);
+	}
+	pthread_mutex_destroy(&self->mutex);
+	pthread_cond_destroy(&self->cond);
 	if (self->document_root) {
 		free((void *)self->document_root);
 	}
-	free(self);
+	if (self->files) {
+		// the connections, closed above, released the entries they were sending.
+		logger::log(std::format("file cache: {} hits, {} misses.", self->files->hits, self->files->misses));
+		FileCache_destroy(self->files);
+	}
+	delete self;
 	logger::log("codeserver stop.");
 }
 
-bool codeserver_run(codeserver *self) {
-	struct sockaddr_in caddr;
-	int conn_fd;
-	unsigned int sockaddr_in_size = sizeof(struct sockaddr_in);
-	char buf[BUFFERSIZE];
-	
-	struct timeval accept_timeout = {0, 0};
-	fd_set accept_fds;
-	FD_ZERO(&accept_fds);
-	FD_SET(self->listen_fd, &accept_fds);
-	int selected = select(self->listen_fd+1, &accept_fds, (fd_set *)NULL, (fd_set *)NULL, &accept_timeout);
-	if (selected < 0) {
-		codeserver__error(self, "select accept failed."); return false;
-	} else if (selected == 0) {
-		return true;
+// Wait up to timeout_ms for the requests the event loop queued for the script engine, and run them.
+// Returns false if the server failed.
+bool codeserver_run(codeserver *self, int timeout_ms) {
+	pthread_mutex_lock(&self->mutex);
+	if (!self->jobs && timeout_ms > 0) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += timeout_ms / 1000;
+		deadline.tv_nsec += (long)(timeout_ms % 1000) * 1000000;
+		if (deadline.tv_nsec >= 1000000000) {
+			deadline.tv_sec++;
+			deadline.tv_nsec -= 1000000000;
+		}
+		while (!self->jobs && self->running) {
+			if (pthread_cond_timedwait(&self->cond, &self->mutex, &deadline) != 0) break;
+		}
 	}
+	codeserver_job *jobs = self->jobs;
+	self->jobs = NULL;
+	pthread_mutex_unlock(&self->mutex);
 
-	if ((conn_fd = accept(self->listen_fd, (struct sockaddr *)&caddr, &sockaddr_in_size)) < 0) {
-		codeserver__error(self, "accept failed."); return false;
+	while (jobs) {
+		codeserver_job *job = jobs;
+		jobs = jobs->next;
+		codeserver__run_job(self, job);
+		pthread_mutex_lock(&self->mutex);
+		job->next = self->done;
+		self->done = job;
+		pthread_mutex_unlock(&self->mutex);
+		codeserver__wake(self);
 	}
+	return !self->failed;
+}
 
-	logger::log(std::format("request from {}", inet_ntoa(caddr.sin_addr)));
-	if ( ! codeserver__check_client_ip( self, &caddr ) ) {
-		codeserver__respond(conn_fd, 403, "accessed denied.", "client from forbidden address.");
-		if ( close(conn_fd) < 0) {
-			codeserver__error(self, "close failed."); return false;
+int codeserver_websockets(codeserver *self) {
+	return self->websockets.load(std::memory_order_relaxed);
+}
+
+void codeserver_publish(codeserver *self, const char *message, size_t length) {
+	if (codeserver_websockets(self) == 0) return;
+	unsigned char header[WEBSOCKET_HEADER_MAX];
+	size_t header_length = websocket_frame_header(WEBSOCKET_OPCODE_TEXT, length, header);
+	codeserver_message *item = (codeserver_message *)malloc(sizeof(codeserver_message));
+	item->data = (char *)malloc(header_length + length);
+	memcpy(item->data, header, header_length);
+	memcpy(item->data + header_length, message, length);
+	item->size = header_length + length;
+	item->next = NULL;
+	pthread_mutex_lock(&self->mutex);
+	if (self->message_count >= CODESERVER_MESSAGES_MAX) {
+		// the event loop is stuck, the messages are only telemetry.
+		pthread_mutex_unlock(&self->mutex);
+		free(item->data);
+		free(item);
+		return;
+	}
+	codeserver_message **tail = &self->messages;
+	while (*tail) tail = &(*tail)->next;
+	*tail = item;
+	self->message_count++;
+	pthread_mutex_unlock(&self->mutex);
+	codeserver__wake(self);
+}
+
+std::string codeserver_json_string(const char *text, size_t length) {
+	std::string json = "\"";
+	json.reserve(length + 2);
+	const unsigned char *bytes = (const unsigned char *)text;
+	for (size_t i = 0; i < length;) {
+		unsigned char c = bytes[i];
+		if (c >= 0x80) {
+			// text frames must be valid UTF-8, and a log message may be cut in the middle of a character.
+			size_t sequence = codeserver__utf8_length(bytes + i, length - i);
+			if (sequence == 0) {
+				json += "\xEF\xBF\xBD";
+				i++;
+			} else {
+				json.append(text + i, sequence);
+				i += sequence;
+			}
+			continue;
 		}
-		return true;
+		switch (c) {
+		case '"': json += "\\\""; break;
+		case '\\': json += "\\\\"; break;
+		case '\n': json += "\\n"; break;
+		case '\r': json += "\\r"; break;
+		case '\t': json += "\\t"; break;
+		default:
+			if (c < 0x20) {
+				char escape[8];
+				snprintf(escape, sizeof(escape), "\\u%04x", c);
+				json += escape;
+			} else {
+				json += (char)c;
+			}
+			break;
+		}
+		i++;
 	}
+	json += '"';
+	return json;
+}
+
+// -------------------------------------------- codeserver event loop implimentation
 
-	codeserver_text *cstext = codeserver_text_new();
-	struct timeval recv_timeout = {0, 100000};
-	fd_set recv_fds;
-	FD_ZERO(&recv_fds);
-	FD_SET(conn_fd, &recv_fds);
-	while (1) {
-		int selected = select(conn_fd+1, &recv_fds, (fd_set *)NULL, (fd_set *)NULL, &recv_timeout);
-		if (selected < 0) {
-			codeserver__error(self, "select recv failed."); return false;
-		} else if (selected == 0) {
+void *codeserver__loop(void *arg) {
+	codeserver *self = (codeserver *)arg;
+	codeserver_event events[CODESERVER_EVENTS_MAX];
+	while (self->running) {
+		int count = codeserver__poll_wait(self, events, CODESERVER_EVENTS_MAX, 1000);
+		if (count < 0) {
+			if (errno == EINTR) continue;
+			codeserver__error(self, "waiting for events failed.");
+			self->failed = true;
 			break;
 		}
+		for (int i = 0; i < count; i++) {
+			void *token = codeserver__event_token(&events[i]);
+			if (token == &self->listen_fd) {
+				codeserver__accept(self);
+			} else if (token == &self->wake_fds) {
+				char drain[64];
+				while (read(self->wake_fds[0], drain, sizeof(drain)) > 0) {}
+				codeserver__complete_jobs(self);
+				codeserver__deliver_messages(self);
+			} else {
+				codeserver_connection *conn = (codeserver_connection *)token;
+				if (conn->fd < 0) continue;
+				if (codeserver__event_readable(&events[i])) {
+					codeserver__receive(self, conn);
+				}
+				if (conn->fd >= 0 && codeserver__event_writable(&events[i])) {
+					codeserver__flush(self, conn);
+				}
+			}
+		}
+		codeserver__sweep(self);
+	}
+	return NULL;
+}
+
+void codeserver__wake(codeserver *self) {
+	if (write(self->wake_fds[1], "", 1) < 0 && errno != EAGAIN) {
+		codeserver__error(self, "waking the codeserver up failed.");
+	}
+}
 
-		int rsize = recv(conn_fd, buf, BUFFERSIZE, 0);
+void codeserver__accept(codeserver *self) {
+	while (true) {
+		struct sockaddr_in caddr;
+		socklen_t sockaddr_in_size = sizeof(struct sockaddr_in);
+		int conn_fd = accept(self->listen_fd, (struct sockaddr *)&caddr, &sockaddr_in_size);
+		if (conn_fd < 0) {
+			if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR && errno != ECONNABORTED) {
+				codeserver__error(self, "accept failed.");
+			}
+			return;
+		}
+		fcntl(conn_fd, F_SETFL, fcntl(conn_fd, F_GETFL) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+		int on = 1;
+		setsockopt(conn_fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+		logger::queue_format(logger::LEVEL_LOG, "request from {}", (const char *)inet_ntoa(caddr.sin_addr));
+
+		codeserver_connection *conn = (codeserver_connection *)calloc(1, sizeof(codeserver_connection));
+		conn->fd = conn_fd;
+		conn->file_fd = -1;
+		conn->last_active = time(NULL);
+		if ( ! codeserver__check_client_ip( self, &caddr ) ) {
+			codeserver__respond(conn, 403, "accessed denied.", "client from forbidden address.");
+		} else if (self->connection_count >= CODESERVER_CONNECTIONS_MAX) {
+			codeserver__respond(conn, 503, "too many connections.", "too many connections.");
+		} else if (codeserver__poll_add(self, conn_fd, conn)) {
+			self->connections[self->connection_count++] = conn;
+			continue;
+		}
+		// a short refusal fits in the socket buffer.
+		send(conn_fd, conn->out.data, conn->out.size, SEND_FLAGS);
+		close(conn_fd);
+		codeserver__free_connection(conn);
+	}
+}
+
+// Read what arrived on the connection and handle the complete requests in it.
+// The buffer is kept to CODESERVER_RECEIVE_MAX: when it fills, the complete requests are handled to make room,
+// and reading waits (see codeserver__flush()) while they are answered.
+void codeserver__receive(codeserver *self, codeserver_connection *conn) {
+	while (!conn->closed) {
+		if (conn->finishing) {
+			// no more requests are handled, what arrives is dropped.
+			conn->in.size = 0;
+		}
+		if (conn->in.size >= CODESERVER_RECEIVE_MAX) {
+			codeserver__process(self, conn);
+			if (conn->fd < 0) return;
+			if (conn->in.size < CODESERVER_RECEIVE_MAX) continue;
+			if (!conn->busy && !codeserver__sending(conn)) {
+				codeserver__overflow(self, conn);
+			}
+			return;
+		}
+		size_t room = CODESERVER_RECEIVE_MAX - conn->in.size;
+		if (!codeserver__buffer_reserve(&conn->in, room < BUFFERSIZE ? room : BUFFERSIZE)) {
+			codeserver__close_connection(self, conn);
+			return;
+		}
+		if (conn->in.capacity - conn->in.size < room) room = conn->in.capacity - conn->in.size;
+		ssize_t rsize = recv(conn->fd, conn->in.data + conn->in.size, room, 0);
 		if (rsize == 0) {
-			break;
-		} else if (rsize == -1) {
-			codeserver__error(self, "recv failed."); return false;
+			conn->closed = true;
+		} else if (rsize < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+			codeserver__close_connection(self, conn);
+			return;
 		} else {
-			codeserver_text_push(cstext, buf, rsize);
-			//if (rsize < BUFFERSIZE) break;
+			conn->in.size += rsize;
+			conn->last_active = time(NULL);
 		}
-	};
+	}
+	codeserver__process(self, conn);
+}
 
-	char *request = NULL;
-	int method;
-	char *path = NULL;
-	char *codestart = NULL;
-	if (cstext->size == 0) {
-		codeserver__respond(conn_fd, 400, "request is empty", "request is empty");
-		codeserver_text_destroy(cstext);
-		goto RETURN_AFTER_CLOSE;
-	}
-	request = codeserver_text_join(cstext);
-	logger::log(std::format("{} bytes request received.", cstext->size));
-	codeserver_text_destroy(cstext);
-
-	method = codeserver__get_http_method(request);
-	switch (method) {
+// The receive buffer is full with a request which is not complete: refuse it, it does not fit.
+void codeserver__overflow(codeserver *self, codeserver_connection *conn) {
+	if (conn->finishing) return;
+	conn->in.size = 0;
+	if (conn->websocket) {
+		logger::queue_format(logger::LEVEL_ERROR, "[server response] websocket frame is too large.");
+		codeserver__close_websocket(conn, WEBSOCKET_CLOSE_TOO_LARGE);
+	} else {
+		conn->keep_alive = false;
+		codeserver__respond(conn, 413, "request is too large.", "request is too large.");
+		conn->finishing = true;
+	}
+	codeserver__flush(self, conn);
+}
+
+// Handle the requests in the receive buffer, in order: a request waits while the one before is queued.
+void codeserver__process(codeserver *self, codeserver_connection *conn) {
+	if (conn->websocket) {
+		codeserver__process_websocket(self, conn);
+		return;
+	}
+	// a request waits while the file of the one before is sent, too.
+	while (!conn->busy && !conn->finishing && conn->fd >= 0 && conn->in.size > 0 && !conn->body_entry && conn->file_fd < 0) {
+		httprequest request;
+		long consumed = httprequest_parse(conn->in.data, conn->in.size, conn->closed, &request);
+		if (consumed == 0) {
+			if (conn->closed) {
+				conn->keep_alive = false;
+				codeserver__respond(conn, 400, "request is incomplete.", "request is incomplete.");
+				conn->finishing = true;
+			}
+			break;
+		} else if (consumed < 0) {
+			conn->keep_alive = false;
+			if (consumed == PARSE_TOO_LARGE) {
+				codeserver__respond(conn, 413, "request is too large.", "request is too large.");
+			} else {
+				codeserver__respond(conn, 400, "bad request format.", "failed to parse request.");
+			}
+			conn->finishing = true;
+			break;
+		}
+		if (request.method == METHOD_GET && self->stream && codeserver__sending(conn) &&
+			strncmp(request.path, CONTROL_PATH_PREFIX, strlen(CONTROL_PATH_PREFIX)) == 0) {
+			// a stream may take the socket over: it waits until the responses before it are sent.
+			httprequest_free(&request);
+			break;
+		}
+		logger::queue_format(logger::LEVEL_LOG, "{} bytes request received.", consumed);
+		conn->keep_alive = request.keep_alive;
+		memmove(conn->in.data, conn->in.data + consumed, conn->in.size - consumed);
+		conn->in.size -= consumed;
+		if (!codeserver__handle(self, conn, &request)) {
+			// the connection belongs to the stream now.
+			return;
+		}
+		if (conn->websocket) {
+			// the rest are frames.
+			codeserver__process_websocket(self, conn);
+			return;
+		}
+		if (!conn->busy && !conn->keep_alive) {
+			conn->finishing = true;
+		}
+	}
+	codeserver__flush(self, conn);
+}
+
+// Send what the socket takes now, watching it for writes while something is left.
+void codeserver__flush(codeserver *self, codeserver_connection *conn) {
+	bool had_pending = codeserver__sending(conn);
+	while (codeserver__sending(conn)) {
+		if (!codeserver__send_body(conn)) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN || errno == EWOULDBLOCK) break;
+			codeserver__close_connection(self, conn);
+			return;
+		}
+		if (conn->body_entry && conn->out_offset == conn->out.size && conn->body_offset == (size_t)conn->body_entry->size) {
+			FileCache_release(self->files, conn->body_entry);
+			conn->body_entry = NULL;
+		}
+		if (conn->file_fd >= 0 && conn->file_offset >= conn->file_end) {
+			close(conn->file_fd);
+			conn->file_fd = -1;
+		}
+	}
+	bool pending = codeserver__sending(conn);
+	if (conn->out_offset == conn->out.size) {
+		conn->out.size = 0;
+		conn->out_offset = 0;
+	}
+	bool paused = conn->in.size >= CODESERVER_RECEIVE_MAX;
+	if (pending != conn->writing || paused != conn->paused) {
+		conn->writing = pending;
+		conn->paused = paused;
+		codeserver__poll_watch(self, conn);
+	}
+	if (!pending && !conn->busy && (conn->finishing || (conn->closed && conn->in.size == 0))) {
+		codeserver__close_connection(self, conn);
+	} else if (!pending && had_pending && conn->in.size > 0) {
+		// go on with the requests which waited for the body, or for the responses before a stream.
+		codeserver__process(self, conn);
+	}
+}
+
+bool codeserver__sending(codeserver_connection *conn) {
+	return conn->out_offset < conn->out.size || conn->body_entry || conn->file_fd >= 0;
+}
+
+// Send a part of the response: out with the cached body in one call, then the file. Returns false on errors.
+bool codeserver__send_body(codeserver_connection *conn) {
+	if (conn->out_offset < conn->out.size || conn->body_entry) {
+		struct iovec iov[2];
+		int count = 0;
+		size_t out_left = conn->out.size - conn->out_offset;
+		if (out_left > 0) {
+			iov[count].iov_base = conn->out.data + conn->out_offset;
+			iov[count++].iov_len = out_left;
+		}
+		if (conn->body_entry && conn->body_offset < (size_t)conn->body_entry->size) {
+			iov[count].iov_base = conn->body_entry->data + conn->body_offset;
+			iov[count++].iov_len = conn->body_entry->size - conn->body_offset;
+		}
+		struct msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = iov;
+		message.msg_iovlen = count;
+		ssize_t written = count > 0 ? sendmsg(conn->fd, &message, SEND_FLAGS) : 0;
+		if (written < 0) return false;
+		size_t from_out = (size_t)written < out_left ? written : out_left;
+		conn->out_offset += from_out;
+		conn->body_offset += written - from_out;
+		return true;
+	}
+	// the file goes from the page cache to the socket without passing through here.
+#ifdef __linux__
+	ssize_t written = sendfile(conn->fd, conn->file_fd, &conn->file_offset, conn->file_end - conn->file_offset);
+	if (written == 0) {
+		// the file got shorter, the response cannot be completed.
+		errno = EPIPE;
+		return false;
+	}
+	return written > 0;
+#else
+	off_t length = conn->file_end - conn->file_offset;
+	int result = sendfile(conn->file_fd, conn->fd, conn->file_offset, &length, NULL, 0);
+	conn->file_offset += length;
+	if (result == 0 && length == 0) {
+		errno = EPIPE;
+		return false;
+	}
+	return result == 0 || length > 0;
+#endif
+}
+
+// Close the socket. The connection is freed by codeserver__sweep() once no job refers to it.
+void codeserver__close_connection(codeserver *self, codeserver_connection *conn) {
+	if (conn->body_entry) {
+		FileCache_release(self->files, conn->body_entry);
+		conn->body_entry = NULL;
+	}
+	if (conn->file_fd >= 0) {
+		close(conn->file_fd);
+		conn->file_fd = -1;
+	}
+	if (conn->fd < 0) return;
+	if (conn->websocket) {
+		self->websockets--;
+	}
+	codeserver__poll_remove(self, conn->fd);
+	if (close(conn->fd) < 0) {
+		codeserver__error(self, "close failed.");
+	}
+	conn->fd = -1;
+}
+
+void codeserver__free_connection(codeserver_connection *conn) {
+	free(conn->in.data);
+	free(conn->out.data);
+	free(conn->message.data);
+	free(conn);
+}
+
+// Free the closed connections, and close those idle too long.
+void codeserver__sweep(codeserver *self) {
+	time_t now = time(NULL);
+	for (int i = 0; i < self->connection_count; i++) {
+		codeserver_connection *conn = self->connections[i];
+		if (conn->fd >= 0 && conn->websocket) {
+			// a quiet WebSocket is pinged, and closed if not even the pong comes back.
+			if (now - conn->last_active >= 2 * CODESERVER_IDLE_SECONDS) {
+				codeserver__close_connection(self, conn);
+			} else if (now - conn->last_active >= CODESERVER_IDLE_SECONDS && !conn->pinged) {
+				codeserver__push_frame(&conn->out, WEBSOCKET_OPCODE_PING, NULL, 0);
+				conn->pinged = true;
+				codeserver__flush(self, conn);
+			}
+		} else if (conn->fd >= 0 && !conn->busy && conn->out.size == 0 && now - conn->last_active >= CODESERVER_IDLE_SECONDS) {
+			codeserver__close_connection(self, conn);
+		}
+		if (conn->fd < 0 && !conn->busy) {
+			codeserver__free_connection(conn);
+			self->connections[i--] = self->connections[--self->connection_count];
+		}
+	}
+}
+
+// Respond to a parsed request, or queue it for the script engine. Returns false if the stream took the connection.
+bool codeserver__handle(codeserver *self, codeserver_connection *conn, httprequest *request) {
+	const char *path = request->path;
+	bool control = strncmp(path, CONTROL_PATH_PREFIX, strlen(CONTROL_PATH_PREFIX)) == 0;
+	if (request->method == METHOD_GET && strcmp(path, CODESERVER_WEBSOCKET_PATH) == 0) {
+		codeserver__upgrade(self, conn, request);
+		httprequest_free(request);
+		return true;
+	}
+	if (control && request->method == METHOD_GET && self->stream) {
+		char *error = NULL;
+		if (self->stream(conn->fd, path + strlen(CONTROL_PATH_PREFIX), &error)) {
+			// the stream writes the socket from its own thread now.
+			logger::queue_format(logger::LEVEL_LOG, "GET {} streaming.", path);
+			codeserver__poll_remove(self, conn->fd);
+			conn->fd = -1;
+			httprequest_free(request);
+			return false;
+		}
+		if (error) {
+			codeserver__respond(conn, 400, error, "stream failed.");
+			free(error);
+			httprequest_free(request);
+			return true;
+		}
+	}
+	if (request->method == METHOD_POST || (control && request->method == METHOD_GET)) {
+		codeserver__queue_job(self, conn, request);
+		return true;
+	}
+	switch (request->method) {
 	case METHOD_GET:
 		if (!self->document_root) {
-			codeserver__respond(conn_fd, 404, "not found.", "document root is not configured.");
-			goto RETURN_AFTER_CLOSE;
-		}
-		path = codeserver__get_request_path(request);
-		if (!path) {
-			codeserver__respond(conn_fd, 400, "bad request format.", "failed to parse request path.");
-			goto RETURN_AFTER_CLOSE;
+			codeserver__respond(conn, 404, "not found.", "document root is not configured.");
+			break;
 		}
-		logger::log(std::format("GET {}", path));
+		logger::queue_format(logger::LEVEL_LOG, "GET {}", path);
 		if (!codeserver__is_safe_path(path)) {
-			codeserver__respond(conn_fd, 403, "forbidden.", "unsafe path requested.");
-			goto RETURN_AFTER_CLOSE;
+			codeserver__respond(conn, 403, "forbidden.", "unsafe path requested.");
+			break;
 		}
-		codeserver__serve_file(self, conn_fd, path);
-		break;
-	case METHOD_POST:
-		const char *ret;
-		bool ret_allocated;
-		codestart = strstr(request, "\r\n\r\n");
-		if (codestart != NULL) {
-			codestart += 4;
-			if ( self->verbose )
-				logger::log(std::format("[CODE START]\n{}\n[CODE END]", codestart));
-			ret = self->callback(codestart);
-			ret_allocated = true;
-		}else{
-			ret = "failed to find code.";
-			ret_allocated = false;
-		}
-
-		if (ret == NULL) {
-			codeserver__respond(conn_fd, 200, NULL, NULL);
-		}else{
-			codeserver__respond(conn_fd, 400, ret, "eval failed.");
-		}
-
-		if (ret_allocated) free((void *)ret);
+		codeserver__serve_file(self, conn, path, request->if_none_match);
 		break;
 	default:
-		codeserver__respond(conn_fd, 400, "unsupported method.", "unsupported method.");
+		codeserver__respond(conn, 400, "unsupported method.", "unsupported method.");
 		break;
 	}
-
-RETURN_AFTER_CLOSE:
-	if (path) free(path);
-	if (request) free(request);
-	if ( close(conn_fd) < 0) {
-		codeserver__error(self, "close failed.");
-		return false;
-	}
+	httprequest_free(request);
 	return true;
 }
 
-// -------------------------------------------- codeserver http helper implimentation
+// -------------------------------------------- codeserver websocket implimentation
 
-int codeserver__get_http_method(const char *request) {
-	if (strncmp(request, "GET ", 4) == 0) {
-		return METHOD_GET;
-	} else if (strncmp(request, "POST ", 5) == 0) {
-		return METHOD_POST;
-	} else {
-		return METHOD_UNKNOWN;
+// Switch the connection to WebSocket, its frames are handled by codeserver__process_websocket() from now on.
+void codeserver__upgrade(codeserver *self, codeserver_connection *conn, httprequest *request) {
+	if (!request->websocket_key) {
+		codeserver__respond(conn, 400, "WebSocket upgrade expected.", "not a WebSocket handshake.");
+		return;
 	}
+	char accept[WEBSOCKET_ACCEPT_SIZE];
+	websocket_accept_key(request->websocket_key, accept);
+	char header[256];
+	int header_length = snprintf(header, sizeof(header),
+		"HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Accept: %s\r\n\r\n", accept);
+	codeserver__buffer_push(&conn->out, header, header_length);
+	conn->websocket = true;
+	conn->keep_alive = true;
+	int count = ++self->websockets;
+	logger::queue_format(logger::LEVEL_INFO, "websocket client joined, {} connected.", count);
 }
 
-void codeserver__respond(int conn_fd, int status, const char *body, const char *server_message) {
-	if (server_message) {
-		logger::error(std::format("[server response] {} {}", status, server_message));
-	}
-	char buf[256];
-	switch (status) {
-		case 200:
-			write(conn_fd, "HTTP/1.1 200 OK\r\n", 17);
+// Handle the frames in the receive buffer, in order like the requests: a message waits while the one before is queued.
+void codeserver__process_websocket(codeserver *self, codeserver_connection *conn) {
+	while (!conn->busy && !conn->finishing && conn->fd >= 0 && conn->in.size > 0) {
+		websocket_frame frame;
+		long consumed = websocket_parse_frame(conn->in.data, conn->in.size, HTTPREQUEST_BODY_MAX, &frame);
+		if (consumed == 0) break;
+		if (consumed < 0) {
+			logger::queue_format(logger::LEVEL_ERROR, "[server response] websocket {}.", consumed == WEBSOCKET_PARSE_TOO_LARGE ? "frame is too large" : "protocol error");
+			codeserver__close_websocket(conn, consumed == WEBSOCKET_PARSE_TOO_LARGE ? WEBSOCKET_CLOSE_TOO_LARGE : WEBSOCKET_CLOSE_PROTOCOL_ERROR);
 			break;
-		case 400:
-			write(conn_fd, "HTTP/1.1 400 Bad Request\r\n", 26);
+		}
+		const char *payload = conn->in.data + frame.header_length;
+		conn->pinged = false;
+		switch (frame.opcode) {
+		case WEBSOCKET_OPCODE_TEXT:
+		case WEBSOCKET_OPCODE_BINARY:
+		case WEBSOCKET_OPCODE_CONTINUATION:
+			// a continuation follows a frame without fin, and only such.
+			if ((frame.opcode == WEBSOCKET_OPCODE_CONTINUATION) != conn->fragmented) {
+				codeserver__close_websocket(conn, WEBSOCKET_CLOSE_PROTOCOL_ERROR);
+				break;
+			}
+			if (conn->message.size + frame.payload_length > HTTPREQUEST_BODY_MAX) {
+				codeserver__close_websocket(conn, WEBSOCKET_CLOSE_TOO_LARGE);
+				break;
+			}
+			codeserver__buffer_push(&conn->message, payload, frame.payload_length);
+			conn->fragmented = !frame.fin;
+			if (frame.fin) {
+				codeserver__websocket_message(self, conn, conn->message.data ? conn->message.data : "", conn->message.size);
+				conn->message.size = 0;
+			}
 			break;
-		case 403:
-			write(conn_fd, "HTTP/1.1 403 Forbidden\r\n", 24);
+		case WEBSOCKET_OPCODE_PING:
+			codeserver__push_frame(&conn->out, WEBSOCKET_OPCODE_PONG, payload, frame.payload_length);
 			break;
-		case 404:
-			write(conn_fd, "HTTP/1.1 404 Not Found\r\n", 24);
+		case WEBSOCKET_OPCODE_PONG:
 			break;
-		case 500:
-			write(conn_fd, "HTTP/1.1 500 Internal Server Error\r\n", 36);
+		case WEBSOCKET_OPCODE_CLOSE:
+			// echo the status code, and close after the responses sent so far.
+			codeserver__push_frame(&conn->out, WEBSOCKET_OPCODE_CLOSE, payload, frame.payload_length < 2 ? 0 : 2);
+			conn->finishing = true;
 			break;
 		default:
-			snprintf(buf, sizeof(buf), "HTTP/1.1 %d Unknown Error\r\n", status);
-			write(conn_fd, buf, strlen(buf));
+			codeserver__close_websocket(conn, WEBSOCKET_CLOSE_PROTOCOL_ERROR);
 			break;
+		}
+		memmove(conn->in.data, conn->in.data + consumed, conn->in.size - consumed);
+		conn->in.size -= consumed;
 	}
-	write(conn_fd, "Content-Type: text/plain;\r\n", 27);
+	codeserver__flush(self, conn);
+}
+
+// A message is a request in short: "POST /" or "GET /otojsd/..." and the body after the first newline.
+// The response comes back as a message, in the order of the requests.
+void codeserver__websocket_message(codeserver *self, codeserver_connection *conn, const char *data, size_t length) {
+	const char *line_end = (const char *)memchr(data, '\n', length);
+	std::string line(data, line_end ? line_end - data : length);
+	if (!line.empty() && line.back() == '\r') line.pop_back();
+	size_t space = line.find(' ');
+	std::string path = space == std::string::npos ? "" : line.substr(space + 1);
+	int method = httprequest_method(line.c_str());
+	bool control = strncmp(path.c_str(), CONTROL_PATH_PREFIX, strlen(CONTROL_PATH_PREFIX)) == 0;
+	if (!(method == METHOD_POST && path == "/") && !(method != METHOD_UNKNOWN && control)) {
+		logger::queue_format(logger::LEVEL_ERROR, "[server response] 400 unsupported websocket request.");
+		codeserver__format_message(&conn->out, 400, "unsupported request, send \"POST /\" or \"GET /otojsd/...\" and the body after a newline.");
+		return;
+	}
+	logger::queue_format(logger::LEVEL_LOG, "websocket {}", line.c_str());
+	httprequest request;
+	memset(&request, 0, sizeof(request));
+	request.method = method;
+	request.path = strdup(path.c_str());
+	request.body = line_end ? strndup(line_end + 1, data + length - (line_end + 1)) : strdup("");
+	request.keep_alive = true;
+	codeserver__queue_job(self, conn, &request);
+}
+
+// Close with the status code once the frames before are sent.
+void codeserver__close_websocket(codeserver_connection *conn, int status) {
+	char payload[2] = { (char)(status >> 8), (char)(status & 0xFF) };
+	codeserver__push_frame(&conn->out, WEBSOCKET_OPCODE_CLOSE, payload, sizeof(payload));
+	conn->finishing = true;
+}
+
+// Append the messages codeserver_publish() queued to the WebSockets, except for those with too much unsent.
+void codeserver__deliver_messages(codeserver *self) {
+	pthread_mutex_lock(&self->mutex);
+	codeserver_message *messages = self->messages;
+	self->messages = NULL;
+	self->message_count = 0;
+	pthread_mutex_unlock(&self->mutex);
+	if (!messages) return;
+	for (int i = 0; i < self->connection_count; i++) {
+		codeserver_connection *conn = self->connections[i];
+		if (conn->fd < 0 || !conn->websocket || conn->finishing) continue;
+		for (codeserver_message *message = messages; message; message = message->next) {
+			if (conn->out.size - conn->out_offset + message->size > CODESERVER_WEBSOCKET_BACKLOG) {
+				if (!conn->lagging) {
+					logger::queue_format(logger::LEVEL_WARN, "websocket client falls behind, skipping messages.");
+					conn->lagging = true;
+				}
+				continue;
+			}
+			conn->lagging = false;
+			codeserver__buffer_push(&conn->out, message->data, message->size);
+		}
+		codeserver__flush(self, conn);
+	}
+	while (messages) {
+		codeserver_message *next = messages->next;
+		free(messages->data);
+		free(messages);
+		messages = next;
+	}
+}
+
+// -------------------------------------------- codeserver job implimentation
+
+// Hand the request over to codeserver_run(), the connection waits for the response.
+void codeserver__queue_job(codeserver *self, codeserver_connection *conn, httprequest *request) {
+	codeserver_job *job = (codeserver_job *)calloc(1, sizeof(codeserver_job));
+	job->conn = conn;
+	job->method = request->method;
+	job->path = request->path;
+	job->body = request->body;
+	job->keep_alive = request->keep_alive;
+	job->websocket = conn->websocket;
+	request->path = NULL;
+	request->body = NULL;
+	httprequest_free(request);
+	conn->busy = true;
+	pthread_mutex_lock(&self->mutex);
+	codeserver_job **tail = &self->jobs;
+	while (*tail) tail = &(*tail)->next;
+	*tail = job;
+	pthread_cond_signal(&self->cond);
+	pthread_mutex_unlock(&self->mutex);
+}
+
+// Run the job on the thread calling codeserver_run().
+void codeserver__run_job(codeserver *self, codeserver_job *job) {
+	const char *path = job->path;
+	if (strncmp(path, CONTROL_PATH_PREFIX, strlen(CONTROL_PATH_PREFIX)) == 0) {
+		codeserver__run_command(self, job, job->method == METHOD_GET ? "GET" : "POST",
+			path + strlen(CONTROL_PATH_PREFIX), job->body);
+		return;
+	}
+	if ( self->verbose )
+		logger::log(std::format("[CODE START]\n{}\n[CODE END]", (const char *)job->body));
+	codeserver_result ret = self->callback(job->body);
+	if (ret.error == NULL) {
+		codeserver__respond_job(job, 200, ret.report, NULL);
+	}else{
+		std::string body = ret.report ? std::format("{}\n{}", ret.error, ret.report) : std::string(ret.error);
+		codeserver__respond_job(job, 400, body.c_str(), "eval failed.");
+	}
+	if (ret.error) free(ret.error);
+	if (ret.report) free(ret.report);
+}
+
+// Send the responses codeserver_run() made, and go on with the requests waiting behind them.
+void codeserver__complete_jobs(codeserver *self) {
+	pthread_mutex_lock(&self->mutex);
+	codeserver_job *jobs = self->done;
+	self->done = NULL;
+	pthread_mutex_unlock(&self->mutex);
+	while (jobs) {
+		codeserver_job *job = jobs;
+		jobs = jobs->next;
+		codeserver_connection *conn = job->conn;
+		conn->busy = false;
+		if (conn->fd >= 0) {
+			codeserver__buffer_push(&conn->out, job->response.data, job->response.size);
+			if (!job->keep_alive) {
+				conn->finishing = true;
+			}
+			codeserver__process(self, conn);
+		}
+		codeserver__free_job(job);
+	}
+}
+
+void codeserver__free_job(codeserver_job *job) {
+	free(job->path);
+	free(job->body);
+	free(job->response.data);
+	free(job);
+}
+
+// -------------------------------------------- codeserver poller implimentation
+
+bool codeserver__poll_add(codeserver *self, int fd, void *token) {
+#ifdef __linux__
+	struct epoll_event event;
+	event.events = EPOLLIN;
+	event.data.ptr = token;
+	return epoll_ctl(self->poll_fd, EPOLL_CTL_ADD, fd, &event) == 0;
+#else
+	struct kevent change;
+	EV_SET(&change, fd, EVFILT_READ, EV_ADD, 0, 0, token);
+	return kevent(self->poll_fd, &change, 1, NULL, 0, NULL) == 0;
+#endif
+}
+
+void codeserver__poll_remove(codeserver *self, int fd) {
+#ifdef __linux__
+	epoll_ctl(self->poll_fd, EPOLL_CTL_DEL, fd, NULL);
+#else
+	// each on its own, the write filter may not be there.
+	struct kevent change;
+	EV_SET(&change, fd, EVFILT_READ, EV_DELETE, 0, 0, NULL);
+	kevent(self->poll_fd, &change, 1, NULL, 0, NULL);
+	EV_SET(&change, fd, EVFILT_WRITE, EV_DELETE, 0, 0, NULL);
+	kevent(self->poll_fd, &change, 1, NULL, 0, NULL);
+#endif
+}
+
+// Watch the connection for reads unless paused, and for writes while writing.
+void codeserver__poll_watch(codeserver *self, codeserver_connection *conn) {
+#ifdef __linux__
+	struct epoll_event event;
+	event.events = (conn->paused ? (uint32_t)0 : (uint32_t)EPOLLIN) | (conn->writing ? (uint32_t)EPOLLOUT : (uint32_t)0);
+	event.data.ptr = conn;
+	epoll_ctl(self->poll_fd, EPOLL_CTL_MOD, conn->fd, &event);
+#else
+	// each on its own, the write filter may not be there.
+	struct kevent change;
+	EV_SET(&change, conn->fd, EVFILT_READ, conn->paused ? EV_DISABLE : EV_ENABLE, 0, 0, conn);
+	kevent(self->poll_fd, &change, 1, NULL, 0, NULL);
+	EV_SET(&change, conn->fd, EVFILT_WRITE, conn->writing ? EV_ADD | EV_ENABLE : EV_DISABLE, 0, 0, conn);
+	kevent(self->poll_fd, &change, 1, NULL, 0, NULL);
+#endif
+}
+
+int codeserver__poll_wait(codeserver *self, codeserver_event *events, int count, int timeout_ms) {
+#ifdef __linux__
+	return epoll_wait(self->poll_fd, events, count, timeout_ms);
+#else
+	struct timespec timeout = {timeout_ms / 1000, (long)(timeout_ms % 1000) * 1000000};
+	return kevent(self->poll_fd, NULL, 0, events, count, &timeout);
+#endif
+}
+
+void *codeserver__event_token(codeserver_event *event) {
+#ifdef __linux__
+	return event->data.ptr;
+#else
+	return event->udata;
+#endif
+}
+
+bool codeserver__event_readable(codeserver_event *event) {
+#ifdef __linux__
+	return event->events & (EPOLLIN | EPOLLHUP | EPOLLERR);
+#else
+	return event->filter == EVFILT_READ;
+#endif
+}
+
+bool codeserver__event_writable(codeserver_event *event) {
+#ifdef __linux__
+	return event->events & EPOLLOUT;
+#else
+	return event->filter == EVFILT_WRITE;
+#endif
+}
+
+// -------------------------------------------- codeserver http helper implimentation
+
+void codeserver__run_command(codeserver *self, codeserver_job *job, const char *method, const char *path, const char *body) {
+	logger::log(std::format("{} {}{}", method, CONTROL_PATH_PREFIX, path));
+	codeserver_result ret = self->command(method, path, body);
+	if (ret.error == NULL) {
+		codeserver__respond_job(job, 200, ret.report, NULL);
+	}else{
+		codeserver__respond_job(job, 400, ret.error, "command failed.");
+	}
+	if (ret.error) free(ret.error);
+	if (ret.report) free(ret.report);
+}
+
+const char *codeserver__status_text(int status) {
+	switch (status) {
+		case 200: return "OK";
+		case 304: return "Not Modified";
+		case 400: return "Bad Request";
+		case 403: return "Forbidden";
+		case 404: return "Not Found";
+		case 413: return "Payload Too Large";
+		case 500: return "Internal Server Error";
+		case 503: return "Service Unavailable";
+		default:  return "Unknown Error";
+	}
+}
+
+// Make room for more bytes at the end.
+bool codeserver__buffer_reserve(codeserver_buffer *buffer, size_t bytes) {
+	if (buffer->capacity - buffer->size >= bytes) return true;
+	size_t capacity = buffer->capacity ? buffer->capacity : BUFFERSIZE;
+	while (capacity - buffer->size < bytes) capacity *= 2;
+	char *data = (char *)realloc(buffer->data, capacity);
+	if (!data) return false;
+	buffer->data = data;
+	buffer->capacity = capacity;
+	return true;
+}
+
+bool codeserver__buffer_push(codeserver_buffer *buffer, const void *data, size_t bytes) {
+	if (!codeserver__buffer_reserve(buffer, bytes)) return false;
+	memcpy(buffer->data + buffer->size, data, bytes);
+	buffer->size += bytes;
+	return true;
+}
+
+// Append a text response, the header and the body together so that they leave in one send.
+void codeserver__format_response(codeserver_buffer *buffer, int status, const char *body, bool keep_alive) {
 	size_t body_length = body ? strlen(body) : 0;
-	snprintf(buf, sizeof(buf), "Content-Length: %zu\r\n\r\n", body_length);
-	write(conn_fd, buf, strlen(buf));
-	if (body_length > 0) {
-		write(conn_fd, body, body_length);
+	char header[256];
+	int header_length = snprintf(header, sizeof(header),
+		"HTTP/1.1 %d %s\r\nContent-Type: text/plain;\r\nContent-Length: %zu\r\nConnection: %s\r\n\r\n",
+		status, codeserver__status_text(status), body_length, keep_alive ? "keep-alive" : "close");
+	if (codeserver__buffer_reserve(buffer, header_length + body_length)) {
+		codeserver__buffer_push(buffer, header, header_length);
+		codeserver__buffer_push(buffer, body, body_length);
+	}
+}
+
+// Respond on the event loop thread.
+void codeserver__respond(codeserver_connection *conn, int status, const char *body, const char *server_message) {
+	if (server_message) {
+		logger::queue_format(logger::LEVEL_ERROR, "[server response] {} {}", status, server_message);
+	}
+	codeserver__format_response(&conn->out, status, body, conn->keep_alive);
+}
+
+// Respond to a job on the thread calling codeserver_run().
+void codeserver__respond_job(codeserver_job *job, int status, const char *body, const char *server_message) {
+	if (server_message) {
+		logger::error(std::format("[server response] {} {}", status, server_message));
+	}
+	if (job->websocket) {
+		codeserver__format_message(&job->response, status, body);
+	} else {
+		codeserver__format_response(&job->response, status, body, job->keep_alive);
+	}
+}
+
+// Append a response to a WebSocket: {"type":"response","status":200,"body":"..."} in a text frame.
+void codeserver__format_message(codeserver_buffer *buffer, int status, const char *body) {
+	std::string json = "{\"type\":\"response\",\"status\":" + std::to_string(status) +
+		",\"body\":" + codeserver_json_string(body ? body : "", body ? strlen(body) : 0) + "}";
+	codeserver__push_frame(buffer, WEBSOCKET_OPCODE_TEXT, json.data(), json.size());
+}
+
+void codeserver__push_frame(codeserver_buffer *buffer, int opcode, const char *payload, size_t length) {
+	unsigned char header[WEBSOCKET_HEADER_MAX];
+	size_t header_length = websocket_frame_header(opcode, length, header);
+	if (codeserver__buffer_reserve(buffer, header_length + length)) {
+		codeserver__buffer_push(buffer, header, header_length);
+		if (length > 0) codeserver__buffer_push(buffer, payload, length);
 	}
 }
 
+// The length of the UTF-8 sequence at text, or 0 if it is invalid or cut.
+size_t codeserver__utf8_length(const unsigned char *text, size_t length) {
+	size_t sequence;
+	unsigned char low = 0x80, high = 0xBF;
+	if (text[0] >= 0xC2 && text[0] <= 0xDF) {
+		sequence = 2;
+	} else if (text[0] >= 0xE0 && text[0] <= 0xEF) {
+		sequence = 3;
+		// no overlong forms, no surrogates
+		if (text[0] == 0xE0) low = 0xA0;
+		if (text[0] == 0xED) high = 0x9F;
+	} else if (text[0] >= 0xF0 && text[0] <= 0xF4) {
+		sequence = 4;
+		if (text[0] == 0xF0) low = 0x90;
+		if (text[0] == 0xF4) high = 0x8F;
+	} else {
+		return 0;
+	}
+	if (length < sequence || text[1] < low || text[1] > high) return 0;
+	for (size_t i = 2; i < sequence; i++) {
+		if (text[i] < 0x80 || text[i] > 0xBF) return 0;
+	}
+	return sequence;
+}
+
 void codeserver__error(codeserver *self, const char *err) {
 	(void)self;
 	perror(err);
@@ -350,70 +1264,8 @@ void codeserver__write_port_file( codeserver *self, const char *path, int port )
 	fclose(portfile);
 }
 
-// -------------------------------------------- codeserver_text implimentation
-codeserver_text *codeserver_text_new() {
-	codeserver_text *self = (codeserver_text *)malloc(sizeof(codeserver_text));
-	self->root = NULL;
-	self->cur = NULL;
-	self->size = 0;
-	return self;
-}
-void codeserver_text_push(codeserver_text *self, char *buf, int size) {
-	codeserver_textnode *newnode = (codeserver_textnode *)malloc(sizeof(codeserver_textnode));
-	newnode->text = (char *)malloc(size);
-	memcpy(newnode->text, buf, size);
-	newnode->size = size;
-	newnode->next = NULL;
-
-	if ( self->root == NULL ) {
-		self->root = newnode;
-		self->cur  = newnode;
-	}else{
-		self->cur->next = newnode;
-		self->cur       = newnode;
-	}
-	self->size += size;
-}
-char *codeserver_text_join(codeserver_text *self) {
-	codeserver_textnode *cur = self->root;
-	char *text = (char *)malloc(self->size + 1);
-	char *textcur = text;
-	while( cur != NULL ) {
-		memcpy(textcur, cur->text, cur->size);
-		textcur += cur->size;
-		cur = cur->next;
-	}
-	*textcur = 0;
-	return text;
-}
-void codeserver_text_destroy(codeserver_text *self) {
-	codeserver_textnode *cur = self->root;
-	while( cur != NULL ) {
-		codeserver_textnode *next = cur->next;
-		free(cur->text);
-		free(cur);
-		cur = next;
-	}
-	free(self);
-}
-
 // -------------------------------------------- codeserver get method implimentation
 
-char *codeserver__get_request_path(const char *request) {
-	const char *start = strchr(request, ' ');
-	if (!start) return NULL;
-	start++;
-
-	const char *end = strchr(start, ' ');
-	if (!end) return NULL;
-
-	int length = end - start;
-	char *path = (char *)malloc(length + 1);
-	strncpy(path, start, length);
-	path[length] = '\0';
-	return path;
-}
-
 bool codeserver__is_safe_path(const char *path) {
 	if (strstr(path, "..") != NULL) {
 		return false;
@@ -449,7 +1301,14 @@ const char *codeserver__get_mime_type(const char *filename) {
 	return "application/octet-stream";
 }
 
-bool codeserver__serve_file(codeserver *self, int conn_fd, const char *path) {
+// Files up to FILECACHE_FILE_MAX are kept in memory and sent from there, larger ones are sent by sendfile.
+bool codeserver__serve_file(codeserver *self, codeserver_connection *conn, const char *path, const char *if_none_match) {
+	FileCacheEntry *entry = FileCache_get(self->files, path);
+	if (entry) {
+		codeserver__respond_entry(self, conn, entry, if_none_match);
+		return true;
+	}
+
 	char full_path[1024];
 
 	if (strcmp(path, "/") == 0) {
@@ -466,15 +1325,15 @@ bool codeserver__serve_file(codeserver *self, int conn_fd, const char *path) {
 			if (stat(dir_path, &file_stat) == 0 && S_ISDIR(file_stat.st_mode)) {
 				snprintf(full_path, sizeof(full_path), "%s/index.html", dir_path);
 				if (stat(full_path, &file_stat) < 0) {
-					codeserver__respond(conn_fd, 404, "not found.", "index.html not found in directory.");
+					codeserver__respond(conn, 404, "not found.", "index.html not found in directory.");
 					return false;
 				}
 			} else {
-				codeserver__respond(conn_fd, 404, "not found.", full_path);
+				codeserver__respond(conn, 404, "not found.", full_path);
 				return false;
 			}
 		} else {
-			codeserver__respond(conn_fd, 404, "not found.", std::format("index.html not found: {}", full_path).c_str());
+			codeserver__respond(conn, 404, "not found.", std::format("index.html not found: {}", full_path).c_str());
 			return false;
 		}
 	}
@@ -482,30 +1341,68 @@ bool codeserver__serve_file(codeserver *self, int conn_fd, const char *path) {
 	if (S_ISDIR(file_stat.st_mode)) {
 		snprintf(full_path + strlen(full_path), sizeof(full_path) - strlen(full_path), "/index.html");
 		if (stat(full_path, &file_stat) < 0) {
-			codeserver__respond(conn_fd, 404, "not found.", std::format("index.html not found in directory: {}", full_path).c_str());
+			codeserver__respond(conn, 404, "not found.", std::format("index.html not found in directory: {}", full_path).c_str());
 			return false;
 		}
 	}
 
 	int file_fd = open(full_path, O_RDONLY);
 	if (file_fd < 0) {
-		codeserver__respond(conn_fd, 500, "internal server error.", std::format("failed to open file: {}", full_path).c_str());
+		codeserver__respond(conn, 500, "internal server error.", std::format("failed to open file: {}", full_path).c_str());
 		return false;
 	}
 
+	// stat again on the opened file, it may have been replaced since.
+	fstat(file_fd, &file_stat);
 	const char *mime_type = codeserver__get_mime_type(full_path);
-	char header[256];
-	snprintf(header, sizeof(header), "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %lld\r\n\r\n",
-	         mime_type, (long long)file_stat.st_size);
-	write(conn_fd, header, strlen(header));
+	entry = FileCache_put(self->files, path, full_path, file_fd, &file_stat, mime_type);
+	if (entry) {
+		close(file_fd);
+		logger::queue_format(logger::LEVEL_LOG, "cached file: {} ({} bytes)", (const char *)full_path, (long long)file_stat.st_size);
+		codeserver__respond_entry(self, conn, entry, if_none_match);
+		return true;
+	}
 
-	char buffer[8192];
-	ssize_t bytes_read;
-	while ((bytes_read = read(file_fd, buffer, sizeof(buffer))) > 0) {
-		write(conn_fd, buffer, bytes_read);
+	char etag[48];
+	FileCache_etag(&file_stat, etag, sizeof(etag));
+	char header[512];
+	int header_length;
+	if (if_none_match && strstr(if_none_match, etag)) {
+		header_length = snprintf(header, sizeof(header), "HTTP/1.1 304 Not Modified\r\nETag: %s\r\nConnection: %s\r\n\r\n",
+		         etag, conn->keep_alive ? "keep-alive" : "close");
+		codeserver__buffer_push(&conn->out, header, header_length);
+		close(file_fd);
+		return true;
 	}
+	header_length = snprintf(header, sizeof(header),
+	         "HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %lld\r\nETag: %s\r\nCache-Control: no-cache\r\nConnection: %s\r\n\r\n",
+	         mime_type, (long long)file_stat.st_size, etag, conn->keep_alive ? "keep-alive" : "close");
 
-	close(file_fd);
-	logger::log(std::format("served file: {} ({} bytes)", (const char *)full_path, (long long)file_stat.st_size));
+	// the event loop sends the file after the header as the socket takes it.
+	codeserver__buffer_push(&conn->out, header, header_length);
+	if (file_stat.st_size > 0) {
+		conn->file_fd = file_fd;
+		conn->file_offset = 0;
+		conn->file_end = file_stat.st_size;
+	} else {
+		close(file_fd);
+	}
+	logger::queue_format(logger::LEVEL_LOG, "served file: {} ({} bytes)", (const char *)full_path, (long long)file_stat.st_size);
 	return true;
 }
+
+// Respond with the cached file, or with 304 if the client has it. The body is sent from the entry itself.
+void codeserver__respond_entry(codeserver *self, codeserver_connection *conn, FileCacheEntry *entry, const char *if_none_match) {
+	const char *connection = conn->keep_alive ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+	if (if_none_match && strstr(if_none_match, entry->etag)) {
+		char header[256];
+		int header_length = snprintf(header, sizeof(header), "HTTP/1.1 304 Not Modified\r\nETag: %s\r\n%s", entry->etag, connection);
+		codeserver__buffer_push(&conn->out, header, header_length);
+		FileCache_release(self->files, entry);
+		return;
+	}
+	codeserver__buffer_push(&conn->out, entry->header, entry->headerLength);
+	codeserver__buffer_push(&conn->out, connection, strlen(connection));
+	conn->body_entry = entry;
+	conn->body_offset = 0;
+}
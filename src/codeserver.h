@@ -3,7 +3,28 @@
 // Otoperl::otoperld::codeserver - mini http server for otoperld.
 
 #include <stdbool.h>
+#include <stddef.h>
+#include <time.h>
+#include <pthread.h>
 #include <netinet/in.h>
+#include <atomic>
+#include <string>
+
+#include "filecache.h"
+
+// connections served at once
+#define CODESERVER_CONNECTIONS_MAX 256
+
+typedef struct {
+	// error message (malloc'ed) if the code failed, or NULL.
+	char *error;
+	// report text (malloc'ed) returned to the client, or NULL.
+	char *report;
+} codeserver_result;
+
+typedef struct codeserver_connection_s codeserver_connection;
+typedef struct codeserver_job_s codeserver_job;
+typedef struct codeserver_message_s codeserver_message;
 
 typedef struct {
 	int port;
@@ -11,14 +32,45 @@ typedef struct {
 	struct in_addr allow_addr;
 	struct in_addr allow_mask;
 	int listen_fd;
-	const char *(*callback)(const char *code);
+	codeserver_result (*callback)(const char *code);
+	codeserver_result (*command)(const char *method, const char *path, const char *body);
+	// takes over the connection of a GET to CONTROL_PATH_PREFIX + path and returns true if it streams the path.
+	bool (*stream)(int conn_fd, const char *path, char **error);
 	bool verbose;
 	const char *document_root;
+	// the files of document_root served lately
+	FileCache *files;
+	// the event loop thread serving the connections, woken up through wake_fds
+	pthread_t thread;
+	bool started;
+	std::atomic<bool> running;
+	std::atomic<bool> failed;
+	int poll_fd;
+	int wake_fds[2];
+	codeserver_connection *connections[CODESERVER_CONNECTIONS_MAX];
+	int connection_count;
+	// requests for the script engine waiting for codeserver_run(), and their responses waiting for the event loop
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	codeserver_job *jobs;
+	codeserver_job *done;
+	// WebSocket clients connected, and the frames published to them waiting for the event loop
+	std::atomic<int> websockets;
+	codeserver_message *messages;
+	int message_count;
 } codeserver;
 
-codeserver *codeserver_init(int port, bool findfreeport, const char *allow, bool verbose, const char *document_root, const char *(*callback)(const char *code));
+codeserver *codeserver_init(int port, bool findfreeport, const char *allow, bool verbose, const char *document_root, codeserver_result (*callback)(const char *code), codeserver_result (*command)(const char *method, const char *path, const char *body), bool (*stream)(int conn_fd, const char *path, char **error));
 bool codeserver_start(codeserver *self);
-bool codeserver_run(codeserver *self);
+// The connections are served by an event loop thread. Wait up to timeout_ms for the requests it queued
+// for the script engine (posted code and control commands), and run them on the calling thread.
+bool codeserver_run(codeserver *self, int timeout_ms);
 void codeserver_stop(codeserver *self);
+// WebSocket clients connected to CONTROL_PATH_PREFIX "ws", from any thread.
+int codeserver_websockets(codeserver *self);
+// Send a text message to every WebSocket client, from any thread. Clients falling behind miss messages.
+void codeserver_publish(codeserver *self, const char *message, size_t length);
+// A JSON string literal of the text, with invalid UTF-8 replaced.
+std::string codeserver_json_string(const char *text, size_t length);
 
 #endif
\ No newline at end of file
@@ -8,5 +8,15 @@
 static const char *PORTFILENAME = ".otojsd_port";
 static const char *OTOJSD_DEFAULT_STARTCODE = "otojsd-start.js";
 static const char *RENDER_FUNCTION_NAME = "oto_render";
+static const char *RENDER_INTO_FUNCTION_NAME = "oto_render_into";
+static const char *RENDER_PLANAR_FUNCTION_NAME = "oto_render_planar";
+// globals of the OSC parameters: a Float32Array of the values and an object of their indices by name
+static const char *PARAMS_VARIABLE_NAME = "params";
+static const char *PARAM_INDEX_VARIABLE_NAME = "param_index";
+
+#define MAX_CHANNELS 128
+
+// requests to paths under this prefix control otojsd instead of posting code or getting files.
+#define CONTROL_PATH_PREFIX "/otojsd/"
 
 #endif // CONST_H
\ No newline at end of file
@@ -1,5 +1,7 @@
 // Otoperl::otoperld::coreaudioutilities - Core Audio Utilities.
 
+#ifdef __APPLE__
+
 #include <CoreFoundation/CoreFoundation.h>
 #include <CoreAudio/CoreAudio.h>
 #include "coreaudioutilities.h"
@@ -192,3 +194,5 @@ void deallocAudioBufferList(AudioBufferList *bufferList) {
 	}
 	free(bufferList);
 }
+
+#endif
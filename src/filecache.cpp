@@ -0,0 +1,182 @@
+// otojsd::filecache - the document root files in memory, with their response headers, for the code server.
+// Entries are keyed by the request path and checked against the mtime, size and inode of the file on each hit,
+// so an edited file is served fresh. The least recently used files are dropped over the size limit.
+// Not thread safe, used by the event loop thread only.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "filecache.h"
+
+// ------------------------------------------------------ private functions
+bool FileCache__fresh(FileCacheEntry *entry, const struct stat *st);
+void FileCache__unlink(FileCache *self, FileCacheEntry *entry);
+void FileCache__drop(FileCache *self, FileCacheEntry *entry);
+void FileCache__free_entry(FileCacheEntry *entry);
+
+// ---------------------------------------------- implimentation
+
+FileCache *FileCache_create(size_t maxBytes) {
+	FileCache *self = new FileCache;
+	self->entries = new std::unordered_map<std::string, FileCacheEntry *>();
+	self->head = NULL;
+	self->tail = NULL;
+	self->dropped = NULL;
+	self->bytes = 0;
+	self->maxBytes = maxBytes;
+	self->hits = 0;
+	self->misses = 0;
+	return self;
+}
+
+// The entry of the request path with the current content of the file, referenced, or NULL.
+FileCacheEntry *FileCache_get(FileCache *self, const char *path) {
+	auto found = self->entries->find(path);
+	if ( found == self->entries->end() ) {
+		self->misses++;
+		return NULL;
+	}
+	FileCacheEntry *entry = found->second;
+	struct stat st;
+	if ( stat(entry->fullPath, &st) != 0 || ! FileCache__fresh(entry, &st) ) {
+		FileCache__drop(self, entry);
+		self->misses++;
+		return NULL;
+	}
+	// move to the front.
+	FileCache__unlink(self, entry);
+	entry->next = self->head;
+	if ( self->head ) self->head->prev = entry;
+	self->head = entry;
+	if ( ! self->tail ) self->tail = entry;
+	entry->refs++;
+	self->hits++;
+	return entry;
+}
+
+// Read the file opened as fd into a new entry of the request path, referenced. NULL if it could not be read.
+FileCacheEntry *FileCache_put(FileCache *self, const char *path, const char *fullPath, int fd, const struct stat *st, const char *mimeType) {
+	if ( st->st_size > FILECACHE_FILE_MAX ) return NULL;
+	FileCacheEntry *entry = (FileCacheEntry *)calloc(1, sizeof(FileCacheEntry));
+	entry->data = (char *)malloc(st->st_size > 0 ? st->st_size : 1);
+	off_t total = 0;
+	while ( total < st->st_size ) {
+		ssize_t bytes = pread(fd, entry->data + total, st->st_size - total, total);
+		if ( bytes <= 0 ) break;
+		total += bytes;
+	}
+	if ( total != st->st_size ) {
+		// changed while reading.
+		free(entry->data);
+		free(entry);
+		return NULL;
+	}
+	entry->path = strdup(path);
+	entry->fullPath = strdup(fullPath);
+	entry->size = st->st_size;
+	entry->inode = st->st_ino;
+#ifdef __APPLE__
+	entry->mtime = st->st_mtimespec;
+#else
+	entry->mtime = st->st_mtim;
+#endif
+	FileCache_etag(st, entry->etag, sizeof(entry->etag));
+	char header[512];
+	int length = snprintf(header, sizeof(header),
+		"HTTP/1.1 200 OK\r\nContent-Type: %s\r\nContent-Length: %lld\r\nETag: %s\r\nCache-Control: no-cache\r\n",
+		mimeType, (long long)entry->size, entry->etag);
+	entry->header = strndup(header, length);
+	entry->headerLength = length;
+	entry->refs = 1;
+
+	auto found = self->entries->find(path);
+	if ( found != self->entries->end() ) {
+		FileCache__drop(self, found->second);
+	}
+	(*self->entries)[path] = entry;
+	entry->next = self->head;
+	if ( self->head ) self->head->prev = entry;
+	self->head = entry;
+	if ( ! self->tail ) self->tail = entry;
+	self->bytes += entry->size + entry->headerLength;
+	while ( self->bytes > self->maxBytes && self->tail && self->tail != entry ) {
+		FileCache__drop(self, self->tail);
+	}
+	return entry;
+}
+
+// A response finished sending the entry.
+void FileCache_release(FileCache *self, FileCacheEntry *entry) {
+	if ( --entry->refs == 0 && entry->dropped ) {
+		if ( entry->prev ) entry->prev->next = entry->next;
+		else self->dropped = entry->next;
+		if ( entry->next ) entry->next->prev = entry->prev;
+		FileCache__free_entry(entry);
+	}
+}
+
+// The validator of the file: changes with its size or modification time.
+void FileCache_etag(const struct stat *st, char *etag, size_t size) {
+#ifdef __APPLE__
+	const struct timespec *mtime = &st->st_mtimespec;
+#else
+	const struct timespec *mtime = &st->st_mtim;
+#endif
+	snprintf(etag, size, "\"%llx-%llx-%lx\"", (unsigned long long)st->st_size,
+		(unsigned long long)mtime->tv_sec, (unsigned long)mtime->tv_nsec);
+}
+
+void FileCache_destroy(FileCache *self) {
+	for ( FileCacheEntry *list : {self->head, self->dropped} ) {
+		while ( list ) {
+			FileCacheEntry *next = list->next;
+			FileCache__free_entry(list);
+			list = next;
+		}
+	}
+	delete self->entries;
+	delete self;
+}
+
+bool FileCache__fresh(FileCacheEntry *entry, const struct stat *st) {
+#ifdef __APPLE__
+	const struct timespec *mtime = &st->st_mtimespec;
+#else
+	const struct timespec *mtime = &st->st_mtim;
+#endif
+	return st->st_size == entry->size && st->st_ino == entry->inode &&
+		mtime->tv_sec == entry->mtime.tv_sec && mtime->tv_nsec == entry->mtime.tv_nsec;
+}
+
+void FileCache__unlink(FileCache *self, FileCacheEntry *entry) {
+	if ( entry->prev ) entry->prev->next = entry->next;
+	else self->head = entry->next;
+	if ( entry->next ) entry->next->prev = entry->prev;
+	else self->tail = entry->prev;
+	entry->prev = NULL;
+	entry->next = NULL;
+}
+
+// Remove the entry from the cache, it is freed when no response sends it.
+void FileCache__drop(FileCache *self, FileCacheEntry *entry) {
+	FileCache__unlink(self, entry);
+	self->entries->erase(entry->path);
+	self->bytes -= entry->size + entry->headerLength;
+	entry->dropped = true;
+	if ( entry->refs == 0 ) {
+		FileCache__free_entry(entry);
+	} else {
+		entry->next = self->dropped;
+		if ( self->dropped ) self->dropped->prev = entry;
+		self->dropped = entry;
+	}
+}
+
+void FileCache__free_entry(FileCacheEntry *entry) {
+	free(entry->path);
+	free(entry->fullPath);
+	free(entry->header);
+	free(entry->data);
+	free(entry);
+}
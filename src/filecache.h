@@ -0,0 +1,56 @@
+#ifndef FILECACHE_H
+#define FILECACHE_H
+// otojsd::filecache - the document root files in memory, with their response headers, for the code server.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <string>
+#include <unordered_map>
+
+// files larger than this are not cached, they are sent with sendfile.
+#define FILECACHE_FILE_MAX (1024 * 1024)
+
+typedef struct FileCacheEntry_s {
+	char *path;
+	// the file the request path resolved to, checked on each hit
+	char *fullPath;
+	off_t size;
+	ino_t inode;
+	struct timespec mtime;
+	char etag[48];
+	// the response header up to the Connection line
+	char *header;
+	size_t headerLength;
+	char *data;
+	// responses sending data, the entry is freed when the last one finishes after the entry was dropped
+	int refs;
+	bool dropped;
+	struct FileCacheEntry_s *prev;
+	struct FileCacheEntry_s *next;
+} FileCacheEntry;
+
+typedef struct {
+	std::unordered_map<std::string, FileCacheEntry *> *entries;
+	// most recently used first
+	FileCacheEntry *head;
+	FileCacheEntry *tail;
+	// entries dropped while responses still send them, until they are released
+	FileCacheEntry *dropped;
+	size_t bytes;
+	size_t maxBytes;
+	uint64_t hits;
+	uint64_t misses;
+} FileCache;
+
+FileCache *FileCache_create(size_t maxBytes);
+FileCacheEntry *FileCache_get(FileCache *self, const char *path);
+FileCacheEntry *FileCache_put(FileCache *self, const char *path, const char *fullPath, int fd, const struct stat *st, const char *mimeType);
+void FileCache_release(FileCache *self, FileCacheEntry *entry);
+void FileCache_etag(const struct stat *st, char *etag, size_t size);
+// Free every entry, those still referenced included: the responses sending them must be gone.
+void FileCache_destroy(FileCache *self);
+
+#endif
@@ -0,0 +1,355 @@
+// otojsd::flacencoder - minimal FLAC encoder for recording.
+// Encodes each channel independently with the fixed predictors (order 0 to 4) and partitioned Rice coding,
+// falling back to constant or verbatim subframes. No MD5 signature is written (allowed by the format).
+
+#include <stdlib.h>
+#include <string.h>
+#include "flacencoder.h"
+
+#define STREAMINFO_OFFSET 8
+#define STREAMINFO_SIZE 34
+#define MAX_FIXED_ORDER 4
+#define MAX_PARTITION_ORDER 6
+#define MAX_RICE_PARAMETER 14
+
+typedef struct {
+	unsigned char *data;
+	size_t position; // in bits
+} FlacBits;
+
+// ------------------------------------------------------ private functions
+bool FlacEncoder__write_frame(FlacEncoder *self);
+void FlacEncoder__streaminfo(FlacEncoder *self, unsigned char *buffer);
+size_t FlacEncoder__subframe(FlacEncoder *self, FlacBits *bits, const int32_t *samples, int frames);
+uint64_t rice_bits(const int32_t *residual, int count, int parameter);
+int rice_best_parameter(const int32_t *residual, int count, uint64_t *bits_return);
+uint64_t rice_partitions(const int32_t *residual, int frames, int order, int partition_order, int *parameters);
+void bits_put(FlacBits *bits, uint32_t value, int count);
+void bits_put_signed(FlacBits *bits, int32_t value, int count);
+void bits_put_utf8(FlacBits *bits, uint32_t value);
+void bits_align(FlacBits *bits);
+uint8_t crc8(const unsigned char *data, size_t length);
+uint16_t crc16(const unsigned char *data, size_t length);
+
+// ---------------------------------------------- implimentation
+
+FlacEncoder *FlacEncoder_create(FILE *fh, int channels, int bits, int sampleRate) {
+	FlacEncoder *self = (FlacEncoder *)calloc(1, sizeof(FlacEncoder));
+	if ( !self ) return NULL;
+	self->fh = fh;
+	self->channels = channels;
+	self->bits = bits;
+	self->sampleRate = sampleRate;
+	self->block = (int32_t *)malloc(sizeof(int32_t) * FLAC_BLOCK_SIZE * channels);
+	self->residual = (int32_t *)malloc(sizeof(int32_t) * FLAC_BLOCK_SIZE);
+	// a verbatim frame of every channel plus the headers is the largest frame written.
+	self->frameCapacity = (size_t)FLAC_BLOCK_SIZE * channels * (bits + 1) / 8 + 64 * channels + 64;
+	self->frame = (unsigned char *)malloc(self->frameCapacity);
+	if ( !self->block || !self->residual || !self->frame ) {
+		FlacEncoder_destroy(self);
+		return NULL;
+	}
+	self->minFrameBytes = UINT32_MAX;
+	return self;
+}
+
+void FlacEncoder_destroy(FlacEncoder *self) {
+	free(self->block);
+	free(self->residual);
+	free(self->frame);
+	free(self);
+}
+
+// Write the stream marker and a STREAMINFO to be completed by FlacEncoder_finish().
+bool FlacEncoder_start(FlacEncoder *self) {
+	unsigned char header[STREAMINFO_OFFSET + STREAMINFO_SIZE];
+	memcpy(header, "fLaC", 4);
+	// last metadata block, type 0 (STREAMINFO)
+	header[4] = 0x80;
+	header[5] = 0;
+	header[6] = 0;
+	header[7] = STREAMINFO_SIZE;
+	FlacEncoder__streaminfo(self, header + STREAMINFO_OFFSET);
+	return fwrite(header, sizeof(header), 1, self->fh) == 1;
+}
+
+// Encode interleaved samples (in the range of the bits).
+bool FlacEncoder_write(FlacEncoder *self, const int32_t *data, int frames) {
+	int channels = self->channels;
+	for ( int i = 0; i < frames; i++ ) {
+		for ( int c = 0; c < channels; c++ ) {
+			self->block[c * FLAC_BLOCK_SIZE + self->blockFrames] = data[i * channels + c];
+		}
+		self->blockFrames++;
+		if ( self->blockFrames == FLAC_BLOCK_SIZE ) {
+			if ( ! FlacEncoder__write_frame(self) ) return false;
+		}
+	}
+	return true;
+}
+
+// Encode the rest of the samples and complete the STREAMINFO. Does not close the file.
+bool FlacEncoder_finish(FlacEncoder *self) {
+	if ( self->blockFrames > 0 && ! FlacEncoder__write_frame(self) ) {
+		return false;
+	}
+	unsigned char streaminfo[STREAMINFO_SIZE];
+	FlacEncoder__streaminfo(self, streaminfo);
+	if ( fseek(self->fh, STREAMINFO_OFFSET, SEEK_SET) != 0 ) return false;
+	return fwrite(streaminfo, sizeof(streaminfo), 1, self->fh) == 1;
+}
+
+void FlacEncoder__streaminfo(FlacEncoder *self, unsigned char *buffer) {
+	FlacBits bits = {buffer, 0};
+	memset(buffer, 0, STREAMINFO_SIZE);
+	// the last block may be shorter than the minimum, as the format allows.
+	bits_put(&bits, FLAC_BLOCK_SIZE, 16);
+	bits_put(&bits, FLAC_BLOCK_SIZE, 16);
+	bits_put(&bits, self->minFrameBytes == UINT32_MAX ? 0 : self->minFrameBytes, 24);
+	bits_put(&bits, self->maxFrameBytes, 24);
+	bits_put(&bits, self->sampleRate, 20);
+	bits_put(&bits, self->channels - 1, 3);
+	bits_put(&bits, self->bits - 1, 5);
+	bits_put(&bits, (uint32_t)(self->totalFrames >> 32) & 0xF, 4);
+	bits_put(&bits, (uint32_t)self->totalFrames, 32);
+	// MD5 signature left zero: unknown
+}
+
+bool FlacEncoder__write_frame(FlacEncoder *self) {
+	int frames = self->blockFrames;
+	FlacBits bits = {self->frame, 0};
+	memset(self->frame, 0, self->frameCapacity);
+
+	// frame header: sync code, fixed block size, block size at the end of the header,
+	// sample rate and sample size from STREAMINFO, independent channels.
+	bits_put(&bits, 0xFFF8, 16);
+	bits_put(&bits, 0x7, 4);
+	bits_put(&bits, 0x0, 4);
+	bits_put(&bits, self->channels - 1, 4);
+	bits_put(&bits, 0x0, 3);
+	bits_put(&bits, 0, 1);
+	bits_put_utf8(&bits, self->frameNumber);
+	bits_put(&bits, frames - 1, 16);
+	size_t header_bytes = bits.position / 8;
+	bits_put(&bits, crc8(self->frame, header_bytes), 8);
+
+	for ( int c = 0; c < self->channels; c++ ) {
+		FlacEncoder__subframe(self, &bits, self->block + c * FLAC_BLOCK_SIZE, frames);
+	}
+	bits_align(&bits);
+	size_t length = bits.position / 8;
+	uint16_t crc = crc16(self->frame, length);
+	self->frame[length++] = crc >> 8;
+	self->frame[length++] = crc & 0xFF;
+
+	if ( fwrite(self->frame, 1, length, self->fh) != length ) {
+		return false;
+	}
+	if ( length < self->minFrameBytes ) self->minFrameBytes = length;
+	if ( length > self->maxFrameBytes ) self->maxFrameBytes = length;
+	self->frameNumber++;
+	self->totalFrames += frames;
+	self->blockFrames = 0;
+	return true;
+}
+
+// Write the smallest of the constant, fixed predictor and verbatim subframes.
+size_t FlacEncoder__subframe(FlacEncoder *self, FlacBits *bits, const int32_t *samples, int frames) {
+	int bps = self->bits;
+	size_t start = bits->position;
+
+	bool constant = true;
+	for ( int i = 1; i < frames && constant; i++ ) {
+		constant = samples[i] == samples[0];
+	}
+	if ( constant ) {
+		bits_put(bits, 0x00, 8);
+		bits_put_signed(bits, samples[0], bps);
+		return bits->position - start;
+	}
+
+	// find the cheapest fixed predictor order and partitioning.
+	uint64_t best_bits = (uint64_t)frames * bps;
+	int best_order = -1;
+	int best_partition_order = 0;
+	for ( int order = 0; order <= MAX_FIXED_ORDER && order < frames; order++ ) {
+		int32_t *residual = self->residual;
+		for ( int i = order; i < frames; i++ ) {
+			const int32_t *s = samples + i;
+			switch ( order ) {
+				case 0: residual[i] = s[0]; break;
+				case 1: residual[i] = s[0] - s[-1]; break;
+				case 2: residual[i] = s[0] - 2 * s[-1] + s[-2]; break;
+				case 3: residual[i] = s[0] - 3 * s[-1] + 3 * s[-2] - s[-3]; break;
+				case 4: residual[i] = s[0] - 4 * s[-1] + 6 * s[-2] - 4 * s[-3] + s[-4]; break;
+			}
+		}
+		for ( int partition_order = 0; partition_order <= MAX_PARTITION_ORDER; partition_order++ ) {
+			if ( (frames >> partition_order) <= order || (frames & ((1 << partition_order) - 1)) ) break;
+			uint64_t cost = (uint64_t)order * bps + 6 + rice_partitions(residual, frames, order, partition_order, NULL);
+			if ( cost < best_bits ) {
+				best_bits = cost;
+				best_order = order;
+				best_partition_order = partition_order;
+			}
+		}
+	}
+
+	if ( best_order < 0 ) {
+		// verbatim
+		bits_put(bits, 0x02, 8);
+		for ( int i = 0; i < frames; i++ ) {
+			bits_put_signed(bits, samples[i], bps);
+		}
+		return bits->position - start;
+	}
+
+	int32_t *residual = self->residual;
+	for ( int i = best_order; i < frames; i++ ) {
+		const int32_t *s = samples + i;
+		switch ( best_order ) {
+			case 0: residual[i] = s[0]; break;
+			case 1: residual[i] = s[0] - s[-1]; break;
+			case 2: residual[i] = s[0] - 2 * s[-1] + s[-2]; break;
+			case 3: residual[i] = s[0] - 3 * s[-1] + 3 * s[-2] - s[-3]; break;
+			case 4: residual[i] = s[0] - 4 * s[-1] + 6 * s[-2] - 4 * s[-3] + s[-4]; break;
+		}
+	}
+	int parameters[1 << MAX_PARTITION_ORDER];
+	rice_partitions(residual, frames, best_order, best_partition_order, parameters);
+
+	bits_put(bits, 0x10 | (best_order << 1), 8);
+	for ( int i = 0; i < best_order; i++ ) {
+		bits_put_signed(bits, samples[i], bps);
+	}
+	// residual coding method 0 (4-bit Rice parameters)
+	bits_put(bits, 0, 2);
+	bits_put(bits, best_partition_order, 4);
+	int partitions = 1 << best_partition_order;
+	int partition_size = frames >> best_partition_order;
+	for ( int p = 0; p < partitions; p++ ) {
+		int first = p == 0 ? best_order : p * partition_size;
+		int end = (p + 1) * partition_size;
+		int k = parameters[p];
+		bits_put(bits, k, 4);
+		for ( int i = first; i < end; i++ ) {
+			uint32_t u = ((uint32_t)residual[i] << 1) ^ (uint32_t)(residual[i] >> 31);
+			uint32_t q = u >> k;
+			// q zeros then a one
+			while ( q >= 32 ) {
+				bits_put(bits, 0, 32);
+				q -= 32;
+			}
+			bits_put(bits, 1, q + 1);
+			if ( k > 0 ) bits_put(bits, u & ((1u << k) - 1), k);
+		}
+	}
+	return bits->position - start;
+}
+
+// Return the bits of the residual partitions with their best Rice parameters, stored in parameters if not NULL.
+uint64_t rice_partitions(const int32_t *residual, int frames, int order, int partition_order, int *parameters) {
+	int partitions = 1 << partition_order;
+	int partition_size = frames >> partition_order;
+	uint64_t total = 0;
+	for ( int p = 0; p < partitions; p++ ) {
+		int first = p == 0 ? order : p * partition_size;
+		int end = (p + 1) * partition_size;
+		uint64_t bits;
+		int k = rice_best_parameter(residual + first, end - first, &bits);
+		if ( parameters ) parameters[p] = k;
+		total += 4 + bits;
+	}
+	return total;
+}
+
+int rice_best_parameter(const int32_t *residual, int count, uint64_t *bits_return) {
+	uint64_t sum = 0;
+	for ( int i = 0; i < count; i++ ) {
+		sum += ((uint32_t)residual[i] << 1) ^ (uint32_t)(residual[i] >> 31);
+	}
+	// estimate from the mean, then check the neighbours.
+	int estimate = 0;
+	while ( estimate < MAX_RICE_PARAMETER && ((uint64_t)count << (estimate + 1)) < sum ) {
+		estimate++;
+	}
+	int best = estimate;
+	uint64_t best_bits = rice_bits(residual, count, estimate);
+	for ( int k = estimate - 1; k <= estimate + 1; k += 2 ) {
+		if ( k < 0 || k > MAX_RICE_PARAMETER ) continue;
+		uint64_t bits = rice_bits(residual, count, k);
+		if ( bits < best_bits ) {
+			best_bits = bits;
+			best = k;
+		}
+	}
+	*bits_return = best_bits;
+	return best;
+}
+
+uint64_t rice_bits(const int32_t *residual, int count, int parameter) {
+	uint64_t bits = (uint64_t)count * (parameter + 1);
+	for ( int i = 0; i < count; i++ ) {
+		bits += (((uint32_t)residual[i] << 1) ^ (uint32_t)(residual[i] >> 31)) >> parameter;
+	}
+	return bits;
+}
+
+// -------------------------------------------- bit writer
+
+// Append the lowest count bits (up to 32) of the value, most significant first. The buffer must be zeroed.
+void bits_put(FlacBits *bits, uint32_t value, int count) {
+	for ( int i = count - 1; i >= 0; i-- ) {
+		if ( (value >> i) & 1 ) {
+			bits->data[bits->position >> 3] |= 0x80 >> (bits->position & 7);
+		}
+		bits->position++;
+	}
+}
+
+void bits_put_signed(FlacBits *bits, int32_t value, int count) {
+	bits_put(bits, (uint32_t)value & (count == 32 ? 0xFFFFFFFFu : ((1u << count) - 1)), count);
+}
+
+// frame numbers are coded like UTF-8.
+void bits_put_utf8(FlacBits *bits, uint32_t value) {
+	if ( value < 0x80 ) {
+		bits_put(bits, value, 8);
+		return;
+	}
+	int bytes = value < 0x800 ? 2 : value < 0x10000 ? 3 : value < 0x200000 ? 4 : value < 0x4000000 ? 5 : 6;
+	int shift = (bytes - 1) * 6;
+	// as many ones as bytes, then a zero
+	bits_put(bits, ((1u << bytes) - 1) << 1, bytes + 1);
+	bits_put(bits, value >> shift, 7 - bytes);
+	while ( shift > 0 ) {
+		shift -= 6;
+		bits_put(bits, 0x80 | ((value >> shift) & 0x3F), 8);
+	}
+}
+
+void bits_align(FlacBits *bits) {
+	bits->position = (bits->position + 7) & ~(size_t)7;
+}
+
+uint8_t crc8(const unsigned char *data, size_t length) {
+	uint8_t crc = 0;
+	for ( size_t i = 0; i < length; i++ ) {
+		crc ^= data[i];
+		for ( int b = 0; b < 8; b++ ) {
+			crc = crc & 0x80 ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+		}
+	}
+	return crc;
+}
+
+uint16_t crc16(const unsigned char *data, size_t length) {
+	uint16_t crc = 0;
+	for ( size_t i = 0; i < length; i++ ) {
+		crc ^= (uint16_t)data[i] << 8;
+		for ( int b = 0; b < 8; b++ ) {
+			crc = crc & 0x8000 ? (uint16_t)((crc << 1) ^ 0x8005) : (uint16_t)(crc << 1);
+		}
+	}
+	return crc;
+}
@@ -0,0 +1,39 @@
+#ifndef FLACENCODER_H
+#define FLACENCODER_H
+// otojsd::flacencoder - minimal FLAC encoder for recording.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+
+// frames per FLAC frame
+#define FLAC_BLOCK_SIZE 4096
+// the channel fields of the headers hold up to 8 channels
+#define FLAC_CHANNELS_MAX 8
+
+typedef struct {
+	FILE *fh;
+	int channels;
+	int bits;
+	int sampleRate;
+	// samples of the block being filled, channel by channel
+	int32_t *block;
+	int blockFrames;
+	// encoded frame
+	unsigned char *frame;
+	size_t frameCapacity;
+	uint32_t frameNumber;
+	uint64_t totalFrames;
+	uint32_t minFrameBytes;
+	uint32_t maxFrameBytes;
+	// residuals of the predictor being evaluated
+	int32_t *residual;
+} FlacEncoder;
+
+FlacEncoder *FlacEncoder_create(FILE *fh, int channels, int bits, int sampleRate);
+bool FlacEncoder_start(FlacEncoder *self);
+bool FlacEncoder_write(FlacEncoder *self, const int32_t *data, int frames);
+bool FlacEncoder_finish(FlacEncoder *self);
+void FlacEncoder_destroy(FlacEncoder *self);
+
+#endif
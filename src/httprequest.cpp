@@ -0,0 +1,129 @@
+// otojsd::httprequest - parsing the HTTP requests of the code server.
+// A request is parsed again from the start as more of it arrives, nothing is kept between the calls.
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <string>
+#include "httprequest.h"
+
+// ---------------------------------------------- implimentation
+
+int httprequest_method(const char *data) {
+	if (strncmp(data, "GET ", 4) == 0) {
+		return METHOD_GET;
+	} else if (strncmp(data, "POST ", 5) == 0) {
+		return METHOD_POST;
+	} else {
+		return METHOD_UNKNOWN;
+	}
+}
+
+long httprequest_parse(const char *data, size_t size, bool closed, httprequest *request) {
+	const char *head_end = (const char *)memmem(data, size, "\r\n\r\n", 4);
+	if (!head_end) {
+		return size > HTTPREQUEST_HEADER_MAX ? PARSE_TOO_LARGE : 0;
+	}
+	size_t head_length = head_end + 4 - data;
+
+	const char *line_end = (const char *)memchr(data, '\r', head_length);
+	const char *path_start = (const char *)memchr(data, ' ', line_end - data);
+	if (!path_start) return PARSE_BAD_REQUEST;
+	path_start++;
+	const char *path_end = (const char *)memchr(path_start, ' ', line_end - path_start);
+	if (!path_end || path_end == path_start) return PARSE_BAD_REQUEST;
+	bool http10 = line_end - (path_end + 1) == 8 && strncmp(path_end + 1, "HTTP/1.0", 8) == 0;
+
+	bool keep_alive = !http10;
+	bool chunked = false;
+	bool has_length = false;
+	unsigned long long content_length = 0;
+	std::string if_none_match;
+	bool upgrade = false;
+	std::string websocket_key;
+	for (const char *line = line_end + 2; line < head_end; line = line_end + 2) {
+		line_end = (const char *)memchr(line, '\r', head_end + 2 - line);
+		const char *colon = (const char *)memchr(line, ':', line_end - line);
+		if (!colon) continue;
+		std::string name(line, colon - line);
+		const char *value = colon + 1;
+		while (*value == ' ' || *value == '\t') value++;
+		std::string text(value, line_end - value);
+		if (strcasecmp(name.c_str(), "Content-Length") == 0) {
+			char *end;
+			content_length = strtoull(text.c_str(), &end, 10);
+			if (end == text.c_str()) return PARSE_BAD_REQUEST;
+			has_length = true;
+		} else if (strcasecmp(name.c_str(), "Transfer-Encoding") == 0) {
+			chunked = strcasestr(text.c_str(), "chunked") != NULL;
+		} else if (strcasecmp(name.c_str(), "Connection") == 0) {
+			if (strcasestr(text.c_str(), "close")) keep_alive = false;
+			if (strcasestr(text.c_str(), "keep-alive")) keep_alive = true;
+		} else if (strcasecmp(name.c_str(), "If-None-Match") == 0) {
+			if_none_match = text;
+		} else if (strcasecmp(name.c_str(), "Upgrade") == 0) {
+			upgrade = strcasestr(text.c_str(), "websocket") != NULL;
+		} else if (strcasecmp(name.c_str(), "Sec-WebSocket-Key") == 0) {
+			websocket_key = text;
+		}
+	}
+
+	const char *body = data + head_length;
+	size_t available = size - head_length;
+	size_t consumed;
+	std::string decoded;
+	if (chunked) {
+		// size line, data and CRLF for each chunk, up to the 0 sized one and the trailers.
+		size_t position = 0;
+		while (true) {
+			const char *size_end = (const char *)memmem(body + position, available - position, "\r\n", 2);
+			if (!size_end) return available - position > 64 ? PARSE_BAD_REQUEST : 0;
+			char *end;
+			unsigned long long chunk = strtoull(body + position, &end, 16);
+			if (end == body + position) return PARSE_BAD_REQUEST;
+			position = size_end + 2 - body;
+			if (chunk == 0) break;
+			if (decoded.size() + chunk > HTTPREQUEST_BODY_MAX) return PARSE_TOO_LARGE;
+			if (available - position < chunk + 2) return 0;
+			if (memcmp(body + position + chunk, "\r\n", 2) != 0) return PARSE_BAD_REQUEST;
+			decoded.append(body + position, chunk);
+			position += chunk + 2;
+		}
+		while (true) {
+			const char *trailer_end = (const char *)memmem(body + position, available - position, "\r\n", 2);
+			if (!trailer_end) return 0;
+			bool empty = trailer_end == body + position;
+			position = trailer_end + 2 - body;
+			if (empty) break;
+		}
+		consumed = head_length + position;
+	} else if (has_length) {
+		if (content_length > HTTPREQUEST_BODY_MAX) return PARSE_TOO_LARGE;
+		if (available < content_length) return 0;
+		decoded.assign(body, content_length);
+		consumed = head_length + content_length;
+	} else if (httprequest_method(data) == METHOD_POST) {
+		if (available > HTTPREQUEST_BODY_MAX) return PARSE_TOO_LARGE;
+		if (!closed) return 0;
+		decoded.assign(body, available);
+		consumed = size;
+		keep_alive = false;
+	} else {
+		consumed = head_length;
+	}
+
+	request->method = httprequest_method(data);
+	request->path = strndup(path_start, path_end - path_start);
+	request->body = strdup(decoded.c_str());
+	request->keep_alive = keep_alive;
+	request->if_none_match = if_none_match.empty() ? NULL : strdup(if_none_match.c_str());
+	request->websocket_key = upgrade && !websocket_key.empty() ? strdup(websocket_key.c_str()) : NULL;
+	return consumed;
+}
+
+void httprequest_free(httprequest *request) {
+	free(request->path);
+	free(request->body);
+	free(request->if_none_match);
+	free(request->websocket_key);
+}
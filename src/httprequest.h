@@ -0,0 +1,41 @@
+#ifndef HTTPREQUEST_H
+#define HTTPREQUEST_H
+// otojsd::httprequest - parsing the HTTP requests of the code server.
+
+#include <stdbool.h>
+#include <stddef.h>
+
+// requests with longer headers or bodies are refused
+#define HTTPREQUEST_HEADER_MAX (64 * 1024)
+#define HTTPREQUEST_BODY_MAX (16 * 1024 * 1024)
+
+const int METHOD_UNKNOWN = 0;
+const int METHOD_UNSUPPORTED = -1;
+const int METHOD_GET     = 1;
+const int METHOD_POST    = 2;
+
+const long PARSE_BAD_REQUEST = -1;
+const long PARSE_TOO_LARGE   = -2;
+
+typedef struct {
+	int method;
+	// malloc'ed, NUL terminated
+	char *path;
+	char *body;
+	bool keep_alive;
+	// the ETag the client has, or NULL
+	char *if_none_match;
+	// Sec-WebSocket-Key of an upgrade to WebSocket, or NULL
+	char *websocket_key;
+} httprequest;
+
+// The METHOD_ of the request line at the start of data.
+int httprequest_method(const char *data);
+// Parse a request at the beginning of data, framed by Content-Length or chunked transfer encoding.
+// Returns the bytes it takes, 0 if it did not arrive entirely yet, or a negative PARSE_ error.
+// closed tells that no more bytes come: a POST without either is read until then, like HTTP/1.0.
+long httprequest_parse(const char *data, size_t size, bool closed, httprequest *request);
+// Free the strings of a parsed request.
+void httprequest_free(httprequest *request);
+
+#endif
@@ -1,5 +1,7 @@
+#include <atomic>
 #include <chrono>
 #include <cmath>
+#include <cstring>
 #include <iostream>
 #include <limits>
 #include <string>
@@ -243,3 +245,165 @@ void logger::levelmeter(float level) {
     print_meter_line(level);
     levelmeter_displayed = true;
 }
+
+// Queue implementation
+
+// bounded multi-producer queue of fixed size slots (Vyukov's algorithm), a power of two.
+static const size_t QUEUE_SLOTS = 256;
+// messages printed per second at most, the rest are counted and reported.
+static const int QUEUE_RATE_LIMIT = 100;
+// a message repeated is reported as a count at most this often.
+static const int QUEUE_REPEAT_REPORT_MS = 1000;
+
+struct QueueSlot {
+    // equals the enqueue position when the slot is free, the position + 1 when it holds a message.
+    std::atomic<size_t> sequence;
+    logger::Level level;
+    size_t length;
+    char text[logger::QUEUE_TEXT_SIZE];
+};
+
+static QueueSlot *queue_slots = [] {
+    QueueSlot *slots = new QueueSlot[QUEUE_SLOTS];
+    for (size_t i = 0; i < QUEUE_SLOTS; i++) {
+        slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+    return slots;
+}();
+static std::atomic<size_t> queue_enqueue_position(0);
+static size_t queue_dequeue_position = 0;
+static std::atomic<uint64_t> queue_dropped(0);
+static std::atomic<float> queue_level(-1.0f);
+static void (*queue_forward)(logger::Level level, const char *text, size_t length) = nullptr;
+
+// drain() state, main thread only
+static uint64_t queue_dropped_reported = 0;
+static uint64_t queue_suppressed = 0;
+static int queue_tokens = QUEUE_RATE_LIMIT;
+static auto queue_tokens_update = std::chrono::steady_clock::now();
+static logger::Level queue_last_level = logger::LEVEL_LOG;
+static std::string queue_last_text;
+static int queue_repeats = 0;
+static auto queue_repeats_since = std::chrono::steady_clock::now();
+
+void logger::queue(Level level, const char *message, size_t length) {
+    size_t position = queue_enqueue_position.load(std::memory_order_relaxed);
+    QueueSlot *slot;
+    while (true) {
+        slot = &queue_slots[position & (QUEUE_SLOTS - 1)];
+        size_t sequence = slot->sequence.load(std::memory_order_acquire);
+        if (sequence == position) {
+            if (queue_enqueue_position.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (sequence < position) {
+            // the slot still holds a message from the previous lap, the queue is full.
+            queue_dropped.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            position = queue_enqueue_position.load(std::memory_order_relaxed);
+        }
+    }
+    slot->level = level;
+    slot->length = std::min(length, QUEUE_TEXT_SIZE);
+    memcpy(slot->text, message, slot->length);
+    slot->sequence.store(position + 1, std::memory_order_release);
+}
+
+void logger::set_forward(void (*forward)(Level level, const char *text, size_t length)) {
+    queue_forward = forward;
+}
+
+void logger::queue_levelmeter(float level) {
+    float peak = queue_level.load(std::memory_order_relaxed);
+    while (level > peak && !queue_level.compare_exchange_weak(peak, level, std::memory_order_relaxed)) {
+    }
+}
+
+void print_queued(logger::Level level, const std::string &text) {
+    switch (level) {
+    case logger::LEVEL_LOG:
+        logger::log(text);
+        break;
+    case logger::LEVEL_INFO:
+        logger::info(text);
+        break;
+    case logger::LEVEL_DEBUG:
+        logger::debug(text);
+        break;
+    case logger::LEVEL_WARN:
+        logger::warn(text);
+        break;
+    case logger::LEVEL_ERROR:
+        logger::error(text);
+        break;
+    case logger::LEVEL_ASSERT:
+        logger::assert(false, text);
+        break;
+    }
+}
+
+void flush_repeats() {
+    if (queue_repeats > 0) {
+        logger::log(std::format("(the last message repeated {} more times)", queue_repeats));
+        queue_repeats = 0;
+    }
+}
+
+void logger::drain() {
+    auto now = std::chrono::steady_clock::now();
+    auto since_refill = std::chrono::duration_cast<std::chrono::milliseconds>(now - queue_tokens_update).count();
+    if (since_refill >= 1000) {
+        if (queue_suppressed > 0) {
+            logger::warn(std::format("{} log messages suppressed, more than {} per second.", queue_suppressed, QUEUE_RATE_LIMIT));
+            queue_suppressed = 0;
+        }
+        queue_tokens = QUEUE_RATE_LIMIT;
+        queue_tokens_update = now;
+    }
+
+    while (true) {
+        QueueSlot &slot = queue_slots[queue_dequeue_position & (QUEUE_SLOTS - 1)];
+        if (slot.sequence.load(std::memory_order_acquire) != queue_dequeue_position + 1) {
+            break;
+        }
+        Level level = slot.level;
+        std::string text(slot.text, slot.length);
+        slot.sequence.store(queue_dequeue_position + QUEUE_SLOTS, std::memory_order_release);
+        queue_dequeue_position++;
+
+        if (level == queue_last_level && text == queue_last_text) {
+            if (queue_repeats == 0) {
+                queue_repeats_since = now;
+            }
+            queue_repeats++;
+            continue;
+        }
+        flush_repeats();
+        if (queue_tokens <= 0) {
+            queue_suppressed++;
+            continue;
+        }
+        queue_tokens--;
+        print_queued(level, text);
+        if (queue_forward) {
+            queue_forward(level, text.c_str(), text.size());
+        }
+        queue_last_level = level;
+        queue_last_text = std::move(text);
+    }
+    if (queue_repeats > 0 && std::chrono::duration_cast<std::chrono::milliseconds>(now - queue_repeats_since).count() >= QUEUE_REPEAT_REPORT_MS) {
+        flush_repeats();
+    }
+
+    uint64_t dropped = queue_dropped.load(std::memory_order_relaxed);
+    if (dropped != queue_dropped_reported) {
+        logger::warn(std::format("{} log messages dropped, the queue was full.", dropped - queue_dropped_reported));
+        queue_dropped_reported = dropped;
+    }
+
+    float level = queue_level.exchange(-1.0f, std::memory_order_relaxed);
+    if (level >= 0.0f) {
+        logger::levelmeter(level);
+    }
+}
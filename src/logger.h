@@ -1,7 +1,11 @@
 #ifndef LOGGER_H
 #define LOGGER_H
 
+#include <algorithm>
+#include <cstddef>
+#include <format>
 #include <string>
+#include <utility>
 
 namespace logger {
 
@@ -31,6 +35,33 @@ void assert(bool condition, const std::string message);
 
 void levelmeter(float level);
 
+// Real-time safe logging for the audio and render threads.
+// queue() copies the message into a preallocated slot without locking nor allocating, and drain() prints it later.
+// Messages are dropped and counted when the queue is full.
+
+enum Level { LEVEL_LOG, LEVEL_INFO, LEVEL_DEBUG, LEVEL_WARN, LEVEL_ERROR, LEVEL_ASSERT };
+
+// longer messages are truncated
+static const size_t QUEUE_TEXT_SIZE = 256;
+
+void queue(Level level, const char *message, size_t length);
+
+template <class... Args>
+void queue_format(Level level, std::format_string<Args...> format, Args &&...args) {
+    char buffer[QUEUE_TEXT_SIZE];
+    auto result = std::format_to_n(buffer, sizeof(buffer), format, std::forward<Args>(args)...);
+    queue(level, buffer, std::min<size_t>(result.size, sizeof(buffer)));
+}
+
+// Keep the peak level until drain() shows it on the level meter.
+void queue_levelmeter(float level);
+
+// Print the queued messages, coalescing repeats and limiting the rate. Call this periodically from the main thread.
+void drain();
+
+// Pass each queued message drain() prints to forward too, on the main thread. NULL stops it.
+void set_forward(void (*forward)(Level level, const char *text, size_t length));
+
 } // namespace logger
 
 #endif // LOGGER_H
\ No newline at end of file
@@ -9,9 +9,10 @@
 #include <vector>
 
 #include "otojsd.h"
+#include "batch.h"
 #include "const.h"
 
-const char options_short[] = "p:fvc:r:a:o:id:l";
+const char options_short[] = "p:fvc:r:a:o:b:id:lw:L:q:t:R:CO:B:x:X:j:P:I:T:A:MU:N:";
 const struct option options_long[] = {
 	{ "port"   , required_argument, NULL, 'p' },
 	{ "findfreeport",  no_argument, NULL, 'f' },
@@ -20,9 +21,28 @@ const struct option options_long[] = {
 	{ "rate"   , required_argument, NULL, 'r' },
 	{ "allow"  , required_argument, NULL, 'a' },
 	{ "output" , required_argument, NULL, 'o' },
+	{ "bits"   , required_argument, NULL, 'b' },
 	{ "enable-input",  no_argument, NULL, 'i' },
 	{ "document-root", required_argument, NULL, 'd' },
 	{ "level-meter"  , no_argument, NULL, 'l' },
+	{ "warmup" , required_argument, NULL, 'w' },
+	{ "lookahead-ms"  , required_argument, NULL, 'L' },
+	{ "render-quantum", required_argument, NULL, 'q' },
+	{ "render-timeout", required_argument, NULL, 't' },
+	{ "retro-minutes" , required_argument, NULL, 'R' },
+	{ "retro-compact" , no_argument,       NULL, 'C' },
+	{ "capture-output", required_argument, NULL, 'O' },
+	{ "backend", required_argument, NULL, 'B' },
+	{ "offline", required_argument, NULL, 'x' },
+	{ "batch"  , required_argument, NULL, 'X' },
+	{ "jobs"   , required_argument, NULL, 'j' },
+	{ "publish" , required_argument, NULL, 'P' },
+	{ "shm-input", required_argument, NULL, 'I' },
+	{ "rt-priority" , required_argument, NULL, 'T' },
+	{ "cpu-affinity", required_argument, NULL, 'A' },
+	{ "mlock"  ,       no_argument, NULL, 'M' },
+	{ "osc-port"  , required_argument, NULL, 'U' },
+	{ "osc-params", required_argument, NULL, 'N' },
 };
 
 char errortext[256];
@@ -48,7 +68,7 @@ int main(int argc, char **argv, char **env) {
 				options.verbose = true;
 				break;
 			case 'c':
-				options.channel = options_integer(optarg, 1, 128, "-c, --channel");
+				options.channel = options_integer(optarg, 1, MAX_CHANNELS, "-c, --channel");
 				break;
 			case 'r':
 				options.sample_rate = options_integer(optarg, 1, 192000, "-r, --rate");
@@ -62,6 +82,11 @@ int main(int argc, char **argv, char **env) {
 			case 'o':
 				options.output = optarg;
 				break;
+			case 'b':
+				options.bits = options_integer(optarg, 16, 32, "-b, --bits");
+				if (options.bits != 16 && options.bits != 24 && options.bits != 32)
+					die("-b, --bits parameter is 16, 24 or 32.");
+				break;
 			case 'i':
 				options.enable_input = true;
 				break;
@@ -71,10 +96,79 @@ int main(int argc, char **argv, char **env) {
 			case 'l':
 				options.level_meter = true;
 				break;
+			case 'w':
+				options.warmup = options_integer(optarg, 0, 100000, "-w, --warmup");
+				break;
+			case 'L':
+				options.lookahead_ms = options_integer(optarg, 0, 1000, "-L, --lookahead-ms");
+				break;
+			case 'q':
+				options.render_quantum = options_integer(optarg, 16, 8192, "-q, --render-quantum");
+				break;
+			case 't':
+				options.render_timeout = options_integer(optarg, 0, 1000, "-t, --render-timeout");
+				break;
+			case 'R':
+				options.retro_minutes = options_integer(optarg, 0, 600, "-R, --retro-minutes");
+				break;
+			case 'C':
+				options.retro_compact = true;
+				break;
+			case 'O':
+				options.capture_output = optarg;
+				break;
+			case 'B':
+				options.audio_backend = optarg;
+				break;
+			case 'x':
+				options.offline = options_integer(optarg, 0, 86400, "-x, --offline");
+				break;
+			case 'X':
+				options.batch_output = optarg;
+				break;
+			case 'j':
+				options.jobs = options_integer(optarg, 0, 256, "-j, --jobs");
+				break;
+			case 'P':
+				options.shm_output = optarg;
+				break;
+			case 'I':
+				options.shm_inputs = optarg;
+				break;
+			case 'T':
+				options.rt_priority = options_integer(optarg, 0, 99, "-T, --rt-priority");
+				break;
+			case 'A':
+				options.cpu_affinity = optarg;
+				break;
+			case 'M':
+				options.lock_memory = true;
+				break;
+			case 'U':
+				options.osc_port = options_integer(optarg, 1, 65535, "-U, --osc-port");
+				break;
+			case 'N':
+				options.osc_params = optarg;
+				break;
 		}
 	}
 
 	std::vector<std::string> start_codes;
+	if (options.batch_output) {
+		// batch: the .js files are the scripts, the others are the sound files to process.
+		std::vector<std::string> inputs;
+		for (int i = optind; i < argc; i++) {
+			length = strlen(argv[i]);
+			if (length > 3 && strcmp(argv[i] + length - 3, ".js") == 0) {
+				start_codes.push_back(argv[i]);
+			} else {
+				inputs.push_back(argv[i]);
+			}
+		}
+		if (start_codes.empty() || inputs.empty())
+			die("-X, --batch needs the script files (.js) and the sound files to process.");
+		return batch_run(&options, start_codes, inputs, argv[0]) == 0 ? 0 : 1;
+	}
 	if (optind < argc) {
 		for (int i = optind; i < argc; i++) {
 			start_codes.push_back(argv[i]);
@@ -0,0 +1,258 @@
+// otojsd::oscserver - OSC over UDP into a block of named float parameters, read by the render function as they are.
+// A message sets the parameter named by its address without the leading slash to its first argument
+// (f, i, d, h, T or F), /cutoff 0.5 sets "cutoff". A new name takes the next free index, so controllers
+// need no setup. Bundles are applied on arrival, their time tags are ignored.
+// The listener thread only stores a float, the render function never waits for it nor sees a lock.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <string>
+#include <format>
+#include "oscserver.h"
+#include "logger.h"
+
+// the largest UDP payload
+#define PACKET_SIZE 65536
+// interval the listener checks for stopping
+#define POLL_MS 200
+// nested bundles followed at most
+#define BUNDLE_DEPTH_MAX 8
+
+// ------------------------------------------------------ private functions
+void *OscServer__listen(void *arg);
+bool OscServer__packet(OscServer *self, const char *data, size_t size, int depth);
+bool OscServer__message(OscServer *self, const char *data, size_t size);
+long OscServer__string(const char *data, size_t size, size_t position);
+uint32_t OscServer__read32(const char *data);
+uint64_t OscServer__read64(const char *data);
+
+// ---------------------------------------------- implimentation
+
+OscServer *OscServer_create(float *values, const char *names) {
+	OscServer *self = new OscServer;
+	self->values = values;
+	self->count = 0;
+	self->fd = -1;
+	self->started = false;
+	self->running = false;
+	self->applied = 0;
+	self->ignored = 0;
+	pthread_mutex_init(&self->mutex, NULL);
+	if ( names ) {
+		std::string list = names;
+		size_t start = 0;
+		while ( start <= list.size() ) {
+			size_t end = list.find(',', start);
+			if ( end == std::string::npos ) end = list.size();
+			std::string name = list.substr(start, end - start);
+			start = end + 1;
+			if ( ! name.empty() && OscServer_index(self, name.c_str(), true) < 0 ) {
+				logger::warn(std::format("OSC parameter not declared, too many or too long: {}.", name));
+			}
+		}
+	}
+	return self;
+}
+
+bool OscServer_start(OscServer *self, int port, struct in_addr allow_addr, struct in_addr allow_mask) {
+	self->allow_addr = allow_addr;
+	self->allow_mask = allow_mask;
+	self->fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if ( self->fd < 0 ) {
+		perror("OSC socket failed.");
+		return false;
+	}
+	struct sockaddr_in saddr;
+	memset(&saddr, 0, sizeof(saddr));
+	saddr.sin_family = AF_INET;
+	saddr.sin_addr.s_addr = INADDR_ANY;
+	saddr.sin_port = htons(port);
+	if ( bind(self->fd, (struct sockaddr *)&saddr, sizeof(saddr)) < 0 ) {
+		perror("OSC bind failed.");
+		close(self->fd);
+		self->fd = -1;
+		return false;
+	}
+	self->running = true;
+	if ( pthread_create(&self->thread, NULL, OscServer__listen, self) != 0 ) {
+		printf("failed to start the OSC listener.\n");
+		self->running = false;
+		return false;
+	}
+	self->started = true;
+	logger::log(std::format("OSC listening UDP port {}, {} parameters declared.", port, OscServer_count(self)));
+	return true;
+}
+
+int OscServer_index(OscServer *self, const char *name, bool add) {
+	// the names below the count are complete, a lookup of a known name needs no lock.
+	int count = self->count.load(std::memory_order_acquire);
+	for ( int i = 0; i < count; i++ ) {
+		if ( strcmp(self->names[i], name) == 0 ) return i;
+	}
+	if ( ! add || strlen(name) >= OSCSERVER_NAME_SIZE ) return -1;
+	pthread_mutex_lock(&self->mutex);
+	// added by the other thread meanwhile?
+	int index = -1;
+	for ( int i = count; i < self->count.load(std::memory_order_relaxed); i++ ) {
+		if ( strcmp(self->names[i], name) == 0 ) index = i;
+	}
+	if ( index < 0 && self->count.load(std::memory_order_relaxed) < OSCSERVER_PARAMS_MAX ) {
+		index = self->count.load(std::memory_order_relaxed);
+		snprintf(self->names[index], OSCSERVER_NAME_SIZE, "%s", name);
+		self->count.store(index + 1, std::memory_order_release);
+	}
+	pthread_mutex_unlock(&self->mutex);
+	return index;
+}
+
+int OscServer_count(OscServer *self) {
+	return self->count.load(std::memory_order_acquire);
+}
+
+const char *OscServer_name(OscServer *self, int index) {
+	return self->names[index];
+}
+
+void OscServer_destroy(OscServer *self) {
+	if ( self->started ) {
+		self->running = false;
+		pthread_join(self->thread, NULL);
+		logger::log(std::format("OSC: {} messages applied, {} ignored.", self->applied.load(), self->ignored.load()));
+	}
+	if ( self->fd >= 0 ) {
+		close(self->fd);
+	}
+	pthread_mutex_destroy(&self->mutex);
+	delete self;
+}
+
+void *OscServer__listen(void *arg) {
+	OscServer *self = (OscServer *)arg;
+	char *packet = (char *)malloc(PACKET_SIZE);
+	while ( self->running ) {
+		struct pollfd waiting = { self->fd, POLLIN, 0 };
+		int ready = poll(&waiting, 1, POLL_MS);
+		if ( ready <= 0 ) {
+			if ( ready < 0 && errno != EINTR ) {
+				perror("OSC poll failed.");
+				break;
+			}
+			continue;
+		}
+		struct sockaddr_in caddr;
+		socklen_t caddr_size = sizeof(caddr);
+		ssize_t size = recvfrom(self->fd, packet, PACKET_SIZE, 0, (struct sockaddr *)&caddr, &caddr_size);
+		if ( size < 0 ) continue;
+		if ( (caddr.sin_addr.s_addr & self->allow_mask.s_addr) != self->allow_addr.s_addr ) {
+			self->ignored++;
+			logger::queue_format(logger::LEVEL_WARN, "OSC packet from forbidden address {} ignored.", (const char *)inet_ntoa(caddr.sin_addr));
+			continue;
+		}
+		if ( ! OscServer__packet(self, packet, size, 0) ) {
+			self->ignored++;
+		}
+	}
+	free(packet);
+	return NULL;
+}
+
+// A message, or a bundle of packets each after its size. Returns false if it is ignored,
+// a bundle counts its ignored elements itself.
+bool OscServer__packet(OscServer *self, const char *data, size_t size, int depth) {
+	if ( size >= 16 && memcmp(data, "#bundle", 8) == 0 ) {
+		if ( depth >= BUNDLE_DEPTH_MAX ) return false;
+		// after the time tag
+		size_t position = 16;
+		while ( position + 4 <= size ) {
+			size_t element = OscServer__read32(data + position);
+			position += 4;
+			if ( element > size - position ) return false;
+			if ( ! OscServer__packet(self, data + position, element, depth + 1) ) {
+				self->ignored++;
+			}
+			position += element;
+		}
+		return true;
+	}
+	return OscServer__message(self, data, size);
+}
+
+bool OscServer__message(OscServer *self, const char *data, size_t size) {
+	long address_end = OscServer__string(data, size, 0);
+	if ( address_end < 0 || data[0] != '/' ) return false;
+	long tags_end = OscServer__string(data, size, address_end);
+	if ( tags_end < 0 || data[address_end] != ',' ) return false;
+	const char *argument = data + tags_end;
+	size_t left = size - tags_end;
+	float value;
+	switch ( data[address_end + 1] ) {
+	case 'f': {
+		if ( left < 4 ) return false;
+		uint32_t bits = OscServer__read32(argument);
+		memcpy(&value, &bits, sizeof(value));
+		break;
+	}
+	case 'i':
+		if ( left < 4 ) return false;
+		value = (float)(int32_t)OscServer__read32(argument);
+		break;
+	case 'd': {
+		if ( left < 8 ) return false;
+		uint64_t bits = OscServer__read64(argument);
+		double number;
+		memcpy(&number, &bits, sizeof(number));
+		value = (float)number;
+		break;
+	}
+	case 'h':
+		if ( left < 8 ) return false;
+		value = (float)(int64_t)OscServer__read64(argument);
+		break;
+	case 'T':
+		value = 1.0f;
+		break;
+	case 'F':
+		value = 0.0f;
+		break;
+	default:
+		return false;
+	}
+	const char *name = data + 1;
+	int count = OscServer_count(self);
+	int index = OscServer_index(self, name, true);
+	if ( index < 0 ) {
+		logger::queue_format(logger::LEVEL_WARN, "OSC parameter {} ignored, no room for it.", name);
+		return false;
+	}
+	if ( index >= count ) {
+		logger::queue_format(logger::LEVEL_INFO, "OSC parameter {}: {}.", index, name);
+	}
+	// an aligned float store is a single write on the supported CPUs, the render function reads either value.
+	self->values[index] = value;
+	self->applied++;
+	return true;
+}
+
+// The position after the NUL padded string at position, or -1 if it overruns the data.
+long OscServer__string(const char *data, size_t size, size_t position) {
+	const char *end = (const char *)memchr(data + position, '\0', size - position);
+	if ( ! end ) return -1;
+	size_t next = ((end - data) + 4) & ~(size_t)3;
+	return next <= size ? (long)next : -1;
+}
+
+uint32_t OscServer__read32(const char *data) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	return (uint32_t)bytes[0] << 24 | (uint32_t)bytes[1] << 16 | (uint32_t)bytes[2] << 8 | bytes[3];
+}
+
+uint64_t OscServer__read64(const char *data) {
+	return (uint64_t)OscServer__read32(data) << 32 | OscServer__read32(data + 4);
+}
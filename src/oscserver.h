@@ -0,0 +1,47 @@
+#ifndef OSCSERVER_H
+#define OSCSERVER_H
+// otojsd::oscserver - OSC over UDP into a block of named float parameters, read by the render function as they are.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <netinet/in.h>
+#include <atomic>
+
+// parameters in the block
+#define OSCSERVER_PARAMS_MAX 256
+// longest name, with the NUL
+#define OSCSERVER_NAME_SIZE 64
+
+typedef struct {
+	// the parameter block, OSCSERVER_PARAMS_MAX floats allocated by the script engine.
+	// Written by the listener thread and read by the render function without locking.
+	float *values;
+	// names by index, added (under mutex) and never removed, so a name once read stays valid
+	char names[OSCSERVER_PARAMS_MAX][OSCSERVER_NAME_SIZE];
+	std::atomic<int> count;
+	pthread_mutex_t mutex;
+	// the listener
+	int fd;
+	struct in_addr allow_addr;
+	struct in_addr allow_mask;
+	pthread_t thread;
+	bool started;
+	std::atomic<bool> running;
+	// messages applied, and those ignored: not allowed, malformed, of unsupported types or over the parameters
+	std::atomic<uint64_t> applied;
+	std::atomic<uint64_t> ignored;
+} OscServer;
+
+// The names are the declared parameters, comma separated (may be NULL), given the first indices in order.
+OscServer *OscServer_create(float *values, const char *names);
+// Listen to the UDP port, accepting the packets from the addresses allowed for the code server.
+bool OscServer_start(OscServer *self, int port, struct in_addr allow_addr, struct in_addr allow_mask);
+// The index of the parameter, added if add is true and there is room. -1 if not found. From any thread.
+int OscServer_index(OscServer *self, const char *name, bool add);
+// The parameters so far, from any thread. The names below the count do not change.
+int OscServer_count(OscServer *self);
+const char *OscServer_name(OscServer *self, int index);
+void OscServer_destroy(OscServer *self);
+
+#endif
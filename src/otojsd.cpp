@@ -2,20 +2,59 @@
 
 #include "logger.h"
 
+#ifdef __APPLE__
 #include <CoreFoundation/CoreFoundation.h>
+#endif
 #include <pthread.h>
+#include <signal.h>
+#include <limits.h>
+#include <time.h>
+#include <atomic>
+#include <chrono>
 #include <format>
 
 #include "otojsd.h"
 #include "script_engine.h"
 #include "codeserver.h"
 #include "audiounit.h"
-#include "aiffrecorder.h"
+#include "soundrecorder.h"
+#include "asyncrecorder.h"
+#include "retrocapture.h"
+#include "shmport.h"
+#include "oscserver.h"
+#include "audiostream.h"
+#include "realtime.h"
+#include "audio_kernels.h"
+#include "const.h"
+#include "spsc_ring.h"
+#include "watchdog.h"
 
 // ------------------------------------------------------ private functions
 void script_audio_callback(AudioBuffer *outbuf, UInt32 frames, UInt32 channels);
-const char *script_code_liveeval(const char *code);
-
+void lookahead_audio_callback(AudioBuffer *outbuf, UInt32 frames, UInt32 channels);
+void render_block(UInt32 frames, UInt32 channels, Float32 *const *buffers);
+void record_output(const Float32 *output, bool planar, UInt32 frames, UInt32 channels);
+void read_port_inputs(RenderBuffers io, UInt32 frames, UInt32 channels);
+void shm_ports_start(otojsd_options *options);
+void shm_ports_stop();
+void osc_params_start(otojsd_options *options);
+void osc_params_sync();
+void *render_thread_main(void *arg);
+void render_thread_start(int lookahead_ms, int quantum);
+void render_thread_stop();
+void render_watchdog_timeout(void *arg);
+codeserver_result script_code_liveeval(const char *code);
+codeserver_result script_control_command(const char *method, const char *path, const char *body);
+codeserver_result capture_command(const char *body);
+bool stream_request(int conn_fd, const char *path, char **error);
+void publish_log(logger::Level level, const char *text, size_t length);
+void publish_meter(unsigned int underruns, uint64_t overflows);
+double elapsed_ms(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to);
+std::string allocator_report();
+std::string sample_cache_report();
+
+void otojsd__serve(otojsd_options *options);
+void otojsd__offline(otojsd_options *options);
 void otojsd__stop(int sig);
 
 // ------------------------------------------------ otojsd implimentation
@@ -23,10 +62,35 @@ void otojsd__stop(int sig);
 ScriptEngine *se;
 
 codeserver *cs;
-AiffRecorder *ar;
+// the recorder is written by its own thread, the audio path only queues the samples.
+AsyncRecorder *ar;
+// offline mode writes the file directly, as fast as it renders
+SoundRecorder *offline_file;
+// the last minutes of output, saved by POST /otojsd/capture
+RetroCapture *rc;
+const char *capture_output;
+int capture_bits;
+// the output streamed to HTTP listeners by GET /otojsd/stream.wav
+AudioStream *as = NULL;
 float *recordBuffer;
+// frames interleaved into recordBuffer at once
+#define RECORD_BUFFER_FRAMES 512
+
+// shared memory ports: the output is published to shm_output, and shm_inputs are passed to the render function.
+#define SHM_INPUTS_MAX 8
+ShmPort *shm_output = NULL;
+ShmPort *shm_inputs[SHM_INPUTS_MAX];
+int shm_input_count = 0;
+// interleaved block read from an input port, split into channels for oto_render_planar
+Float32 *shm_block;
+Float32 *shm_channels[MAX_CHANNELS];
 bool running = false;
 
+// named float parameters set by OSC messages, the render function reads them from the global params.
+OscServer *osc = NULL;
+// parameters named in param_index of the engine so far
+int osc_params_named = 0;
+
 pthread_mutex_t mutex_for_script_engine;
 pthread_cond_t cond_for_script_engine;
 
@@ -36,153 +100,897 @@ bool input_enabled;
 
 bool level_meter_enabled = false;
 
+// the peak of the output since the last meter message to the WebSocket clients, measured while some are connected.
+std::atomic<bool> telemetry_enabled(false);
+std::atomic<float> telemetry_peak(0.0f);
+#define TELEMETRY_INTERVAL_MS 100
+
+int warmup_calls;
+int sample_rate;
+int channel_count;
+// frames of the latest audio callback, the warm-up renders the same shape.
+unsigned int last_frames = 512;
+
+// terminates render calls running longer than render_timeout times the block duration
+watchdog *wd = NULL;
+int render_timeout;
+// render calls terminated in a row, the render function is disabled when it reaches RENDER_OVERRUNS_MAX.
+int render_overruns = 0;
+#define RENDER_OVERRUNS_MAX 3
+
+// channel pointers of the device buffers and of the planar output being recorded
+Float32 *device_channels[MAX_CHANNELS];
+const Float32 *record_channels[MAX_CHANNELS];
+
+// lookahead mode: the render thread renders ahead into output_ring, the audio callback only copies.
+bool lookahead_enabled = false;
+pthread_t render_thread;
+std::atomic<bool> render_thread_running(false);
+// interleaved samples from the render thread to the audio callback, and the input the other way.
+SpscRing<Float32> *output_ring;
+SpscRing<Float32> *input_ring;
+// rendering runs while output_ring holds less than this many samples.
+size_t lookahead_samples;
+unsigned int render_quantum;
+// planar buffers the render thread renders into, and the interleaved copy for the rings
+Float32 *render_planar;
+Float32 *render_interleaved;
+Float32 *render_channels[MAX_CHANNELS];
+// interleaved samples the audio callback moves from/to the rings at once
+#define LOOKAHEAD_CHUNK_FRAMES 512
+Float32 *lookahead_chunk;
+Float32 *lookahead_channels[MAX_CHANNELS];
+// counts blocks the audio callback consumed, the render thread waits on it.
+std::atomic<unsigned int> blocks_consumed(0);
+// set while the render thread waits, so the audio callback makes the wake-up call only then.
+std::atomic<bool> render_thread_waiting(false);
+// counts audio callbacks which found output_ring short.
+std::atomic<unsigned int> underruns(0);
+
 void otojsd_start(otojsd_options *options, std::vector<std::string> start_codes, const char *exec_path, char **env) {
 	logger::log(std::format("otojsd - Otojs sound server - port: {}, allowed clients: {}.", options->port, options->allow_pattern));
 	if (strcmp(options->allow_pattern, OTOJSD_DEFAULT_IPMASK) != 0) {
 		logger::warn("Otojsd will run code sent from other devices.");
 	}
 
+	if (options->offline == 0) {
+		as = AudioStream_create(options->channel, options->sample_rate);
+	}
+	if (options->output || options->retro_minutes > 0 || options->shm_output || as) {
+		recordBuffer = (float *)malloc(RECORD_BUFFER_FRAMES * options->channel * sizeof(float));
+	}
 	if (options->output) {
 		logger::log(std::format("recording: {}.", options->output));
-		recordBuffer = (float *)malloc(options->channel);
-		ar = AiffRecorder_create(options->channel, 32, options->sample_rate);
-		AiffRecorder_open(ar, options->output);
+		SoundRecorder *file = SoundRecorder_create(options->channel, options->bits, options->sample_rate);
+		if (file && SoundRecorder_open(file, options->output)) {
+			if (options->offline > 0) {
+				offline_file = file;
+			} else {
+				ar = AsyncRecorder_create(file, options->channel, options->sample_rate);
+			}
+		} else {
+			logger::error(std::format("failed to start recording: {}.", options->output));
+			if (file) SoundRecorder_destroy(file);
+			ar = NULL;
+		}
 	}else{
 		ar = NULL;
 	}
+	rc = NULL;
+	if (options->retro_minutes > 0) {
+		rc = RetroCapture_create(options->channel, options->sample_rate, options->retro_minutes * 60, options->retro_compact);
+		if (rc) {
+			double minute_bytes = 60.0 * options->sample_rate * (options->retro_compact ? sizeof(int16_t) : sizeof(float));
+			logger::log(std::format("retro capture: last {} minutes in {:.1f} MiB ({:.2f} MiB per minute and channel).",
+				options->retro_minutes, RetroCapture_bytes(rc) / 1048576.0, minute_bytes / 1048576.0));
+		} else {
+			logger::error("failed to start retro capture.");
+		}
+		capture_output = options->capture_output;
+		capture_bits = options->bits;
+	}
 
 	input_enabled = options->enable_input;
 
 	level_meter_enabled = options->level_meter;
 
-	pthread_mutex_init( &mutex_for_script_engine , NULL );
+	warmup_calls = options->warmup;
+	sample_rate = options->sample_rate;
+	channel_count = options->channel;
+	render_timeout = options->render_timeout;
+	if (!realtime_configure(options->rt_priority, options->cpu_affinity)) {
+		logger::error(std::format("-A, --cpu-affinity is a list of CPUs like 2,3 or 2-3: {}.", options->cpu_affinity));
+		realtime_configure(options->rt_priority, NULL);
+	}
+
+	logger::info(std::format("audio kernels: {}.", audio_kernels::initialize()));
+
+	if (options->rt_priority > 0) {
+		// the real-time audio and render threads wait for the engine held by normal threads (eval, jobs, OSC),
+		// which run at their priority meanwhile instead of being preempted by the threads in between.
+		pthread_mutexattr_t mutex_attr;
+		pthread_mutexattr_init(&mutex_attr);
+		if (pthread_mutexattr_setprotocol(&mutex_attr, PTHREAD_PRIO_INHERIT) != 0) {
+			logger::warn("priority inheritance is not available for the script engine lock.");
+		}
+		pthread_mutex_init( &mutex_for_script_engine , &mutex_attr );
+		pthread_mutexattr_destroy(&mutex_attr);
+	} else {
+		pthread_mutex_init( &mutex_for_script_engine , NULL );
+	}
 	pthread_cond_init( &cond_for_script_engine, NULL );
 
-	se = new ScriptEngine(exec_path);
+	if (warmup_calls > 0) {
+		// to read the optimization status of the warmed-up render function.
+		ScriptEngine::setFlags("--allow-natives-syntax");
+	}
+	ScriptEngine::initializePlatform(exec_path);
+	se = new ScriptEngine();
+	// the warm-up replays the scripts, they are kept only for it.
+	se->setReplayHistory(warmup_calls > 0);
 	se->setGlobalVariable("sample_rate", options->sample_rate);
+	shm_ports_start(options);
+	osc_params_start(options);
+	// offline rendering has no deadline, a heavy render function only takes longer.
+	if (render_timeout > 0 && options->offline == 0) {
+		wd = watchdog_start(render_watchdog_timeout, NULL);
+	}
 
 	for (std::string code : start_codes) {
 		logger::log(std::format("loading start code: {}.", code));
 		const char *error_message = se->executeFromFile(code.c_str());
 		if (error_message) {
 			logger::error(error_message);
-			delete error_message;
+			free((void *)error_message);
 		}
 	}
 
 	has_runtime_error = false;
-	audiounit_start(options->enable_input, options->channel, options->sample_rate, script_audio_callback);
+	if (options->offline > 0) {
+		otojsd__offline(options);
+	} else {
+		otojsd__serve(options);
+	}
+	if (wd) {
+		watchdog_stop(wd);
+	}
+
+	if (ar) {
+		AsyncRecorder_destroy(ar);
+	}
+	if (rc) {
+		RetroCapture_destroy(rc);
+	}
+	if (as) {
+		AudioStream_destroy(as);
+	}
+	shm_ports_stop();
+	if (osc) {
+		// before the engine, which owns the parameter block.
+		OscServer_destroy(osc);
+	}
+	free(recordBuffer);
+
+	logger::log(allocator_report());
+	logger::log(sample_cache_report());
+	delete se;
+	ScriptEngine::disposePlatform();
+
+	pthread_mutex_destroy( &mutex_for_script_engine );
+	pthread_cond_destroy( &cond_for_script_engine );
 
-	cs = codeserver_init(options->port, options->findfreeport, options->allow_pattern, options->verbose, options->document_root, script_code_liveeval);
-	running = codeserver_start(cs);
+	logger::drain();
+	logger::log("otojsd - stopped.");
+}
+
+// Run the audio device and the code server until stopped.
+void otojsd__serve(otojsd_options *options) {
+	bool audio_started;
+	if (options->lookahead_ms > 0) {
+		render_thread_start(options->lookahead_ms, options->render_quantum);
+		audio_started = audiounit_start(options->audio_backend, options->enable_input, options->channel, options->sample_rate, options->bits, lookahead_audio_callback);
+	} else {
+		audio_started = audiounit_start(options->audio_backend, options->enable_input, options->channel, options->sample_rate, options->bits, script_audio_callback);
+	}
+	if (!audio_started) {
+		logger::error(std::format("failed to start the audio backend, built in: {}.", audiounit_backends()));
+	}
+	if (options->lock_memory) {
+		// the engine, the start codes and the audio buffers are all mapped by now.
+		realtime_lock_memory();
+	}
+
+	cs = codeserver_init(options->port, options->findfreeport, options->allow_pattern, options->verbose, options->document_root, script_code_liveeval, script_control_command, stream_request);
+	running = codeserver_start(cs) && audio_started;
+	if (osc && !OscServer_start(osc, options->osc_port, cs->allow_addr, cs->allow_mask)) {
+		logger::error(std::format("failed to listen to OSC on UDP port {}.", options->osc_port));
+	}
 	
 	if (SIG_ERR == signal(SIGINT, otojsd__stop)) {
 		logger::error("failed to set signal handler.");
 		running = false;
 	}
+	logger::set_forward(publish_log);
 
+	unsigned int underruns_reported = 0;
+	uint64_t overflows_reported = 0;
+	auto telemetry_sent = std::chrono::steady_clock::now();
 	while(running){
-		CFRunLoopRunInMode(kCFRunLoopDefaultMode, 0.1, false);
-		if (!codeserver_run(cs)) {
+#ifdef __APPLE__
+		CFRunLoopRunInMode(kCFRunLoopDefaultMode, 0.01, false);
+#endif
+		// waits for the requests instead of sleeping, so that a request is handled as soon as it arrives.
+		if (!codeserver_run(cs, 100)) {
 			running = false;
 		}
+		unsigned int underruns_now = underruns.load(std::memory_order_relaxed);
+		if (underruns_now != underruns_reported) {
+			logger::warn(std::format("render thread fell behind: {} underruns so far.", underruns_now));
+			underruns_reported = underruns_now;
+		}
+		uint64_t overflows_now = ar ? AsyncRecorder_overflows(ar) : 0;
+		if (overflows_now != overflows_reported) {
+			logger::warn(std::format("recording fell behind: {} frames lost so far.", overflows_now));
+			overflows_reported = overflows_now;
+		}
+		if (osc && OscServer_count(osc) > osc_params_named) {
+			pthread_mutex_lock(&mutex_for_script_engine);
+			osc_params_sync();
+			pthread_mutex_unlock(&mutex_for_script_engine);
+		}
+		// print what the audio and render threads logged meanwhile.
+		logger::drain();
+		telemetry_enabled.store(codeserver_websockets(cs) > 0, std::memory_order_relaxed);
+		auto now = std::chrono::steady_clock::now();
+		if (telemetry_enabled.load(std::memory_order_relaxed) && elapsed_ms(telemetry_sent, now) >= TELEMETRY_INTERVAL_MS) {
+			publish_meter(underruns_now, overflows_now);
+			telemetry_sent = now;
+		}
 	}
 	
+	logger::set_forward(NULL);
+	telemetry_enabled = false;
 	codeserver_stop(cs);
 
 	audiounit_stop();
-
-	if (ar) {
-		AiffRecorder_close(ar);
-		AiffRecorder_destroy(ar);
-		free(recordBuffer);
+	if (lookahead_enabled) {
+		render_thread_stop();
 	}
+}
 
-	delete se;
-
-	pthread_mutex_destroy( &mutex_for_script_engine );
-	pthread_cond_destroy( &cond_for_script_engine );
+// Render the seconds as fast as the CPU allows, without the audio device nor the code server,
+// into the output file if given.
+void otojsd__offline(otojsd_options *options) {
+	UInt32 channels = channel_count;
+	UInt32 quantum = options->render_quantum;
+	uint64_t total = (uint64_t)options->offline * sample_rate;
+	Float32 *planar = (Float32 *)malloc((size_t)quantum * channels * sizeof(Float32));
+	Float32 *interleaved = (Float32 *)malloc((size_t)quantum * channels * sizeof(Float32));
+	Float32 *buffers[MAX_CHANNELS];
+	const Float32 *sources[MAX_CHANNELS];
+	for (UInt32 channel = 0; channel < channels; channel++) {
+		buffers[channel] = planar + channel * quantum;
+		sources[channel] = buffers[channel];
+	}
+	// no input device, and the same render each run
+	input_enabled = false;
 
-	logger::log("otojsd - stopped.");
+	running = true;
+	if (SIG_ERR == signal(SIGINT, otojsd__stop)) {
+		logger::error("failed to set signal handler.");
+	}
+	logger::log(std::format("offline: rendering {} seconds, {} frames per call.", options->offline, quantum));
+
+	auto started = std::chrono::steady_clock::now();
+	uint64_t done = 0;
+	while (done < total && running) {
+		UInt32 frames = total - done < quantum ? (UInt32)(total - done) : quantum;
+		// a failed render call leaves silence, not the previous block.
+		memset(planar, 0, (size_t)quantum * channels * sizeof(Float32));
+		render_block(frames, channels, buffers);
+		if (offline_file) {
+			audio_kernels::interleave(interleaved, sources, frames, channels);
+			if (!SoundRecorder_write(offline_file, interleaved, frames)) {
+				logger::error("offline: failed to write the output, stopped.");
+				running = false;
+			}
+		}
+		// print the render errors every second of output.
+		if ((done + frames) / sample_rate != done / sample_rate) {
+			logger::drain();
+		}
+		done += frames;
+	}
+	double elapsed = elapsed_ms(started, std::chrono::steady_clock::now()) / 1000.0;
+	double seconds = (double)done / sample_rate;
+	logger::drain();
+	logger::log(std::format("offline: rendered {:.1f} seconds in {:.2f} seconds, {:.1f} times realtime ({:.0f} samples/s).",
+		seconds, elapsed, elapsed > 0 ? seconds / elapsed : 0.0, elapsed > 0 ? done * channels / elapsed : 0.0));
+
+	if (offline_file) {
+		SoundRecorder_close(offline_file);
+		SoundRecorder_destroy(offline_file);
+		offline_file = NULL;
+	}
+	free(planar);
+	free(interleaved);
 }
 
 void otojsd__stop(int sig) {
 	running = false;
+	// a second one ends the process, for a render call which never returns (offline, without the watchdog).
+	signal(sig, SIG_DFL);
 }
 
 void script_audio_callback(AudioBuffer *outbuf, UInt32 frames, UInt32 channels) {
-	UInt32 channel, frame;
+	realtime_thread_enter("audio", true);
+	if (channels > MAX_CHANNELS) {
+		channels = MAX_CHANNELS;
+	}
+	for (UInt32 channel = 0; channel < channels; channel++) {
+		device_channels[channel] = (Float32 *)outbuf[channel].mData;
+	}
+
 	pthread_mutex_lock( &mutex_for_script_engine );
+	last_frames = frames;
+	render_block(frames, channels, device_channels);
+	pthread_mutex_unlock( &mutex_for_script_engine );
+	pthread_cond_signal( &cond_for_script_engine );
+}
 
-	size_t data_size = frames * channels * sizeof(Float32);
-	Float32 *inoutbuf = new Float32[frames * channels];
+// Render a block with the script engine: read the input from the planar buffers if enabled, and write the output to them.
+// Call this while holding the engine.
+void render_block(UInt32 frames, UInt32 channels, Float32 *const *buffers) {
+	UInt32 channel;
 
-	// copy input buffer to inoutbuf
-	if (input_enabled) {
-		int i = 0;
-		for (frame = 0; frame < frames; frame++) {
-			for (channel = 0; channel < channels; channel++) {
-				inoutbuf[i++] = ((Float32 *)( outbuf[channel].mData ))[frame];
-			}
+	// buffers shared with the script engine, reused every callback
+	RenderBuffers io = se->buffers(frames, channels);
+
+	// copy input buffer to io.input
+	if (input_enabled && io.planar) {
+		for (channel = 0; channel < channels; channel++) {
+			memcpy(io.input + channel * frames, buffers[channel], frames * sizeof(Float32));
 		}
+	} else if (input_enabled) {
+		audio_kernels::interleave(io.input, buffers, frames, channels);
+	}
+	if (shm_input_count > 0) {
+		read_port_inputs(io, frames, channels);
 	}
 
 	// スクリプトエンジンで render() の実行（戻り値が count）
-	RenderResult result = se->executeRender(inoutbuf, frames, channels);
+	double budget_ms = 1000.0 * render_timeout * frames / sample_rate;
+	if (wd) {
+		watchdog_arm(wd, budget_ms);
+	}
+	RenderResult result = se->executeRender(frames, channels);
+	if (wd && watchdog_disarm(wd)) {
+		// the call may have returned just before the termination, do not leave it for the next call.
+		se->cancelTerminateExecution();
+		result.terminated = true;
+	}
+
+	if (result.fallback_version) {
+		logger::queue_format(logger::LEVEL_WARN, "render version {} failed, fell back to version {}.", result.failed_version, result.fallback_version);
+	}
 
 	// エラー時はエラーテキストを出力して has_runtime_error を true にセット
-	if (result.error) {
+	if (result.terminated) {
+		for (channel = 0; channel < channels; channel++) {
+			memset(buffers[channel], 0, frames * sizeof(Float32));
+		}
+		render_overruns++;
+		logger::queue_format(logger::LEVEL_ERROR, "render call exceeded {:.1f} ms and was terminated ({} in a row).", budget_ms, render_overruns);
+		if (render_overruns >= RENDER_OVERRUNS_MAX) {
+			se->disableRender();
+			render_overruns = 0;
+			logger::queue_format(logger::LEVEL_ERROR, "render function disabled after repeated overruns, post a new one to resume.");
+		}
+	} else if (result.error) {
+		// silent, also while the render function is disabled or not defined yet.
+		for (channel = 0; channel < channels; channel++) {
+			memset(buffers[channel], 0, frames * sizeof(Float32));
+		}
 		if ( ! has_runtime_error ) {
 			has_runtime_error = true;
-			logger::error(std::format("render runtime error: {}.", result.error));
+			logger::queue_format(logger::LEVEL_ERROR, "render runtime error: {}.", result.error);
 		}
 	} else {
 		has_runtime_error = false;
-		int i = 0;
-		Float32 level = 0;
-		if (ar) {
-			for (frame = 0; frame < frames; frame++) {
-				for (channel = 0; channel < channels; channel++) {
-					Float32 val = inoutbuf[i++];
-					recordBuffer[channel] = ((Float32 *)( outbuf[channel].mData ))[frame] = val;
-					if (level_meter_enabled && level < fabs(val)) { level = fabs(val); }
-					if (i >= result.count) break;
-				}
-				AiffRecorder_write32bit(ar, (uint32_t *)recordBuffer, 1);
+		render_overruns = 0;
+		int length = frames * channels;
+		if (result.count < length) {
+			// a short array from oto_render() leaves the rest silent.
+			memset(io.output + result.count, 0, (length - result.count) * sizeof(Float32));
+		}
+		if (io.planar) {
+			// the device buffers are planar too, copy each channel at once.
+			for (channel = 0; channel < channels; channel++) {
+				memcpy(buffers[channel], io.output + channel * frames, frames * sizeof(Float32));
 			}
 		} else {
-			for (frame = 0; frame < frames; frame++) {
-				for (channel = 0; channel < channels; channel++) {
-					Float32 val = inoutbuf[i++];
-					((Float32 *)( outbuf[channel].mData ))[frame] = val;
-					if (level_meter_enabled && level < fabs(val)) { level = fabs(val); }
-					if (i >= result.count) break;
+			audio_kernels::deinterleave(buffers, io.output, frames, channels);
+		}
+		if (ar || rc || shm_output || (as && AudioStream_listening(as))) {
+			record_output(io.output, io.planar, frames, channels);
+		}
+		bool telemetry = telemetry_enabled.load(std::memory_order_relaxed);
+		if (level_meter_enabled || telemetry) {
+			float peak = audio_kernels::peak(io.output, length);
+			if (level_meter_enabled) {
+				logger::queue_levelmeter(peak);
+			}
+			if (telemetry) {
+				float last = telemetry_peak.load(std::memory_order_relaxed);
+				while (peak > last && !telemetry_peak.compare_exchange_weak(last, peak, std::memory_order_relaxed)) {
 				}
 			}
 		}
-		if (level_meter_enabled) {
-			logger::levelmeter(level);
+	}
+}
+
+// Pass the rendered output to the recorder, the retro capture, the published port and the stream, interleaved.
+void record_output(const Float32 *output, bool planar, UInt32 frames, UInt32 channels) {
+	if (!planar) {
+		if (ar) AsyncRecorder_write(ar, output, frames);
+		if (rc) RetroCapture_write(rc, output, frames);
+		if (shm_output) ShmPort_write(shm_output, output, frames);
+		if (as) AudioStream_write(as, output, frames);
+		return;
+	}
+	for (UInt32 frame = 0; frame < frames; frame += RECORD_BUFFER_FRAMES) {
+		UInt32 chunk = frames - frame < RECORD_BUFFER_FRAMES ? frames - frame : RECORD_BUFFER_FRAMES;
+		for (UInt32 channel = 0; channel < channels; channel++) {
+			record_channels[channel] = output + channel * frames + frame;
 		}
+		audio_kernels::interleave(recordBuffer, record_channels, chunk, channels);
+		if (ar) AsyncRecorder_write(ar, recordBuffer, chunk);
+		if (rc) RetroCapture_write(rc, recordBuffer, chunk);
+		if (shm_output) ShmPort_write(shm_output, recordBuffer, chunk);
+		if (as) AudioStream_write(as, recordBuffer, chunk);
 	}
+}
 
-	delete[] inoutbuf;
-	
-	pthread_mutex_unlock( &mutex_for_script_engine );
-	pthread_cond_signal( &cond_for_script_engine );
+// Fill the port inputs of the render function with the latest block of each input port.
+void read_port_inputs(RenderBuffers io, UInt32 frames, UInt32 channels) {
+	for (int port = 0; port < shm_input_count; port++) {
+		Float32 *block = io.ports + port * frames * channels;
+		if (frames > SHMPORT_FRAMES) {
+			memset(block, 0, frames * channels * sizeof(Float32));
+		} else if (io.planar) {
+			ShmPort_read(shm_inputs[port], shm_block, frames);
+			for (UInt32 channel = 0; channel < channels; channel++) {
+				shm_channels[channel] = block + channel * frames;
+			}
+			audio_kernels::deinterleave(shm_channels, shm_block, frames, channels);
+		} else {
+			// interleaved, straight from the ring.
+			ShmPort_read(shm_inputs[port], block, frames);
+		}
+	}
+}
+
+// Give the engine the parameter block and listen to OSC later if -U is given, with the names declared by -N.
+void osc_params_start(otojsd_options *options) {
+	if (options->osc_port <= 0) {
+		return;
+	}
+	if (options->offline > 0) {
+		logger::warn("OSC is not listened to offline.");
+		return;
+	}
+	osc = OscServer_create(se->setParameters(OSCSERVER_PARAMS_MAX), options->osc_params);
+	osc_params_sync();
+}
+
+// Name the parameters the listener added since the last call in param_index. Call this while holding the engine.
+void osc_params_sync() {
+	int count = OscServer_count(osc);
+	for (; osc_params_named < count; osc_params_named++) {
+		se->setParameterIndex(OscServer_name(osc, osc_params_named), osc_params_named);
+	}
+}
+
+// Create the shared memory ports of the options: the comma separated names of -I, and -P.
+void shm_ports_start(otojsd_options *options) {
+	if (options->offline > 0) {
+		if (options->shm_output || options->shm_inputs) {
+			logger::warn("shared memory ports are not used offline.");
+		}
+		return;
+	}
+	if (options->shm_output) {
+		shm_output = ShmPort_create(options->shm_output, true, options->channel, options->sample_rate);
+		if (shm_output) {
+			logger::log(std::format("publishing the output to shared memory: {}.", shm_output->name));
+		}
+	}
+	if (options->shm_inputs) {
+		std::string names = options->shm_inputs;
+		size_t start = 0;
+		while (start <= names.size() && shm_input_count < SHM_INPUTS_MAX) {
+			size_t end = names.find(',', start);
+			if (end == std::string::npos) end = names.size();
+			std::string name = names.substr(start, end - start);
+			start = end + 1;
+			if (name.empty()) continue;
+			ShmPort *port = ShmPort_create(name.c_str(), false, options->channel, options->sample_rate);
+			if (port) {
+				logger::log(std::format("input {} from shared memory: {}.", shm_input_count, port->name));
+				shm_inputs[shm_input_count++] = port;
+			}
+		}
+		if (shm_input_count > 0) {
+			shm_block = (Float32 *)malloc((size_t)SHMPORT_FRAMES * options->channel * sizeof(Float32));
+			se->setPortInputs(shm_input_count);
+		}
+	}
+}
+
+// Remove the shared memory ports, after the audio has stopped.
+void shm_ports_stop() {
+	for (int port = 0; port < shm_input_count; port++) {
+		if (shm_inputs[port]->underruns > 0 || shm_inputs[port]->overruns > 0) {
+			logger::warn(std::format("shared memory input {}: {} blocks late, {} blocks overwritten while read.",
+				shm_inputs[port]->name, shm_inputs[port]->underruns, shm_inputs[port]->overruns));
+		}
+		ShmPort_destroy(shm_inputs[port]);
+	}
+	shm_input_count = 0;
+	free(shm_block);
+	if (shm_output) {
+		ShmPort_destroy(shm_output);
+		shm_output = NULL;
+	}
+}
+
+// Called on the watchdog thread when a render call passed its deadline.
+void render_watchdog_timeout(void *) {
+	se->terminateExecution();
+}
+
+// ------------------------------------------------ lookahead mode
+
+// Render quanta ahead into output_ring until it holds the lookahead.
+void *render_thread_main(void *) {
+	realtime_thread_enter("render", false);
+	UInt32 channels = channel_count;
+	size_t quantum_samples = (size_t)render_quantum * channels;
+	while (render_thread_running) {
+		// read the counter before checking the ring, so a block consumed meanwhile wakes the wait up.
+		unsigned int consumed = blocks_consumed.load(std::memory_order_acquire);
+		if (output_ring->readable() >= lookahead_samples || output_ring->writable() < quantum_samples) {
+			// the flag is set before the wait checks the counter again, and the callback counts before it
+			// reads the flag (both seq_cst): a callback either sees the flag or its block is seen here.
+			render_thread_waiting.store(true);
+			blocks_consumed.wait(consumed, std::memory_order_seq_cst);
+			render_thread_waiting.store(false, std::memory_order_relaxed);
+			continue;
+		}
+
+		if (input_enabled) {
+			size_t count = input_ring->read(render_interleaved, quantum_samples);
+			memset(render_interleaved + count, 0, (quantum_samples - count) * sizeof(Float32));
+			audio_kernels::deinterleave(render_channels, render_interleaved, render_quantum, channels);
+		} else {
+			memset(render_planar, 0, quantum_samples * sizeof(Float32));
+		}
+
+		pthread_mutex_lock( &mutex_for_script_engine );
+		render_block(render_quantum, channels, render_channels);
+		pthread_mutex_unlock( &mutex_for_script_engine );
+		pthread_cond_signal( &cond_for_script_engine );
+
+		audio_kernels::interleave(render_interleaved, render_channels, render_quantum, channels);
+		output_ring->write(render_interleaved, quantum_samples);
+	}
+	return NULL;
+}
+
+void render_thread_start(int lookahead_ms, int quantum) {
+	UInt32 channels = channel_count;
+	render_quantum = quantum;
+	// the warm-up renders the same shape as the render thread.
+	last_frames = quantum;
+
+	size_t lookahead_frames = (size_t)lookahead_ms * sample_rate / 1000;
+	if (lookahead_frames < (size_t)quantum) {
+		lookahead_frames = quantum;
+	}
+	lookahead_samples = lookahead_frames * channels;
+	output_ring = new SpscRing<Float32>((lookahead_frames + quantum) * channels);
+	input_ring = new SpscRing<Float32>((lookahead_frames + quantum + LOOKAHEAD_CHUNK_FRAMES) * channels);
+
+	render_planar = (Float32 *)calloc((size_t)quantum * channels, sizeof(Float32));
+	render_interleaved = (Float32 *)calloc((size_t)quantum * channels, sizeof(Float32));
+	for (UInt32 channel = 0; channel < channels; channel++) {
+		render_channels[channel] = render_planar + channel * quantum;
+	}
+	lookahead_chunk = (Float32 *)calloc((size_t)LOOKAHEAD_CHUNK_FRAMES * channels, sizeof(Float32));
+
+	logger::log(std::format("render thread: lookahead {} ms ({} frames), quantum {} frames.", lookahead_ms, lookahead_frames, quantum));
+	lookahead_enabled = true;
+	render_thread_running = true;
+	// fills the lookahead before the audio starts.
+	pthread_create(&render_thread, NULL, render_thread_main, NULL);
+}
+
+void render_thread_stop() {
+	render_thread_running = false;
+	blocks_consumed.fetch_add(1, std::memory_order_release);
+	blocks_consumed.notify_one();
+	pthread_join(render_thread, NULL);
+
+	delete output_ring;
+	delete input_ring;
+	free(render_planar);
+	free(render_interleaved);
+	free(lookahead_chunk);
+	lookahead_enabled = false;
 }
 
-const char *script_code_liveeval(const char *code) {
+// Copy the samples rendered ahead to the device. Does not touch the script engine nor block.
+void lookahead_audio_callback(AudioBuffer *outbuf, UInt32 frames, UInt32 channels) {
+	realtime_thread_enter("audio", true);
+	UInt32 channel, frame, chunk;
+	if (channels > (UInt32)channel_count) {
+		channels = channel_count;
+	}
+	bool short_of_samples = false;
+	for (frame = 0; frame < frames; frame += chunk) {
+		chunk = frames - frame < LOOKAHEAD_CHUNK_FRAMES ? frames - frame : LOOKAHEAD_CHUNK_FRAMES;
+		size_t samples = (size_t)chunk * channels;
+		for (channel = 0; channel < channels; channel++) {
+			lookahead_channels[channel] = (Float32 *)outbuf[channel].mData + frame;
+		}
+
+		if (input_enabled) {
+			audio_kernels::interleave(lookahead_chunk, lookahead_channels, chunk, channels);
+			input_ring->write(lookahead_chunk, samples);
+		}
+
+		size_t count = output_ring->read(lookahead_chunk, samples);
+		if (count < samples) {
+			memset(lookahead_chunk + count, 0, (samples - count) * sizeof(Float32));
+			short_of_samples = true;
+		}
+		audio_kernels::deinterleave(lookahead_channels, lookahead_chunk, chunk, channels);
+	}
+	if (short_of_samples) {
+		underruns.fetch_add(1, std::memory_order_relaxed);
+	}
+
+	blocks_consumed.fetch_add(1);
+	// wake the render thread only if it waits and has room for a quantum now, the ring sizes seen here
+	// are exact or in favour of the room.
+	if (render_thread_waiting.load() && output_ring->readable() < lookahead_samples
+		&& output_ring->writable() >= (size_t)render_quantum * channel_count) {
+		blocks_consumed.notify_one();
+	}
+}
+
+codeserver_result script_code_liveeval(const char *code) {
+    auto time_start = std::chrono::steady_clock::now();
+
+    // parse and compile without holding the engine, the audio keeps rendering meanwhile.
+    pthread_mutex_lock(&mutex_for_script_engine);
+    ScriptEngine::CompileJob *job = se->startCompile(code);
+    pthread_mutex_unlock(&mutex_for_script_engine);
+    ScriptEngine::runCompile(job);
+    auto time_compiled = std::chrono::steady_clock::now();
+
+    // warm the new render function up in a shadow context, a slice after each audio callback.
+    std::string warmup_report;
+    if (warmup_calls > 0) {
+        pthread_mutex_lock(&mutex_for_script_engine);
+        bool compiled = se->finishCompile(job);
+        if (compiled) {
+            se->startWarmup(job, last_frames, channel_count, warmup_calls);
+        }
+        pthread_mutex_unlock(&mutex_for_script_engine);
+        if (compiled) {
+            // use half of a callback period, the other half is left for the render.
+            double budget_ms = 500.0 * last_frames / sample_rate;
+            bool over = false;
+            while (!over) {
+                pthread_mutex_lock(&mutex_for_script_engine);
+                pthread_cond_wait(&cond_for_script_engine, &mutex_for_script_engine);
+                // a runaway call in the shadow context would hold the engine as well.
+                if (wd) {
+                    watchdog_arm(wd, budget_ms + 1000.0 * render_timeout * last_frames / sample_rate);
+                }
+                over = se->stepWarmup(job, budget_ms);
+                if (wd && watchdog_disarm(wd)) {
+                    se->cancelTerminateExecution();
+                }
+                pthread_mutex_unlock(&mutex_for_script_engine);
+            }
+            pthread_mutex_lock(&mutex_for_script_engine);
+            WarmupResult warmup = se->finishWarmup(job);
+            pthread_mutex_unlock(&mutex_for_script_engine);
+            warmup_report = std::format("warmup: {:.3f} ms, {} calls, optimized in the shadow context: {}\n",
+                warmup.milliseconds, warmup.calls,
+                warmup.optimization_status < 0 ? "unknown" : warmup.optimized ? "yes" : "no");
+            if (warmup.error) {
+                warmup_report += std::format("warmup error: {}\n", warmup.error);
+                free(warmup.error);
+            }
+        }
+    }
+    auto time_warmed = std::chrono::steady_clock::now();
+
+    // run the code and swap the render function just after an audio callback.
     pthread_mutex_lock(&mutex_for_script_engine);
     pthread_cond_wait(&cond_for_script_engine, &mutex_for_script_engine);
+    auto time_locked = std::chrono::steady_clock::now();
 
-    const char *error_message = se->executeCode(code);
+    const char *error_message = se->executeCompiled(job);
 
     has_runtime_error = false;
     pthread_mutex_unlock(&mutex_for_script_engine);
+    auto time_done = std::chrono::steady_clock::now();
 
     if (error_message) {
         logger::error(error_message);
     }
 
-    return error_message;
+    std::string report = std::format("compile: {:.3f} ms, wait: {:.3f} ms, run: {:.3f} ms\n",
+        elapsed_ms(time_start, time_compiled),
+        elapsed_ms(time_warmed, time_locked),
+        elapsed_ms(time_locked, time_done));
+    report += warmup_report;
+    report += allocator_report() + "\n";
+    if (se->sampleCacheStats().samples > 0) {
+        report += sample_cache_report() + "\n";
+    }
+
+    return { (char *)error_message, strdup(report.c_str()) };
+}
+
+// Handle a request to CONTROL_PATH_PREFIX + path.
+codeserver_result script_control_command(const char *method, const char *path, const char *body) {
+    codeserver_result result = {NULL, NULL};
+    if (strcmp(method, "GET") == 0 && strcmp(path, "versions") == 0) {
+        // list the render versions, "*" marks the one playing.
+        pthread_mutex_lock(&mutex_for_script_engine);
+        std::vector<RenderVersionInfo> versions = se->renderVersions();
+        pthread_mutex_unlock(&mutex_for_script_engine);
+        std::string report;
+        for (auto &version : versions) {
+            report += std::format("{} {} {}{}\n", version.active ? "*" : " ", version.id, version.name,
+                version.failed ? " (failed)" : version.clean ? "" : " (not rendered yet)");
+        }
+        result.report = strdup(report.c_str());
+    } else if (strcmp(method, "POST") == 0 && strncmp(path, "versions/", 9) == 0) {
+        // switch to the render version, without compiling anything.
+        char *end;
+        long id = strtol(path + 9, &end, 10);
+        bool switched = false;
+        if (*end == '\0' && end != path + 9) {
+            pthread_mutex_lock(&mutex_for_script_engine);
+            switched = se->switchRenderVersion(id);
+            if (switched) {
+                has_runtime_error = false;
+            }
+            pthread_mutex_unlock(&mutex_for_script_engine);
+        }
+        if (switched) {
+            result.report = strdup(std::format("switched to render version {}.\n", id).c_str());
+        } else {
+            result.error = strdup(std::format("no render version: {}", path + 9).c_str());
+        }
+    } else if (strcmp(method, "GET") == 0 && strcmp(path, "samples") == 0) {
+        // list the files loaded by Otojs.loadSample().
+        pthread_mutex_lock(&mutex_for_script_engine);
+        std::vector<SampleInfo> samples = se->samples();
+        pthread_mutex_unlock(&mutex_for_script_engine);
+        std::string report;
+        for (auto &sample : samples) {
+            report += std::format("{} {}ch {} frames {} Hz {} hits\n",
+                sample.path, sample.channels, sample.frames, sample.sample_rate, sample.hits);
+        }
+        report += sample_cache_report() + "\n";
+        result.report = strdup(report.c_str());
+    } else if (strcmp(method, "POST") == 0 && strcmp(path, "samples/clear") == 0) {
+        pthread_mutex_lock(&mutex_for_script_engine);
+        se->clearSamples();
+        pthread_mutex_unlock(&mutex_for_script_engine);
+        result.report = strdup("sample cache cleared.\n");
+    } else if (strcmp(method, "POST") == 0 && strcmp(path, "capture") == 0) {
+        result = capture_command(body);
+    } else {
+        result.error = strdup(std::format("unknown command: {} {}{}", method, CONTROL_PATH_PREFIX, path).c_str());
+    }
+    return result;
+}
+
+// Stream the output to the connection if the path is stream, stream.wav, stream.flac or stream.raw.
+bool stream_request(int conn_fd, const char *path, char **error) {
+    if (strncmp(path, "stream", 6) != 0 || (path[6] != '\0' && path[6] != '.' && path[6] != '?')) {
+        return false;
+    }
+    if (!as) {
+        *error = strdup("stream is not available.");
+        return false;
+    }
+    return AudioStream_add(as, conn_fd, path, error);
+}
+
+// Save the last seconds given in the body (all that is kept if empty) of the retro capture to a file named by the time.
+codeserver_result capture_command(const char *body) {
+    codeserver_result result = {NULL, NULL};
+    if (!rc) {
+        result.error = strdup("retro capture is not enabled, launch with -R minutes.");
+        return result;
+    }
+    char *end;
+    long seconds = strtol(body, &end, 10);
+    while (*end == '\r' || *end == '\n' || *end == ' ') end++;
+    if (*end != '\0' || seconds < 0) {
+        result.error = strdup(std::format("capture seconds must be a number: {}", body).c_str());
+        return result;
+    }
+
+    char path[PATH_MAX];
+    time_t now = time(NULL);
+    if (strftime(path, sizeof(path), capture_output, localtime(&now)) == 0) {
+        result.error = strdup(std::format("bad capture output: {}", capture_output).c_str());
+        return result;
+    }
+    // claimed before the output is opened: a capture being saved may be writing the same path.
+    if (!RetroCapture_claim(rc)) {
+        result.error = strdup("a capture is being saved, try again later.");
+        return result;
+    }
+    SoundRecorder *file = SoundRecorder_create(channel_count, capture_bits, sample_rate);
+    if (!file || !SoundRecorder_open(file, path)) {
+        if (file) SoundRecorder_destroy(file);
+        RetroCapture_release(rc);
+        result.error = strdup(std::format("cannot open capture output: {}", path).c_str());
+        return result;
+    }
+    uint64_t frames;
+    if (!RetroCapture_save(rc, file, (int)seconds, &frames)) {
+        // the file this request opened is left empty, remove it.
+        SoundRecorder_close(file);
+        SoundRecorder_destroy(file);
+        remove(path);
+        result.error = strdup("failed to start the capture thread.");
+        return result;
+    }
+    result.report = strdup(std::format("saving the last {:.1f} seconds to {}.\n", (double)frames / sample_rate, path).c_str());
+    return result;
+}
+
+// Pass a message of the log to the WebSocket clients, as {"type":"log","level":"error","text":"..."}.
+void publish_log(logger::Level level, const char *text, size_t length) {
+	static const char *levels[] = { "log", "info", "debug", "warn", "error", "assert" };
+	if (codeserver_websockets(cs) == 0) return;
+	std::string message = std::format("{{\"type\":\"log\",\"level\":\"{}\",\"text\":{}}}",
+		levels[level], codeserver_json_string(text, length));
+	codeserver_publish(cs, message.data(), message.size());
+}
+
+// Pass the peak of the output since the last call and the counters of the main loop to the WebSocket clients.
+void publish_meter(unsigned int underruns, uint64_t overflows) {
+	float peak = telemetry_peak.exchange(0.0f, std::memory_order_relaxed);
+	std::string message = std::format("{{\"type\":\"meter\",\"peak\":{:.5f},\"underruns\":{},\"overflows\":{}}}",
+		peak, underruns, overflows);
+	codeserver_publish(cs, message.data(), message.size());
+}
+
+double elapsed_ms(std::chrono::steady_clock::time_point from, std::chrono::steady_clock::time_point to) {
+	return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+std::string allocator_report() {
+	AllocatorStats stats = se->allocatorStats();
+	return std::format("arraybuffer pool: {} hits, {} misses, {} bytes outstanding, {} bytes pooled",
+		stats.hits, stats.misses, stats.bytes_outstanding, stats.bytes_pooled);
+}
+
+std::string sample_cache_report() {
+	SampleCacheStats stats = se->sampleCacheStats();
+	return std::format("sample cache: {} files, {} bytes, {} hits, {} misses",
+		stats.samples, stats.bytes, stats.hits, stats.misses);
 }
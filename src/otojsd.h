@@ -13,12 +13,32 @@ typedef struct {
 	int sample_rate;
 	bool verbose;
 	const char *output;
+	int bits;
 	bool enable_input;
 	const char *document_root;
 	bool level_meter;
+	int warmup;
+	int lookahead_ms;
+	int render_quantum;
+	int render_timeout;
+	int retro_minutes;
+	bool retro_compact;
+	const char *capture_output;
+	const char *audio_backend;
+	int offline;
+	const char *batch_output;
+	int jobs;
+	const char *shm_output;
+	const char *shm_inputs;
+	int rt_priority;
+	const char *cpu_affinity;
+	bool lock_memory;
+	int osc_port;
+	const char *osc_params;
 } otojsd_options;
 
 #define OTOJSD_DEFAULT_IPMASK "127.0.0.1"
+#define OTOJSD_DEFAULT_CAPTURE_OUTPUT "capture-%Y%m%d-%H%M%S.wav"
 
 #define OTOJSD_OPTIONS_DEFAULTS {\
 	14609,\
@@ -28,9 +48,28 @@ typedef struct {
 	48000,\
 	false,\
 	NULL,\
+	0,\
 	false,\
 	NULL,\
-	false\
+	false,\
+	0,\
+	0,\
+	256,\
+	20,\
+	0,\
+	false,\
+	OTOJSD_DEFAULT_CAPTURE_OUTPUT,\
+	NULL,\
+	0,\
+	NULL,\
+	0,\
+	NULL,\
+	NULL,\
+	0,\
+	NULL,\
+	false,\
+	0,\
+	NULL\
 }
 
 void otojsd_start(otojsd_options *options, std::vector<std::string> start_codes, const char *exec_path, char **env);
@@ -0,0 +1,186 @@
+// otojsd::realtime - scheduling, CPU affinity, memory locking and denormals of the audio and render threads.
+// The settings are applied by each thread to itself when it first runs, and what the OS granted is logged,
+// since SCHED_FIFO and mlock need privileges (rtprio and memlock limits) that are often missing.
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <string>
+#include <format>
+#if defined(__x86_64__) || defined(__i386__)
+#include <xmmintrin.h>
+#include <pmmintrin.h>
+#endif
+#include "realtime.h"
+#include "logger.h"
+
+// bytes of stack touched by a thread entering, so that its first deep calls do not fault.
+#define STACK_PREFAULT_BYTES (128 * 1024)
+#define CPUS_MAX 1024
+
+static int realtime_priority = 0;
+static bool realtime_pinned = false;
+static bool realtime_cpus[CPUS_MAX];
+static char realtime_cpu_text[64];
+
+// ------------------------------------------------------ private functions
+const char *realtime__flush_denormals();
+int realtime__set_priority(bool device, char *report, size_t size);
+int realtime__set_affinity();
+void realtime__prefault_stack();
+
+// ---------------------------------------------- implimentation
+
+bool realtime_configure(int priority, const char *cpus) {
+	realtime_priority = priority;
+	realtime_pinned = false;
+	if ( ! cpus ) return true;
+	memset(realtime_cpus, 0, sizeof(realtime_cpus));
+	const char *p = cpus;
+	while ( *p ) {
+		char *end;
+		long first = strtol(p, &end, 10);
+		long last = first;
+		if ( end == p ) return false;
+		if ( *end == '-' ) {
+			p = end + 1;
+			last = strtol(p, &end, 10);
+			if ( end == p ) return false;
+		}
+		if ( first < 0 || last < first || last >= CPUS_MAX ) return false;
+		for ( long cpu = first; cpu <= last; cpu++ ) realtime_cpus[cpu] = true;
+		if ( *end == ',' ) end++;
+		else if ( *end != '\0' ) return false;
+		p = end;
+	}
+	realtime_pinned = true;
+	snprintf(realtime_cpu_text, sizeof(realtime_cpu_text), "%s", cpus);
+	return true;
+}
+
+void realtime_thread_enter(const char *name, bool device) {
+	static thread_local bool entered = false;
+	if ( entered ) return;
+	entered = true;
+
+	const char *denormals = realtime__flush_denormals();
+	char policy[64];
+	int priority_error = realtime__set_priority(device, policy, sizeof(policy));
+	int affinity_error = realtime__set_affinity();
+	realtime__prefault_stack();
+
+	char affinity[96];
+	if ( ! realtime_pinned ) {
+		snprintf(affinity, sizeof(affinity), "any CPU");
+	} else if ( affinity_error == 0 ) {
+		snprintf(affinity, sizeof(affinity), "CPU %s", realtime_cpu_text);
+	} else {
+		snprintf(affinity, sizeof(affinity), "CPU %s not granted (%s)", realtime_cpu_text, strerror(affinity_error));
+	}
+	logger::queue_format(priority_error || affinity_error ? logger::LEVEL_WARN : logger::LEVEL_INFO,
+		"{} thread: {}, {}, {}.", name, (const char *)policy, (const char *)affinity, denormals);
+}
+
+bool realtime_lock_memory() {
+	// MCL_FUTURE is not used: V8 reserves far more address space than it uses, and grows its heap with mmap
+	// which would fail once the lock limit is reached. The pages mapped later are the heap growing, which
+	// the render path should not depend on anyway.
+	if ( mlockall(MCL_CURRENT) != 0 ) {
+		int error = errno;
+		struct rlimit limit;
+		getrlimit(RLIMIT_MEMLOCK, &limit);
+		std::string allowed = limit.rlim_cur == RLIM_INFINITY ? "unlimited" : std::format("{} KiB", limit.rlim_cur / 1024);
+		logger::warn(std::format("memory lock not granted: {} (memlock limit {}, try ulimit -l unlimited).", strerror(error), allowed));
+		return false;
+	}
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+#ifdef __APPLE__
+	long resident_kib = usage.ru_maxrss / 1024;
+#else
+	long resident_kib = usage.ru_maxrss;
+#endif
+	logger::info(std::format("memory locked: {:.1f} MiB resident.", resident_kib / 1024.0));
+	return true;
+}
+
+// Denormal floats are computed in microcode on most CPUs, a decaying filter tail can take
+// many times the usual time. Flushing them to zero is inaudible.
+const char *realtime__flush_denormals() {
+#if defined(__x86_64__) || defined(__i386__)
+	_MM_SET_FLUSH_ZERO_MODE(_MM_FLUSH_ZERO_ON);
+	_MM_SET_DENORMALS_ZERO_MODE(_MM_DENORMALS_ZERO_ON);
+	return "denormals flushed (FTZ/DAZ)";
+#elif defined(__aarch64__)
+	uint64_t fpcr;
+	__asm__ __volatile__("mrs %0, fpcr" : "=r"(fpcr));
+	__asm__ __volatile__("msr fpcr, %0" : : "r"(fpcr | (1 << 24)));
+	return "denormals flushed (FZ)";
+#else
+	return "denormals kept";
+#endif
+}
+
+// Returns 0 or the errno of a denied SCHED_FIFO, with the policy of the thread in report.
+int realtime__set_priority(bool device, char *report, size_t size) {
+	int policy;
+	struct sched_param param;
+	pthread_getschedparam(pthread_self(), &policy, &param);
+	if ( realtime_priority == 0 ) {
+		snprintf(report, size, "%s", policy == SCHED_FIFO || policy == SCHED_RR ? "real-time policy of the backend" : "default policy");
+		return 0;
+	}
+#ifdef __APPLE__
+	if ( device ) {
+		// the Core Audio IO thread already runs with a time-constraint policy, SCHED_FIFO would lower it.
+		snprintf(report, size, "time-constraint policy of Core Audio");
+		return 0;
+	}
+#else
+	(void)device;
+#endif
+	if ( (policy == SCHED_FIFO || policy == SCHED_RR) && param.sched_priority >= realtime_priority ) {
+		// JACK runs its process thread real-time by itself.
+		snprintf(report, size, "SCHED_%s %d of the backend", policy == SCHED_FIFO ? "FIFO" : "RR", param.sched_priority);
+		return 0;
+	}
+	param.sched_priority = realtime_priority;
+	int error = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+	if ( error == 0 ) {
+		snprintf(report, size, "SCHED_FIFO %d", realtime_priority);
+	} else {
+		snprintf(report, size, "SCHED_FIFO %d not granted (%s)", realtime_priority, strerror(error));
+	}
+	return error;
+}
+
+// Returns 0 or the errno of a denied affinity.
+int realtime__set_affinity() {
+	if ( ! realtime_pinned ) return 0;
+#ifdef __linux__
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for ( int cpu = 0; cpu < CPUS_MAX && cpu < CPU_SETSIZE; cpu++ ) {
+		if ( realtime_cpus[cpu] ) CPU_SET(cpu, &set);
+	}
+	return pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+	return ENOTSUP;
+#endif
+}
+
+void realtime__prefault_stack() {
+	volatile char stack[STACK_PREFAULT_BYTES];
+	for ( size_t i = 0; i < sizeof(stack); i += 4096 ) {
+		stack[i] = 0;
+	}
+}
@@ -0,0 +1,16 @@
+#ifndef REALTIME_H
+#define REALTIME_H
+// otojsd::realtime - scheduling, CPU affinity, memory locking and denormals of the audio and render threads.
+
+#include <stdbool.h>
+
+// Set the SCHED_FIFO priority (0 leaves the policy) and the CPUs like "2,3" or "2-3" (NULL leaves the affinity)
+// for the threads entering later. Returns false if the CPU list is invalid.
+bool realtime_configure(int priority, const char *cpus);
+// Apply the settings to the calling thread once, and flush denormals to zero on it. Cheap on later calls,
+// so it can be called from every audio callback. device is true for the audio device thread.
+void realtime_thread_enter(const char *name, bool device);
+// Lock the memory mapped so far, faulting every page in, and log what was granted.
+bool realtime_lock_memory();
+
+#endif
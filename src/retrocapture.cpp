@@ -0,0 +1,172 @@
+// otojsd::retrocapture - keeps the last minutes of output in memory, to be saved after the fact.
+// The audio path overwrites the oldest frames of a preallocated ring. A capture copies the ring
+// out to a recorder on its own thread, starting a margin ahead of the frames being overwritten.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "retrocapture.h"
+#include "audio_kernels.h"
+#include "logger.h"
+
+// seconds the ring holds beyond the frames saved, the head start of a capture over the audio path
+#define MARGIN_SECONDS 2
+// frames copied out and written at once
+#define SAVE_BLOCK_FRAMES 4096
+
+// ------------------------------------------------------ private functions
+void *RetroCapture__saver(void *arg);
+bool RetroCapture__copy(RetroCapture *self, uint64_t from, size_t frames);
+
+// ---------------------------------------------- implimentation
+
+RetroCapture *RetroCapture_create(int channels, int sampleRate, int seconds, bool compact) {
+	RetroCapture *self = new RetroCapture;
+	self->channels = channels;
+	self->sampleRate = sampleRate;
+	self->compact = compact;
+	self->keepFrames = (size_t)seconds * sampleRate;
+	self->capacity = self->keepFrames + (size_t)MARGIN_SECONDS * sampleRate;
+	self->written = 0;
+	self->saving = false;
+	self->threadStarted = false;
+	self->recorder = NULL;
+	self->samples = NULL;
+	self->compactSamples = NULL;
+
+	size_t count = self->capacity * channels;
+	void *ring = compact ? malloc(count * sizeof(int16_t)) : malloc(count * sizeof(float));
+	self->block = (float *)malloc(SAVE_BLOCK_FRAMES * channels * sizeof(float));
+	if ( !ring || !self->block ) {
+		printf("malloc failed for retro capture.\n");
+		free(ring);
+		free(self->block);
+		delete self;
+		return NULL;
+	}
+	// touch every page now, not on the audio thread.
+	memset(ring, 0, compact ? count * sizeof(int16_t) : count * sizeof(float));
+	if ( compact ) {
+		self->compactSamples = (int16_t *)ring;
+	} else {
+		self->samples = (float *)ring;
+	}
+	return self;
+}
+
+// Memory used by the ring.
+size_t RetroCapture_bytes(RetroCapture *self) {
+	return self->capacity * self->channels * (self->compact ? sizeof(int16_t) : sizeof(float));
+}
+
+// Keep interleaved frames, overwriting the oldest. Real-time safe: never blocks nor allocates.
+void RetroCapture_write(RetroCapture *self, const float *data, int frames) {
+	uint64_t position = self->written.load(std::memory_order_relaxed);
+	int channels = self->channels;
+	size_t done = 0;
+	while ( done < (size_t)frames ) {
+		size_t index = (position + done) % self->capacity;
+		size_t length = frames - done;
+		if ( length > self->capacity - index ) length = self->capacity - index;
+		if ( self->compact ) {
+			audio_kernels::float_to_int16(self->compactSamples + index * channels, data + done * channels, length * channels);
+		} else {
+			memcpy(self->samples + index * channels, data + done * channels, length * channels * sizeof(float));
+		}
+		done += length;
+	}
+	self->written.store(position + frames, std::memory_order_release);
+}
+
+// Claim the capture before opening its output. Returns false if a capture is being saved.
+// A claim is followed by RetroCapture_save(), or given back by RetroCapture_release().
+bool RetroCapture_claim(RetroCapture *self) {
+	return ! self->saving.exchange(true);
+}
+
+void RetroCapture_release(RetroCapture *self) {
+	self->saving = false;
+}
+
+// Start saving the last seconds (all kept frames if 0) to the opened recorder on a background thread, after a claim.
+// Takes the ownership of the recorder, it is closed and destroyed when the capture is saved.
+// Returns false (and does not take the recorder, and releases the claim) if the thread did not start.
+bool RetroCapture_save(RetroCapture *self, SoundRecorder *recorder, int seconds, uint64_t *frames_return) {
+	if ( self->threadStarted ) {
+		pthread_join(self->thread, NULL);
+		self->threadStarted = false;
+	}
+	uint64_t end = self->written.load(std::memory_order_acquire);
+	uint64_t frames = seconds > 0 ? (uint64_t)seconds * self->sampleRate : self->keepFrames;
+	if ( frames > self->keepFrames ) frames = self->keepFrames;
+	if ( frames > end ) frames = end;
+	self->recorder = recorder;
+	self->saveFrom = end - frames;
+	self->saveFrames = frames;
+	if ( pthread_create(&self->thread, NULL, RetroCapture__saver, self) != 0 ) {
+		self->recorder = NULL;
+		self->saving = false;
+		return false;
+	}
+	self->threadStarted = true;
+	*frames_return = frames;
+	return true;
+}
+
+void RetroCapture_destroy(RetroCapture *self) {
+	if ( self->threadStarted ) {
+		pthread_join(self->thread, NULL);
+	}
+	free(self->samples);
+	free(self->compactSamples);
+	free(self->block);
+	delete self;
+}
+
+void *RetroCapture__saver(void *arg) {
+	RetroCapture *self = (RetroCapture *)arg;
+	uint64_t saved = 0;
+	while ( saved < self->saveFrames ) {
+		size_t length = self->saveFrames - saved < SAVE_BLOCK_FRAMES ? self->saveFrames - saved : SAVE_BLOCK_FRAMES;
+		if ( ! RetroCapture__copy(self, self->saveFrom + saved, length) ) {
+			logger::queue_format(logger::LEVEL_ERROR, "capture overrun: the audio output overtook the capture after {} frames.", saved);
+			break;
+		}
+		if ( ! SoundRecorder_write(self->recorder, self->block, length) ) {
+			logger::queue_format(logger::LEVEL_ERROR, "capture write failed after {} frames.", saved);
+			break;
+		}
+		saved += length;
+	}
+	SoundRecorder_close(self->recorder);
+	SoundRecorder_destroy(self->recorder);
+	self->recorder = NULL;
+	logger::queue_format(logger::LEVEL_LOG, "capture saved: {:.1f} seconds.", (double)saved / self->sampleRate);
+	self->saving = false;
+	return NULL;
+}
+
+// Copy frames from the ring into self->block. Returns false if the audio path may have overwritten them meanwhile.
+bool RetroCapture__copy(RetroCapture *self, uint64_t from, size_t frames) {
+	int channels = self->channels;
+	size_t done = 0;
+	while ( done < frames ) {
+		size_t index = (from + done) % self->capacity;
+		size_t length = frames - done;
+		if ( length > self->capacity - index ) length = self->capacity - index;
+		float *dst = self->block + done * channels;
+		if ( self->compact ) {
+			const int16_t *src = self->compactSamples + index * channels;
+			for ( size_t i = 0; i < length * channels; i++ ) {
+				dst[i] = src[i] * (1.0f / 32767.0f);
+			}
+		} else {
+			memcpy(dst, self->samples + index * channels, length * channels * sizeof(float));
+		}
+		done += length;
+	}
+	// the frames are intact while the audio path stays half the margin behind them.
+	std::atomic_thread_fence(std::memory_order_acquire);
+	uint64_t written = self->written.load(std::memory_order_acquire);
+	return written + (uint64_t)MARGIN_SECONDS * self->sampleRate / 2 <= from + self->capacity;
+}
@@ -0,0 +1,43 @@
+#ifndef RETROCAPTURE_H
+#define RETROCAPTURE_H
+// otojsd::retrocapture - keeps the last minutes of output in memory, to be saved after the fact.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+
+#include "soundrecorder.h"
+
+typedef struct {
+	int channels;
+	int sampleRate;
+	// 16-bit samples instead of float, half the memory
+	bool compact;
+	// frames the ring holds, and the frames a capture can save (a margin less)
+	size_t capacity;
+	size_t keepFrames;
+	// interleaved ring, one of them is allocated
+	float *samples;
+	int16_t *compactSamples;
+	// frames written so far, the ring index is written % capacity
+	std::atomic<uint64_t> written;
+	// saving a capture
+	std::atomic<bool> saving;
+	bool threadStarted;
+	pthread_t thread;
+	SoundRecorder *recorder;
+	uint64_t saveFrom;
+	uint64_t saveFrames;
+	float *block;
+} RetroCapture;
+
+RetroCapture *RetroCapture_create(int channels, int sampleRate, int seconds, bool compact);
+size_t RetroCapture_bytes(RetroCapture *self);
+void RetroCapture_write(RetroCapture *self, const float *data, int frames);
+bool RetroCapture_claim(RetroCapture *self);
+void RetroCapture_release(RetroCapture *self);
+bool RetroCapture_save(RetroCapture *self, SoundRecorder *recorder, int seconds, uint64_t *frames_return);
+void RetroCapture_destroy(RetroCapture *self);
+
+#endif
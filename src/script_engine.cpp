@@ -1,5 +1,9 @@
 // Otojsd::ScriptEngine - JavaScript engine wrapper for otojsd.
 
+#include <stdio.h>
+
+#include <algorithm>
+#include <chrono>
 #include <string>
 
 #include "script_engine.h"
@@ -8,24 +12,126 @@
 
 // internal functions prototypes
 const char *ToCString(const v8::String::Utf8Value &value);
-const char *ExecuteString(v8::Isolate *isolate, v8::Local<v8::Context> context, v8::Local<v8::String> source, v8::Local<v8::String> name);
+const char *CompileString(v8::Isolate *isolate, v8::Local<v8::Context> context, v8::Local<v8::String> source, v8::Local<v8::String> name, v8::Local<v8::Script> *script);
+const char *ExecuteString(v8::Isolate *isolate, v8::Local<v8::Context> context, v8::Local<v8::String> source, v8::Local<v8::String> name, v8::Local<v8::Script> *script);
 v8::MaybeLocal<v8::String> ReadFile(v8::Isolate *isolate, const char *name);
 const char *FormatException(v8::Isolate *isolate, v8::TryCatch *try_catch);
+const char *FormatTermination(v8::Isolate *isolate, v8::TryCatch *try_catch);
+void WriteException(v8::Isolate *isolate, v8::Local<v8::Context> context, v8::Local<v8::Value> exception, char *buffer, size_t size);
+void GetRenderFunctions(v8::Isolate *isolate, v8::Local<v8::Context> context, v8::Local<v8::Value> *values);
+bool PickRenderFunction(v8::Isolate *isolate, v8::Local<v8::Context> context, v8::Local<v8::Value> *previous, v8::Local<v8::Function> *render, RenderKind *kind);
+void CreateRenderArrays(v8::Isolate *isolate, v8::Local<v8::Context> context, v8::Local<v8::ArrayBuffer> input, v8::Local<v8::ArrayBuffer> output, v8::Local<v8::ArrayBuffer> ports, unsigned int port_count, unsigned int frames, unsigned int channels, RenderArrays *arrays);
+int RenderArguments(v8::Isolate *isolate, RenderKind kind, const RenderArrays &arrays, unsigned int frames, unsigned int channels, v8::Local<v8::Value> *argv);
+void SetupOtojs(v8::Isolate *isolate, v8::Local<v8::Context> context, ScriptEngineSamples *samples);
+void SetupParameters(v8::Isolate *isolate, v8::Local<v8::Context> context, v8::Local<v8::ArrayBuffer> buffer, const std::vector<std::pair<std::string, int>> &names);
+
+// V8 platform shared by every ScriptEngine of the process
+static std::unique_ptr<v8::Platform> platform;
+
+// render function names by RenderKind
+static const char *RENDER_FUNCTION_NAMES[RENDER_KINDS] = {RENDER_FUNCTION_NAME, RENDER_INTO_FUNCTION_NAME, RENDER_PLANAR_FUNCTION_NAME};
+// preferred order when a script defines several render functions
+static const RenderKind RENDER_PREFERENCE[RENDER_KINDS] = {RENDER_PLANAR, RENDER_INTO, RENDER_RETURN};
+// maximum number of arguments of the render functions
+static const int RENDER_ARGC_MAX = 5;
+// number of render versions kept for fallback and switching
+static const size_t RENDER_VERSIONS_MAX = 16;
+// number of posted scripts replayed by the warm-up, older ones are dropped (the start codes are all kept)
+static const size_t REPLAY_POSTED_MAX = 16;
+
+// -------------------- compile job
+
+// Hands the whole posted code to the V8 streaming parser in one chunk.
+class CodeSourceStream : public v8::ScriptCompiler::ExternalSourceStream {
+    std::string code_;
+    bool done_ = false;
+
+public:
+    CodeSourceStream(const std::string &code) : code_(code) {}
+
+    size_t GetMoreData(const uint8_t **src) override {
+        if (done_ || code_.empty()) {
+            return 0;
+        }
+        done_ = true;
+        // V8 takes ownership of the returned chunk.
+        uint8_t *chunk = new uint8_t[code_.size()];
+        memcpy(chunk, code_.data(), code_.size());
+        *src = chunk;
+        return code_.size();
+    }
+};
+
+class ScriptEngine::CompileJob {
+public:
+    std::string code;
+    std::unique_ptr<v8::ScriptCompiler::StreamedSource> source;
+    // null if V8 refused to stream the code, then it is compiled in finishCompile().
+    std::unique_ptr<v8::ScriptCompiler::ScriptStreamingTask> task;
+
+    // result of finishCompile()
+    bool finished = false;
+    v8::Global<v8::Script> script;
+    const char *error = nullptr;
+
+    // warm-up state
+    v8::Global<v8::Context> shadow_context;
+    v8::Global<v8::Function> shadow_render;
+    RenderKind shadow_render_kind = RENDER_RETURN;
+    v8::Global<v8::Function> shadow_status;
+    RenderArrays shadow_arrays;
+    size_t replayed = 0;
+    unsigned int frames = 0;
+    unsigned int channels = 0;
+    int calls_max = 0;
+    WarmupResult warmup = {0, 0.0, false, -1, nullptr};
+};
+
+// %GetOptimizationStatus() bits, see v8/src/runtime/runtime.h
+static const int OPTIMIZATION_STATUS_OPTIMIZED = 1 << 4;
+// calls made between checks of the optimization status
+static const int WARMUP_CALLS_PER_CHECK = 16;
 
 // -------------------- create/destroy
 
-ScriptEngine::ScriptEngine(const char *exec_path) {
-    // Initialize V8.
+// Set V8 flags. Call this before initializePlatform().
+void ScriptEngine::setFlags(const char *flags) {
+    v8::V8::SetFlagsFromString(flags);
+}
+
+// Initialize V8 once for the process, before creating any ScriptEngine.
+void ScriptEngine::initializePlatform(const char *exec_path) {
     v8::V8::InitializeICUDefaultLocation(exec_path);
     v8::V8::InitializeExternalStartupData(exec_path);
-    this->platform_ = v8::platform::NewDefaultPlatform();
-    v8::V8::InitializePlatform(platform_.get());
+    platform = v8::platform::NewDefaultPlatform();
+    v8::V8::InitializePlatform(platform.get());
     v8::V8::Initialize();
+}
+
+// Tear V8 down after every ScriptEngine has been deleted.
+void ScriptEngine::disposePlatform() {
+    v8::V8::Dispose();
+    v8::V8::DisposePlatform();
+    platform.reset();
+}
+
+ScriptEngine::ScriptEngine() {
+    this->active_version_ = -1;
+    this->render_disabled_ = false;
+    this->replay_history_ = false;
+    this->start_scripts_ = 0;
+    this->next_version_id_ = 1;
+    this->io_frames_ = 0;
+    this->io_channels_ = 0;
+    this->port_inputs_ = 0;
 
     // Create a new Isolate and make it the current one.
-    this->create_params_.array_buffer_allocator = v8::ArrayBuffer::Allocator::NewDefaultAllocator();
+    // ArrayBuffers allocated in oto_render are recycled by the pool.
+    this->allocator_ = new ScriptEngineAllocator(v8::ArrayBuffer::Allocator::NewDefaultAllocator());
+    this->create_params_.array_buffer_allocator = this->allocator_;
     this->isolate_ = v8::Isolate::New(create_params_);
     v8::Isolate::Scope isolate_scope(this->isolate_);
+    this->samples_ = new ScriptEngineSamples();
 
     // Create a stack-allocated handle scope.
     v8::HandleScope handle_scope(this->isolate_);
@@ -35,8 +141,9 @@ ScriptEngine::ScriptEngine(const char *exec_path) {
     this->context_.Reset(this->isolate_, context);
     v8::Context::Scope context_scope(context);
 
-    // Setup console object
+    // Setup console and Otojs objects
     script_engine_console::setup(this->isolate_, context);
+    SetupOtojs(this->isolate_, context, this->samples_);
 
     // Create reusable string cache.
     v8::Local<v8::String> no_file_name_local = v8::String::NewFromUtf8(isolate_, "posted").ToLocalChecked();
@@ -44,37 +151,124 @@ ScriptEngine::ScriptEngine(const char *exec_path) {
 }
 
 ScriptEngine::~ScriptEngine() {
-    render_.Reset();
+    versions_.clear();
+    io_arrays_.Reset();
+    input_store_.reset();
+    output_store_.reset();
+    ports_store_.reset();
+    params_store_.reset();
+    for (auto &script : scripts_) {
+        script.Reset();
+    }
     context_.Reset();
     no_file_name_.Reset();
+    // the samples are freed by the allocator of the isolate.
+    delete samples_;
 
     isolate_->Dispose();
-    v8::V8::Dispose();
-    v8::V8::DisposePlatform();
     delete create_params_.array_buffer_allocator;
 }
 
 // -------------------- private functions
 
-void ScriptEngine::resetRender_(v8::Local<v8::Context> context) {
-    v8::Local<v8::String> process_name = v8::String::NewFromUtf8(this->isolate_, RENDER_FUNCTION_NAME).ToLocalChecked();
-    v8::Local<v8::Value> process_val;
-    // If there is no render function, or if it is not a function, bail out
-    if (
-        !context->Global()->Get(context, process_name).ToLocal(&process_val) ||
-        !process_val->IsFunction()
-    ) {
+// previous is the render functions before the script ran, see GetRenderFunctions().
+void ScriptEngine::resetRender_(v8::Local<v8::Context> context, v8::Local<v8::Value> *previous) {
+    v8::Local<v8::Function> render_fun;
+    RenderKind kind;
+    // If the script defined no render function, keep the current one. Without one, any render function in the
+    // globals is taken, unless it was disabled: the disabled one is still there and only a new one counts.
+    bool take_any = active_version_ < 0 && !render_disabled_;
+    if (!PickRenderFunction(this->isolate_, context, take_any ? nullptr : previous, &render_fun, &kind)) {
+        return;
+    }
+    if (versions_.size() >= RENDER_VERSIONS_MAX) {
+        // drop the oldest version, unless it is the active one.
+        int dropped = active_version_ == 0 ? 1 : 0;
+        versions_.erase(versions_.begin() + dropped);
+        if (active_version_ > dropped) {
+            active_version_--;
+        }
+    }
+    RenderVersion version;
+    version.id = next_version_id_++;
+    version.function.Reset(this->isolate_, render_fun);
+    version.kind = kind;
+    version.clean = false;
+    version.failed = false;
+    versions_.push_back(std::move(version));
+    active_version_ = versions_.size() - 1;
+    render_disabled_ = false;
+}
+
+// Keep the script for the warm-up to replay, if enabled.
+void ScriptEngine::recordScript_(v8::Local<v8::Script> script, bool start_code) {
+    if (!replay_history_) {
+        return;
+    }
+    v8::Global<v8::UnboundScript> unbound(this->isolate_, script->GetUnboundScript());
+    if (start_code) {
+        scripts_.insert(scripts_.begin() + start_scripts_, std::move(unbound));
+        start_scripts_++;
         return;
     }
-    // cast it to a Function and store it.
-    v8::Local<v8::Function> render_fun = process_val.As<v8::Function>();
-    render_.Reset(this->isolate_, render_fun);
+    if (scripts_.size() - start_scripts_ >= REPLAY_POSTED_MAX) {
+        scripts_.erase(scripts_.begin() + start_scripts_);
+    }
+    scripts_.push_back(std::move(unbound));
+}
+
+// Mark the active version failed and fall back to the latest version which rendered cleanly.
+RenderResult ScriptEngine::renderFailed_(RenderResult result) {
+    result.error = render_error_;
+    RenderVersion &failed = versions_[active_version_];
+    failed.failed = true;
+    failed.clean = false;
+    result.failed_version = failed.id;
+    for (int i = versions_.size() - 1; i >= 0; i--) {
+        if (i != active_version_ && versions_[i].clean) {
+            active_version_ = i;
+            result.fallback_version = versions_[i].id;
+            break;
+        }
+    }
+    return result;
 }
 
 // -------------------- public functions
 
 // Execute the given JavaScript code and return the error message if any.
 const char *ScriptEngine::executeCode(const char *code) {
+    CompileJob *job = this->startCompile(code);
+    runCompile(job);
+    return this->executeCompiled(job);
+}
+
+// Prepare to compile the given code. Touches the isolate, so call this while holding the engine.
+ScriptEngine::CompileJob *ScriptEngine::startCompile(const char *code) {
+    v8::Isolate::Scope isolate_scope(this->isolate_);
+
+    CompileJob *job = new CompileJob();
+    job->code = code;
+    job->source = std::make_unique<v8::ScriptCompiler::StreamedSource>(
+        std::make_unique<CodeSourceStream>(job->code), v8::ScriptCompiler::StreamedSource::UTF8);
+    job->task.reset(v8::ScriptCompiler::StartStreaming(this->isolate_, job->source.get()));
+    return job;
+}
+
+// Parse and compile the code of the job. Does not touch the isolate, so call this without holding the engine.
+void ScriptEngine::runCompile(CompileJob *job) {
+    if (job->task) {
+        job->task->Run();
+    }
+}
+
+// Finish compiling the code of the job and return false on a compile error. Touches the isolate.
+bool ScriptEngine::finishCompile(CompileJob *job) {
+    if (job->finished) {
+        return job->error == nullptr;
+    }
+    job->finished = true;
+
     v8::Isolate::Scope isolate_scope(this->isolate_);
     v8::HandleScope handle_scope(this->isolate_);
     v8::Local<v8::Context> local_context = this->context_.Get(this->isolate_);
@@ -82,10 +276,192 @@ const char *ScriptEngine::executeCode(const char *code) {
 
     v8::Local<v8::String> local_no_file_name = this->no_file_name_.Get(this->isolate_);
 
-    v8::Local<v8::String> source = v8::String::NewFromUtf8(this->isolate_, code).ToLocalChecked();
-    const char *result = ExecuteString(isolate_, local_context, source, local_no_file_name);
+    v8::Local<v8::String> source = v8::String::NewFromUtf8(this->isolate_, job->code.c_str()).ToLocalChecked();
+    v8::Local<v8::Script> script;
+    if (job->task) {
+        // finalizing the streamed compile is short, the parse already happened in runCompile().
+        v8::TryCatch try_catch(this->isolate_);
+        v8::ScriptOrigin origin(local_no_file_name);
+        if (!v8::ScriptCompiler::Compile(local_context, job->source.get(), source, origin).ToLocal(&script)) {
+            job->error = FormatException(this->isolate_, &try_catch);
+        }
+    } else {
+        job->error = CompileString(isolate_, local_context, source, local_no_file_name, &script);
+    }
+    if (job->error == nullptr) {
+        job->script.Reset(this->isolate_, script);
+    }
+    return job->error == nullptr;
+}
+
+// Prepare a shadow context to exercise the render function of the job before it goes live.
+// The shadow context replays the kept scripts, so their top-level code runs again (silently for the console).
+void ScriptEngine::startWarmup(CompileJob *job, unsigned int frames, unsigned int channels, int calls) {
+    v8::Isolate::Scope isolate_scope(this->isolate_);
+    v8::HandleScope handle_scope(this->isolate_);
+
+    // the shadow context has its own globals, so the live state is not touched.
+    v8::Local<v8::Context> shadow = v8::Context::New(this->isolate_);
+    v8::Context::Scope context_scope(shadow);
+    script_engine_console::setup(this->isolate_, shadow, true);
+    SetupOtojs(this->isolate_, shadow, this->samples_);
+    for (auto &global : globals_) {
+        v8::Local<v8::String> var_name = v8::String::NewFromUtf8(this->isolate_, global.first.c_str()).ToLocalChecked();
+        shadow->Global()->Set(shadow, var_name, v8::Number::New(this->isolate_, global.second)).FromJust();
+    }
+    if (params_store_) {
+        // a copy of the parameters as they are now, the scripts replayed may write them.
+        v8::Local<v8::ArrayBuffer> params_buffer = v8::ArrayBuffer::New(this->isolate_, params_store_->ByteLength());
+        memcpy(params_buffer->Data(), params_store_->Data(), params_store_->ByteLength());
+        SetupParameters(this->isolate_, shadow, params_buffer, param_names_);
+    }
+
+    // reading the optimization status requires --allow-natives-syntax.
+    {
+        v8::TryCatch try_catch(this->isolate_);
+        v8::Local<v8::String> status_source = v8::String::NewFromUtf8Literal(this->isolate_, "(function (f) { return %GetOptimizationStatus(f); })");
+        v8::Local<v8::Script> status_script;
+        v8::Local<v8::Value> status_fun;
+        if (v8::Script::Compile(shadow, status_source).ToLocal(&status_script) &&
+            status_script->Run(shadow).ToLocal(&status_fun) && status_fun->IsFunction()) {
+            job->shadow_status.Reset(this->isolate_, status_fun.As<v8::Function>());
+        }
+    }
+
+    size_t byte_length = frames * channels * sizeof(float);
+    v8::Local<v8::ArrayBuffer> input_buffer = v8::ArrayBuffer::New(this->isolate_, byte_length);
+    v8::Local<v8::ArrayBuffer> output_buffer = v8::ArrayBuffer::New(this->isolate_, byte_length);
+    v8::Local<v8::ArrayBuffer> ports_buffer;
+    if (port_inputs_ > 0) {
+        // the warm-up renders silent port inputs.
+        ports_buffer = v8::ArrayBuffer::New(this->isolate_, byte_length * port_inputs_);
+    }
+    CreateRenderArrays(this->isolate_, shadow, input_buffer, output_buffer, ports_buffer, port_inputs_, frames, channels, &job->shadow_arrays);
+
+    job->shadow_context.Reset(this->isolate_, shadow);
+    job->replayed = 0;
+    job->frames = frames;
+    job->channels = channels;
+    job->calls_max = calls;
+    job->warmup = {0, 0.0, false, -1, nullptr};
+}
+
+// Continue the warm-up within the time budget. Returns true when the warm-up is over.
+// The budget is checked between the scripts and between the render calls, a replayed script is not interrupted.
+bool ScriptEngine::stepWarmup(CompileJob *job, double budget_ms) {
+    auto time_start = std::chrono::steady_clock::now();
+    auto deadline = time_start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double, std::milli>(budget_ms));
+    bool over = false;
+
+    v8::Isolate::Scope isolate_scope(this->isolate_);
+    v8::HandleScope handle_scope(this->isolate_);
+    v8::Local<v8::Context> shadow = job->shadow_context.Get(this->isolate_);
+    v8::Context::Scope context_scope(shadow);
+    v8::TryCatch try_catch(this->isolate_);
+
+    // replay the scripts ran so far and then the new one in the shadow context.
+    // Binding the same UnboundScript shares the compiled functions with the live context.
+    while (job->replayed <= scripts_.size() && std::chrono::steady_clock::now() < deadline) {
+        bool is_new_script = job->replayed == scripts_.size();
+        v8::Local<v8::UnboundScript> unbound = is_new_script
+            ? job->script.Get(this->isolate_)->GetUnboundScript()
+            : scripts_[job->replayed].Get(this->isolate_);
+        job->replayed++;
+        v8::Local<v8::Value> previous[RENDER_KINDS];
+        GetRenderFunctions(this->isolate_, shadow, previous);
+        samples_->setReading(true);
+        bool ran = !unbound->BindToCurrentContext()->Run(shadow).IsEmpty();
+        samples_->setReading(false);
+        if (!ran) {
+            job->warmup.error = (char *)FormatTermination(this->isolate_, &try_catch);
+            over = true;
+            break;
+        }
+        if (is_new_script) {
+            // nothing to warm up if the new script defines no render function.
+            v8::Local<v8::Function> render_fun;
+            if (!PickRenderFunction(this->isolate_, shadow, previous, &render_fun, &job->shadow_render_kind)) {
+                over = true;
+                break;
+            }
+            job->shadow_render.Reset(this->isolate_, render_fun);
+        }
+    }
+
+    // call the render function with the real shape until it is optimized (the shadow closure, not the live one).
+    if (!over && !job->shadow_render.IsEmpty()) {
+        v8::Local<v8::Function> render = job->shadow_render.Get(this->isolate_);
+        v8::Local<v8::Value> argv[RENDER_ARGC_MAX];
+        int argc = RenderArguments(this->isolate_, job->shadow_render_kind, job->shadow_arrays, job->frames, job->channels, argv);
+        while (job->warmup.calls < job->calls_max && std::chrono::steady_clock::now() < deadline) {
+            if (render->Call(shadow, shadow->Global(), argc, argv).IsEmpty()) {
+                job->warmup.error = (char *)FormatTermination(this->isolate_, &try_catch);
+                over = true;
+                break;
+            }
+            job->warmup.calls++;
+            if (job->warmup.calls % WARMUP_CALLS_PER_CHECK == 0 && !job->shadow_status.IsEmpty()) {
+                v8::Local<v8::Value> status_argv[1] = {render};
+                v8::Local<v8::Value> status;
+                if (job->shadow_status.Get(this->isolate_)->Call(shadow, shadow->Global(), 1, status_argv).ToLocal(&status) && status->IsInt32()) {
+                    job->warmup.optimization_status = status.As<v8::Int32>()->Value();
+                    job->warmup.optimized = (job->warmup.optimization_status & OPTIMIZATION_STATUS_OPTIMIZED) != 0;
+                }
+                if (job->warmup.optimized) {
+                    over = true;
+                    break;
+                }
+            }
+        }
+        if (job->warmup.calls >= job->calls_max) {
+            over = true;
+        }
+    }
+
+    job->warmup.milliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - time_start).count();
+    return over;
+}
+
+// Discard the shadow context and return the result of the warm-up.
+WarmupResult ScriptEngine::finishWarmup(CompileJob *job) {
+    job->shadow_render.Reset();
+    job->shadow_status.Reset();
+    job->shadow_arrays.Reset();
+    job->shadow_context.Reset();
+    WarmupResult result = job->warmup;
+    job->warmup.error = nullptr;
+    return result;
+}
+
+// Run the compiled code of the job and return the error message if any. The job is deleted.
+const char *ScriptEngine::executeCompiled(CompileJob *job) {
+    this->finishCompile(job);
+    const char *result = job->error;
+
+    v8::Isolate::Scope isolate_scope(this->isolate_);
+    v8::HandleScope handle_scope(this->isolate_);
+    v8::Local<v8::Context> local_context = this->context_.Get(this->isolate_);
+    v8::Context::Scope context_scope(local_context);
+
+    v8::Local<v8::Value> previous[RENDER_KINDS];
+    GetRenderFunctions(this->isolate_, local_context, previous);
     if (result == nullptr) {
-        this->resetRender_(local_context);
+        v8::TryCatch try_catch(this->isolate_);
+        v8::Local<v8::Script> script = job->script.Get(this->isolate_);
+        // the top level of a script may read sample files, the render function only gets them from the cache.
+        samples_->setReading(true);
+        bool ran = !script->Run(local_context).IsEmpty();
+        samples_->setReading(false);
+        if (!ran) {
+            result = FormatException(this->isolate_, &try_catch);
+        } else {
+            this->recordScript_(script, false);
+        }
+    }
+    delete job;
+
+    if (result == nullptr) {
+        this->resetRender_(local_context, previous);
     }
     return result;
 }
@@ -103,16 +479,63 @@ const char *ScriptEngine::executeFromFile(const char *filename) {
         fprintf(stderr, "Error reading '%s'\n", filename);
         exit(1);
     }
-    const char *result = ExecuteString(isolate_, local_context, source, file_name);
+    v8::Local<v8::Value> previous[RENDER_KINDS];
+    GetRenderFunctions(this->isolate_, local_context, previous);
+    v8::Local<v8::Script> script;
+    samples_->setReading(true);
+    const char *result = ExecuteString(isolate_, local_context, source, file_name, &script);
+    samples_->setReading(false);
     if (result == nullptr) {
-        this->resetRender_(local_context);
+        this->recordScript_(script, true);
+        this->resetRender_(local_context, previous);
     }
     return result;
 }
 
-// Call the render function with the given input buffer and return the output samples.
-RenderResult ScriptEngine::executeRender(float *inoutbuf, unsigned int frames, unsigned int channels) {
-    RenderResult result = {0, nullptr};
+// Give the render function count more inputs, filled by the host through RenderBuffers::ports. Call this before buffers().
+void ScriptEngine::setPortInputs(unsigned int count) {
+    this->port_inputs_ = count;
+    // the arrays are made again with the ports at the next buffers().
+    this->io_frames_ = 0;
+}
+
+// Return the input/output buffers for the given shape. Write the input before executeRender() and read the output after.
+RenderBuffers ScriptEngine::buffers(unsigned int frames, unsigned int channels) {
+    if (frames != this->io_frames_ || channels != this->io_channels_) {
+        v8::Isolate::Scope isolate_scope(this->isolate_);
+        v8::HandleScope handle_scope(this->isolate_);
+        v8::Local<v8::Context> local_context = this->context_.Get(this->isolate_);
+        v8::Context::Scope context_scope(local_context);
+
+        // the stores are allocated by V8 so that they are inside the V8 sandbox, and only grow.
+        size_t byte_length = frames * channels * sizeof(float);
+        if (!input_store_ || input_store_->ByteLength() < byte_length) {
+            input_store_ = v8::ArrayBuffer::NewBackingStore(this->isolate_, byte_length);
+            output_store_ = v8::ArrayBuffer::NewBackingStore(this->isolate_, byte_length);
+        }
+        v8::Local<v8::ArrayBuffer> input_buffer = v8::ArrayBuffer::New(this->isolate_, input_store_);
+        v8::Local<v8::ArrayBuffer> output_buffer = v8::ArrayBuffer::New(this->isolate_, output_store_);
+        v8::Local<v8::ArrayBuffer> ports_buffer;
+        if (port_inputs_ > 0) {
+            if (!ports_store_ || ports_store_->ByteLength() < byte_length * port_inputs_) {
+                ports_store_ = v8::ArrayBuffer::NewBackingStore(this->isolate_, byte_length * port_inputs_);
+            }
+            ports_buffer = v8::ArrayBuffer::New(this->isolate_, ports_store_);
+        }
+        CreateRenderArrays(this->isolate_, local_context, input_buffer, output_buffer, ports_buffer, port_inputs_, frames, channels, &io_arrays_);
+        this->io_frames_ = frames;
+        this->io_channels_ = channels;
+    }
+    return {static_cast<float *>(input_store_->Data()), static_cast<float *>(output_store_->Data()),
+            active_version_ >= 0 && versions_[active_version_].kind == RENDER_PLANAR,
+            ports_store_ ? static_cast<float *>(ports_store_->Data()) : nullptr};
+}
+
+// Call the render function with the input buffer and fill the output buffer.
+RenderResult ScriptEngine::executeRender(unsigned int frames, unsigned int channels) {
+    RenderResult result = {0, nullptr, false, 0, 0};
+    RenderBuffers io = this->buffers(frames, channels);
+    size_t length = frames * channels;
 
     v8::Isolate::Scope isolate_scope(this->isolate_);
     v8::HandleScope handle_scope(this->isolate_);
@@ -121,45 +544,46 @@ RenderResult ScriptEngine::executeRender(float *inoutbuf, unsigned int frames, u
 
     v8::TryCatch try_catch(this->isolate_);
 
-    // create arguments for render(frames, channels, input_array)
-    const int argc = 3;
-    v8::Local<v8::Number> frames_arg = v8::Number::New(this->isolate_, frames);
-    v8::Local<v8::Number> channels_arg = v8::Number::New(this->isolate_, channels);
-    v8::Local<v8::Float32Array> input_array;
-    v8::Local<v8::Primitive> undefined = v8::Undefined(this->isolate_);
-    if (inoutbuf) {
-        size_t byte_length = frames * channels * sizeof(float);
-        v8::Local<v8::ArrayBuffer> array_buffer = v8::ArrayBuffer::New(isolate_, byte_length);
-        void* buffer_data = array_buffer->GetBackingStore()->Data();
-        memcpy(buffer_data, inoutbuf, byte_length);
-        input_array = v8::Float32Array::New(array_buffer, 0, frames * channels);
+    if (active_version_ < 0) {
+        result.error = "render function is not defined";
+        return result;
     }
-    v8::Local<v8::Value> argv[argc] = {
-        frames_arg,
-        channels_arg,
-        inoutbuf ? (v8::Local<v8::Value>)input_array : (v8::Local<v8::Value>)undefined
-    };
-
-    // call render()
-    v8::Local<v8::Function> render = this->render_.Get(this->isolate_);
+    RenderVersion &version = versions_[active_version_];
+    v8::Local<v8::Function> render = version.function.Get(this->isolate_);
+    v8::Local<v8::Value> argv[RENDER_ARGC_MAX];
+    int argc = RenderArguments(this->isolate_, version.kind, io_arrays_, frames, channels, argv);
 
     // check result
     v8::Local<v8::Value> call_result;
     if (!render->Call(local_context, local_context->Global(), argc, argv).ToLocal(&call_result)) {
-        v8::String::Utf8Value error(this->isolate_, try_catch.Exception());
-        result.error = strdup(*error);
+        if (try_catch.HasTerminated()) {
+            this->isolate_->CancelTerminateExecution();
+            result.terminated = true;
+            snprintf(render_error_, sizeof(render_error_), "render call terminated by the watchdog");
+        } else {
+            WriteException(this->isolate_, local_context, try_catch.Exception(), render_error_, sizeof(render_error_));
+        }
+        return this->renderFailed_(result);
+    }
+    if (version.kind != RENDER_RETURN) {
+        // oto_render_into and oto_render_planar wrote into the output buffer.
+        version.clean = true;
+        version.failed = false;
+        result.count = length;
         return result;
     }
     if (!call_result->IsFloat32Array()) {
-        result.error = strdup("Return value from render is not Float32Array");
-        return result;
+        snprintf(render_error_, sizeof(render_error_), "Return value from render is not Float32Array");
+        return this->renderFailed_(result);
     }
+    version.clean = true;
+    version.failed = false;
 
-    // copy result to inoutbuf
+    // copy result to the output buffer
     v8::Local<v8::Float32Array> ret_array = call_result.As<v8::Float32Array>();
-    std::shared_ptr<v8::BackingStore> backing = ret_array->Buffer()->GetBackingStore();
-    memcpy(inoutbuf, static_cast<float *>(backing->Data()), ret_array->Length() * sizeof(float));
-    result.count = ret_array->Length();
+    size_t count = std::min(ret_array->Length(), length);
+    ret_array->CopyContents(io.output, count * sizeof(float));
+    result.count = count;
 
     return result;
 }
@@ -174,25 +598,263 @@ void ScriptEngine::setGlobalVariable(const char *name, double value) {
     v8::Local<v8::String> var_name = v8::String::NewFromUtf8(this->isolate_, name).ToLocalChecked();
     v8::Local<v8::Number> var_value = v8::Number::New(this->isolate_, value);
     local_context->Global()->Set(local_context, var_name, var_value).FromJust();
+    if (replay_history_) {
+        globals_[name] = value;
+    }
+}
+
+// Keep the scripts and the globals for the warm-up to replay, from the next ones.
+void ScriptEngine::setReplayHistory(bool enabled) {
+    this->replay_history_ = enabled;
+}
+
+// Give the scripts a block of count parameters as the global Float32Array params and return it for the host to write.
+float *ScriptEngine::setParameters(unsigned int count) {
+    v8::Isolate::Scope isolate_scope(this->isolate_);
+    v8::HandleScope handle_scope(this->isolate_);
+    v8::Local<v8::Context> local_context = this->context_.Get(this->isolate_);
+    v8::Context::Scope context_scope(local_context);
+
+    // allocated by V8 inside its sandbox like the render buffers, zero filled.
+    params_store_ = v8::ArrayBuffer::NewBackingStore(this->isolate_, count * sizeof(float));
+    param_names_.clear();
+    SetupParameters(this->isolate_, local_context, v8::ArrayBuffer::New(this->isolate_, params_store_), param_names_);
+    return static_cast<float *>(params_store_->Data());
+}
+
+// Name a parameter, as param_index[name] of the scripts.
+void ScriptEngine::setParameterIndex(const char *name, int index) {
+    v8::Isolate::Scope isolate_scope(this->isolate_);
+    v8::HandleScope handle_scope(this->isolate_);
+    v8::Local<v8::Context> local_context = this->context_.Get(this->isolate_);
+    v8::Context::Scope context_scope(local_context);
+
+    v8::Local<v8::Value> param_index;
+    v8::Local<v8::String> index_name = v8::String::NewFromUtf8(this->isolate_, PARAM_INDEX_VARIABLE_NAME).ToLocalChecked();
+    if (local_context->Global()->Get(local_context, index_name).ToLocal(&param_index) && param_index->IsObject()) {
+        v8::Local<v8::String> key = v8::String::NewFromUtf8(this->isolate_, name).ToLocalChecked();
+        param_index.As<v8::Object>()->Set(local_context, key, v8::Integer::New(this->isolate_, index)).Check();
+    }
+    param_names_.emplace_back(name, index);
+}
+
+// Return the counters of the ArrayBuffer pool. Can be called from any thread.
+AllocatorStats ScriptEngine::allocatorStats() const {
+    return allocator_->stats();
+}
+
+// Return the counters of the sample cache. Can be called from any thread.
+SampleCacheStats ScriptEngine::sampleCacheStats() const {
+    return samples_->stats();
+}
+
+// Return the files in the sample cache. Call this while holding the engine.
+std::vector<SampleInfo> ScriptEngine::samples() const {
+    return samples_->samples();
+}
+
+// Drop the files in the sample cache, the next loads read them again. Call this while holding the engine.
+void ScriptEngine::clearSamples() {
+    samples_->clear();
+}
+
+// Stop the JavaScript running now, for a runaway render call. Can be called from any thread.
+void ScriptEngine::terminateExecution() {
+    this->isolate_->TerminateExecution();
+}
+
+// Clear a termination which arrived after the call had finished. Touches the isolate.
+void ScriptEngine::cancelTerminateExecution() {
+    this->isolate_->CancelTerminateExecution();
+}
+
+// Stop calling the render function until a posted code defines one again.
+void ScriptEngine::disableRender() {
+    this->active_version_ = -1;
+    this->render_disabled_ = true;
+}
+
+// Return the render versions, oldest first.
+std::vector<RenderVersionInfo> ScriptEngine::renderVersions() const {
+    std::vector<RenderVersionInfo> infos;
+    for (size_t i = 0; i < versions_.size(); i++) {
+        const RenderVersion &version = versions_[i];
+        infos.push_back({version.id, RENDER_FUNCTION_NAMES[version.kind], version.clean, version.failed, (int)i == active_version_});
+    }
+    return infos;
+}
+
+// Make the render version with the id the one executeRender() calls. Returns false if there is no such version.
+bool ScriptEngine::switchRenderVersion(int id) {
+    for (size_t i = 0; i < versions_.size(); i++) {
+        if (versions_[i].id == id) {
+            active_version_ = i;
+            render_disabled_ = false;
+            return true;
+        }
+    }
+    return false;
 }
 
 // -------------------- internal functions
 
+void RenderArrays::Reset() {
+    input.Reset();
+    output.Reset();
+    input_channels.Reset();
+    output_channels.Reset();
+    ports.Reset();
+    port_channels.Reset();
+}
+
+// Create the interleaved arrays and the per channel views over the buffers.
+void CreateRenderArrays(v8::Isolate *isolate, v8::Local<v8::Context> context,
+                        v8::Local<v8::ArrayBuffer> input, v8::Local<v8::ArrayBuffer> output,
+                        v8::Local<v8::ArrayBuffer> ports, unsigned int port_count,
+                        unsigned int frames, unsigned int channels, RenderArrays *arrays) {
+    size_t length = frames * channels;
+    arrays->input.Reset(isolate, v8::Float32Array::New(input, 0, length));
+    arrays->output.Reset(isolate, v8::Float32Array::New(output, 0, length));
+
+    v8::Local<v8::Array> input_channels = v8::Array::New(isolate, channels);
+    v8::Local<v8::Array> output_channels = v8::Array::New(isolate, channels);
+    for (unsigned int channel = 0; channel < channels; channel++) {
+        size_t byte_offset = channel * frames * sizeof(float);
+        input_channels->Set(context, channel, v8::Float32Array::New(input, byte_offset, frames)).Check();
+        output_channels->Set(context, channel, v8::Float32Array::New(output, byte_offset, frames)).Check();
+    }
+    arrays->input_channels.Reset(isolate, input_channels);
+    arrays->output_channels.Reset(isolate, output_channels);
+
+    // each port input is a block laid out like the input.
+    if (port_count == 0) {
+        arrays->ports.Reset();
+        arrays->port_channels.Reset();
+        return;
+    }
+    v8::Local<v8::Array> ports_array = v8::Array::New(isolate, port_count);
+    v8::Local<v8::Array> port_channels = v8::Array::New(isolate, port_count);
+    for (unsigned int port = 0; port < port_count; port++) {
+        size_t port_offset = port * length * sizeof(float);
+        ports_array->Set(context, port, v8::Float32Array::New(ports, port_offset, length)).Check();
+        v8::Local<v8::Array> views = v8::Array::New(isolate, channels);
+        for (unsigned int channel = 0; channel < channels; channel++) {
+            views->Set(context, channel, v8::Float32Array::New(ports, port_offset + channel * frames * sizeof(float), frames)).Check();
+        }
+        port_channels->Set(context, port, views).Check();
+    }
+    arrays->ports.Reset(isolate, ports_array);
+    arrays->port_channels.Reset(isolate, port_channels);
+}
+
+// Set the globals params over the buffer and param_index of the names.
+void SetupParameters(v8::Isolate *isolate, v8::Local<v8::Context> context, v8::Local<v8::ArrayBuffer> buffer, const std::vector<std::pair<std::string, int>> &names) {
+    v8::Local<v8::Float32Array> params = v8::Float32Array::New(buffer, 0, buffer->ByteLength() / sizeof(float));
+    v8::Local<v8::Object> param_index = v8::Object::New(isolate);
+    for (auto &name : names) {
+        v8::Local<v8::String> key = v8::String::NewFromUtf8(isolate, name.first.c_str()).ToLocalChecked();
+        param_index->Set(context, key, v8::Integer::New(isolate, name.second)).Check();
+    }
+    context->Global()->Set(context, v8::String::NewFromUtf8(isolate, PARAMS_VARIABLE_NAME).ToLocalChecked(), params).Check();
+    context->Global()->Set(context, v8::String::NewFromUtf8(isolate, PARAM_INDEX_VARIABLE_NAME).ToLocalChecked(), param_index).Check();
+}
+
+// Fill argv with the arguments of the render function of the kind and return the number of them.
+int RenderArguments(v8::Isolate *isolate, RenderKind kind, const RenderArrays &arrays,
+                    unsigned int frames, unsigned int channels, v8::Local<v8::Value> *argv) {
+    v8::Local<v8::Value> frames_arg = v8::Number::New(isolate, frames);
+    v8::Local<v8::Value> channels_arg = v8::Number::New(isolate, channels);
+    int argc;
+    switch (kind) {
+    case RENDER_INTO:
+        argv[0] = arrays.output.Get(isolate);
+        argv[1] = arrays.input.Get(isolate);
+        argv[2] = frames_arg;
+        argv[3] = channels_arg;
+        argc = 4;
+        break;
+    case RENDER_PLANAR:
+        argv[0] = arrays.output_channels.Get(isolate);
+        argv[1] = arrays.input_channels.Get(isolate);
+        argv[2] = frames_arg;
+        argv[3] = channels_arg;
+        argc = 4;
+        break;
+    default:
+        argv[0] = frames_arg;
+        argv[1] = channels_arg;
+        argv[2] = arrays.input.Get(isolate);
+        argc = 3;
+        break;
+    }
+    // the port inputs come last, in the form of the input argument.
+    if (!arrays.ports.IsEmpty()) {
+        argv[argc++] = kind == RENDER_PLANAR ? arrays.port_channels.Get(isolate) : arrays.ports.Get(isolate);
+    }
+    return argc;
+}
+
+// Set the Otojs object of the native functions to global.
+void SetupOtojs(v8::Isolate *isolate, v8::Local<v8::Context> context, ScriptEngineSamples *samples) {
+    v8::Local<v8::Object> otojs = v8::Object::New(isolate);
+    samples->setup(isolate, context, otojs);
+    context->Global()->Set(context, v8::String::NewFromUtf8Literal(isolate, "Otojs"), otojs).Check();
+}
+
+// Read the render function candidates, indexed by RenderKind, from the global object.
+void GetRenderFunctions(v8::Isolate *isolate, v8::Local<v8::Context> context, v8::Local<v8::Value> *values) {
+    for (int kind = 0; kind < RENDER_KINDS; kind++) {
+        v8::Local<v8::String> name = v8::String::NewFromUtf8(isolate, RENDER_FUNCTION_NAMES[kind]).ToLocalChecked();
+        if (!context->Global()->Get(context, name).ToLocal(&values[kind])) {
+            values[kind] = v8::Undefined(isolate);
+        }
+    }
+}
+
+// Pick the render function after a script ran. A render function (re)defined by the script wins,
+// and any render function is picked if previous is null.
+bool PickRenderFunction(v8::Isolate *isolate, v8::Local<v8::Context> context, v8::Local<v8::Value> *previous, v8::Local<v8::Function> *render, RenderKind *kind) {
+    v8::Local<v8::Value> current[RENDER_KINDS];
+    GetRenderFunctions(isolate, context, current);
+    for (RenderKind candidate : RENDER_PREFERENCE) {
+        if (!current[candidate]->IsFunction()) {
+            continue;
+        }
+        if (previous && current[candidate]->StrictEquals(previous[candidate])) {
+            continue;
+        }
+        *render = current[candidate].As<v8::Function>();
+        *kind = candidate;
+        return true;
+    }
+    return false;
+}
+
 // Extracts a C string from a V8 Utf8Value.
 const char *ToCString(const v8::String::Utf8Value &value) {
     return *value ? *value : "<string conversion failed>";
 }
 
-// Executes a string within the current v8 context.
-const char *ExecuteString(v8::Isolate *isolate, v8::Local<v8::Context> context,
-                   v8::Local<v8::String> source, v8::Local<v8::String> name) {
+// Compiles a string within the current v8 context.
+const char *CompileString(v8::Isolate *isolate, v8::Local<v8::Context> context,
+                   v8::Local<v8::String> source, v8::Local<v8::String> name, v8::Local<v8::Script> *script) {
     v8::TryCatch try_catch(isolate);
     v8::ScriptOrigin origin(name);
-    v8::Local<v8::Script> script;
-    if (!v8::Script::Compile(context, source, &origin).ToLocal(&script)) {
+    if (!v8::Script::Compile(context, source, &origin).ToLocal(script)) {
         return FormatException(isolate, &try_catch);
     }
-    if (script->Run(context).IsEmpty()) {
+    return nullptr;
+}
+
+// Executes a string within the current v8 context.
+const char *ExecuteString(v8::Isolate *isolate, v8::Local<v8::Context> context,
+                   v8::Local<v8::String> source, v8::Local<v8::String> name, v8::Local<v8::Script> *script) {
+    const char *error = CompileString(isolate, context, source, name, script);
+    if (error) {
+        return error;
+    }
+    v8::TryCatch try_catch(isolate);
+    if ((*script)->Run(context).IsEmpty()) {
         return FormatException(isolate, &try_catch);
     }
     return nullptr;
@@ -273,3 +935,30 @@ const char *FormatException(v8::Isolate *isolate, v8::TryCatch *try_catch) {
     }
     return strdup(result.c_str());
 }
+
+// Format the exception, or clear the termination if the call was stopped by terminateExecution().
+const char *FormatTermination(v8::Isolate *isolate, v8::TryCatch *try_catch) {
+    if (try_catch->HasTerminated()) {
+        isolate->CancelTerminateExecution();
+        return strdup("execution terminated by the render watchdog");
+    }
+    return FormatException(isolate, try_catch);
+}
+
+// Write the exception as UTF-8 into the buffer, truncated to the size, without allocating outside the V8 heap.
+void WriteException(v8::Isolate *isolate, v8::Local<v8::Context> context, v8::Local<v8::Value> exception, char *buffer, size_t size) {
+    v8::TryCatch try_catch(isolate);
+    v8::Local<v8::String> str;
+    size_t length = 0;
+    if (exception->ToString(context).ToLocal(&str)) {
+#if V8_MAJOR_VERSION >= 14
+        length = str->WriteUtf8V2(isolate, buffer, size - 1, v8::String::WriteFlags::kReplaceInvalidUtf8);
+#else
+        length = str->WriteUtf8(isolate, buffer, size - 1, nullptr,
+                                v8::String::NO_NULL_TERMINATION | v8::String::REPLACE_INVALID_UTF8);
+#endif
+    } else {
+        length = snprintf(buffer, size, "<string conversion failed>");
+    }
+    buffer[length < size ? length : size - 1] = '\0';
+}
@@ -5,43 +5,240 @@
 #include <libplatform/libplatform.h>
 #include <v8.h>
 
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "script_engine_allocator.h"
+#include "script_engine_samples.h"
+
+// How the render function receives and returns the samples.
+enum RenderKind {
+    // oto_render(frames, channels, input_array) returns a new Float32Array.
+    RENDER_RETURN,
+    // oto_render_into(output_array, input_array, frames, channels) fills output_array.
+    RENDER_INTO,
+    // oto_render_planar(output_channels, input_channels, frames, channels) fills a Float32Array per channel.
+    RENDER_PLANAR,
+    RENDER_KINDS
+};
+// With port inputs (see setPortInputs()), every render function gets one more argument after the others:
+// an Array of the port inputs, each in the same form as its input argument.
+
+// Buffers shared with JavaScript without copy, valid until the shape changes.
+struct RenderBuffers {
+    float *input;
+    float *output;
+    // true if the samples are laid out channel by channel (frames samples each), otherwise interleaved.
+    bool planar;
+    // inputs of the ports one after another, each laid out like input. null without port inputs.
+    float *ports;
+};
+
+// JavaScript side of the render buffers.
+struct RenderArrays {
+    v8::Global<v8::Float32Array> input;
+    v8::Global<v8::Float32Array> output;
+    // Arrays of a Float32Array view per channel over input/output
+    v8::Global<v8::Array> input_channels;
+    v8::Global<v8::Array> output_channels;
+    // Arrays of the port inputs, a Float32Array per port and an Array of views per channel per port. Empty without port inputs.
+    v8::Global<v8::Array> ports;
+    v8::Global<v8::Array> port_channels;
+
+    void Reset();
+};
+
 struct RenderResult {
     // number if output samples (channels * frames);
     int count;
-    // error message if any
+    // error message if any, owned by the engine and valid until the next executeRender()
+    const char *error;
+    // true if the call was stopped by terminateExecution()
+    bool terminated;
+    // id of the render version which failed, and of the version the engine fell back to (0 if none)
+    int failed_version;
+    int fallback_version;
+};
+
+struct RenderVersionInfo {
+    int id;
+    // name of the render function
+    const char *name;
+    // true if the version rendered without error
+    bool clean;
+    // true if the version threw or was terminated
+    bool failed;
+    // true if the version is the one called now
+    bool active;
+};
+
+struct WarmupResult {
+    // number of calls made to the render function in the shadow context
+    int calls;
+    // time spent for the warm-up including the replay of the scripts
+    double milliseconds;
+    // true if V8 reported the render function of the shadow context as optimized. The live function is another
+    // closure of the same code: it shares the bytecode, but has its own feedback and is optimized by its own calls.
+    bool optimized;
+    // V8 optimization status bits of the render function of the shadow context, -1 if unknown
+    int optimization_status;
+    // error message (malloc'ed) if the warm-up failed
     char *error;
 };
 
 class ScriptEngine {
-    // V8 environment
-    std::unique_ptr<v8::Platform> platform_;
+    // V8 environment, one isolate per engine
     v8::Isolate::CreateParams create_params_;
+    ScriptEngineAllocator *allocator_;
     v8::Isolate *isolate_;
     v8::Global<v8::Context> context_;
 
     // Object Cache
     v8::Global<v8::String> no_file_name_;
 
-    // keep render function reference
-    v8::Global<v8::Function> render_;
+    // files loaded by Otojs.loadSample(), kept across posted codes
+    ScriptEngineSamples *samples_;
+
+    // render functions installed so far, the oldest is dropped beyond RENDER_VERSIONS_MAX.
+    struct RenderVersion {
+        int id;
+        v8::Global<v8::Function> function;
+        RenderKind kind;
+        bool clean;
+        bool failed;
+    };
+    std::vector<RenderVersion> versions_;
+    // index of the version executeRender() calls, -1 if none
+    int active_version_;
+    // true after disableRender(), until a script (re)defines a render function or a version is switched to.
+    // Until then the render function left in the globals is not picked up again.
+    bool render_disabled_;
+    int next_version_id_;
+    // error message of the latest executeRender(), written in place so that a failing render does not allocate
+    char render_error_[256];
+
+    // input/output arrays reused by every render call, backed by buffers the host writes and reads directly
+    std::shared_ptr<v8::BackingStore> input_store_;
+    std::shared_ptr<v8::BackingStore> output_store_;
+    RenderArrays io_arrays_;
+    // inputs of the shared memory ports, passed to the render function after its other arguments
+    unsigned int port_inputs_;
+    std::shared_ptr<v8::BackingStore> ports_store_;
+    unsigned int io_frames_;
+    unsigned int io_channels_;
+
+    // scripts ran so far and global variables set so far, replayed into shadow contexts. Kept only with
+    // setReplayHistory(true): the start codes (the first start_scripts_) and the last REPLAY_POSTED_MAX posted codes.
+    bool replay_history_;
+    std::vector<v8::Global<v8::UnboundScript>> scripts_;
+    size_t start_scripts_;
+    std::map<std::string, double> globals_;
 
-    void resetRender_(v8::Local<v8::Context> context);
+    // the parameter block shared with the host, and its names by index, null without parameters
+    std::shared_ptr<v8::BackingStore> params_store_;
+    std::vector<std::pair<std::string, int>> param_names_;
+
+    void resetRender_(v8::Local<v8::Context> context, v8::Local<v8::Value> *previous);
+    void recordScript_(v8::Local<v8::Script> script, bool start_code);
+    RenderResult renderFailed_(RenderResult result);
 
 public:
-    ScriptEngine(const char *exec_path);
+    // Posted code on its way from source text to a runnable script.
+    class CompileJob;
+
+    // Set V8 flags. Call this before initializePlatform().
+    static void setFlags(const char *flags);
+
+    // Initialize V8 for the process. Call this once before creating ScriptEngines.
+    static void initializePlatform(const char *exec_path);
+
+    // Dispose V8. Call this after deleting every ScriptEngine.
+    static void disposePlatform();
+
+    // Each engine owns an isolate, engines can run on different threads at the same time.
+    ScriptEngine();
     ~ScriptEngine();
 
     // Execute the given JavaScript code and return the error message if any.
     const char *executeCode(const char *code);
 
-    // Execute the given JavaScript file and return the error message if any.
+    // Prepare to compile the given code. Touches the isolate, so call this while holding the engine.
+    CompileJob *startCompile(const char *code);
+
+    // Parse and compile the code of the job. Does not touch the isolate, so call this without holding the engine.
+    static void runCompile(CompileJob *job);
+
+    // Finish compiling the code of the job and return false on a compile error. Touches the isolate.
+    bool finishCompile(CompileJob *job);
+
+    // Keep the scripts and the globals for the warm-up to replay, from the next ones. Off by default.
+    void setReplayHistory(bool enabled);
+
+    // Prepare a shadow context to exercise the render function of the job before it goes live.
+    // The shadow context replays the kept scripts, so their top-level code runs again (silently for the console).
+    void startWarmup(CompileJob *job, unsigned int frames, unsigned int channels, int calls);
+
+    // Continue the warm-up within the time budget. Returns true when the warm-up is over.
+    // The budget is checked between the scripts and between the render calls: the top level of a replayed script
+    // runs to its end, so a slow one overruns the budget.
+    bool stepWarmup(CompileJob *job, double budget_ms);
+
+    // Discard the shadow context and return the result of the warm-up.
+    WarmupResult finishWarmup(CompileJob *job);
+
+    // Run the compiled code of the job and return the error message if any. The job is deleted.
+    const char *executeCompiled(CompileJob *job);
+
+    // Execute the given JavaScript file and return the error message if any. Kept for the warm-up as a start code.
     const char *executeFromFile(const char *filename);
 
-    // Call the render function with the given input buffer and return the output samples.
-    RenderResult executeRender(float *inoutbuf, unsigned int frames, unsigned int channels);
+    // Give the render function count more inputs, filled by the host through RenderBuffers::ports. Call this before buffers().
+    void setPortInputs(unsigned int count);
+
+    // Return the input/output buffers for the given shape. Write the input before executeRender() and read the output after.
+    RenderBuffers buffers(unsigned int frames, unsigned int channels);
+
+    // Call the render function with the input buffer and fill the output buffer.
+    RenderResult executeRender(unsigned int frames, unsigned int channels);
 
     // Set global variable.
     void setGlobalVariable(const char *name, double value);
+
+    // Give the scripts a block of count parameters as the global Float32Array params and return it for the host to write.
+    // The host writes the values at any time, the render function reads them as they are. Call this once.
+    float *setParameters(unsigned int count);
+
+    // Name a parameter, as param_index[name] of the scripts.
+    void setParameterIndex(const char *name, int index);
+
+    // Stop the JavaScript running now, for a runaway render call. Can be called from any thread.
+    void terminateExecution();
+
+    // Clear a termination which arrived after the call had finished. Touches the isolate.
+    void cancelTerminateExecution();
+
+    // Stop calling the render function until a posted code defines one again.
+    void disableRender();
+
+    // Return the render versions, oldest first.
+    std::vector<RenderVersionInfo> renderVersions() const;
+
+    // Make the render version with the id the one executeRender() calls. Returns false if there is no such version.
+    bool switchRenderVersion(int id);
+
+    // Return the counters of the ArrayBuffer pool. Can be called from any thread.
+    AllocatorStats allocatorStats() const;
+
+    // Return the counters of the sample cache. Can be called from any thread.
+    SampleCacheStats sampleCacheStats() const;
+
+    // Return the files in the sample cache. Call this while holding the engine.
+    std::vector<SampleInfo> samples() const;
+
+    // Drop the files in the sample cache, the next loads read them again. Call this while holding the engine.
+    void clearSamples();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,132 @@
+// Otojsd::ScriptEngineAllocator - ArrayBuffer allocator pooling audio-sized blocks.
+
+#include <string.h>
+
+#include "script_engine_allocator.h"
+
+// Return the size class index for the length, or -1 if it is too large to be pooled.
+static int size_class_of(size_t length, int min_shift, int max_shift) {
+    int shift = min_shift;
+    while (shift <= max_shift && ((size_t)1 << shift) < length) {
+        shift++;
+    }
+    return shift <= max_shift ? shift - min_shift : -1;
+}
+
+// -------------------- create/destroy
+
+ScriptEngineAllocator::ScriptEngineAllocator(v8::ArrayBuffer::Allocator *underlying)
+    : underlying_(underlying), hits_(0), misses_(0), bytes_outstanding_(0), bytes_pooled_(0) {
+}
+
+ScriptEngineAllocator::~ScriptEngineAllocator() {
+    for (int i = 0; i < CLASSES; i++) {
+        size_t class_size = (size_t)1 << (i + MIN_CLASS_SHIFT);
+        FreeBlock *block = classes_[i].head;
+        while (block) {
+            FreeBlock *next = block->next;
+            underlying_->Free(block, class_size);
+            block = next;
+        }
+        classes_[i].head = nullptr;
+    }
+    delete underlying_;
+}
+
+// -------------------- private functions
+
+void *ScriptEngineAllocator::allocate_(size_t length, bool initialize) {
+    int index = size_class_of(length, MIN_CLASS_SHIFT, MAX_CLASS_SHIFT);
+    if (index < 0) {
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        void *data = initialize ? underlying_->Allocate(length) : underlying_->AllocateUninitialized(length);
+        if (data) {
+            bytes_outstanding_.fetch_add(length, std::memory_order_relaxed);
+        }
+        return data;
+    }
+
+    size_t class_size = (size_t)1 << (index + MIN_CLASS_SHIFT);
+    SizeClass &size_class = classes_[index];
+    while (size_class.lock.test_and_set(std::memory_order_acquire)) {
+    }
+    FreeBlock *block = size_class.head;
+    if (block) {
+        size_class.head = block->next;
+        size_class.count--;
+    }
+    size_class.lock.clear(std::memory_order_release);
+
+    void *data;
+    if (block) {
+        hits_.fetch_add(1, std::memory_order_relaxed);
+        bytes_pooled_.fetch_sub(class_size, std::memory_order_relaxed);
+        data = block;
+        if (initialize) {
+            memset(data, 0, length);
+        }
+    } else {
+        // allocate the whole class size, so that the block can serve any length of the class later.
+        misses_.fetch_add(1, std::memory_order_relaxed);
+        data = initialize ? underlying_->Allocate(class_size) : underlying_->AllocateUninitialized(class_size);
+    }
+    if (data) {
+        bytes_outstanding_.fetch_add(class_size, std::memory_order_relaxed);
+    }
+    return data;
+}
+
+// -------------------- public functions
+
+void *ScriptEngineAllocator::Allocate(size_t length) {
+    return allocate_(length, true);
+}
+
+void *ScriptEngineAllocator::AllocateUninitialized(size_t length) {
+    return allocate_(length, false);
+}
+
+// V8 may call this from its background threads.
+void ScriptEngineAllocator::Free(void *data, size_t length) {
+    if (!data) {
+        return;
+    }
+    int index = size_class_of(length, MIN_CLASS_SHIFT, MAX_CLASS_SHIFT);
+    if (index < 0) {
+        bytes_outstanding_.fetch_sub(length, std::memory_order_relaxed);
+        underlying_->Free(data, length);
+        return;
+    }
+
+    size_t class_size = (size_t)1 << (index + MIN_CLASS_SHIFT);
+    bytes_outstanding_.fetch_sub(class_size, std::memory_order_relaxed);
+
+    SizeClass &size_class = classes_[index];
+    bool pooled = false;
+    while (size_class.lock.test_and_set(std::memory_order_acquire)) {
+    }
+    if ((size_class.count + 1) * class_size <= MAX_POOLED_BYTES_PER_CLASS) {
+        FreeBlock *block = static_cast<FreeBlock *>(data);
+        block->next = size_class.head;
+        size_class.head = block;
+        size_class.count++;
+        pooled = true;
+    }
+    size_class.lock.clear(std::memory_order_release);
+
+    if (pooled) {
+        bytes_pooled_.fetch_add(class_size, std::memory_order_relaxed);
+    } else {
+        underlying_->Free(data, class_size);
+    }
+}
+
+// Return the pool counters. Can be called from any thread.
+AllocatorStats ScriptEngineAllocator::stats() const {
+    return {
+        hits_.load(std::memory_order_relaxed),
+        misses_.load(std::memory_order_relaxed),
+        bytes_outstanding_.load(std::memory_order_relaxed),
+        bytes_pooled_.load(std::memory_order_relaxed),
+    };
+}
@@ -0,0 +1,67 @@
+#ifndef SCRIPT_ENGINE_ALLOCATOR_H
+#define SCRIPT_ENGINE_ALLOCATOR_H
+// Otojsd::ScriptEngineAllocator - ArrayBuffer allocator pooling audio-sized blocks.
+
+#include <v8.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+struct AllocatorStats {
+    // allocations served from the pool
+    uint64_t hits;
+    // allocations passed to the underlying allocator
+    uint64_t misses;
+    // bytes handed to V8 and not freed yet
+    int64_t bytes_outstanding;
+    // bytes kept in the pool for reuse
+    int64_t bytes_pooled;
+};
+
+// Keeps freed blocks in power-of-two size classes and hands them out again,
+// so per-callback `new Float32Array(frames * channels)` does not reach calloc/free.
+// Blocks come from the underlying allocator, which keeps them inside the V8 sandbox.
+class ScriptEngineAllocator : public v8::ArrayBuffer::Allocator {
+    // size classes: 64 bytes to 256 KiB
+    static const int MIN_CLASS_SHIFT = 6;
+    static const int MAX_CLASS_SHIFT = 18;
+    static const int CLASSES = MAX_CLASS_SHIFT - MIN_CLASS_SHIFT + 1;
+    // upper bound of bytes pooled per size class
+    static const size_t MAX_POOLED_BYTES_PER_CLASS = 4 * 1024 * 1024;
+
+    // freed block, linked through its own first bytes
+    struct FreeBlock {
+        FreeBlock *next;
+    };
+
+    struct SizeClass {
+        std::atomic_flag lock = ATOMIC_FLAG_INIT;
+        FreeBlock *head = nullptr;
+        size_t count = 0;
+    };
+
+    v8::ArrayBuffer::Allocator *underlying_;
+    SizeClass classes_[CLASSES];
+
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<int64_t> bytes_outstanding_;
+    std::atomic<int64_t> bytes_pooled_;
+
+    void *allocate_(size_t length, bool initialize);
+
+public:
+    // Takes the ownership of the underlying allocator.
+    ScriptEngineAllocator(v8::ArrayBuffer::Allocator *underlying);
+    ~ScriptEngineAllocator() override;
+
+    void *Allocate(size_t length) override;
+    void *AllocateUninitialized(size_t length) override;
+    void Free(void *data, size_t length) override;
+
+    // Return the pool counters. Can be called from any thread.
+    AllocatorStats stats() const;
+};
+
+#endif // SCRIPT_ENGINE_ALLOCATOR_H
@@ -11,27 +11,38 @@
     v8::Isolate *isolate = args.GetIsolate(); \
     v8::HandleScope handle_scope(isolate);
 
-#define SET_MESSAGES                                         \
-    const char **messages = new const char *[args.Length()]; \
-    for (int i = 0; i < args.Length(); ++i) {                \
-        v8::String::Utf8Value str(isolate, args[i]);         \
-        messages[i] = strdup(*str);                          \
+// Queue the arguments from start as one message, without allocating. See logger::queue().
+#define QUEUE_MESSAGES(level, start)                                                \
+    char message[logger::QUEUE_TEXT_SIZE];                                          \
+    size_t length = WriteArguments(isolate, args, start, message, sizeof(message)); \
+    logger::queue(level, message, length);
+
+// Write the arguments from start into the buffer as UTF-8, truncated to the size. Returns the length.
+size_t WriteArguments(v8::Isolate *isolate, const v8::FunctionCallbackInfo<v8::Value> &args, int start, char *buffer, size_t size) {
+    v8::Local<v8::Context> context = isolate->GetCurrentContext();
+    v8::TryCatch try_catch(isolate);
+    size_t length = 0;
+    for (int i = start; i < args.Length() && length < size; ++i) {
+        v8::Local<v8::String> str;
+        if (!args[i]->ToString(context).ToLocal(&str)) {
+            continue;
+        }
+#if V8_MAJOR_VERSION >= 14
+        length += str->WriteUtf8V2(isolate, buffer + length, size - length, v8::String::WriteFlags::kReplaceInvalidUtf8);
+#else
+        length += str->WriteUtf8(isolate, buffer + length, size - length, nullptr,
+                                 v8::String::NO_NULL_TERMINATION | v8::String::REPLACE_INVALID_UTF8);
+#endif
     }
-
-#define FREE_MESSAGES                         \
-    for (int i = 0; i < args.Length(); ++i) { \
-        free((void *)messages[i]);            \
-    }                                         \
-    delete[] messages;
+    return length;
+}
 
 void callback_console_log(const v8::FunctionCallbackInfo<v8::Value> &args) {
     if (args.Length() < 1) {
         return;
     }
     ISOLATE
-    SET_MESSAGES
-    logger::log(args.Length(), messages);
-    FREE_MESSAGES
+    QUEUE_MESSAGES(logger::LEVEL_LOG, 0)
 }
 
 void callback_console_info(const v8::FunctionCallbackInfo<v8::Value> &args) {
@@ -39,9 +50,7 @@ void callback_console_info(const v8::FunctionCallbackInfo<v8::Value> &args) {
         return;
     }
     ISOLATE
-    SET_MESSAGES
-    logger::info(args.Length(), messages);
-    FREE_MESSAGES
+    QUEUE_MESSAGES(logger::LEVEL_INFO, 0)
 }
 
 void callback_console_debug(const v8::FunctionCallbackInfo<v8::Value> &args) {
@@ -49,9 +58,7 @@ void callback_console_debug(const v8::FunctionCallbackInfo<v8::Value> &args) {
         return;
     }
     ISOLATE
-    SET_MESSAGES
-    logger::debug(args.Length(), messages);
-    FREE_MESSAGES
+    QUEUE_MESSAGES(logger::LEVEL_DEBUG, 0)
 }
 
 void callback_console_warn(const v8::FunctionCallbackInfo<v8::Value> &args) {
@@ -59,9 +66,7 @@ void callback_console_warn(const v8::FunctionCallbackInfo<v8::Value> &args) {
         return;
     }
     ISOLATE
-    SET_MESSAGES
-    logger::warn(args.Length(), messages);
-    FREE_MESSAGES
+    QUEUE_MESSAGES(logger::LEVEL_WARN, 0)
 }
 
 void callback_console_error(const v8::FunctionCallbackInfo<v8::Value> &args) {
@@ -69,9 +74,7 @@ void callback_console_error(const v8::FunctionCallbackInfo<v8::Value> &args) {
         return;
     }
     ISOLATE
-    SET_MESSAGES
-    logger::error(args.Length(), messages);
-    FREE_MESSAGES
+    QUEUE_MESSAGES(logger::LEVEL_ERROR, 0)
 }
 
 void callback_console_assert(const v8::FunctionCallbackInfo<v8::Value> &args) {
@@ -80,33 +83,27 @@ void callback_console_assert(const v8::FunctionCallbackInfo<v8::Value> &args) {
     }
     ISOLATE
 
-    bool condition = args[0]->BooleanValue(isolate);
-
-    const char **messages = new const char *[args.Length() - 1];
-    for (int i = 0; i < args.Length() - 1; ++i) {
-        v8::String::Utf8Value str(isolate, args[i + 1]);
-        messages[i] = strdup(*str);
+    if (args[0]->BooleanValue(isolate)) {
+        return;
     }
+    QUEUE_MESSAGES(logger::LEVEL_ASSERT, 1)
+}
 
-    logger::assert(condition, args.Length() - 1, messages);
-
-    for (int i = 0; i < args.Length() - 1; ++i) {
-        free((void *)messages[i]);
-    }
-    delete[] messages;
+void callback_console_silent(const v8::FunctionCallbackInfo<v8::Value> &args) {
+    (void)args;
 }
 
-// Setup console object in the V8 context
-void script_engine_console::setup(v8::Isolate *isolate, v8::Local<v8::Context> context) {
+// Setup console object in the V8 context. A silent console discards everything.
+void script_engine_console::setup(v8::Isolate *isolate, v8::Local<v8::Context> context, bool silent) {
     // the console object
     v8::Local<v8::Object> console = v8::Object::New(isolate);
 
-    SET_CALLBACK(context, console, "log", callback_console_log);
-    SET_CALLBACK(context, console, "info", callback_console_info);
-    SET_CALLBACK(context, console, "debug", callback_console_debug);
-    SET_CALLBACK(context, console, "warn", callback_console_warn);
-    SET_CALLBACK(context, console, "error", callback_console_error);
-    SET_CALLBACK(context, console, "assert", callback_console_assert);
+    SET_CALLBACK(context, console, "log", silent ? callback_console_silent : callback_console_log);
+    SET_CALLBACK(context, console, "info", silent ? callback_console_silent : callback_console_info);
+    SET_CALLBACK(context, console, "debug", silent ? callback_console_silent : callback_console_debug);
+    SET_CALLBACK(context, console, "warn", silent ? callback_console_silent : callback_console_warn);
+    SET_CALLBACK(context, console, "error", silent ? callback_console_silent : callback_console_error);
+    SET_CALLBACK(context, console, "assert", silent ? callback_console_silent : callback_console_assert);
 
     // Set console to global
     context->Global()->Set(context, v8::String::NewFromUtf8(isolate, "console").ToLocalChecked(), console).Check();
@@ -5,8 +5,8 @@
 
 namespace script_engine_console {
 
-// Setup console object in the V8 context
-void setup(v8::Isolate *isolate, v8::Local<v8::Context> context);
+// Setup console object in the V8 context. A silent console discards everything.
+void setup(v8::Isolate *isolate, v8::Local<v8::Context> context, bool silent = false);
 
 }; // namespace script_engine_console
 
@@ -0,0 +1,237 @@
+// Otojsd::ScriptEngineSamples - sound files loaded by Otojs.loadSample(), kept across code reloads.
+
+#include <fcntl.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "script_engine_samples.h"
+#include "audio_kernels.h"
+#include "soundreader.h"
+#include "const.h"
+
+// V8 aborts when it cannot allocate a store, so larger files are refused.
+static const size_t SAMPLE_MAX_BYTES = (size_t)1 << 30;
+// frames decoded at once from a sound file
+static const int SAMPLE_READ_FRAMES = 4096;
+
+// Return true if the path has the extension of a raw float file.
+static bool is_raw_file(const char *path) {
+    const char *dot = strrchr(path, '.');
+    return dot && (strcasecmp(dot, ".f32") == 0 || strcasecmp(dot, ".raw") == 0);
+}
+
+static void throw_error(v8::Isolate *isolate, const std::string &message) {
+    isolate->ThrowException(v8::Exception::Error(v8::String::NewFromUtf8(isolate, message.c_str()).ToLocalChecked()));
+}
+
+// Otojs.loadSample(path, [channels]) returns {sampleRate, frames, channels: [Float32Array per channel]}.
+// channels is the number of interleaved channels of a raw float file (1 if omitted), ignored for sound files.
+static void callback_load_sample(const v8::FunctionCallbackInfo<v8::Value> &args) {
+    v8::Isolate *isolate = args.GetIsolate();
+    v8::HandleScope handle_scope(isolate);
+    v8::Local<v8::Context> context = isolate->GetCurrentContext();
+    ScriptEngineSamples *self = static_cast<ScriptEngineSamples *>(args.Data().As<v8::External>()->Value());
+
+    if (args.Length() < 1 || !args[0]->IsString()) {
+        throw_error(isolate, "Otojs.loadSample: path must be a string");
+        return;
+    }
+    v8::String::Utf8Value path(isolate, args[0]);
+    int raw_channels = 1;
+    if (args.Length() >= 2 && !args[1]->IsUndefined()) {
+        raw_channels = args[1]->Int32Value(context).FromMaybe(0);
+        if (raw_channels < 1 || raw_channels > MAX_CHANNELS) {
+            throw_error(isolate, "Otojs.loadSample: channels must be 1 to " + std::to_string(MAX_CHANNELS));
+            return;
+        }
+    }
+
+    std::string error;
+    const ScriptEngineSamples::Entry *entry = self->load(isolate, *path, raw_channels, &error);
+    if (!entry) {
+        throw_error(isolate, "Otojs.loadSample: " + error);
+        return;
+    }
+
+    // a new ArrayBuffer over the cached store, the samples are not copied.
+    v8::Local<v8::ArrayBuffer> buffer = v8::ArrayBuffer::New(isolate, entry->store);
+    v8::Local<v8::Array> channels = v8::Array::New(isolate, entry->channels);
+    for (int channel = 0; channel < entry->channels; channel++) {
+        size_t byte_offset = (size_t)channel * entry->frames * sizeof(float);
+        channels->Set(context, channel, v8::Float32Array::New(buffer, byte_offset, entry->frames)).Check();
+    }
+    v8::Local<v8::Object> result = v8::Object::New(isolate);
+    if (entry->sample_rate > 0) {
+        result->Set(context, v8::String::NewFromUtf8Literal(isolate, "sampleRate"), v8::Number::New(isolate, entry->sample_rate)).Check();
+    }
+    result->Set(context, v8::String::NewFromUtf8Literal(isolate, "frames"), v8::Number::New(isolate, (double)entry->frames)).Check();
+    result->Set(context, v8::String::NewFromUtf8Literal(isolate, "channels"), channels).Check();
+    args.GetReturnValue().Set(result);
+}
+
+// -------------------- create/destroy
+
+ScriptEngineSamples::ScriptEngineSamples()
+    : reading_(false), hits_(0), misses_(0), samples_(0), bytes_(0) {
+}
+
+// Install Otojs.loadSample(path, [channels]) into the otojs object of the context.
+void ScriptEngineSamples::setup(v8::Isolate *isolate, v8::Local<v8::Context> context, v8::Local<v8::Object> otojs) {
+    v8::Local<v8::External> data = v8::External::New(isolate, this);
+    otojs->Set(context, v8::String::NewFromUtf8Literal(isolate, "loadSample"),
+               v8::Function::New(context, callback_load_sample, data).ToLocalChecked())
+        .Check();
+}
+
+// -------------------- cache
+
+// Allow reading the files, while the top level of a script runs. Otherwise only the cached ones are loaded.
+void ScriptEngineSamples::setReading(bool reading) {
+    reading_ = reading;
+}
+
+// Return the entry for the file, reading it if it is not cached or changed. Returns null with the error.
+const ScriptEngineSamples::Entry *ScriptEngineSamples::load(v8::Isolate *isolate, const char *path, int raw_channels, std::string *error) {
+    if (!reading_) {
+        // from the render function: no file access, a changed file is read again by the next script loading it.
+        auto known = paths_.find(path);
+        if (known != paths_.end() && (!is_raw_file(path) || known->second->channels == raw_channels)) {
+            known->second->hits++;
+            hits_++;
+            return known->second;
+        }
+        *error = std::string(path) + " is not loaded, load it at the top level of the code, not in the render function";
+        return nullptr;
+    }
+    char real_path[PATH_MAX];
+    struct stat st;
+    if (!realpath(path, real_path) || stat(real_path, &st) != 0) {
+        *error = std::string("cannot find ") + path;
+        return nullptr;
+    }
+    bool raw = is_raw_file(real_path);
+    auto found = entries_.find(real_path);
+    if (found != entries_.end()) {
+        Entry &cached = found->second;
+        if (cached.mtime == st.st_mtime && cached.size == st.st_size && (!raw || cached.channels == raw_channels)) {
+            cached.hits++;
+            hits_++;
+            paths_[path] = &cached;
+            return &cached;
+        }
+    }
+
+    Entry entry = {st.st_mtime, st.st_size, raw ? raw_channels : 0, 0, 0, nullptr, 0};
+    if (!(raw ? readRawFile_(isolate, real_path, &entry, error) : readSoundFile_(isolate, real_path, &entry, error))) {
+        return nullptr;
+    }
+    misses_++;
+    if (found != entries_.end()) {
+        bytes_ -= found->second.store->ByteLength();
+        found->second = entry;
+    } else {
+        found = entries_.emplace(real_path, entry).first;
+        samples_++;
+    }
+    bytes_ += entry.store->ByteLength();
+    paths_[path] = &found->second;
+    return &found->second;
+}
+
+// Return the cached files. Touches the cache, so call this while holding the engine.
+std::vector<SampleInfo> ScriptEngineSamples::samples() const {
+    std::vector<SampleInfo> infos;
+    for (auto &item : entries_) {
+        const Entry &entry = item.second;
+        infos.push_back({item.first, entry.channels, entry.sample_rate, entry.frames, entry.hits});
+    }
+    return infos;
+}
+
+// Drop every cached file. Arrays already handed to JavaScript keep their samples.
+void ScriptEngineSamples::clear() {
+    paths_.clear();
+    entries_.clear();
+    samples_ = 0;
+    bytes_ = 0;
+}
+
+// Return the counters. Can be called from any thread.
+SampleCacheStats ScriptEngineSamples::stats() const {
+    return {hits_.load(), misses_.load(), samples_.load(), bytes_.load()};
+}
+
+// -------------------- private functions
+
+// Decode an AIFF or WAV file into planar samples.
+bool ScriptEngineSamples::readSoundFile_(v8::Isolate *isolate, const char *path, Entry *entry, std::string *error) {
+    SoundReader *reader = SoundReader_open(path);
+    if (!reader) {
+        *error = std::string("cannot read ") + path + " (AIFF or WAV, or .f32/.raw float samples)";
+        return false;
+    }
+    if (reader->frames == 0 || reader->frames * reader->channels * sizeof(float) > SAMPLE_MAX_BYTES) {
+        *error = std::string(reader->frames == 0 ? "no samples in " : "too large: ") + path;
+        SoundReader_close(reader);
+        return false;
+    }
+    entry->channels = reader->channels;
+    entry->sample_rate = reader->sampleRate;
+    entry->frames = reader->frames;
+    entry->store = v8::ArrayBuffer::NewBackingStore(isolate, entry->frames * entry->channels * sizeof(float));
+
+    float *samples = static_cast<float *>(entry->store->Data());
+    float *interleaved = (float *)malloc((size_t)SAMPLE_READ_FRAMES * entry->channels * sizeof(float));
+    float *planar[MAX_CHANNELS];
+    size_t done = 0;
+    int frames;
+    while ((frames = SoundReader_read(reader, interleaved, SAMPLE_READ_FRAMES)) > 0) {
+        for (int channel = 0; channel < entry->channels; channel++) {
+            planar[channel] = samples + channel * entry->frames + done;
+        }
+        audio_kernels::deinterleave(planar, interleaved, frames, entry->channels);
+        done += frames;
+    }
+    free(interleaved);
+    SoundReader_close(reader);
+    // a truncated file leaves silence at the end.
+    for (int channel = 0; channel < entry->channels && done < entry->frames; channel++) {
+        memset(samples + channel * entry->frames + done, 0, (entry->frames - done) * sizeof(float));
+    }
+    return true;
+}
+
+// Map a file of interleaved native-endian 32-bit floats and copy it into planar samples.
+bool ScriptEngineSamples::readRawFile_(v8::Isolate *isolate, const char *path, Entry *entry, std::string *error) {
+    size_t frame_bytes = entry->channels * sizeof(float);
+    entry->frames = entry->size / frame_bytes;
+    if (entry->frames == 0 || entry->size > (off_t)SAMPLE_MAX_BYTES) {
+        *error = std::string(entry->frames == 0 ? "no samples in " : "too large: ") + path;
+        return false;
+    }
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        *error = std::string("cannot open ") + path;
+        return false;
+    }
+    void *mapped = mmap(NULL, entry->size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        *error = std::string("cannot map ") + path;
+        return false;
+    }
+    entry->store = v8::ArrayBuffer::NewBackingStore(isolate, entry->frames * frame_bytes);
+    float *samples = static_cast<float *>(entry->store->Data());
+    float *planar[MAX_CHANNELS];
+    for (int channel = 0; channel < entry->channels; channel++) {
+        planar[channel] = samples + channel * entry->frames;
+    }
+    audio_kernels::deinterleave(planar, static_cast<const float *>(mapped), entry->frames, entry->channels);
+    munmap(mapped, entry->size);
+    return true;
+}
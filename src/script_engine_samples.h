@@ -0,0 +1,93 @@
+#ifndef SCRIPT_ENGINE_SAMPLES_H
+#define SCRIPT_ENGINE_SAMPLES_H
+// Otojsd::ScriptEngineSamples - sound files loaded by Otojs.loadSample(), kept across code reloads.
+
+#include <v8.h>
+
+#include <sys/types.h>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+struct SampleCacheStats {
+    // loads served from the cache
+    uint64_t hits;
+    // loads which read the file
+    uint64_t misses;
+    // files in the cache
+    uint64_t samples;
+    // bytes of samples in the cache
+    int64_t bytes;
+};
+
+struct SampleInfo {
+    std::string path;
+    int channels;
+    // 0 for raw float files
+    int sample_rate;
+    size_t frames;
+    uint64_t hits;
+};
+
+// Decodes sound files into ArrayBuffer stores once, and hands every later load
+// the same stores as Float32Arrays without copy.
+// Files are read, and checked for changes, only while the top level of a script runs (see setReading()),
+// holding the engine. The render function gets the files loaded so far by a map lookup, and an error for others,
+// so a load never reads a file on the audio path.
+// The stores are allocated by V8 so that they are inside the V8 sandbox: raw float files (.f32, .raw)
+// are mapped and copied into them, as memory outside the sandbox cannot back an ArrayBuffer.
+class ScriptEngineSamples {
+public:
+    // a cached file
+    struct Entry {
+        // the file is read again when these change
+        time_t mtime;
+        off_t size;
+        int channels;
+        int sample_rate;
+        size_t frames;
+        // the channels one after another, frames samples each
+        std::shared_ptr<v8::BackingStore> store;
+        uint64_t hits;
+    };
+
+private:
+    // entries by real path, and by the paths given to load(): a hit is one lookup without touching the file.
+    std::map<std::string, Entry> entries_;
+    std::map<std::string, Entry *> paths_;
+    bool reading_;
+
+    std::atomic<uint64_t> hits_;
+    std::atomic<uint64_t> misses_;
+    std::atomic<uint64_t> samples_;
+    std::atomic<int64_t> bytes_;
+
+    bool readSoundFile_(v8::Isolate *isolate, const char *path, Entry *entry, std::string *error);
+    bool readRawFile_(v8::Isolate *isolate, const char *path, Entry *entry, std::string *error);
+
+public:
+    ScriptEngineSamples();
+
+    // Install Otojs.loadSample(path, [channels]) into the otojs object of the context.
+    void setup(v8::Isolate *isolate, v8::Local<v8::Context> context, v8::Local<v8::Object> otojs);
+
+    // Allow reading the files, while the top level of a script runs. Otherwise only the cached ones are loaded.
+    void setReading(bool reading);
+
+    // Return the entry for the file, reading it if it is not cached or changed. Returns null with the error.
+    const Entry *load(v8::Isolate *isolate, const char *path, int raw_channels, std::string *error);
+
+    // Return the cached files. Touches the cache, so call this while holding the engine.
+    std::vector<SampleInfo> samples() const;
+
+    // Drop every cached file. Arrays already handed to JavaScript keep their samples.
+    void clear();
+
+    // Return the counters. Can be called from any thread.
+    SampleCacheStats stats() const;
+};
+
+#endif // SCRIPT_ENGINE_SAMPLES_H
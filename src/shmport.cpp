@@ -0,0 +1,117 @@
+// otojsd::shmport - audio ports in POSIX shared memory, to exchange samples with other local processes.
+// otojsd creates every port, output ports to publish what it renders and input ports for others to write into,
+// so the processes can start in any order. Reading and writing are lock-free, and never block nor allocate.
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <new>
+#include "shmport.h"
+
+// ------------------------------------------------------ private functions
+void ShmPort__copy_out(ShmPort *self, uint64_t position, float *data, int frames);
+
+// ---------------------------------------------- implimentation
+
+ShmPort *ShmPort_create(const char *name, bool output, int channels, int sampleRate) {
+	ShmPort *self = new ShmPort;
+	snprintf(self->name, sizeof(self->name), "%s%s", name[0] == '/' ? "" : "/", name);
+	self->output = output;
+	self->channels = channels;
+	self->readPosition = 0;
+	self->underruns = 0;
+	self->overruns = 0;
+	self->bytes = SHMPORT_HEADER_SIZE + (size_t)SHMPORT_FRAMES * channels * sizeof(float);
+
+	int fd = shm_open(self->name, O_RDWR | O_CREAT, 0600);
+	if ( fd < 0 ) {
+		printf("shm_open failed: %s\n", self->name);
+		delete self;
+		return NULL;
+	}
+	if ( ftruncate(fd, self->bytes) != 0 ) {
+		printf("ftruncate failed for the shared memory: %s\n", self->name);
+		close(fd);
+		shm_unlink(self->name);
+		delete self;
+		return NULL;
+	}
+	void *mapped = mmap(NULL, self->bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if ( mapped == MAP_FAILED ) {
+		printf("mmap failed for the shared memory: %s\n", self->name);
+		shm_unlink(self->name);
+		delete self;
+		return NULL;
+	}
+	// touch every page now, not on the audio thread.
+	memset(mapped, 0, self->bytes);
+	self->header = new (mapped) ShmPortHeader;
+	self->samples = (float *)((char *)mapped + SHMPORT_HEADER_SIZE);
+	self->header->version = SHMPORT_VERSION;
+	self->header->channels = channels;
+	self->header->sampleRate = sampleRate;
+	self->header->frames = SHMPORT_FRAMES;
+	self->header->writePosition.store(0, std::memory_order_relaxed);
+	// the magic is the last, a reader seeing it finds the rest ready.
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(self->header->magic, SHMPORT_MAGIC, sizeof(SHMPORT_MAGIC));
+	return self;
+}
+
+// Write interleaved frames to an output port. Frames the readers did not read yet are overwritten if they are late.
+void ShmPort_write(ShmPort *self, const float *data, int frames) {
+	uint64_t position = self->header->writePosition.load(std::memory_order_relaxed);
+	if ( frames > SHMPORT_FRAMES ) {
+		// only the last frames fit in the ring.
+		data += (size_t)(frames - SHMPORT_FRAMES) * self->channels;
+		position += frames - SHMPORT_FRAMES;
+		frames = SHMPORT_FRAMES;
+	}
+	size_t index = position & (SHMPORT_FRAMES - 1);
+	size_t first = (size_t)frames < SHMPORT_FRAMES - index ? frames : SHMPORT_FRAMES - index;
+	memcpy(self->samples + index * self->channels, data, first * self->channels * sizeof(float));
+	memcpy(self->samples, data + first * self->channels, (frames - first) * self->channels * sizeof(float));
+	self->header->writePosition.store(position + frames, std::memory_order_release);
+}
+
+// Read the latest interleaved frames from an input port. Older frames are skipped so that the latency stays
+// at one block, and missing frames are silent.
+void ShmPort_read(ShmPort *self, float *data, int frames) {
+	uint64_t written = self->header->writePosition.load(std::memory_order_acquire);
+	if ( written - self->readPosition > (uint64_t)frames ) {
+		self->readPosition = written - frames;
+	}
+	int available = (int)(written - self->readPosition);
+	if ( available > SHMPORT_FRAMES ) {
+		self->readPosition = written - SHMPORT_FRAMES;
+		available = SHMPORT_FRAMES;
+	}
+	ShmPort__copy_out(self, self->readPosition, data, available);
+	if ( available < frames ) {
+		memset(data + available * self->channels, 0, (frames - available) * self->channels * sizeof(float));
+		// nothing written yet is not a writer being late.
+		if ( written > 0 ) self->underruns++;
+	}
+	// the writer went around the ring while we were copying.
+	if ( self->header->writePosition.load(std::memory_order_acquire) - self->readPosition > SHMPORT_FRAMES ) {
+		self->overruns++;
+	}
+	self->readPosition += available;
+}
+
+void ShmPort_destroy(ShmPort *self) {
+	munmap(self->header, self->bytes);
+	shm_unlink(self->name);
+	delete self;
+}
+
+void ShmPort__copy_out(ShmPort *self, uint64_t position, float *data, int frames) {
+	size_t index = position & (SHMPORT_FRAMES - 1);
+	size_t first = (size_t)frames < SHMPORT_FRAMES - index ? frames : SHMPORT_FRAMES - index;
+	memcpy(data, self->samples + index * self->channels, first * self->channels * sizeof(float));
+	memcpy(data + first * self->channels, self->samples, (frames - first) * self->channels * sizeof(float));
+}
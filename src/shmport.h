@@ -0,0 +1,55 @@
+#ifndef SHMPORT_H
+#define SHMPORT_H
+// otojsd::shmport - audio ports in POSIX shared memory, to exchange samples with other local processes.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <atomic>
+
+#define SHMPORT_MAGIC "OTOJSPT"
+#define SHMPORT_VERSION 1
+// frames of a ring, a power of two
+#define SHMPORT_FRAMES 16384
+// the interleaved float samples start at this offset of the shared memory
+#define SHMPORT_HEADER_SIZE 128
+
+// Layout of the shared memory, for the processes on the other side.
+// The writer copies the samples into the ring at write_position % frames and then advances write_position,
+// it never waits for the reader. The reader keeps its own position and skips to write_position - frames
+// to read when it fell behind. Only write_position is shared, the reader has nothing to write back.
+typedef struct {
+	char magic[8];
+	uint32_t version;
+	uint32_t channels;
+	uint32_t sampleRate;
+	// ring capacity in frames
+	uint32_t frames;
+	// frames written so far, only grows
+	alignas(64) std::atomic<uint64_t> writePosition;
+} ShmPortHeader;
+
+static_assert(sizeof(ShmPortHeader) <= SHMPORT_HEADER_SIZE, "the samples follow the header");
+static_assert(std::atomic<uint64_t>::is_always_lock_free, "the position is shared between processes");
+
+typedef struct {
+	// shm_open name, with the leading slash
+	char name[64];
+	// true if otojsd writes the port, false if otojsd reads it
+	bool output;
+	int channels;
+	ShmPortHeader *header;
+	float *samples;
+	size_t bytes;
+	// reading: frames read so far
+	uint64_t readPosition;
+	// blocks read short because the writer was late, and blocks overwritten while being read
+	uint64_t underruns;
+	uint64_t overruns;
+} ShmPort;
+
+ShmPort *ShmPort_create(const char *name, bool output, int channels, int sampleRate);
+void ShmPort_write(ShmPort *self, const float *data, int frames);
+void ShmPort_read(ShmPort *self, float *data, int frames);
+void ShmPort_destroy(ShmPort *self);
+
+#endif
@@ -0,0 +1,212 @@
+// otojsd::soundreader - reads AIFF/AIFF-C and WAV/RF64 files as float samples.
+// Integer samples of 16, 24 and 32 bits and 32-bit float samples are supported.
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/types.h>
+#include "soundreader.h"
+#include "const.h"
+
+// frames read from the file at once
+#define RAW_FRAMES 4096
+
+// ------------------------------------------------------ private functions
+bool SoundReader__parse_wav(SoundReader *self, bool rf64);
+bool SoundReader__parse_aiff(SoundReader *self, bool aifc);
+uint32_t get_be16(const unsigned char *p);
+uint32_t get_be32(const unsigned char *p);
+uint32_t get_le16(const unsigned char *p);
+uint32_t get_le32(const unsigned char *p);
+uint64_t get_le64(const unsigned char *p);
+double get_extended80(const unsigned char *p);
+
+// ---------------------------------------------- implimentation
+
+SoundReader *SoundReader_open(const char *path) {
+	SoundReader *self = (SoundReader *)calloc(1, sizeof(SoundReader));
+	if ( !self ) {
+		printf("malloc failed for reading.\n");
+		return NULL;
+	}
+	self->fh = fopen(path, "r");
+	if ( !self->fh ) {
+		printf("cannot open input file: %s\n", path);
+		free(self);
+		return NULL;
+	}
+	unsigned char header[12];
+	bool parsed = false;
+	if ( fread(header, sizeof(header), 1, self->fh) == 1 ) {
+		if ( memcmp(header + 8, "WAVE", 4) == 0 && (memcmp(header, "RIFF", 4) == 0 || memcmp(header, "RF64", 4) == 0) ) {
+			parsed = SoundReader__parse_wav(self, memcmp(header, "RF64", 4) == 0);
+		} else if ( memcmp(header, "FORM", 4) == 0 && (memcmp(header + 8, "AIFF", 4) == 0 || memcmp(header + 8, "AIFC", 4) == 0) ) {
+			parsed = SoundReader__parse_aiff(self, memcmp(header + 8, "AIFC", 4) == 0);
+		}
+	}
+	bool supported = self->isFloat ? self->bits == 32 : (self->bits == 16 || self->bits == 24 || self->bits == 32);
+	if ( !parsed || !supported || self->channels < 1 || self->channels > MAX_CHANNELS || self->sampleRate < 1 ) {
+		printf("unsupported sound file: %s (AIFF or WAV of 16, 24, 32-bit integer or 32-bit float samples)\n", path);
+		fclose(self->fh);
+		free(self);
+		return NULL;
+	}
+	self->rawFrames = RAW_FRAMES;
+	self->raw = (unsigned char *)malloc(RAW_FRAMES * self->channels * (self->bits / 8));
+	if ( !self->raw ) {
+		printf("malloc failed for reading.\n");
+		fclose(self->fh);
+		free(self);
+		return NULL;
+	}
+	return self;
+}
+
+void SoundReader_close(SoundReader *self) {
+	fclose(self->fh);
+	free(self->raw);
+	free(self);
+}
+
+// Read up to frames interleaved frames. Returns the frames read, 0 at the end of the file.
+int SoundReader_read(SoundReader *self, float *data, int frames) {
+	int bytes = self->bits / 8;
+	int done = 0;
+	while ( done < frames && self->position < self->frames ) {
+		size_t length = frames - done;
+		if ( length > self->rawFrames ) length = self->rawFrames;
+		if ( length > self->frames - self->position ) length = self->frames - self->position;
+		length = fread(self->raw, self->channels * bytes, length, self->fh);
+		if ( length == 0 ) {
+			// truncated file
+			self->frames = self->position;
+			break;
+		}
+		size_t count = length * self->channels;
+		float *dst = data + (size_t)done * self->channels;
+		const unsigned char *p = self->raw;
+		for ( size_t i = 0; i < count; i++, p += bytes ) {
+			uint32_t value = 0;
+			for ( int b = 0; b < bytes; b++ ) {
+				value = (value << 8) | p[self->bigEndian ? b : bytes - 1 - b];
+			}
+			if ( self->isFloat ) {
+				memcpy(dst + i, &value, sizeof(float));
+			} else if ( bytes == 2 ) {
+				dst[i] = (int16_t)value * (1.0f / 32768.0f);
+			} else if ( bytes == 3 ) {
+				dst[i] = ((int32_t)(value << 8) >> 8) * (1.0f / 8388608.0f);
+			} else {
+				dst[i] = (int32_t)value * (1.0f / 2147483648.0f);
+			}
+		}
+		done += length;
+		self->position += length;
+	}
+	return done;
+}
+
+// Find the format and the sound data, and leave the file at the start of the data.
+bool SoundReader__parse_wav(SoundReader *self, bool rf64) {
+	unsigned char chunk[8], body[40];
+	uint64_t ds64DataSize = 0;
+	off_t dataOffset = -1;
+	uint64_t dataSize = 0;
+	int blockAlign = 0;
+	while ( fread(chunk, sizeof(chunk), 1, self->fh) == 1 ) {
+		uint64_t size = get_le32(chunk + 4);
+		off_t next = ftello(self->fh) + size + (size & 1);
+		if ( memcmp(chunk, "ds64", 4) == 0 && size >= 24 ) {
+			if ( fread(body, 24, 1, self->fh) != 1 ) return false;
+			ds64DataSize = get_le64(body + 8);
+		} else if ( memcmp(chunk, "fmt ", 4) == 0 && size >= 16 ) {
+			size_t length = size < sizeof(body) ? size : sizeof(body);
+			if ( fread(body, length, 1, self->fh) != 1 ) return false;
+			uint32_t tag = get_le16(body);
+			if ( tag == 0xFFFE && length >= 26 ) {
+				// WAVE_FORMAT_EXTENSIBLE, the subformat starts with the tag
+				tag = get_le16(body + 24);
+			}
+			self->channels = get_le16(body + 2);
+			self->sampleRate = get_le32(body + 4);
+			blockAlign = get_le16(body + 12);
+			self->bits = get_le16(body + 14);
+			self->isFloat = tag == 3;
+			if ( tag != 1 && tag != 3 ) return false;
+		} else if ( memcmp(chunk, "data", 4) == 0 ) {
+			dataOffset = ftello(self->fh);
+			dataSize = rf64 && size == 0xFFFFFFFF ? ds64DataSize : size;
+			if ( blockAlign ) break;
+			// the format comes later
+			next = dataOffset + dataSize + (dataSize & 1);
+		}
+		if ( fseeko(self->fh, next, SEEK_SET) != 0 ) return false;
+	}
+	if ( dataOffset < 0 || blockAlign == 0 || blockAlign != self->channels * self->bits / 8 ) return false;
+	self->bigEndian = false;
+	self->frames = dataSize / blockAlign;
+	return fseeko(self->fh, dataOffset, SEEK_SET) == 0;
+}
+
+bool SoundReader__parse_aiff(SoundReader *self, bool aifc) {
+	unsigned char chunk[8], body[22];
+	off_t dataOffset = -1;
+	bool common = false;
+	self->bigEndian = true;
+	while ( fread(chunk, sizeof(chunk), 1, self->fh) == 1 ) {
+		uint64_t size = get_be32(chunk + 4);
+		off_t next = ftello(self->fh) + size + (size & 1);
+		if ( memcmp(chunk, "COMM", 4) == 0 && size >= 18 ) {
+			size_t length = aifc && size >= 22 ? 22 : 18;
+			if ( fread(body, length, 1, self->fh) != 1 ) return false;
+			self->channels = get_be16(body);
+			self->frames = get_be32(body + 2);
+			self->bits = get_be16(body + 6);
+			self->sampleRate = (int)get_extended80(body + 8);
+			if ( aifc ) {
+				if ( length < 22 ) return false;
+				if ( memcmp(body + 18, "fl32", 4) == 0 || memcmp(body + 18, "FL32", 4) == 0 ) {
+					self->isFloat = true;
+				} else if ( memcmp(body + 18, "sowt", 4) == 0 ) {
+					self->bigEndian = false;
+				} else if ( memcmp(body + 18, "NONE", 4) != 0 && memcmp(body + 18, "twos", 4) != 0 ) {
+					return false;
+				}
+			}
+			common = true;
+		} else if ( memcmp(chunk, "SSND", 4) == 0 && size >= 8 ) {
+			if ( fread(body, 8, 1, self->fh) != 1 ) return false;
+			dataOffset = ftello(self->fh) + get_be32(body);
+		}
+		if ( common && dataOffset >= 0 ) break;
+		if ( fseeko(self->fh, next, SEEK_SET) != 0 ) return false;
+	}
+	if ( !common || dataOffset < 0 ) return false;
+	return fseeko(self->fh, dataOffset, SEEK_SET) == 0;
+}
+
+uint32_t get_be16(const unsigned char *p) {
+	return (uint32_t)p[0] << 8 | p[1];
+}
+
+uint32_t get_be32(const unsigned char *p) {
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+uint32_t get_le16(const unsigned char *p) {
+	return (uint32_t)p[1] << 8 | p[0];
+}
+
+uint32_t get_le32(const unsigned char *p) {
+	return (uint32_t)p[3] << 24 | (uint32_t)p[2] << 16 | (uint32_t)p[1] << 8 | p[0];
+}
+
+uint64_t get_le64(const unsigned char *p) {
+	return (uint64_t)get_le32(p + 4) << 32 | get_le32(p);
+}
+
+double get_extended80(const unsigned char *p) {
+	int exponent = (int)((p[0] & 0x7F) << 8 | p[1]) - 16383;
+	uint64_t mantissa = (uint64_t)get_be32(p + 2) << 32 | get_be32(p + 6);
+	return ldexp((double)mantissa, exponent - 63);
+}
@@ -0,0 +1,28 @@
+#ifndef SOUNDREADER_H
+#define SOUNDREADER_H
+// otojsd::soundreader - reads AIFF/AIFF-C and WAV/RF64 files as float samples.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+
+typedef struct {
+	FILE *fh;
+	int channels;
+	int sampleRate;
+	int bits;
+	bool isFloat;
+	bool bigEndian;
+	uint64_t frames;
+	// frames read so far
+	uint64_t position;
+	// raw samples read at once before conversion
+	unsigned char *raw;
+	size_t rawFrames;
+} SoundReader;
+
+SoundReader *SoundReader_open(const char *path);
+int SoundReader_read(SoundReader *self, float *data, int frames);
+void SoundReader_close(SoundReader *self);
+
+#endif
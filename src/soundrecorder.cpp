@@ -0,0 +1,458 @@
+// otojsd::soundrecorder - sound recorder for otojsd, writes AIFF, WAV/RF64, FLAC or raw PCM.
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "soundrecorder.h"
+#include "audio_kernels.h"
+
+// samples converted and written at once
+#define CONVERT_BUFFER_SAMPLES 16384
+// WAV: a JUNK chunk of the size of ds64 is reserved to become ds64 when the file exceeds 4 GB.
+#define DS64_SIZE 28
+#define RIFF_SIZE_MAX 0xFFFFFFFFull
+// AIFF has no 64-bit variant, the recording stops at the limit.
+#define AIFF_SIZE_MAX 0xFFFFFFFFull
+
+// ------------------------------------------------------ private functions
+SoundFileFormat SoundRecorder__format(const char *path);
+bool SoundRecorder__start(SoundRecorder *self);
+bool SoundRecorder__supported(SoundRecorder *self, SoundFileFormat format);
+void SoundRecorder__abort(SoundRecorder *self);
+size_t SoundRecorder__build_headers(SoundRecorder *self);
+size_t SoundRecorder__build_aiff(SoundRecorder *self, unsigned char *p, uint64_t dataSize);
+size_t SoundRecorder__build_wav(SoundRecorder *self, unsigned char *p, uint64_t dataSize);
+bool SoundRecorder__write_chunk(SoundRecorder *self, const float *data, size_t frames);
+void SoundRecorder__dither(SoundRecorder *self, const float *src, size_t count);
+uint64_t SoundRecorder__data_size(SoundRecorder *self);
+void put_be16(unsigned char *p, uint16_t value);
+void put_be32(unsigned char *p, uint32_t value);
+void put_le16(unsigned char *p, uint16_t value);
+void put_le32(unsigned char *p, uint32_t value);
+void put_le64(unsigned char *p, uint64_t value);
+void convert_extended80(unsigned char * buffer, unsigned long value);
+
+// ---------------------------------------------- implimentation
+
+// bits is 16, 24, 32 (float) or 0 for the default of the format (32-bit float, 24-bit for FLAC).
+SoundRecorder *SoundRecorder_create(int channels, int bits, int sampleRate) {
+	SoundRecorder *self = (SoundRecorder *)calloc(1, sizeof(SoundRecorder));
+	if ( !self ) {
+		printf("malloc failed for recording.\n");
+		return NULL;
+	}
+	self->bits = bits;
+	self->channels = channels;
+	self->sampleRate = sampleRate;
+	self->ditherSeed = 0x9E3779B9;
+
+	self->ditherBuffer = (float *)malloc(CONVERT_BUFFER_SAMPLES * sizeof(float));
+	self->intBuffer = (int32_t *)malloc(CONVERT_BUFFER_SAMPLES * sizeof(int32_t));
+	self->packBuffer = (unsigned char *)malloc(CONVERT_BUFFER_SAMPLES * 4);
+	if ( !self->ditherBuffer || !self->intBuffer || !self->packBuffer ) {
+		printf("malloc failed for recording.\n");
+		SoundRecorder_destroy(self);
+		return NULL;
+	}
+	return self;
+}
+
+void SoundRecorder_destroy(SoundRecorder *self) {
+	free(self->ditherBuffer);
+	free(self->intBuffer);
+	free(self->packBuffer);
+	free(self);
+}
+
+// The format is chosen by the extension of the path, AIFF if unknown.
+bool SoundRecorder_open(SoundRecorder *self, const char *path) {
+	self->format = SoundRecorder__format(path);
+	if ( ! SoundRecorder__supported(self, self->format) ) {
+		return false;
+	}
+	self->fh = fopen(path, "w+");
+	if ( ! self->fh ) {
+		printf("cannot open output file: %s\n", path);
+		return false;
+	}
+	self->streaming = false;
+	return SoundRecorder__start(self);
+}
+
+// Write to a stream which is not seekable, like a socket. The sizes in the headers are left unknown,
+// and SoundRecorder_close() does not close the stream. AIFF is not supported.
+bool SoundRecorder_open_stream(SoundRecorder *self, FILE *fh, SoundFileFormat format) {
+	if ( format == SOUNDFILE_AIFF || format == SOUNDFILE_RF64 ) {
+		printf("unsupported format for streaming.\n");
+		return false;
+	}
+	if ( ! SoundRecorder__supported(self, format) ) {
+		return false;
+	}
+	self->format = format;
+	self->fh = fh;
+	self->streaming = true;
+	return SoundRecorder__start(self);
+}
+
+// FLAC has no 32-bit float samples and up to 8 channels.
+bool SoundRecorder__supported(SoundRecorder *self, SoundFileFormat format) {
+	if ( format != SOUNDFILE_FLAC ) return true;
+	if ( self->bits == 32 ) {
+		printf("FLAC recording is 16 or 24 bits.\n");
+		return false;
+	}
+	if ( self->channels > FLAC_CHANNELS_MAX ) {
+		printf("FLAC recording is up to %d channels, record %d channels to .wav.\n", FLAC_CHANNELS_MAX, self->channels);
+		return false;
+	}
+	return true;
+}
+
+// Undo a failed SoundRecorder__start(), closing the file (not a stream) so that the recorder can just be destroyed.
+void SoundRecorder__abort(SoundRecorder *self) {
+	if ( self->flac ) {
+		FlacEncoder_destroy(self->flac);
+		self->flac = NULL;
+	}
+	if ( ! self->streaming && self->fh ) {
+		fclose(self->fh);
+	}
+	self->fh = NULL;
+}
+
+// Write the headers to the opened fh.
+bool SoundRecorder__start(SoundRecorder *self) {
+	if ( self->bits == 0 ) {
+		self->bits = self->format == SOUNDFILE_FLAC ? 24 : 32;
+	}
+	self->frames = 0;
+	self->limitReached = false;
+
+	if ( self->format == SOUNDFILE_FLAC ) {
+		self->flac = FlacEncoder_create(self->fh, self->channels, self->bits, self->sampleRate);
+		if ( ! self->flac || ! FlacEncoder_start(self->flac) ) {
+			printf("failed to start FLAC output.\n");
+			SoundRecorder__abort(self);
+			return false;
+		}
+		return true;
+	}
+
+	self->headersSize = SoundRecorder__build_headers(self);
+	if ( self->headersSize > 0 && fwrite(self->headers, self->headersSize, 1, self->fh) != 1 ) {
+		printf("fwrite failed for sound file header output.\n");
+		SoundRecorder__abort(self);
+		return false;
+	}
+	return true;
+}
+
+// Write interleaved frames, converting them to the format of the file.
+bool SoundRecorder_write(SoundRecorder *self, const float *data, int frames) {
+	if ( self->limitReached ) return false;
+	size_t count = frames;
+	if ( self->format == SOUNDFILE_AIFF ) {
+		uint64_t frameSize = (uint64_t)self->channels * self->bits / 8;
+		uint64_t limit = (AIFF_SIZE_MAX - self->headersSize) / frameSize;
+		if ( self->frames + count > limit ) {
+			printf("AIFF size limit reached, recording stopped. record to .wav or .flac for longer recordings.\n");
+			self->limitReached = true;
+			count = limit - self->frames;
+		}
+	}
+	size_t chunk = CONVERT_BUFFER_SAMPLES / self->channels;
+	for ( size_t i = 0; i < count; i += chunk ) {
+		size_t length = count - i < chunk ? count - i : chunk;
+		if ( ! SoundRecorder__write_chunk(self, data + i * self->channels, length) ) {
+			return false;
+		}
+	}
+	return ! self->limitReached;
+}
+
+bool SoundRecorder_close(SoundRecorder *self) {
+	int r;
+	if ( self->streaming ) {
+		// the listener of the stream is gone, nothing to complete.
+		if ( self->flac ) {
+			FlacEncoder_destroy(self->flac);
+			self->flac = NULL;
+		}
+		return true;
+	}
+	if ( self->format == SOUNDFILE_RAW ) {
+		// no headers
+	} else if ( self->format == SOUNDFILE_FLAC ) {
+		bool finished = FlacEncoder_finish(self->flac);
+		FlacEncoder_destroy(self->flac);
+		self->flac = NULL;
+		if ( ! finished ) {
+			printf("failed to finish FLAC output.\n");
+		}
+	} else {
+		// chunks are padded to even sizes.
+		if ( SoundRecorder__data_size(self) & 1 ) {
+			fputc(0, self->fh);
+		}
+		SoundRecorder__build_headers(self);
+		r = fseek(self->fh, 0, SEEK_SET);
+		if ( r ) {
+			printf("fseek failed for sound file header output.\n");
+			return false;
+		}
+		r = fwrite(self->headers, self->headersSize, 1, self->fh);
+		if ( r != 1 ) {
+			printf("fwrite failed for sound file header output.\n");
+			return false;
+		}
+	}
+	r = fclose(self->fh);
+	if ( r ) {
+		printf("fclose failed for sound file output.\n");
+		return false;
+	}
+	return true;
+}
+
+SoundFileFormat SoundRecorder__format(const char *path) {
+	const char *extension = strrchr(path, '.');
+	if ( extension ) {
+		if ( strcasecmp(extension, ".wav") == 0 ) return SOUNDFILE_WAV;
+		if ( strcasecmp(extension, ".rf64") == 0 ) return SOUNDFILE_RF64;
+		if ( strcasecmp(extension, ".flac") == 0 ) return SOUNDFILE_FLAC;
+		if ( strcasecmp(extension, ".raw") == 0 ) return SOUNDFILE_RAW;
+	}
+	return SOUNDFILE_AIFF;
+}
+
+uint64_t SoundRecorder__data_size(SoundRecorder *self) {
+	return self->frames * self->channels * (self->bits / 8);
+}
+
+// Build the headers for the frames written so far into self->headers and return their size.
+size_t SoundRecorder__build_headers(SoundRecorder *self) {
+	memset(self->headers, 0, SOUNDRECORDER_HEADER_MAX);
+	uint64_t dataSize = SoundRecorder__data_size(self);
+	if ( self->format == SOUNDFILE_AIFF ) {
+		return SoundRecorder__build_aiff(self, self->headers, dataSize);
+	}
+	if ( self->format == SOUNDFILE_RAW ) {
+		return 0;
+	}
+	return SoundRecorder__build_wav(self, self->headers, dataSize);
+}
+
+// AIFF-C with 32-bit float samples, or AIFF with integer samples.
+size_t SoundRecorder__build_aiff(SoundRecorder *self, unsigned char *p, uint64_t dataSize) {
+	bool isFloat = self->bits == 32;
+	size_t commSize = isFloat ? 44 : 18;
+	size_t size = 12 + (isFloat ? 12 : 0) + 8 + commSize + 16;
+	unsigned char *q = p;
+
+	memcpy(q, "FORM", 4);
+	put_be32(q + 4, (uint32_t)(size - 8 + dataSize + (dataSize & 1)));
+	memcpy(q + 8, isFloat ? "AIFC" : "AIFF", 4);
+	q += 12;
+	if ( isFloat ) {
+		memcpy(q, "FVER", 4);
+		put_be32(q + 4, 4);
+		put_be32(q + 8, 0xA2805140);
+		q += 12;
+	}
+	memcpy(q, "COMM", 4);
+	put_be32(q + 4, (uint32_t)commSize);
+	put_be16(q + 8, (uint16_t)self->channels);
+	put_be32(q + 10, (uint32_t)self->frames);
+	put_be16(q + 14, (uint16_t)self->bits);
+	convert_extended80(q + 16, (unsigned long)self->sampleRate);
+	if ( isFloat ) {
+		static const char compressionName[] = "32-bit Floating Point";
+		memcpy(q + 26, "fl32", 4);
+		q[30] = sizeof(compressionName) - 1;
+		memcpy(q + 31, compressionName, sizeof(compressionName) - 1);
+	}
+	q += 8 + commSize;
+	memcpy(q, "SSND", 4);
+	put_be32(q + 4, (uint32_t)(dataSize + 8));
+	// offset and block size are 0
+	return size;
+}
+
+// WAV (RIFF), or RF64 if requested or the data exceeds 4 GB.
+size_t SoundRecorder__build_wav(SoundRecorder *self, unsigned char *p, uint64_t dataSize) {
+	bool isFloat = self->bits == 32;
+	// WAVE_FORMAT_EXTENSIBLE for more than 2 channels or more than 16 bits integer
+	bool extensible = self->channels > 2 || (! isFloat && self->bits > 16);
+	size_t fmtSize = extensible ? 40 : 16;
+	size_t size = 12 + 8 + DS64_SIZE + 8 + fmtSize + 8;
+	uint64_t riffSize = size - 8 + dataSize + (dataSize & 1);
+	bool rf64 = self->format == SOUNDFILE_RF64 || riffSize > RIFF_SIZE_MAX;
+	// a stream of unknown length, the sizes are the largest
+	uint32_t unknownSize = self->streaming ? 0xFFFFFFFF : 0;
+	int blockAlign = self->channels * self->bits / 8;
+	uint16_t formatTag = isFloat ? 3 : 1;
+	unsigned char *q = p;
+
+	memcpy(q, rf64 ? "RF64" : "RIFF", 4);
+	put_le32(q + 4, rf64 ? 0xFFFFFFFF : unknownSize ? unknownSize : (uint32_t)riffSize);
+	memcpy(q + 8, "WAVE", 4);
+	q += 12;
+	if ( rf64 ) {
+		memcpy(q, "ds64", 4);
+		put_le32(q + 4, DS64_SIZE);
+		put_le64(q + 8, riffSize);
+		put_le64(q + 16, dataSize);
+		put_le64(q + 24, self->frames);
+		// no table entries
+	} else {
+		memcpy(q, "JUNK", 4);
+		put_le32(q + 4, DS64_SIZE);
+	}
+	q += 8 + DS64_SIZE;
+	memcpy(q, "fmt ", 4);
+	put_le32(q + 4, (uint32_t)fmtSize);
+	put_le16(q + 8, extensible ? 0xFFFE : formatTag);
+	put_le16(q + 10, (uint16_t)self->channels);
+	put_le32(q + 12, (uint32_t)self->sampleRate);
+	put_le32(q + 16, (uint32_t)(self->sampleRate * blockAlign));
+	put_le16(q + 20, (uint16_t)blockAlign);
+	put_le16(q + 22, (uint16_t)self->bits);
+	if ( extensible ) {
+		static const unsigned char subformatTail[] = {
+			0x00,0x00, 0x00,0x00, 0x10,0x00, 0x80,0x00, 0x00,0xAA,0x00,0x38,0x9B,0x71
+		};
+		put_le16(q + 24, 22);
+		put_le16(q + 26, (uint16_t)self->bits);
+		// speakers are assigned for mono and stereo only.
+		put_le32(q + 28, self->channels == 1 ? 0x4 : self->channels == 2 ? 0x3 : 0);
+		put_le16(q + 32, formatTag);
+		memcpy(q + 34, subformatTail, sizeof(subformatTail));
+	}
+	q += 8 + fmtSize;
+	memcpy(q, "data", 4);
+	put_le32(q + 4, rf64 ? 0xFFFFFFFF : unknownSize ? unknownSize : (uint32_t)dataSize);
+	return size;
+}
+
+// Convert and write frames (not more than CONVERT_BUFFER_SAMPLES samples).
+bool SoundRecorder__write_chunk(SoundRecorder *self, const float *data, size_t frames) {
+	size_t count = frames * self->channels;
+	const void *bytes = self->packBuffer;
+	size_t size = count * (self->bits / 8);
+	bool bigEndian = self->format == SOUNDFILE_AIFF;
+	unsigned char *p = self->packBuffer;
+
+	if ( self->bits == 32 ) {
+		if ( bigEndian ) {
+			audio_kernels::float_to_be32((uint32_t *)self->packBuffer, data, count);
+		} else {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+			bytes = data;
+#else
+			for ( size_t i = 0; i < count; i++ ) {
+				uint32_t value;
+				memcpy(&value, data + i, 4);
+				put_le32(p + i * 4, value);
+			}
+#endif
+		}
+	} else if ( self->bits == 16 ) {
+		SoundRecorder__dither(self, data, count);
+		int16_t *samples = (int16_t *)self->packBuffer;
+		audio_kernels::float_to_int16(samples, self->ditherBuffer, count);
+		if ( self->format == SOUNDFILE_FLAC ) {
+			for ( size_t i = 0; i < count; i++ ) {
+				self->intBuffer[i] = samples[i];
+			}
+		} else {
+			for ( size_t i = 0; i < count; i++ ) {
+				uint16_t value = (uint16_t)samples[i];
+				if ( bigEndian ) put_be16(p + i * 2, value); else put_le16(p + i * 2, value);
+			}
+		}
+	} else {
+		SoundRecorder__dither(self, data, count);
+		audio_kernels::float_to_int24(self->intBuffer, self->ditherBuffer, count);
+		if ( self->format != SOUNDFILE_FLAC ) {
+			for ( size_t i = 0; i < count; i++ ) {
+				uint32_t value = (uint32_t)self->intBuffer[i];
+				unsigned char *q = p + i * 3;
+				q[bigEndian ? 0 : 2] = value >> 16;
+				q[1] = value >> 8;
+				q[bigEndian ? 2 : 0] = value;
+			}
+		}
+	}
+
+	if ( self->format == SOUNDFILE_FLAC ) {
+		if ( ! FlacEncoder_write(self->flac, self->intBuffer, (int)frames) ) {
+			printf("fwrite failed for FLAC output.\n");
+			return false;
+		}
+	} else if ( fwrite(bytes, 1, size, self->fh) != size ) {
+		printf("fwrite failed for sound data output.\n");
+		return false;
+	}
+	self->frames += frames;
+	return true;
+}
+
+// Add triangular (TPDF) dither of 1 LSB of the output bits, into ditherBuffer.
+void SoundRecorder__dither(SoundRecorder *self, const float *src, size_t count) {
+	const float lsb = 1.0f / (self->bits == 16 ? 32767.0f : 8388607.0f);
+	const float unit = 1.0f / 16777216.0f;
+	uint32_t x = self->ditherSeed;
+	for ( size_t i = 0; i < count; i++ ) {
+		// xorshift32, two uniform values per sample
+		x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+		float a = (x >> 8) * unit;
+		x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+		float b = (x >> 8) * unit;
+		self->ditherBuffer[i] = src[i] + (a - b) * lsb;
+	}
+	self->ditherSeed = x;
+}
+
+void put_be16(unsigned char *p, uint16_t value) {
+	p[0] = value >> 8; p[1] = value;
+}
+
+void put_be32(unsigned char *p, uint32_t value) {
+	p[0] = value >> 24; p[1] = value >> 16; p[2] = value >> 8; p[3] = value;
+}
+
+void put_le16(unsigned char *p, uint16_t value) {
+	p[0] = value; p[1] = value >> 8;
+}
+
+void put_le32(unsigned char *p, uint32_t value) {
+	p[0] = value; p[1] = value >> 8; p[2] = value >> 16; p[3] = value >> 24;
+}
+
+void put_le64(unsigned char *p, uint64_t value) {
+	put_le32(p, (uint32_t)value);
+	put_le32(p + 4, (uint32_t)(value >> 32));
+}
+
+void convert_extended80(unsigned char * buffer, unsigned long value) {
+	unsigned long exp;
+	unsigned char i, e;
+	memset(buffer, 0, 10);
+
+	exp = value;
+	exp >>= 1;
+	for ( e = 0; e < 32; e++ ) {
+		exp >>= 1;
+		if (!exp) break;
+	}
+
+	for ( i = 32; i; i-- ) {
+		if (value & 0x80000000) break;
+		value <<= 1;
+	}
+
+	*buffer = 0x40;
+	*(buffer+1) = e;
+	put_be32(buffer + 2, (uint32_t)value);
+}
@@ -0,0 +1,49 @@
+#ifndef SOUNDRECORDER_H
+#define SOUNDRECORDER_H
+// otojsd::soundrecorder - sound recorder for otojsd, writes AIFF, WAV/RF64, FLAC or raw PCM.
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdint.h>
+
+#include "flacencoder.h"
+
+typedef enum {
+	SOUNDFILE_AIFF, // .aiff .aif .aifc
+	SOUNDFILE_WAV,  // .wav, becomes RF64 when it grows over 4 GB
+	SOUNDFILE_RF64, // .rf64
+	SOUNDFILE_FLAC, // .flac
+	SOUNDFILE_RAW   // .raw, little-endian samples without header
+} SoundFileFormat;
+
+// large enough for every header written
+#define SOUNDRECORDER_HEADER_MAX 128
+
+typedef struct {
+	FILE *fh;
+	SoundFileFormat format;
+	uint64_t frames;
+	int bits; // 16, 24 or 32 (float)
+	int channels;
+	int sampleRate;
+	unsigned char headers[SOUNDRECORDER_HEADER_MAX];
+	size_t headersSize;
+	bool limitReached;
+	// writing to a stream opened by the caller, which cannot seek back to complete the headers
+	bool streaming;
+	// samples are dithered, converted and packed through these before written
+	float *ditherBuffer;
+	int32_t *intBuffer;
+	unsigned char *packBuffer;
+	uint32_t ditherSeed;
+	FlacEncoder *flac;
+} SoundRecorder;
+
+SoundRecorder *SoundRecorder_create(int channels, int bits, int sampleRate);
+void SoundRecorder_destroy(SoundRecorder *self);
+bool SoundRecorder_open(SoundRecorder *self, const char *path);
+bool SoundRecorder_open_stream(SoundRecorder *self, FILE *fh, SoundFileFormat format);
+bool SoundRecorder_write(SoundRecorder *self, const float *data, int frames);
+bool SoundRecorder_close(SoundRecorder *self);
+
+#endif
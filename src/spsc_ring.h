@@ -0,0 +1,95 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+// Otojsd::SpscRing - lock-free ring buffer for one writer thread and one reader thread.
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <type_traits>
+
+// Fixed size ring of trivially copyable elements. write() and read() never block nor allocate,
+// so they can be called from the audio callback.
+template <typename T>
+class SpscRing {
+    static_assert(std::is_trivially_copyable<T>::value, "SpscRing elements are copied with memcpy");
+
+    T *buffer_;
+    size_t capacity_;
+    size_t mask_;
+    // positions only grow, the index in the buffer is position & mask_.
+    alignas(64) std::atomic<size_t> write_position_;
+    alignas(64) std::atomic<size_t> read_position_;
+
+    // copy count elements between the ring at the position and the linear data, wrapping around the end.
+    void copy_in_(size_t position, const T *data, size_t count) {
+        size_t index = position & mask_;
+        size_t first = count < capacity_ - index ? count : capacity_ - index;
+        memcpy(buffer_ + index, data, first * sizeof(T));
+        memcpy(buffer_, data + first, (count - first) * sizeof(T));
+    }
+
+    void copy_out_(size_t position, T *data, size_t count) const {
+        size_t index = position & mask_;
+        size_t first = count < capacity_ - index ? count : capacity_ - index;
+        memcpy(data, buffer_ + index, first * sizeof(T));
+        memcpy(data + first, buffer_, (count - first) * sizeof(T));
+    }
+
+public:
+    // The capacity is rounded up to a power of two.
+    SpscRing(size_t capacity) : write_position_(0), read_position_(0) {
+        capacity_ = 1;
+        while (capacity_ < capacity) {
+            capacity_ <<= 1;
+        }
+        mask_ = capacity_ - 1;
+        buffer_ = new T[capacity_]();
+    }
+
+    ~SpscRing() {
+        delete[] buffer_;
+    }
+
+    SpscRing(const SpscRing &) = delete;
+    SpscRing &operator=(const SpscRing &) = delete;
+
+    size_t capacity() const {
+        return capacity_;
+    }
+
+    // Number of elements the reader can read. Call this from the reader (or as an estimate from others).
+    size_t readable() const {
+        return write_position_.load(std::memory_order_acquire) - read_position_.load(std::memory_order_relaxed);
+    }
+
+    // Number of elements the writer can write. Call this from the writer (or as an estimate from others).
+    size_t writable() const {
+        return capacity_ - (write_position_.load(std::memory_order_relaxed) - read_position_.load(std::memory_order_acquire));
+    }
+
+    // Write up to count elements and return the number written. Writer thread only.
+    size_t write(const T *data, size_t count) {
+        size_t position = write_position_.load(std::memory_order_relaxed);
+        size_t space = capacity_ - (position - read_position_.load(std::memory_order_acquire));
+        if (count > space) {
+            count = space;
+        }
+        copy_in_(position, data, count);
+        write_position_.store(position + count, std::memory_order_release);
+        return count;
+    }
+
+    // Read up to count elements and return the number read. Reader thread only.
+    size_t read(T *data, size_t count) {
+        size_t position = read_position_.load(std::memory_order_relaxed);
+        size_t available = write_position_.load(std::memory_order_acquire) - position;
+        if (count > available) {
+            count = available;
+        }
+        copy_out_(position, data, count);
+        read_position_.store(position + count, std::memory_order_release);
+        return count;
+    }
+};
+
+#endif // SPSC_RING_H
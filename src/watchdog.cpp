@@ -0,0 +1,119 @@
+// otojsd::watchdog - deadline watchdog for the render calls.
+
+#include <stdlib.h>
+#include <chrono>
+
+#include "watchdog.h"
+
+enum {
+	WATCHDOG_IDLE,
+	WATCHDOG_ARMED,
+	WATCHDOG_FIRING,
+	WATCHDOG_FIRED
+};
+
+
+// -------------------------------------------------------- private function
+
+void *watchdog__main(void *arg);
+void watchdog__sleep_until(watchdog *self, int64_t time);
+int64_t watchdog__now();
+
+// ----------------------------------------------------- watchdog implimentation
+
+watchdog *watchdog_start(void (*on_timeout)(void *arg), void *arg) {
+	watchdog *self = new watchdog;
+	self->running = true;
+	self->state = WATCHDOG_IDLE;
+	self->deadline = 0;
+	self->budget = 0;
+	self->blocked = false;
+	self->on_timeout = on_timeout;
+	self->arg = arg;
+	if (pthread_create(&self->thread, NULL, watchdog__main, self) != 0) {
+		delete self;
+		return NULL;
+	}
+	return self;
+}
+
+// Start watching a call which should finish within budget_ms.
+// Calls coming within a budget of each other find the watchdog awake, only the first after a pause wakes it up.
+void watchdog_arm(watchdog *self, double budget_ms) {
+	int64_t budget = (int64_t)(budget_ms * 1000000);
+	self->budget.store(budget, std::memory_order_relaxed);
+	self->deadline.store(watchdog__now() + budget, std::memory_order_relaxed);
+	self->state.store(WATCHDOG_ARMED, std::memory_order_seq_cst);
+	if (self->blocked.load(std::memory_order_seq_cst) && self->blocked.exchange(false)) {
+		std::lock_guard<std::mutex> lock(self->mutex);
+		self->wake.notify_one();
+	}
+}
+
+// Stop watching the call. Returns true if the deadline passed and on_timeout was called.
+bool watchdog_disarm(watchdog *self) {
+	int expected = WATCHDOG_ARMED;
+	if (self->state.compare_exchange_strong(expected, WATCHDOG_IDLE, std::memory_order_acq_rel)) {
+		return false;
+	}
+	// the watchdog thread is in on_timeout, wait for it so the caller can clean up after it.
+	while (self->state.load(std::memory_order_acquire) != WATCHDOG_FIRED) {
+	}
+	self->state.store(WATCHDOG_IDLE, std::memory_order_release);
+	return true;
+}
+
+void watchdog_stop(watchdog *self) {
+	{
+		std::lock_guard<std::mutex> lock(self->mutex);
+		self->running = false;
+		self->wake.notify_one();
+	}
+	pthread_join(self->thread, NULL);
+	delete self;
+}
+
+// Sleep until the deadline of the armed call. Once the call is over, stay awake for one more budget,
+// which the deadline of a call armed meanwhile is past, and block when no call came.
+void *watchdog__main(void *arg) {
+	watchdog *self = (watchdog *)arg;
+	bool lingered = false;
+	while (self->running) {
+		if (self->state.load(std::memory_order_seq_cst) == WATCHDOG_ARMED) {
+			lingered = false;
+			int64_t deadline = self->deadline.load(std::memory_order_relaxed);
+			if (watchdog__now() < deadline) {
+				// re-armed meanwhile, the later deadline is checked on the next round.
+				watchdog__sleep_until(self, deadline);
+				continue;
+			}
+			int expected = WATCHDOG_ARMED;
+			if (self->state.compare_exchange_strong(expected, WATCHDOG_FIRING, std::memory_order_acq_rel)) {
+				self->on_timeout(self->arg);
+				self->state.store(WATCHDOG_FIRED, std::memory_order_release);
+			}
+		} else if (!lingered) {
+			lingered = true;
+			watchdog__sleep_until(self, watchdog__now() + self->budget.load(std::memory_order_relaxed));
+		} else {
+			std::unique_lock<std::mutex> lock(self->mutex);
+			self->blocked.store(true, std::memory_order_seq_cst);
+			if (self->state.load(std::memory_order_seq_cst) == WATCHDOG_ARMED) {
+				self->blocked = false;
+				continue;
+			}
+			self->wake.wait(lock, [self] { return !self->blocked || !self->running; });
+			self->blocked = false;
+		}
+	}
+	return NULL;
+}
+
+void watchdog__sleep_until(watchdog *self, int64_t time) {
+	std::unique_lock<std::mutex> lock(self->mutex);
+	self->wake.wait_until(lock, std::chrono::steady_clock::time_point(std::chrono::nanoseconds(time)), [self] { return !self->running; });
+}
+
+int64_t watchdog__now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
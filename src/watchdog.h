@@ -0,0 +1,34 @@
+#ifndef WATCHDOG_H
+#define WATCHDOG_H
+// otojsd::watchdog - deadline watchdog for the render calls.
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <stdint.h>
+
+typedef struct {
+	pthread_t thread;
+	std::atomic<bool> running;
+	// WATCHDOG_IDLE, WATCHDOG_ARMED, WATCHDOG_FIRING or WATCHDOG_FIRED
+	std::atomic<int> state;
+	// steady clock time in nanoseconds the armed call must finish by, and the budget it was armed with
+	std::atomic<int64_t> deadline;
+	std::atomic<int64_t> budget;
+	// the watchdog thread waits for the next watchdog_arm() to wake it up
+	std::atomic<bool> blocked;
+	std::mutex mutex;
+	std::condition_variable wake;
+	// called on the watchdog thread when the deadline passed
+	void (*on_timeout)(void *arg);
+	void *arg;
+} watchdog;
+
+watchdog *watchdog_start(void (*on_timeout)(void *arg), void *arg);
+void watchdog_arm(watchdog *self, double budget_ms);
+bool watchdog_disarm(watchdog *self);
+void watchdog_stop(watchdog *self);
+
+#endif
@@ -0,0 +1,161 @@
+// otojsd::websocket - the handshake and the framing of RFC 6455 for the code server.
+// Only what a server needs: frames from clients are masked, frames to them are not.
+
+#include <stdio.h>
+#include <string.h>
+#include "websocket.h"
+
+// the GUID a server appends to the key of the client, RFC 6455 section 1.3
+#define WEBSOCKET_GUID "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"
+
+// ------------------------------------------------------ private functions
+void websocket__sha1(const unsigned char *data, size_t length, unsigned char *digest);
+void websocket__sha1_block(uint32_t *state, const unsigned char *block);
+size_t websocket__base64(const unsigned char *data, size_t length, char *text);
+
+// ---------------------------------------------- implimentation
+
+void websocket_accept_key(const char *key, char *accept) {
+	char text[128];
+	int length = snprintf(text, sizeof(text), "%s%s", key, WEBSOCKET_GUID);
+	if ( length < 0 || (size_t)length >= sizeof(text) ) length = 0;
+	unsigned char digest[20];
+	websocket__sha1((const unsigned char *)text, length, digest);
+	accept[websocket__base64(digest, sizeof(digest), accept)] = '\0';
+}
+
+long websocket_parse_frame(char *data, size_t size, size_t max_payload, websocket_frame *frame) {
+	const unsigned char *bytes = (const unsigned char *)data;
+	if ( size < 2 ) return 0;
+	// no extension is negotiated, the reserved bits must be clear.
+	if ( bytes[0] & 0x70 ) return WEBSOCKET_PARSE_ERROR;
+	if ( ! (bytes[1] & 0x80) ) return WEBSOCKET_PARSE_ERROR;
+	frame->fin = (bytes[0] & 0x80) != 0;
+	frame->opcode = bytes[0] & 0x0F;
+	uint64_t length = bytes[1] & 0x7F;
+	size_t position = 2;
+	if ( length == 126 ) {
+		if ( size < 4 ) return 0;
+		length = (uint64_t)bytes[2] << 8 | bytes[3];
+		position = 4;
+	} else if ( length == 127 ) {
+		if ( size < 10 ) return 0;
+		length = 0;
+		for ( int i = 0; i < 8; i++ ) length = length << 8 | bytes[2 + i];
+		position = 10;
+	}
+	if ( (frame->opcode & 0x8) && (length > 125 || ! frame->fin) ) return WEBSOCKET_PARSE_ERROR;
+	if ( length > max_payload ) return WEBSOCKET_PARSE_TOO_LARGE;
+	if ( size < position + 4 + length ) return 0;
+	const unsigned char *mask = bytes + position;
+	position += 4;
+	for ( size_t i = 0; i < length; i++ ) {
+		data[position + i] ^= mask[i & 3];
+	}
+	frame->header_length = position;
+	frame->payload_length = length;
+	return position + length;
+}
+
+size_t websocket_frame_header(int opcode, size_t payload_length, unsigned char *header) {
+	header[0] = 0x80 | (opcode & 0x0F);
+	if ( payload_length < 126 ) {
+		header[1] = payload_length;
+		return 2;
+	}
+	if ( payload_length <= 0xFFFF ) {
+		header[1] = 126;
+		header[2] = payload_length >> 8;
+		header[3] = payload_length & 0xFF;
+		return 4;
+	}
+	header[1] = 127;
+	for ( int i = 0; i < 8; i++ ) {
+		header[2 + i] = ((uint64_t)payload_length >> (56 - 8 * i)) & 0xFF;
+	}
+	return 10;
+}
+
+// SHA-1 of FIPS 180-4, the handshake is its only use here.
+void websocket__sha1(const unsigned char *data, size_t length, unsigned char *digest) {
+	uint32_t state[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+	size_t position = 0;
+	for ( ; position + 64 <= length; position += 64 ) {
+		websocket__sha1_block(state, data + position);
+	}
+	// the rest, the 1 bit, and the length in bits at the end of the last block.
+	unsigned char block[128];
+	size_t rest = length - position;
+	memset(block, 0, sizeof(block));
+	memcpy(block, data + position, rest);
+	block[rest] = 0x80;
+	size_t blocks = rest + 1 + 8 > 64 ? 2 : 1;
+	uint64_t bits = (uint64_t)length * 8;
+	for ( int i = 0; i < 8; i++ ) {
+		block[blocks * 64 - 1 - i] = (bits >> (8 * i)) & 0xFF;
+	}
+	for ( size_t i = 0; i < blocks; i++ ) {
+		websocket__sha1_block(state, block + i * 64);
+	}
+	for ( int i = 0; i < 5; i++ ) {
+		digest[i * 4] = state[i] >> 24;
+		digest[i * 4 + 1] = (state[i] >> 16) & 0xFF;
+		digest[i * 4 + 2] = (state[i] >> 8) & 0xFF;
+		digest[i * 4 + 3] = state[i] & 0xFF;
+	}
+}
+
+#define ROTATE_LEFT(value, bits) (((value) << (bits)) | ((value) >> (32 - (bits))))
+
+void websocket__sha1_block(uint32_t *state, const unsigned char *block) {
+	uint32_t w[80];
+	for ( int i = 0; i < 16; i++ ) {
+		w[i] = (uint32_t)block[i * 4] << 24 | (uint32_t)block[i * 4 + 1] << 16 | (uint32_t)block[i * 4 + 2] << 8 | block[i * 4 + 3];
+	}
+	for ( int i = 16; i < 80; i++ ) {
+		w[i] = ROTATE_LEFT(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+	}
+	uint32_t a = state[0], b = state[1], c = state[2], d = state[3], e = state[4];
+	for ( int i = 0; i < 80; i++ ) {
+		uint32_t f, k;
+		if ( i < 20 ) {
+			f = (b & c) | (~b & d);
+			k = 0x5A827999;
+		} else if ( i < 40 ) {
+			f = b ^ c ^ d;
+			k = 0x6ED9EBA1;
+		} else if ( i < 60 ) {
+			f = (b & c) | (b & d) | (c & d);
+			k = 0x8F1BBCDC;
+		} else {
+			f = b ^ c ^ d;
+			k = 0xCA62C1D6;
+		}
+		uint32_t temp = ROTATE_LEFT(a, 5) + f + e + k + w[i];
+		e = d;
+		d = c;
+		c = ROTATE_LEFT(b, 30);
+		b = a;
+		a = temp;
+	}
+	state[0] += a;
+	state[1] += b;
+	state[2] += c;
+	state[3] += d;
+	state[4] += e;
+}
+
+size_t websocket__base64(const unsigned char *data, size_t length, char *text) {
+	static const char *alphabet = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+	size_t out = 0;
+	for ( size_t i = 0; i < length; i += 3 ) {
+		uint32_t triple = (uint32_t)data[i] << 16;
+		if ( i + 1 < length ) triple |= (uint32_t)data[i + 1] << 8;
+		if ( i + 2 < length ) triple |= data[i + 2];
+		text[out++] = alphabet[(triple >> 18) & 0x3F];
+		text[out++] = alphabet[(triple >> 12) & 0x3F];
+		text[out++] = i + 1 < length ? alphabet[(triple >> 6) & 0x3F] : '=';
+		text[out++] = i + 2 < length ? alphabet[triple & 0x3F] : '=';
+	}
+	return out;
+}
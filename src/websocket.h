@@ -0,0 +1,45 @@
+#ifndef WEBSOCKET_H
+#define WEBSOCKET_H
+// otojsd::websocket - the handshake and the framing of RFC 6455 for the code server.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define WEBSOCKET_OPCODE_CONTINUATION 0x0
+#define WEBSOCKET_OPCODE_TEXT 0x1
+#define WEBSOCKET_OPCODE_BINARY 0x2
+#define WEBSOCKET_OPCODE_CLOSE 0x8
+#define WEBSOCKET_OPCODE_PING 0x9
+#define WEBSOCKET_OPCODE_PONG 0xA
+
+// status codes of close frames
+#define WEBSOCKET_CLOSE_NORMAL 1000
+#define WEBSOCKET_CLOSE_PROTOCOL_ERROR 1002
+#define WEBSOCKET_CLOSE_TOO_LARGE 1009
+
+// returned by websocket_parse_frame()
+#define WEBSOCKET_PARSE_ERROR (-1)
+#define WEBSOCKET_PARSE_TOO_LARGE (-2)
+
+// base64 of a SHA-1 digest, and the NUL
+#define WEBSOCKET_ACCEPT_SIZE 29
+// the longest header of a frame sent by the server (unmasked)
+#define WEBSOCKET_HEADER_MAX 10
+
+typedef struct {
+	int opcode;
+	bool fin;
+	size_t header_length;
+	size_t payload_length;
+} websocket_frame;
+
+// Sec-WebSocket-Accept for the Sec-WebSocket-Key of a client.
+void websocket_accept_key(const char *key, char *accept);
+// Parse a frame from a client at the start of data, unmasking its payload in place. Returns the length of the frame,
+// 0 if it is not complete yet, or WEBSOCKET_PARSE_* for an unmasked frame or a payload longer than max_payload.
+long websocket_parse_frame(char *data, size_t size, size_t max_payload, websocket_frame *frame);
+// Write the header of a frame from the server, returns its length.
+size_t websocket_frame_header(int opcode, size_t payload_length, unsigned char *header);
+
+#endif
@@ -0,0 +1,115 @@
+// Otojsd::audio_kernels test - every implementation built in against the scalar one,
+// over odd lengths and channel counts and buffers off the vector alignment.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+
+#include "audio_kernels.h"
+
+static const char *IMPLEMENTATIONS[] = {"sse2", "avx2", "neon"};
+static const unsigned int LENGTHS[] = {0, 1, 2, 3, 4, 5, 7, 8, 9, 15, 16, 17, 31, 33, 63, 127, 1021};
+static const unsigned int CHANNELS[] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 12};
+// samples in front of the data, so that it starts off the 16 and 32-byte alignment
+static const size_t OFFSET = 1;
+static const size_t BUFFER_SIZE = 1021 * 12 + 64;
+
+static int failures = 0;
+
+// Fill with values over -1.5 to 1.5, so the conversions clip, and the exact ties of the rounding.
+static void fill(float *samples, size_t count, unsigned int seed) {
+    srand(seed);
+    for (size_t i = 0; i < count; i++) {
+        samples[i] = (rand() / (float)RAND_MAX) * 3.0f - 1.5f;
+    }
+    if (count > 3) {
+        samples[1] = 0.5f / 32767.0f;
+        samples[2] = -1.0f;
+        samples[3] = 1.0f;
+    }
+}
+
+static void check(bool ok, const char *implementation, const char *kernel, unsigned int length, unsigned int channels) {
+    if (!ok) {
+        fprintf(stderr, "%s %s differs from scalar: length %u, channels %u\n", implementation, kernel, length, channels);
+        failures++;
+    }
+}
+
+// Outputs of the kernels over one input, compared between the implementations.
+struct Outputs {
+    std::vector<float> interleaved;
+    std::vector<float> planar;
+    float peak;
+    float rms;
+    std::vector<uint32_t> be32;
+    std::vector<int16_t> int16;
+    std::vector<int32_t> int24;
+};
+
+static Outputs run(const float *input, unsigned int frames, unsigned int channels) {
+    Outputs outputs;
+    size_t count = (size_t)frames * channels;
+    std::vector<float> buffer(BUFFER_SIZE, 0.0f);
+    const float *planar_in[16];
+    float *planar_out[16];
+    std::vector<float> planar(OFFSET + count + 64, 0.0f);
+    for (unsigned int channel = 0; channel < channels; channel++) {
+        planar_in[channel] = input + channel * frames;
+        planar_out[channel] = planar.data() + OFFSET + channel * frames;
+    }
+    audio_kernels::interleave(buffer.data() + OFFSET, planar_in, frames, channels);
+    outputs.interleaved.assign(buffer.begin(), buffer.end());
+    audio_kernels::deinterleave(planar_out, input, frames, channels);
+    outputs.planar = planar;
+
+    outputs.peak = audio_kernels::peak(input, count);
+    outputs.rms = audio_kernels::rms(input, count);
+    outputs.be32.assign(count + 1, 0);
+    audio_kernels::float_to_be32(outputs.be32.data() + OFFSET, input, count);
+    outputs.int16.assign(count + 1, 0);
+    audio_kernels::float_to_int16(outputs.int16.data() + OFFSET, input, count);
+    outputs.int24.assign(count + 1, 0);
+    audio_kernels::float_to_int24(outputs.int24.data() + OFFSET, input, count);
+    return outputs;
+}
+
+int main() {
+    std::vector<float> input(BUFFER_SIZE);
+    fill(input.data(), input.size(), 1);
+    // off the alignment too
+    const float *samples = input.data() + OFFSET;
+
+    int tested = 0;
+    for (const char *implementation : IMPLEMENTATIONS) {
+        if (!audio_kernels::select(implementation)) {
+            continue;
+        }
+        tested++;
+        for (unsigned int frames : LENGTHS) {
+            for (unsigned int channels : CHANNELS) {
+                audio_kernels::select("scalar");
+                Outputs expected = run(samples, frames, channels);
+                audio_kernels::select(implementation);
+                Outputs actual = run(samples, frames, channels);
+
+                check(actual.interleaved == expected.interleaved, implementation, "interleave", frames, channels);
+                check(actual.planar == expected.planar, implementation, "deinterleave", frames, channels);
+                check(actual.peak == expected.peak, implementation, "peak", frames, channels);
+                // the sums are added in another order.
+                check(fabsf(actual.rms - expected.rms) <= 1e-5f * (expected.rms + 1e-6f), implementation, "rms", frames, channels);
+                check(actual.be32 == expected.be32, implementation, "float_to_be32", frames, channels);
+                check(actual.int16 == expected.int16, implementation, "float_to_int16", frames, channels);
+                check(actual.int24 == expected.int24, implementation, "float_to_int24", frames, channels);
+            }
+        }
+        printf("%s: checked against scalar.\n", implementation);
+    }
+    if (tested == 0) {
+        printf("only the scalar kernels are built in, nothing to compare.\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,242 @@
+// Otojsd::codeserver test - the protocol parts of the code server: HTTP requests with their framings,
+// the WebSocket handshake and frames, and the UTF-8 of the JSON strings sent over them.
+
+#include <stdio.h>
+#include <string.h>
+
+#include <string>
+
+#include "codeserver.h"
+#include "httprequest.h"
+#include "websocket.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "failed: %s\n", what);
+        failures++;
+    }
+}
+
+// Parse a whole request, the request is freed unless it is returned.
+static long parse(const std::string &data, bool closed, httprequest *request = NULL) {
+    httprequest parsed;
+    long result = httprequest_parse(data.data(), data.size(), closed, &parsed);
+    if (result > 0) {
+        if (request) {
+            *request = parsed;
+        } else {
+            httprequest_free(&parsed);
+        }
+    }
+    return result;
+}
+
+static void test_requests() {
+    httprequest request;
+    std::string get = "GET /index.html HTTP/1.1\r\nHost: localhost\r\n\r\n";
+    check(parse(get + "GET /", false, &request) == (long)get.size(), "GET takes its header only");
+    check(request.method == METHOD_GET && strcmp(request.path, "/index.html") == 0, "GET path");
+    check(request.keep_alive && request.if_none_match == NULL && request.websocket_key == NULL, "GET defaults");
+    httprequest_free(&request);
+
+    check(parse("GET / HTTP/1.1\r\nHost: local", false) == 0, "incomplete header");
+    check(parse("GET / HTTP/1.0\r\n\r\n", false, &request) > 0 && !request.keep_alive, "HTTP/1.0 closes");
+    httprequest_free(&request);
+    check(parse("GET / HTTP/1.0\r\nConnection: keep-alive\r\n\r\n", false, &request) > 0 && request.keep_alive,
+        "HTTP/1.0 keep-alive");
+    httprequest_free(&request);
+    check(parse("GET / HTTP/1.1\r\nConnection: close\r\n\r\n", false, &request) > 0 && !request.keep_alive,
+        "HTTP/1.1 close");
+    httprequest_free(&request);
+    check(parse("GET\r\n\r\n", false) == PARSE_BAD_REQUEST, "request line without a path");
+    check(parse("DELETE / HTTP/1.1\r\n\r\n", false, &request) > 0 && request.method == METHOD_UNKNOWN, "unknown method");
+    httprequest_free(&request);
+    check(parse(std::string(HTTPREQUEST_HEADER_MAX + 1, 'x'), false) == PARSE_TOO_LARGE, "header too large");
+
+    std::string post = "POST /eval HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello";
+    check(parse(post + "POST", false, &request) == (long)post.size(), "Content-Length frames the body");
+    check(request.method == METHOD_POST && strcmp(request.body, "hello") == 0, "Content-Length body");
+    httprequest_free(&request);
+    check(parse(post.substr(0, post.size() - 1), false) == 0, "Content-Length body incomplete");
+    check(parse("POST / HTTP/1.1\r\nContent-Length: x\r\n\r\n", false) == PARSE_BAD_REQUEST, "Content-Length not a number");
+    char too_large[64];
+    snprintf(too_large, sizeof(too_large), "POST / HTTP/1.1\r\nContent-Length: %d\r\n\r\n", HTTPREQUEST_BODY_MAX + 1);
+    check(parse(too_large, false) == PARSE_TOO_LARGE, "Content-Length too large");
+
+    std::string unframed = "POST / HTTP/1.0\r\n\r\nuntil closed";
+    check(parse(unframed, false) == 0, "body without a length waits for the close");
+    check(parse(unframed, true, &request) == (long)unframed.size() && strcmp(request.body, "until closed") == 0
+        && !request.keep_alive, "body without a length read at the close");
+    httprequest_free(&request);
+
+    check(parse("GET / HTTP/1.1\r\nIf-None-Match: \"abc\"\r\nUpgrade: websocket\r\nSec-WebSocket-Key: key==\r\n\r\n",
+        false, &request) > 0, "headers");
+    check(request.if_none_match && strcmp(request.if_none_match, "\"abc\"") == 0, "If-None-Match");
+    check(request.websocket_key && strcmp(request.websocket_key, "key==") == 0, "Sec-WebSocket-Key");
+    httprequest_free(&request);
+    check(parse("GET / HTTP/1.1\r\nSec-WebSocket-Key: key==\r\n\r\n", false, &request) > 0
+        && request.websocket_key == NULL, "Sec-WebSocket-Key without Upgrade");
+    httprequest_free(&request);
+}
+
+static void test_chunked() {
+    httprequest request;
+    std::string head = "POST /eval HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n";
+    std::string chunked = head + "5\r\nhello\r\n7;name=x\r\n, world\r\n0\r\nTrailer: yes\r\n\r\n";
+    check(parse(chunked + "GET", false, &request) == (long)chunked.size(), "chunked takes its trailers");
+    check(strcmp(request.body, "hello, world") == 0, "chunked body");
+    httprequest_free(&request);
+    for (size_t length = head.size(); length < chunked.size(); length++) {
+        if (parse(chunked.substr(0, length), false) != 0) {
+            check(false, "chunked incomplete");
+            break;
+        }
+    }
+    check(parse(head + "a\r\n0123456789\r\n0\r\n\r\n", false) > 0, "chunk size in hex");
+    check(parse(head + "5\r\nhelloXY0\r\n\r\n", false) == PARSE_BAD_REQUEST, "chunk without its CRLF");
+    check(parse(head + "x\r\n", false) == PARSE_BAD_REQUEST, "chunk size not a number");
+    check(parse(head + std::string(65, '1'), false) == PARSE_BAD_REQUEST, "chunk size line too long");
+    char size_line[32];
+    snprintf(size_line, sizeof(size_line), "%x\r\n", HTTPREQUEST_BODY_MAX + 1);
+    check(parse(head + size_line, false) == PARSE_TOO_LARGE, "chunk too large");
+}
+
+// A frame from a client: masked, with the length in 7, 16 or 64 bits.
+static std::string client_frame(int opcode, bool fin, const std::string &payload) {
+    static const unsigned char mask[4] = {0x37, 0xFA, 0x21, 0x3D};
+    std::string frame;
+    frame += (char)((fin ? 0x80 : 0) | opcode);
+    size_t length = payload.size();
+    if (length < 126) {
+        frame += (char)(0x80 | length);
+    } else if (length <= 0xFFFF) {
+        frame += (char)(0x80 | 126);
+        frame += (char)(length >> 8);
+        frame += (char)length;
+    } else {
+        frame += (char)(0x80 | 127);
+        for (int shift = 56; shift >= 0; shift -= 8) frame += (char)((uint64_t)length >> shift);
+    }
+    frame.append((const char *)mask, 4);
+    for (size_t i = 0; i < length; i++) frame += (char)(payload[i] ^ mask[i & 3]);
+    return frame;
+}
+
+static void check_frame(const std::string &payload, const char *what) {
+    std::string data = client_frame(WEBSOCKET_OPCODE_TEXT, true, payload);
+    websocket_frame frame;
+    long length = websocket_parse_frame(&data[0], data.size(), 1 << 20, &frame);
+    check(length == (long)data.size() && frame.fin && frame.opcode == WEBSOCKET_OPCODE_TEXT
+        && frame.payload_length == payload.size()
+        && data.compare(frame.header_length, frame.payload_length, payload) == 0, what);
+    // every prefix waits for the rest, the length fields included.
+    for (size_t size = 0; size < data.size(); size += size < 16 ? 1 : 4093) {
+        std::string prefix = client_frame(WEBSOCKET_OPCODE_TEXT, true, payload).substr(0, size);
+        if (websocket_parse_frame(&prefix[0], prefix.size(), 1 << 20, &frame) != 0) {
+            check(false, what);
+            break;
+        }
+    }
+}
+
+static void test_websocket() {
+    // RFC 6455 section 1.3
+    char accept[WEBSOCKET_ACCEPT_SIZE];
+    websocket_accept_key("dGhlIHNhbXBsZSBub25jZQ==", accept);
+    check(strcmp(accept, "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=") == 0, "accept key of RFC 6455");
+
+    // RFC 6455 section 5.7, a masked "Hello"
+    unsigned char hello[] = {0x81, 0x85, 0x37, 0xfa, 0x21, 0x3d, 0x7f, 0x9f, 0x4d, 0x51, 0x58};
+    websocket_frame frame;
+    check(websocket_parse_frame((char *)hello, sizeof(hello), 125, &frame) == (long)sizeof(hello)
+        && frame.header_length == 6 && frame.payload_length == 5
+        && memcmp(hello + frame.header_length, "Hello", 5) == 0, "masked frame of RFC 6455");
+
+    check_frame("", "empty frame");
+    check_frame(std::string(125, 'a'), "7-bit length");
+    check_frame(std::string(126, 'b'), "16-bit length");
+    check_frame(std::string(0xFFFF, 'c'), "longest 16-bit length");
+    check_frame(std::string(0x10000, 'd'), "64-bit length");
+
+    // a message in fragments: the first, continuations, and a control frame between them.
+    std::string data = client_frame(WEBSOCKET_OPCODE_TEXT, false, "frag")
+        + client_frame(WEBSOCKET_OPCODE_PING, true, "p")
+        + client_frame(WEBSOCKET_OPCODE_CONTINUATION, true, "ment");
+    char *position = &data[0];
+    size_t left = data.size();
+    const int opcodes[] = {WEBSOCKET_OPCODE_TEXT, WEBSOCKET_OPCODE_PING, WEBSOCKET_OPCODE_CONTINUATION};
+    const bool fins[] = {false, true, true};
+    const char *payloads[] = {"frag", "p", "ment"};
+    for (int i = 0; i < 3; i++) {
+        long length = websocket_parse_frame(position, left, 125, &frame);
+        check(length > 0 && frame.opcode == opcodes[i] && frame.fin == fins[i]
+            && frame.payload_length == strlen(payloads[i])
+            && memcmp(position + frame.header_length, payloads[i], frame.payload_length) == 0, "fragmented message");
+        if (length <= 0) break;
+        position += length;
+        left -= length;
+    }
+
+    std::string large = client_frame(WEBSOCKET_OPCODE_BINARY, true, std::string(126, 'x'));
+    check(websocket_parse_frame(&large[0], 4, 125, &frame) == WEBSOCKET_PARSE_TOO_LARGE, "oversized frame, header only");
+    std::string huge = client_frame(WEBSOCKET_OPCODE_BINARY, true, std::string(0x10000, 'x')).substr(0, 10);
+    check(websocket_parse_frame(&huge[0], huge.size(), 0xFFFF, &frame) == WEBSOCKET_PARSE_TOO_LARGE, "oversized 64-bit frame");
+
+    unsigned char unmasked[] = {0x81, 0x01, 'a'};
+    check(websocket_parse_frame((char *)unmasked, sizeof(unmasked), 125, &frame) == WEBSOCKET_PARSE_ERROR, "unmasked frame");
+    std::string reserved = client_frame(WEBSOCKET_OPCODE_TEXT, true, "a");
+    reserved[0] |= 0x40;
+    check(websocket_parse_frame(&reserved[0], reserved.size(), 125, &frame) == WEBSOCKET_PARSE_ERROR, "reserved bit");
+    std::string fragmented_ping = client_frame(WEBSOCKET_OPCODE_PING, false, "a");
+    check(websocket_parse_frame(&fragmented_ping[0], fragmented_ping.size(), 125, &frame) == WEBSOCKET_PARSE_ERROR,
+        "fragmented control frame");
+    std::string long_ping = client_frame(WEBSOCKET_OPCODE_PING, true, std::string(126, 'a'));
+    check(websocket_parse_frame(&long_ping[0], long_ping.size(), 1024, &frame) == WEBSOCKET_PARSE_ERROR,
+        "control frame over 125 bytes");
+
+    unsigned char header[WEBSOCKET_HEADER_MAX];
+    check(websocket_frame_header(WEBSOCKET_OPCODE_TEXT, 125, header) == 2 && header[0] == 0x81 && header[1] == 125,
+        "header of 7-bit length");
+    check(websocket_frame_header(WEBSOCKET_OPCODE_TEXT, 0xFFFF, header) == 4 && header[1] == 126
+        && header[2] == 0xFF && header[3] == 0xFF, "header of 16-bit length");
+    check(websocket_frame_header(WEBSOCKET_OPCODE_BINARY, 0x10000, header) == 10 && header[0] == 0x82
+        && header[1] == 127 && header[7] == 0x01 && header[8] == 0 && header[9] == 0, "header of 64-bit length");
+}
+
+static std::string json(const char *text) {
+    return codeserver_json_string(text, strlen(text));
+}
+
+static void test_utf8() {
+    check(json("a\"b\\c\n\x01") == "\"a\\\"b\\\\c\\n\\u0001\"", "JSON escapes");
+    // 2, 3 and 4 byte sequences at the ends of their ranges pass as they are.
+    const char *valid[] = {"\xC2\x80", "\xDF\xBF", "\xE0\xA0\x80", "\xED\x9F\xBF", "\xEE\x80\x80", "\xEF\xBF\xBF",
+        "\xF0\x90\x80\x80", "\xF4\x8F\xBF\xBF"};
+    for (const char *text : valid) {
+        std::string expected = std::string("\"").append(text).append("\"");
+        check(json(text) == expected, "valid UTF-8");
+    }
+    // overlong forms, surrogates, beyond U+10FFFF, stray continuations and cut sequences become U+FFFD each byte.
+    const char *invalid[] = {"\xC0\xAF", "\xC1\xBF", "\xE0\x9F\xBF", "\xED\xA0\x80", "\xF0\x8F\xBF\xBF", "\xF4\x90\x80\x80",
+        "\xF5\x80\x80\x80", "\x80", "\xBF", "\xFF"};
+    for (const char *text : invalid) {
+        std::string expected = "\"";
+        for (size_t i = 0; i < strlen(text); i++) expected += "\xEF\xBF\xBD";
+        check(json(text) == expected + "\"", "invalid UTF-8 replaced");
+    }
+    check(json("ab\xE3\x81") == "\"ab\xEF\xBF\xBD\xEF\xBF\xBD\"", "sequence cut at the end");
+    check(json("\xE3\x81\x82z") == "\"\xE3\x81\x82z\"", "sequence followed by ASCII");
+}
+
+int main() {
+    test_requests();
+    test_chunked();
+    test_websocket();
+    test_utf8();
+    if (failures == 0) {
+        printf("code server protocols: all checks passed.\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
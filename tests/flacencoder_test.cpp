@@ -0,0 +1,261 @@
+// Otojsd::flacencoder test - streams encoded and decoded back by a decoder of the subset the encoder writes
+// (constant, verbatim and fixed predictor subframes, Rice coded residuals), which checks the structure,
+// the CRCs and the STREAMINFO on the way and must give back every sample.
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include "flacencoder.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "failed: %s\n", what);
+        failures++;
+    }
+}
+
+static uint8_t crc8(const unsigned char *data, size_t length) {
+    uint8_t crc = 0;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++) crc = crc & 0x80 ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+    }
+    return crc;
+}
+
+static uint16_t crc16(const unsigned char *data, size_t length) {
+    uint16_t crc = 0;
+    for (size_t i = 0; i < length; i++) {
+        crc ^= (uint16_t)data[i] << 8;
+        for (int b = 0; b < 8; b++) crc = crc & 0x8000 ? (uint16_t)((crc << 1) ^ 0x8005) : (uint16_t)(crc << 1);
+    }
+    return crc;
+}
+
+struct Reader {
+    const std::vector<unsigned char> &data;
+    size_t position; // in bits
+    bool overrun;
+
+    uint32_t get(int count) {
+        uint32_t value = 0;
+        for (int i = 0; i < count; i++) {
+            if (position >> 3 >= data.size()) {
+                overrun = true;
+                return 0;
+            }
+            value = value << 1 | ((data[position >> 3] >> (7 - (position & 7))) & 1);
+            position++;
+        }
+        return value;
+    }
+    int32_t get_signed(int count) {
+        uint32_t value = get(count);
+        return count < 32 && (value >> (count - 1)) ? (int32_t)(value - (1u << count)) : (int32_t)value;
+    }
+    uint32_t get_unary() {
+        uint32_t zeros = 0;
+        while (!overrun && get(1) == 0) zeros++;
+        return zeros;
+    }
+    // frame numbers are coded like UTF-8.
+    uint32_t get_utf8() {
+        uint32_t first = get(8);
+        int bytes = 0;
+        while (bytes < 7 && (first & (0x80 >> bytes))) bytes++;
+        if (bytes == 0) return first;
+        uint32_t value = first & (0x7F >> bytes);
+        for (int i = 1; i < bytes; i++) value = value << 6 | (get(8) & 0x3F);
+        return value;
+    }
+    size_t byte() const { return position >> 3; }
+};
+
+struct Stream {
+    int channels;
+    int bits;
+    int sample_rate;
+    uint64_t total_frames;
+    uint32_t min_frame_bytes;
+    uint32_t max_frame_bytes;
+    // interleaved
+    std::vector<int32_t> samples;
+};
+
+static bool decode_subframe(Reader &reader, int bits, int frames, int32_t *samples, std::string &error) {
+    if (reader.get(1) != 0) return error = "subframe padding", false;
+    uint32_t type = reader.get(6);
+    if (reader.get(1) != 0) return error = "wasted bits are not written", false;
+    if (type == 0) {
+        int32_t value = reader.get_signed(bits);
+        for (int i = 0; i < frames; i++) samples[i] = value;
+    } else if (type == 1) {
+        for (int i = 0; i < frames; i++) samples[i] = reader.get_signed(bits);
+    } else if (type >= 8 && type <= 12) {
+        int order = type - 8;
+        for (int i = 0; i < order; i++) samples[i] = reader.get_signed(bits);
+        if (reader.get(2) != 0) return error = "residual coding method", false;
+        int partition_order = reader.get(4);
+        int partitions = 1 << partition_order;
+        int i = order;
+        for (int p = 0; p < partitions; p++) {
+            int parameter = reader.get(4);
+            if (parameter == 15) return error = "escaped partitions are not written", false;
+            int count = (frames >> partition_order) - (p == 0 ? order : 0);
+            if (count < 0 || i + count > frames) return error = "partition sizes", false;
+            for (int n = 0; n < count && !reader.overrun; n++, i++) {
+                uint32_t u = reader.get_unary() << parameter | reader.get(parameter);
+                int64_t residual = (int32_t)((u >> 1) ^ -(u & 1));
+                const int32_t *s = samples + i;
+                int64_t prediction = 0;
+                switch (order) {
+                    case 1: prediction = s[-1]; break;
+                    case 2: prediction = 2 * (int64_t)s[-1] - s[-2]; break;
+                    case 3: prediction = 3 * (int64_t)s[-1] - 3 * (int64_t)s[-2] + s[-3]; break;
+                    case 4: prediction = 4 * (int64_t)s[-1] - 6 * (int64_t)s[-2] + 4 * (int64_t)s[-3] - s[-4]; break;
+                }
+                samples[i] = (int32_t)(prediction + residual);
+            }
+        }
+        if (i != frames) return error = "residuals short of the block", false;
+    } else {
+        return error = "subframe type " + std::to_string(type), false;
+    }
+    return !reader.overrun || (error = "subframe overruns the stream", false);
+}
+
+static bool decode(const std::vector<unsigned char> &data, Stream &stream, std::string &error) {
+    if (data.size() < 42 || memcmp(data.data(), "fLaC", 4) != 0) return error = "stream marker", false;
+    if (data[4] != 0x80 || data[5] != 0 || data[6] != 0 || data[7] != 34) return error = "STREAMINFO block header", false;
+    Reader reader = {data, 8 * 8, false};
+    if (reader.get(16) != FLAC_BLOCK_SIZE || reader.get(16) != FLAC_BLOCK_SIZE) return error = "block sizes", false;
+    stream.min_frame_bytes = reader.get(24);
+    stream.max_frame_bytes = reader.get(24);
+    stream.sample_rate = reader.get(20);
+    stream.channels = reader.get(3) + 1;
+    stream.bits = reader.get(5) + 1;
+    stream.total_frames = (uint64_t)reader.get(4) << 32;
+    stream.total_frames |= reader.get(32);
+    reader.position += 128; // MD5
+
+    uint32_t min_bytes = UINT32_MAX, max_bytes = 0;
+    std::vector<int32_t> block((size_t)FLAC_BLOCK_SIZE * stream.channels);
+    for (uint32_t number = 0; reader.byte() < data.size(); number++) {
+        size_t start = reader.byte();
+        if (reader.get(16) != 0xFFF8) return error = "frame sync", false;
+        if (reader.get(4) != 0x7 || reader.get(4) != 0) return error = "block size and sample rate codes", false;
+        if ((int)reader.get(4) != stream.channels - 1) return error = "channel assignment", false;
+        if (reader.get(3) != 0 || reader.get(1) != 0) return error = "sample size code", false;
+        if (reader.get_utf8() != number) return error = "frame number", false;
+        int frames = reader.get(16) + 1;
+        if (frames > FLAC_BLOCK_SIZE) return error = "block size", false;
+        uint8_t header_crc = crc8(data.data() + start, reader.byte() - start);
+        if (reader.get(8) != header_crc) return error = "header CRC-8", false;
+        for (int c = 0; c < stream.channels; c++) {
+            if (!decode_subframe(reader, stream.bits, frames, block.data() + c * FLAC_BLOCK_SIZE, error)) return false;
+        }
+        reader.position = (reader.position + 7) & ~(size_t)7;
+        uint16_t crc = crc16(data.data() + start, reader.byte() - start);
+        if (reader.get(16) != crc) return error = "frame CRC-16", false;
+        if (reader.overrun) return error = "frame overruns the stream", false;
+        uint32_t bytes = reader.byte() - start;
+        if (bytes < min_bytes) min_bytes = bytes;
+        if (bytes > max_bytes) max_bytes = bytes;
+        for (int i = 0; i < frames; i++) {
+            for (int c = 0; c < stream.channels; c++) stream.samples.push_back(block[c * FLAC_BLOCK_SIZE + i]);
+        }
+    }
+    if (stream.samples.size() != stream.total_frames * stream.channels) return error = "total samples", false;
+    if ((min_bytes == UINT32_MAX ? 0 : min_bytes) != stream.min_frame_bytes || max_bytes != stream.max_frame_bytes) {
+        return error = "frame sizes in STREAMINFO", false;
+    }
+    return true;
+}
+
+// Encode the samples, written in pieces of odd lengths, and decode them back.
+static void round_trip(const std::vector<int32_t> &samples, int channels, int bits, const char *what) {
+    FILE *fh = tmpfile();
+    FlacEncoder *encoder = FlacEncoder_create(fh, channels, bits, 48000);
+    bool ok = encoder && FlacEncoder_start(encoder);
+    int frames = samples.size() / channels;
+    for (int position = 0; ok && position < frames;) {
+        int length = std::min(frames - position, 1237);
+        ok = FlacEncoder_write(encoder, samples.data() + (size_t)position * channels, length);
+        position += length;
+    }
+    ok = ok && FlacEncoder_finish(encoder);
+    if (encoder) FlacEncoder_destroy(encoder);
+    std::vector<unsigned char> data;
+    if (ok) {
+        // FlacEncoder_finish() leaves the file after the STREAMINFO.
+        fseek(fh, 0, SEEK_END);
+        data.resize(ftell(fh));
+        rewind(fh);
+        ok = fread(data.data(), 1, data.size(), fh) == data.size();
+    }
+    fclose(fh);
+    if (!ok) {
+        check(false, what);
+        return;
+    }
+    Stream stream;
+    std::string error;
+    if (!decode(data, stream, error)) {
+        fprintf(stderr, "%s: %s\n", what, error.c_str());
+        check(false, what);
+        return;
+    }
+    check(stream.channels == channels && stream.bits == bits && stream.sample_rate == 48000, what);
+    check(stream.samples == samples, what);
+}
+
+int main() {
+    const unsigned char numbers[] = "123456789";
+    check(crc8(numbers, 9) == 0xF4 && crc16(numbers, 9) == 0xFEE8, "CRC check values");
+
+    round_trip({}, 2, 16, "empty stream");
+
+    // a sine and noise over the channels, a partial last block.
+    int frames = FLAC_BLOCK_SIZE * 3 + 1000;
+    std::vector<int32_t> stereo;
+    srand(1);
+    for (int i = 0; i < frames; i++) {
+        stereo.push_back((int32_t)(20000 * sin(i * 0.01)));
+        stereo.push_back(rand() % 65536 - 32768);
+    }
+    round_trip(stereo, 2, 16, "sine and noise");
+
+    // silence, the extremes of the range, and a block of a single frame.
+    std::vector<int32_t> edges(FLAC_BLOCK_SIZE * 3 + 1, 0);
+    for (int i = FLAC_BLOCK_SIZE; i < FLAC_BLOCK_SIZE * 2; i++) edges[i] = i & 1 ? 32767 : -32768;
+    for (int i = FLAC_BLOCK_SIZE * 2; i < (int)edges.size(); i++) edges[i] = -32768;
+    round_trip(edges, 1, 16, "silence and extremes");
+
+    std::vector<int32_t> wide;
+    for (int i = 0; i < FLAC_BLOCK_SIZE + 77; i++) {
+        for (int c = 0; c < 3; c++) wide.push_back((int32_t)(8388607 * sin(i * 0.003 * (c + 1))) - (c == 2 ? 1 : 0));
+    }
+    round_trip(wide, 3, 24, "24 bits, 3 channels");
+
+    // frame numbers from 128 on take two bytes.
+    std::vector<int32_t> ramp(FLAC_BLOCK_SIZE * 130);
+    for (size_t i = 0; i < ramp.size(); i++) ramp[i] = (int32_t)(i % 1000) - 500;
+    round_trip(ramp, 1, 16, "long stream");
+
+    std::vector<int32_t> many(FLAC_BLOCK_SIZE * FLAC_CHANNELS_MAX);
+    for (size_t i = 0; i < many.size(); i++) many[i] = (int32_t)((i * 7919) % 4096) - 2048;
+    round_trip(many, FLAC_CHANNELS_MAX, 16, "most channels");
+
+    if (failures == 0) {
+        printf("flacencoder: all streams decoded back.\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,151 @@
+// Otojsd::oscserver test - OSC packets sent over the loopback to a listener: the argument types,
+// new names, bundles, and the packets it must ignore.
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+
+#include <string>
+
+#include "oscserver.h"
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "failed: %s\n", what);
+        failures++;
+    }
+}
+
+// An OSC string, NUL padded to 4 bytes.
+static std::string osc_string(const std::string &text) {
+    std::string padded = text;
+    padded.append(4 - text.size() % 4, '\0');
+    return padded;
+}
+
+static std::string osc_int32(uint32_t value) {
+    std::string bytes;
+    for (int shift = 24; shift >= 0; shift -= 8) bytes += (char)(value >> shift);
+    return bytes;
+}
+
+static std::string osc_int64(uint64_t value) {
+    return osc_int32(value >> 32) + osc_int32((uint32_t)value);
+}
+
+static std::string message_float(const char *address, float value) {
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return osc_string(address) + osc_string(",f") + osc_int32(bits);
+}
+
+static std::string bundle(const std::string *elements, int count) {
+    std::string packet = osc_string("#bundle") + osc_int64(1);
+    for (int i = 0; i < count; i++) packet += osc_int32(elements[i].size()) + elements[i];
+    return packet;
+}
+
+struct Listener {
+    float values[OSCSERVER_PARAMS_MAX];
+    OscServer *server;
+    int port;
+};
+
+// Listen on a free port from the addresses allowed.
+static bool listen(Listener &listener, const char *names, const char *allow_addr, const char *allow_mask) {
+    memset(listener.values, 0, sizeof(listener.values));
+    listener.server = OscServer_create(listener.values, names);
+    struct in_addr addr, mask;
+    inet_aton(allow_addr, &addr);
+    inet_aton(allow_mask, &mask);
+    for (listener.port = 57200; listener.port < 57300; listener.port++) {
+        if (OscServer_start(listener.server, listener.port, addr, mask)) return true;
+    }
+    return false;
+}
+
+static void send_packet(int fd, int port, const std::string &packet) {
+    struct sockaddr_in saddr;
+    memset(&saddr, 0, sizeof(saddr));
+    saddr.sin_family = AF_INET;
+    saddr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    saddr.sin_port = htons(port);
+    sendto(fd, packet.data(), packet.size(), 0, (struct sockaddr *)&saddr, sizeof(saddr));
+}
+
+// Wait for the listener to count the messages, up to 2 seconds.
+static bool wait_counts(OscServer *server, uint64_t applied, uint64_t ignored) {
+    for (int i = 0; i < 200; i++) {
+        if (server->applied == applied && server->ignored == ignored) return true;
+        usleep(10000);
+    }
+    fprintf(stderr, "%llu applied, %llu ignored\n",
+        (unsigned long long)server->applied.load(), (unsigned long long)server->ignored.load());
+    return false;
+}
+
+int main() {
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    Listener listener;
+    if (fd < 0 || !listen(listener, "cutoff,gain", "127.0.0.1", "255.255.255.255")) {
+        fprintf(stderr, "no UDP port to listen.\n");
+        return 1;
+    }
+    OscServer *server = listener.server;
+    check(OscServer_count(server) == 2 && strcmp(OscServer_name(server, 1), "gain") == 0, "declared names");
+
+    int port = listener.port;
+    send_packet(fd, port, message_float("/cutoff", 0.5f));
+    send_packet(fd, port, osc_string("/gain") + osc_string(",i") + osc_int32((uint32_t)-3));
+    double number = 2.25;
+    uint64_t bits;
+    memcpy(&bits, &number, sizeof(bits));
+    send_packet(fd, port, osc_string("/double") + osc_string(",d") + osc_int64(bits));
+    send_packet(fd, port, osc_string("/long") + osc_string(",h") + osc_int64((uint64_t)-7));
+    send_packet(fd, port, osc_string("/on") + osc_string(",T"));
+    send_packet(fd, port, osc_string("/off") + osc_string(",F"));
+    check(wait_counts(server, 6, 0), "messages applied");
+    check(listener.values[0] == 0.5f && listener.values[1] == -3.0f, "float and int32 arguments");
+    check(OscServer_index(server, "double", false) == 2 && listener.values[2] == 2.25f, "double argument, new name");
+    check(OscServer_index(server, "long", false) == 3 && listener.values[3] == -7.0f, "int64 argument");
+    check(listener.values[4] == 1.0f && listener.values[5] == 0.0f, "true and false");
+
+    // a bundle in a bundle, with an element it ignores.
+    std::string inner[] = {message_float("/gain", 0.25f), osc_string("/bad") + osc_string(",s") + osc_string("text")};
+    std::string outer[] = {message_float("/cutoff", 0.75f), bundle(inner, 2)};
+    send_packet(fd, port, bundle(outer, 2));
+    check(wait_counts(server, 8, 1), "bundle");
+    check(listener.values[0] == 0.75f && listener.values[1] == 0.25f, "bundle values");
+
+    // nested too deep, no slash, a short argument, type tags without the comma, type tags cut,
+    // an element longer than the bundle, and a name too long.
+    std::string deep = message_float("/cutoff", 0.0f);
+    for (int depth = 0; depth < 9; depth++) deep = bundle(&deep, 1);
+    send_packet(fd, port, deep);
+    send_packet(fd, port, osc_string("cutoff") + osc_string(",f") + osc_int32(0));
+    send_packet(fd, port, osc_string("/cutoff") + osc_string(",f") + std::string(2, '\0'));
+    send_packet(fd, port, osc_string("/cutoff") + osc_string("f") + osc_int32(0));
+    send_packet(fd, port, std::string("/cutoff\0,f", 10));
+    send_packet(fd, port, std::string("#bundle\0", 8) + osc_int64(1) + osc_int32(100) + message_float("/cutoff", 0.0f));
+    send_packet(fd, port, message_float(std::string("/").append(OSCSERVER_NAME_SIZE, 'n').c_str(), 1.0f));
+    check(wait_counts(server, 8, 8), "malformed packets ignored");
+    check(listener.values[0] == 0.75f, "malformed packets change nothing");
+    OscServer_destroy(server);
+
+    Listener forbidden;
+    if (listen(forbidden, NULL, "10.0.0.0", "255.0.0.0")) {
+        send_packet(fd, forbidden.port, message_float("/cutoff", 1.0f));
+        check(wait_counts(forbidden.server, 0, 1) && OscServer_count(forbidden.server) == 0, "forbidden address");
+        OscServer_destroy(forbidden.server);
+    }
+    close(fd);
+
+    if (failures == 0) {
+        printf("oscserver: all checks passed.\n");
+    }
+    return failures == 0 ? 0 : 1;
+}
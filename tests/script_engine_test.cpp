@@ -0,0 +1,77 @@
+// Otojsd::ScriptEngine test - which render function the engine calls as codes are posted.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "script_engine.h"
+
+static const unsigned int FRAMES = 64;
+static const unsigned int CHANNELS = 2;
+
+static int failures = 0;
+
+static void check(bool ok, const char *what) {
+    if (!ok) {
+        fprintf(stderr, "failed: %s\n", what);
+        failures++;
+    }
+}
+
+static void post(ScriptEngine *se, const char *code) {
+    const char *error = se->executeCode(code);
+    if (error) {
+        fprintf(stderr, "error posting %s: %s\n", code, error);
+        failures++;
+        free((void *)error);
+    }
+}
+
+// Render a block and return the first output sample, or -1 if nothing was rendered.
+static float render(ScriptEngine *se) {
+    RenderResult result = se->executeRender(FRAMES, CHANNELS);
+    if (result.error || result.count == 0) {
+        return -1;
+    }
+    return se->buffers(FRAMES, CHANNELS).output[0];
+}
+
+// A render function disabled after overruns stays disabled until a posted code defines one again.
+static void test_disabled_render(ScriptEngine *se) {
+    post(se, "function oto_render_into(output) { output.fill(0.5); }");
+    check(render(se) == 0.5f, "the posted render function is called");
+
+    // as otojsd does after RENDER_OVERRUNS_MAX terminated calls
+    se->disableRender();
+    check(render(se) == -1, "nothing is rendered after disableRender()");
+
+    // the disabled function is still in the globals, a code without a render function must not bring it back.
+    post(se, "var x = 1;");
+    check(render(se) == -1, "a code without a render function keeps the render disabled");
+
+    post(se, "function oto_render_into(output) { output.fill(0.25); }");
+    check(render(se) == 0.25f, "a code defining a render function enables it");
+}
+
+// The error of a throwing render function is reported, truncated to the buffer the engine keeps for it.
+static void test_render_error(ScriptEngine *se) {
+    post(se, "function oto_render_into(output) { throw new Error('boom ' + 'x'.repeat(1000)); }");
+    RenderResult result = se->executeRender(FRAMES, CHANNELS);
+    check(result.error && strstr(result.error, "Error: boom xxx") != nullptr, "the exception of the render function is the error");
+    check(result.error && strlen(result.error) < 1000, "a long exception is truncated");
+}
+
+int main(int, char **argv) {
+    ScriptEngine::initializePlatform(argv[0]);
+    ScriptEngine *se = new ScriptEngine();
+
+    test_disabled_render(se);
+    test_render_error(se);
+
+    delete se;
+    ScriptEngine::disposePlatform();
+    if (failures == 0) {
+        printf("script engine: ok.\n");
+    }
+    return failures == 0 ? 0 : 1;
+}